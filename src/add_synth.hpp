@@ -5,9 +5,11 @@
 #include <vector>
 
 #include "allocore/io/al_AudioIOData.hpp"
+#include "allocore/math/al_Random.hpp"
 #include "allocore/ui/al_Parameter.hpp"
 #include "allocore/ui/al_Preset.hpp"
 
+#include "preset_bank.hpp"
 
 #include "Gamma/Noise.h"
 #include "Gamma/Filter.h"
@@ -96,7 +98,6 @@ public:
     }
 
     void release() {
-		std::cout << "Note release " << mId << std::endl;
         for (int i = 0; i < NUM_VOICES; i++) {
             mEnvelopes[i].release();
             mAmpModEnvelopes[i].release();
@@ -114,19 +115,24 @@ public:
     }
 
     void generateAudio(AudioIOData &io) {
+        generateAudio(io, 0, io.framesPerBuffer());
+    }
+
+    // Renders frames [start, end) of the block
+    void generateAudio(AudioIOData &io, int start, int end) {
 		float fundamental = mFundamental;
 		float level = mLevel;
 		float attenuation = mAttenuation;
 		for (int i = 0; i < NUM_VOICES; i++) {
-			float *outbuf = io.outBuffer(mOutMap[i]);
-			float *swbuf = io.outBuffer(47);
+			float *outbuf = io.outBuffer(mOutMap[i]) + start;
+			float *swbuf = io.outBuffer(47) + start;
 			gam::Sine<> &oscs = mOscillators[i];
 			gam::Env<5> &envs = mEnvelopes[i];
 			float amp = mAmplitudes[i];
 			gam::SineR<> &ampmods = mAmpModulators[i];
 			gam::Env<3> &modenv = mAmpModEnvelopes[i];
 			float freqfact = mFrequencyFactors[i];
-			for (int samp = 0; samp < io.framesPerBuffer(); samp++) {
+			for (int samp = start; samp < end; samp++) {
 				if (mFreqMod) {
 					oscs.freq(fundamental  * freqfact + (ampmods() * modenv()));
 					float out = attenuation * oscs() * envs() * amp  * level;
@@ -144,10 +150,8 @@ public:
 
     void setInitialCumulativeDelay(float initialDelay, float randomDev)
     {
-        srand(time(0));
         for (int i = 0; i < NUM_VOICES; i++) {
-            int random_variable = std::rand();
-            float dev = randomDev *((2.0 * random_variable/(float) RAND_MAX) - 1.0);
+            float dev = randomDev * rnd::uniform(1.0, -1.0);
 
             if (initialDelay >= 0) {
                 float length = initialDelay * i + dev;
@@ -274,6 +278,21 @@ public:
 	        mPresetHandler << mAmpModFrequencies[i];
 	    }
 
+	    // Same order as mPresetHandler, for the preloaded bank
+	    mPresetParameters = {&mLevel, &mFundamental, &mCumulativeDelay, &mCumulativeDelayRandomness,
+	                         &mArcStart, &mArcSpan, &mAttackCurve, &mReleaseCurve,
+	                         &mModDepth, &mModAttack, &mModRelease, &mModType, &mLayer};
+	    for (int i = 0; i < NUM_VOICES; i++) {
+	        mPresetParameters.push_back(&mFrequencyFactors[i]);
+	        mPresetParameters.push_back(&mAmplitudes[i]);
+	        mPresetParameters.push_back(&mAttackTimes[i]);
+	        mPresetParameters.push_back(&mDecayTimes[i]);
+	        mPresetParameters.push_back(&mSustainLevels[i]);
+	        mPresetParameters.push_back(&mReleaseTimes[i]);
+	        mPresetParameters.push_back(&mAmpModFrequencies[i]);
+	    }
+	    mPresetBank = PresetBank::get("presets", mPresetParameters);
+
 
 		mFundamental.set(220);
 	    harmonicPartials();
@@ -306,10 +325,16 @@ public:
     }
 
     void generateAudio(AudioIOData &io)
+    {
+        generateAudio(io, 0, io.framesPerBuffer());
+    }
+
+    // Renders frames [start, end) of the block, e.g. up to the next sequence event
+    void generateAudio(AudioIOData &io, int start, int end)
     {
         for (int i = 0; i < SYNTH_POLYPHONY; i++) {
             if (!synth[i].done()) {
-                synth[i].generateAudio(io);
+                synth[i].generateAudio(io, start, end);
                 io.frame(0);
             }
         }
@@ -323,7 +348,6 @@ public:
 
 	void trigger(int id)
 	{
-	    std::cout << "trigger id " << id << std::endl;
 	    AddSynthNoteParameters params;
 	    params.id = id;
 	    params.mLevel = mLevel.get();
@@ -354,7 +378,6 @@ public:
 	    for (int i = 0; i < SYNTH_POLYPHONY; i++) {
 	        if (synth[i].done()) {
 	            synth[i].trigger(params);
-				std::cout << "Triggered voice " << i << std::endl;
 	            break;
 	        }
 	    }
@@ -362,7 +385,6 @@ public:
 
 	void release(int id)
 	{
-	    std::cout << "release id " << id << std::endl;
 	    for (int i = 0; i < SYNTH_POLYPHONY; i++) {
 	        if (synth[i].id() == id) {
 	            synth[i].release();
@@ -386,11 +408,9 @@ public:
 	    } else if (max < 1) {
 	        max = 1.0;
 	    }
-	    srand(time(0));
 	    vector<float> randomFactors(NUM_VOICES);
 	    for (int i = 0; i < NUM_VOICES; i++) {
-	        int random_variable = std::rand();
-	        randomFactors[i] = 1 + (max *random_variable/(float) RAND_MAX);
+	        randomFactors[i] = 1 + max * rnd::uniform();
 	    }
 	    if (sortPartials) {
 	        sort(randomFactors.begin(), randomFactors.end());
@@ -512,11 +532,9 @@ public:
 	    } else if (max < 1) {
 	        max = 1.0;
 	    }
-	    srand(time(0));
 	    vector<float> randomFactors(NUM_VOICES);
 	    for (int i = 0; i < NUM_VOICES; i++) {
-	        int random_variable = std::rand();
-	        randomFactors[i] = 1 + (max *random_variable/(float) RAND_MAX);
+	        randomFactors[i] = 1 + max * rnd::uniform();
 	    }
 	    if (sortPartials) {
 	        sort(randomFactors.begin(), randomFactors.end());
@@ -526,6 +544,17 @@ public:
 	    }
 	}
 
+	// Recall from the presets loaded at construction: no file reads or change
+	// callbacks, so it is safe in the audio callback. Returns the preset name,
+	// or an empty string if there is no such preset.
+	const std::string &recallPreset(int index) {
+	    return recall(mPresetBank->preset(index));
+	}
+
+	const std::string &recallPreset(const std::string &name) {
+	    return recall(mPresetBank->preset(name));
+	}
+
 	// Presets
     PresetHandler mPresetHandler;
 
@@ -737,8 +766,19 @@ public:
 
 private:
 
+	const std::string &recall(const PresetBank::Preset *preset) {
+	    static const std::string none;
+	    if (!mPresetBank->apply(preset, mPresetParameters)) {
+	        return none;
+	    }
+	    return preset->name;
+	}
+
     AddSynthNote synth[SYNTH_POLYPHONY];
 
+    std::vector<Parameter *> mPresetParameters;
+    std::shared_ptr<const PresetBank> mPresetBank;
+
 };
 
 #endif // ADD_SYNTH_HPP
@@ -0,0 +1,526 @@
+#ifndef ASSET_LOADER_HPP
+#define ASSET_LOADER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "allocore/graphics/al_Image.hpp"
+#include "allocore/graphics/al_OpenGL.hpp"
+#include "allocore/graphics/al_Texture.hpp"
+
+#include "texture_atlas.hpp"
+
+namespace al {
+
+/**
+ * @brief Decodes images on worker threads and uploads them as atlas textures a few per frame
+ *
+ * Images are added to atlas pages created with atlas(), and decoded to RGBA
+ * by a small thread pool as soon as start() is called, so decoding overlaps
+ * with window and network setup. Once all images of a page are decoded, the
+ * last decoding thread packs them into the page. upload() is called once per
+ * frame on the render thread and submits packed pages to GL until its time
+ * budget is spent. Images in the same page share one texture and are drawn
+ * with the texture coordinates from uvs().
+ *
+ * If a cache file is given, pages are read from it instead of being decoded
+ * and packed. The cache holds the packed RGBA pixels of every page and is
+ * memory mapped, so a node only has to copy the pixels to GL. A page is used
+ * only if it holds the same images and the size and modification time of all
+ * its source images match. When any page had to be decoded, the cache is
+ * rewritten once all pages are ready.
+ *
+ * An image that fails to load is reported and stays unavailable (ready()
+ * returns false) instead of stopping the application.
+ *
+ * Pages are packed before there is a GL context, so a page larger than
+ * GL_MAX_TEXTURE_SIZE is halved when it is uploaded.
+ */
+class TextureAssets {
+public:
+    enum State {
+        PENDING = 0,
+        DECODED,
+        UPLOADED
+    };
+
+    TextureAssets(std::string cachePath = "", int maxAtlasSize = 8192) :
+        mCachePath(cachePath), mMaxAtlasSize(maxAtlasSize) {}
+
+    ~TextureAssets() {
+        mQuit = true;
+        for (auto &worker: mWorkers) {
+            worker.join();
+        }
+        unmapCache();
+    }
+
+    // Returns the index of a new atlas page. Must be called before start()
+    int atlas(const std::string &name) {
+        std::unique_ptr<Page> page(new Page);
+        page->name = name;
+        mPages.push_back(std::move(page));
+        return mPages.size() - 1;
+    }
+
+    // Returns the index of the image. Must be called before start()
+    int add(const std::string &filename, int atlas) {
+        std::unique_ptr<Asset> asset(new Asset);
+        asset->filename = filename;
+        asset->page = atlas;
+        mPages[atlas]->images.push_back(mAssets.size());
+        mAssets.push_back(std::move(asset));
+        return mAssets.size() - 1;
+    }
+
+    // Starts decoding. numThreads 0 uses one thread per core
+    void start(unsigned int numThreads = 0) {
+        if (mWorkers.size() > 0) {
+            return;
+        }
+        for (auto &page: mPages) {
+            page->remaining = page->images.size();
+        }
+        readCache();
+        if (numThreads == 0) {
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        numThreads = std::min<unsigned int>(numThreads, mAssets.size());
+        if (numThreads == 0) {
+            mDecodeDone = true; // No worker would get to set it
+            return;
+        }
+        mRunning = numThreads;
+        for (unsigned int i = 0; i < numThreads; i++) {
+            mWorkers.push_back(std::thread(&TextureAssets::decodeLoop, this));
+        }
+    }
+
+    /**
+     * @brief Submits packed pages to GL until maxSeconds are spent
+     *
+     * At least one page is submitted per call when one is available. Must be
+     * called from the thread that owns the GL context.
+     */
+    void upload(double maxSeconds = 0.004) {
+        auto startTime = std::chrono::steady_clock::now();
+        for (; mNextUpload < mPages.size(); mNextUpload++) {
+            Page &page = *mPages[mNextUpload];
+            if (page.state == PENDING) {
+                break; // Keep pages uploading in order
+            }
+            const unsigned char *pixels = page.pixels();
+            int width = page.atlas.width(), height = page.atlas.height();
+            std::vector<unsigned char> scaled[2]; // halve() can't write to its input
+            int halvings = 0;
+            for (; std::max(width, height) > maxTextureSize(); halvings++) {
+                TextureAtlas::halve(pixels, width, height, scaled[halvings % 2]);
+                pixels = scaled[halvings % 2].data();
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+            if (halvings > 0) {
+                std::cout << "Atlas " << page.name << " scaled down " << (1 << halvings)
+                          << " times to fit GL_MAX_TEXTURE_SIZE " << maxTextureSize() << std::endl;
+            }
+            page.texture.format(Graphics::RGBA);
+            page.texture.type(Graphics::UBYTE);
+            page.texture.resize(width, height);
+            page.texture.submit(pixels);
+            page.state = UPLOADED;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+            if (elapsed.count() > maxSeconds) {
+                mNextUpload++;
+                break;
+            }
+        }
+        if (done() && mDecodeDone && !mReleased) {
+            // GL has its own copy now. Pixels are kept until then for the cache
+            for (auto &page: mPages) {
+                std::vector<unsigned char>().swap(page->packed);
+                page->mapped = nullptr;
+            }
+            unmapCache();
+            mReleased = true;
+        }
+    }
+
+    size_t size() { return mAssets.size(); }
+
+    bool ready(int index) {
+        return !mAssets[index]->failed && mPages[mAssets[index]->page]->state == UPLOADED;
+    }
+
+    // Valid once the image's page is packed
+    bool failed(int index) { return mAssets[index]->failed; }
+
+    // True once every page is uploaded
+    bool done() { return mNextUpload == mPages.size(); }
+
+    // The atlas texture holding the image
+    Texture &texture(int index) { return mPages[mAssets[index]->page]->texture; }
+
+    // Texture coordinates of the image in its atlas: u0, v0, u1, v1
+    void uvs(int index, float *uv) {
+        const Asset &asset = *mAssets[index];
+        mPages[asset.page]->atlas.uvs(asset.slot, uv);
+    }
+
+    // Size of the source image, valid once its page is packed
+    int width(int index) { return mAssets[index]->width; }
+    int height(int index) { return mAssets[index]->height; }
+
+    const std::string &filename(int index) { return mAssets[index]->filename; }
+
+private:
+    struct Asset {
+        std::string filename;
+        int page = 0;
+        int slot = 0; // Index within the page
+        bool failed = false;
+        int width = 0;
+        int height = 0;
+        int64_t sourceSize = 0;
+        int64_t sourceTime = 0;
+        std::vector<unsigned char> decoded; // Freed once packed
+    };
+
+    struct Page {
+        std::string name;
+        std::vector<int> images;
+        std::atomic<int> state {PENDING};
+        std::atomic<int> remaining {0};
+        TextureAtlas atlas;
+        std::vector<unsigned char> packed;
+        const unsigned char *mapped = nullptr; // Points into the mapped cache
+        Texture texture;
+
+        const unsigned char *pixels() { return mapped ? mapped : packed.data(); }
+    };
+
+    // Cache file layout: header, page entries, image entries, then pixel data
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t numPages;
+        uint32_t numImages;
+        uint32_t padding;
+    };
+
+    struct CachePage {
+        char name[64];
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset; // Of RGBA pixels from the start of the file
+    };
+
+    struct CacheImage {
+        char filename[256];
+        int64_t sourceSize;
+        int64_t sourceTime;
+        uint32_t page;
+        uint32_t failed;
+        uint32_t width;  // Of the source image
+        uint32_t height;
+        int32_t x, y, w, h; // Rect in the page
+    };
+
+    static const uint32_t cacheVersion = 2;
+
+    // Largest texture side the GL context takes, or the atlas size without a GL answer
+    int maxTextureSize() {
+        if (mMaxTextureSize == 0) {
+            GLint size = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+            mMaxTextureSize = size > 0 ? std::min<int>(size, mMaxAtlasSize) : mMaxAtlasSize;
+        }
+        return mMaxTextureSize;
+    }
+
+    static bool sourceInfo(const std::string &filename, int64_t &size, int64_t &time) {
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0) {
+            return false;
+        }
+        size = info.st_size;
+        time = info.st_mtime;
+        return true;
+    }
+
+    void decodeLoop() {
+        while (!mQuit) {
+            size_t index = mNextDecode++;
+            if (index >= mAssets.size()) {
+                break;
+            }
+            Asset &asset = *mAssets[index];
+            Page &page = *mPages[asset.page];
+            if (page.state != PENDING) {
+                continue; // Read from the cache
+            }
+            if (!decode(asset)) {
+                std::cout << "Failed to read image from " << asset.filename << std::endl;
+                asset.failed = true;
+            }
+            if (--page.remaining == 0) {
+                pack(page);
+                mCacheStale = true;
+            }
+        }
+        if (--mRunning == 0 && !mQuit) {
+            if (mCacheStale && mCachePath.size() > 0) {
+                writeCache();
+            }
+            mDecodeDone = true;
+        }
+    }
+
+    static bool decode(Asset &asset) {
+        Image image;
+        if (!image.load(asset.filename)) {
+            return false;
+        }
+        sourceInfo(asset.filename, asset.sourceSize, asset.sourceTime);
+        const Array &array = image.array();
+        int components = array.header.components;
+        asset.width = array.header.dim[0];
+        asset.height = array.header.dim[1];
+        asset.decoded.resize((size_t) asset.width * asset.height * 4);
+        const unsigned char *src = (const unsigned char *) array.data.ptr;
+        unsigned char *dst = asset.decoded.data();
+        for (int y = 0; y < asset.height; y++) {
+            const unsigned char *row = src + y * array.header.stride[1];
+            for (int x = 0; x < asset.width; x++) {
+                const unsigned char *p = row + x * components;
+                switch (components) {
+                case 1: dst[0] = dst[1] = dst[2] = p[0]; dst[3] = 255; break;
+                case 2: dst[0] = dst[1] = dst[2] = p[0]; dst[3] = p[1]; break;
+                case 3: dst[0] = p[0]; dst[1] = p[1]; dst[2] = p[2]; dst[3] = 255; break;
+                default: std::memcpy(dst, p, 4); break;
+                }
+                dst += 4;
+            }
+        }
+        return true;
+    }
+
+    // Called from the thread that decoded the last image of the page
+    void pack(Page &page) {
+        page.atlas = TextureAtlas(mMaxAtlasSize);
+        std::vector<int> widths, heights;
+        for (size_t i = 0; i < page.images.size(); i++) {
+            Asset &asset = *mAssets[page.images[i]];
+            asset.slot = i;
+            widths.push_back(asset.failed ? 0 : asset.width);
+            heights.push_back(asset.failed ? 0 : asset.height);
+        }
+        int halvings = page.atlas.layout(widths, heights);
+        if (halvings > 0) {
+            std::cout << "Atlas " << page.name << " scaled down " << (1 << halvings) << " times to fit" << std::endl;
+        }
+        page.packed.assign((size_t) page.atlas.width() * page.atlas.height() * 4, 0);
+        for (size_t i = 0; i < page.images.size(); i++) {
+            Asset &asset = *mAssets[page.images[i]];
+            if (!asset.failed) {
+                page.atlas.blit(i, asset.decoded.data(), asset.width, asset.height, halvings,
+                                page.packed.data());
+            }
+            std::vector<unsigned char>().swap(asset.decoded);
+        }
+        page.state = DECODED;
+    }
+
+    void readCache() {
+        if (mCachePath.size() == 0) {
+            return;
+        }
+        int fd = open(mCachePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(CacheHeader)) {
+            close(fd);
+            return;
+        }
+        void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        mCacheData = (const unsigned char *) data;
+        mCacheSize = info.st_size;
+
+        const CacheHeader *header = (const CacheHeader *) mCacheData;
+        if (std::memcmp(header->magic, "ALTEXCH", 8) != 0 || header->version != cacheVersion
+                || sizeof(CacheHeader) + header->numPages * sizeof(CachePage)
+                   + header->numImages * sizeof(CacheImage) > mCacheSize) {
+            std::cout << "Ignoring invalid texture cache " << mCachePath << std::endl;
+            unmapCache();
+            return;
+        }
+        const CachePage *pages = (const CachePage *) (mCacheData + sizeof(CacheHeader));
+        const CacheImage *images = (const CacheImage *) (pages + header->numPages);
+        for (auto &page: mPages) {
+            for (uint32_t p = 0; p < header->numPages; p++) {
+                if (std::strncmp(pages[p].name, page->name.c_str(), sizeof(pages[p].name)) == 0) {
+                    readCachedPage(*page, pages[p], p, images, header->numImages);
+                    break;
+                }
+            }
+        }
+    }
+
+    void readCachedPage(Page &page, const CachePage &cached, uint32_t index,
+                        const CacheImage *images, uint32_t numImages) {
+        if (cached.offset + (uint64_t) cached.width * cached.height * 4 > mCacheSize) {
+            return;
+        }
+        std::vector<const CacheImage *> entries;
+        for (uint32_t i = 0; i < numImages; i++) {
+            if (images[i].page == index) {
+                entries.push_back(&images[i]);
+            }
+        }
+        if (entries.size() != page.images.size()) {
+            return;
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            Asset &asset = *mAssets[page.images[i]];
+            int64_t size = 0, time = 0;
+            if (std::strncmp(entries[i]->filename, asset.filename.c_str(), sizeof(entries[i]->filename)) != 0) {
+                return;
+            }
+            if (sourceInfo(asset.filename, size, time)
+                    && (size != entries[i]->sourceSize || time != entries[i]->sourceTime)) {
+                return; // Image changed since the cache was written
+            }
+        }
+        // The layout only depends on the packed sizes, so it comes out the same as when written
+        TextureAtlas atlas(mMaxAtlasSize);
+        std::vector<int> widths, heights;
+        for (const CacheImage *entry: entries) {
+            widths.push_back(entry->w);
+            heights.push_back(entry->h);
+        }
+        atlas.layout(widths, heights);
+        if ((uint32_t) atlas.width() != cached.width || (uint32_t) atlas.height() != cached.height) {
+            return;
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            Asset &asset = *mAssets[page.images[i]];
+            const CacheImage &entry = *entries[i];
+            const TextureAtlas::Rect &rect = atlas.rect(i);
+            if (rect.x != entry.x || rect.y != entry.y) {
+                return;
+            }
+            asset.slot = i;
+            asset.failed = entry.failed != 0;
+            asset.width = entry.width;
+            asset.height = entry.height;
+            asset.sourceSize = entry.sourceSize;
+            asset.sourceTime = entry.sourceTime;
+        }
+        page.atlas = atlas;
+        page.mapped = mCacheData + cached.offset;
+        page.state = DECODED;
+    }
+
+    // Called from the last decoding thread, once every page is packed
+    void writeCache() {
+        std::string tempPath = mCachePath + "." + std::to_string(getpid());
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file) {
+            std::cout << "Could not write texture cache " << mCachePath << std::endl;
+            return;
+        }
+        CacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "ALTEXCH", 8);
+        header.version = cacheVersion;
+        header.numPages = mPages.size();
+        header.numImages = mAssets.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        uint64_t offset = sizeof(CacheHeader) + mPages.size() * sizeof(CachePage)
+                + mAssets.size() * sizeof(CacheImage);
+        for (auto &page: mPages) {
+            CachePage entry;
+            std::memset(&entry, 0, sizeof(entry));
+            std::strncpy(entry.name, page->name.c_str(), sizeof(entry.name) - 1);
+            entry.width = page->atlas.width();
+            entry.height = page->atlas.height();
+            entry.offset = offset;
+            offset += (uint64_t) entry.width * entry.height * 4;
+            ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+        }
+        for (auto &asset: mAssets) {
+            CacheImage entry;
+            std::memset(&entry, 0, sizeof(entry));
+            std::strncpy(entry.filename, asset->filename.c_str(), sizeof(entry.filename) - 1);
+            entry.sourceSize = asset->sourceSize;
+            entry.sourceTime = asset->sourceTime;
+            entry.page = asset->page;
+            entry.failed = asset->failed ? 1 : 0;
+            entry.width = asset->width;
+            entry.height = asset->height;
+            const TextureAtlas::Rect &rect = mPages[asset->page]->atlas.rect(asset->slot);
+            entry.x = rect.x; entry.y = rect.y; entry.w = rect.width; entry.h = rect.height;
+            ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+        }
+        for (auto &page: mPages) {
+            // Not released yet: upload() waits for mDecodeDone
+            size_t bytes = (size_t) page->atlas.width() * page->atlas.height() * 4;
+            ok = ok && fwrite(page->pixels(), 1, bytes, file) == bytes;
+        }
+        ok = (fclose(file) == 0) && ok;
+        // Rename so other nodes never map a partially written cache
+        if (!ok || rename(tempPath.c_str(), mCachePath.c_str()) != 0) {
+            std::cout << "Could not write texture cache " << mCachePath << std::endl;
+            unlink(tempPath.c_str());
+        } else {
+            std::cout << "Wrote texture cache " << mCachePath << std::endl;
+        }
+    }
+
+    void unmapCache() {
+        if (mCacheData) {
+            munmap((void *) mCacheData, mCacheSize);
+            mCacheData = nullptr;
+        }
+    }
+
+    std::string mCachePath;
+    int mMaxAtlasSize;
+    int mMaxTextureSize = 0; // Render thread
+    const unsigned char *mCacheData = nullptr;
+    size_t mCacheSize = 0;
+
+    std::vector<std::unique_ptr<Asset>> mAssets;
+    std::vector<std::unique_ptr<Page>> mPages;
+    std::vector<std::thread> mWorkers;
+    std::atomic<size_t> mNextDecode {0};
+    std::atomic<unsigned int> mRunning {0};
+    std::atomic<bool> mDecodeDone {false};
+    std::atomic<bool> mCacheStale {false};
+    std::atomic<bool> mQuit {false};
+    size_t mNextUpload = 0; // Render thread only
+    bool mReleased = false;
+};
+
+} // namespace al
+
+#endif // ASSET_LOADER_HPP
@@ -1,4 +1,5 @@
 
+#include <atomic>
 #include <vector>
 
 #include "allocore/al_Allocore.hpp"
@@ -15,6 +16,12 @@
 #include "add_synth.hpp"
 #include "granulator.hpp"
 #include "downmixer.hpp"
+#include "control_input.hpp"
+#include "offline_render.hpp"
+#include "dsp_profiler.hpp"
+#include "sequence_bank.hpp"
+#include "chaos_scenes.hpp"
+#include "event_scheduler.hpp"
 
 #define CHAOS_SYNTH_POLYPHONY 1
 #define ADD_SYNTH_POLYPHONY 1
@@ -39,6 +46,7 @@ public:
 		mAudioIO.framesPerBuffer(framesPerBuffer);
 		mAudioIO.channelsOut(outChans);
 		mAudioIO.channelsIn(inChans);
+		mChannelsOut = outChans;
 		gam::sampleRate(framesPerSec);
 	}
 
@@ -61,10 +69,27 @@ public:
 		}
 	}
 
+	// Runs the callback seconds without the device, as fast as possible,
+	// applying the timeline's messages with control(), and writes all the
+	// channels asked of initAudio() to path (see OfflineRender)
+	bool renderOffline(double seconds, const ControlTimeline &timeline, std::string path) {
+		mOffline = true;
+		return OfflineRender::render(*this, mChannelsOut, mAudioIO.framesPerBuffer(), mAudioIO.framesPerSecond(),
+		                             seconds, timeline, path, [this](const ControlEvent &event) {
+			control(event.address, event.value, event.frame);
+		});
+	}
+
+	bool offline() const { return mOffline; }
+
     virtual void printStatus() = 0;
+    // Applies a control message at a frame of the audio clock
+    virtual void control(const std::string &address, float value, uint64_t frame) = 0;
 
 private:
 	AudioIO mAudioIO;
+	unsigned mChannelsOut {2}; // Requested, mAudioIO has at most the device's
+	bool mOffline {false};
 };
 
 class AudioApp: public BaseAudioApp, public osc::PacketHandler
@@ -99,219 +124,7 @@ public:
             {16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45},
             {48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59}
         };
-
-
-        mSequencer1a.setDirectory("sequences");
-        mSequencer1a.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[0].mFundamental.set(midi2cps(params[0]));
-            app->addSynth[0].trigger(params[0]);
-            std::cout << "Note On 1!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1a.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[0].release(params[0]);
-            std::cout << "Note Off 1!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1a.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program 1!! " << app->addSynth[0].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer1b.setDirectory("sequences");
-        mSequencer1b.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[1].mFundamental.set(midi2cps(params[0]));
-            app->addSynth[1].trigger(params[0]);
-            std::cout << "Note On 2!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1b.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[1].release(params[0]);
-            std::cout << "Note Off 2!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1b.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program 2!! " << app->addSynth[1].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer1c.setDirectory("sequences");
-        mSequencer1c.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[2].mFundamental.set(midi2cps(params[0]));
-            app->addSynth[2].trigger(params[0]);
-            std::cout << "Note On 3!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1c.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth[2].release(params[0]);
-            std::cout << "Note Off 3!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer1c.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program 3!! " << app->addSynth[2].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer2.setDirectory("sequences");
-        mSequencer2.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth2.mFundamental.set(midi2cps(params[0]));
-            app->addSynth2.trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer2.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth2.release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer2.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth2.mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-
-        mSequencer3a.setDirectory("sequences");
-        mSequencer3a.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[0].mFundamental.set(midi2cps(params[0]));
-            app->addSynth3[0].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3a.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[0].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3a.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth3[0].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer3b.setDirectory("sequences");
-        mSequencer3b.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[1].mFundamental.set(midi2cps(params[0]));
-            app->addSynth3[1].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3b.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[1].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3b.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth3[1].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer3c.setDirectory("sequences");
-        mSequencer3c.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[2].mFundamental.set(midi2cps(params[0]));
-            app->addSynth3[2].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3c.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth3[2].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer3c.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth3[2].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-
-        mSequencer4a.setDirectory("sequences");
-        mSequencer4a.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[0].mFundamental.set(midi2cps(params[0]));
-            app->addSynth4[0].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4a.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[0].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4a.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth4[0].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer4b.setDirectory("sequences");
-        mSequencer4b.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[1].mFundamental.set(midi2cps(params[0]));
-            app->addSynth4[1].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4b.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[1].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4b.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth4[1].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
-
-        mSequencer4c.setDirectory("sequences");
-        mSequencer4c.registerEventCommand("ON", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[2].mFundamental.set(midi2cps(params[0]));
-            app->addSynth4[2].trigger(params[0]);
-            std::cout << "Note On!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4c.registerEventCommand("OFF", [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            app->addSynth4[2].release(params[0]);
-            std::cout << "Note Off!! " << params[0]  << std::endl;
-        }, this);
-        mSequencer4c.registerEventCommand("PROGRAM",
-                                         [](void *data, std::vector<float> &params)
-        {
-            AudioApp *app = static_cast<AudioApp *>(data);
-            std::cout << "Program!! " << app->addSynth4[2].mPresetHandler.recallPresetSynchronous(params[0]) << std::endl;
-        }, this);
+        mScenes.load("scenes/campanitas.scenes");
     }
 
     static inline float midi2cps(int midiNote) {
@@ -322,25 +135,58 @@ public:
         mFromSimulator.handler(*this);
         mFromSimulator.timeout(0.005);
         mFromSimulator.start();
+        startProfiler();
+    }
+
+    // Reports the DSP load every second to the control app, see DspProfiler
+    void startProfiler() {
+        mProfiler.startCollector([this]() { mProfiler.send(mProfileSender); });
     }
 
-    void trigger1();
-    void trigger2();
-    void trigger22();
+    void playScene(const ChaosScene &scene);
+    void renderSequence(AudioIOData &io, SequencePlayer &sequencer, AddSynth &synth);
 
     virtual void onAudioCB(AudioIOData &io) override;
+    // Writes the messages received from the simulator to path, as a ControlTimeline
+    bool recordControls(std::string path) {
+        return mRecording.record(path, audioIO().framesPerSecond());
+    }
+
     virtual void onMessage(osc::Message &m) override {
-        if (m.addressPattern() == "/chaos" && m.typeTags() == "f") {
-            mPrevChaos = mChaos;
-            m >> mChaos;
+        if (m.typeTags() == "f") {
+            float value;
+            m >> value;
+            uint64_t frame = mChaos.nextFrame();
+            mRecording.write(frame, m.addressPattern(), value);
+            control(m.addressPattern(), value, frame);
+        }
+    }
+
+    virtual void control(const std::string &address, float value, uint64_t frame) override {
+        if (address == "/chaos") {
+            mChaos.pushAt(frame, value);
         }
     }
     virtual void printStatus() override {
         std::cout << "On States: ";
-        for (int i : mCampanitasStates) {
-            std::cout << i <<  "  ";
+        for (size_t i = 0; i < mScenes.scenes().size(); i++) {
+            if (mScenes.active(i)) {
+                std::cout << mScenes.scenes()[i].id <<  "  ";
+            }
         }
         std::cout << std::endl;
+        if (mSequences.misses() > 0) {
+            std::cout << "Sequences not found: " << mSequences.misses() << std::endl;
+        }
+        static const char *startedNames[STARTED_COUNT] = {"campanitas", "Seq 1", "Seq 3", "Seq 4"};
+        std::cout << "Started:";
+        for (int i = 0; i < STARTED_COUNT; i++) {
+            std::cout << " " << startedNames[i] << " " << mStarted[i].load(std::memory_order_relaxed);
+        }
+        std::cout << std::endl;
+        for (const std::string &line: mProfiler.lines()) {
+            std::cout << line << std::endl;
+        }
     }
 
 private:
@@ -352,93 +198,98 @@ private:
     AddSynth addSynthCampanas;
 
     // Sequence players
-    PresetSequencer mSequencer1a;
-    PresetSequencer mSequencer1b;
-    PresetSequencer mSequencer1c;
-    PresetSequencer mSequencer2;
-    PresetSequencer mSequencer3a;
-    PresetSequencer mSequencer3b;
-    PresetSequencer mSequencer3c;
-    PresetSequencer mSequencer4a;
-    PresetSequencer mSequencer4b;
-    PresetSequencer mSequencer4c;
-
-    // Schedule Messages
-    MsgQueue msgQueue;
+    SequenceBank mSequences {"sequences"};
+    SequencePlayer mSequencer1a;
+    SequencePlayer mSequencer1b;
+    SequencePlayer mSequencer1c;
+    SequencePlayer mSequencer2;
+    SequencePlayer mSequencer3a;
+    SequencePlayer mSequencer3b;
+    SequencePlayer mSequencer3c;
+    SequencePlayer mSequencer4a;
+    SequencePlayer mSequencer4b;
+    SequencePlayer mSequencer4c;
+
+    // Timed events, e.g. note releases
+    EventScheduler<> mScheduler;
+
+    // Counted by the audio callback instead of printed there, see printStatus()
+    enum Started { CAMPANITAS, SEQ_1, SEQ_3, SEQ_4, STARTED_COUNT };
+    std::atomic<unsigned int> mStarted[STARTED_COUNT] {};
 
     DownMixer mDownMixer;
 
     osc::Recv mFromSimulator {AUDIO_IN_PORT, AUDIO_IP_ADDRESS};
 
-    float mChaos {0};
-    float mPrevChaos {0};
-    std::list<int> mCampanitasStates;
-    int mCampanitasCounter[45] {0};
+    ControlInput mChaos; // Written by the OSC thread, read by the audio thread
+    ControlTimeline mRecording;
+    ChaosScenes mScenes;
+
+    osc::Send mProfileSender {CONTROL_IN_PORT, CONTROL_IP_ADDRESS}; // Used by mProfiler's collector until it stops
+    DspProfiler mProfiler {"audio"};
+    int mAddSynthStage = mProfiler.stage("addSynth");
+    int mCampanasStage = mProfiler.stage("campanas");
+    int mDownMixStage = mProfiler.stage("downmix");
 };
 
-static void releaseAddSynth(al_sec timestamp, AddSynth *addSynth, int id)
+static void releaseAddSynth(void *addSynth, int id)
 {
-    addSynth->release(id);
-    std::cout << "release" << std::endl;
+    static_cast<AddSynth *>(addSynth)->release(id);
 }
 
-void AudioApp::trigger1() {
-    std::cout << "CAMPANITAS 1 Trigger" << std::endl;
-    addSynthCampanas.mPresetHandler.recallPresetSynchronous(1);
-
-    int midinote = rnd::uniform(80,50);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.mLevel = 0.2;
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + rnd::uniform(1.0, 0.3), releaseAddSynth, &addSynthCampanas, midinote);
-
-    midinote = rnd::uniform(80,50);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + rnd::uniform(1.0, 0.3), releaseAddSynth, &addSynthCampanas, midinote);
-
-    midinote = rnd::uniform(80,50);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + rnd::uniform(1.0, 0.3), releaseAddSynth, &addSynthCampanas, midinote);
-
-    midinote = rnd::uniform(80,50);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + rnd::uniform(1.0, 0.3), releaseAddSynth, &addSynthCampanas, midinote);
-
-    midinote = rnd::uniform(80,50);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + rnd::uniform(1.0, 0.3), releaseAddSynth, &addSynthCampanas, midinote);
+void AudioApp::playScene(const ChaosScene &scene)
+{
+    float sharedDuration = -1;
+    for (const ScenePlay &play: scene.plays) {
+        addSynthCampanas.recallPreset(play.preset);
+        addSynthCampanas.mLevel = play.level;
+        for (int i = 0; i < play.size(); i++) {
+            int midinote = play.note(i);
+            float duration = rnd::uniform(play.maxDuration, play.minDuration);
+            if (play.sharedDuration) {
+                if (sharedDuration < 0) {
+                    sharedDuration = duration;
+                }
+                duration = sharedDuration;
+            }
+            addSynthCampanas.mFundamental = midi2cps(midinote);
+            addSynthCampanas.trigger(midinote + play.idOffset);
+            mScheduler.schedule(duration, releaseAddSynth, &addSynthCampanas, midinote + play.idOffset);
+        }
+    }
 }
 
-void AudioApp::trigger2()
+static void sequenceEvent(const SequenceEvent &event, AddSynth &synth)
 {
-    std::cout << "CAMPANITAS 2 Trigger" << std::endl;
-    addSynthCampanas.mPresetHandler.recallPresetSynchronous(2);
-
-    int midinote = rnd::uniform(48,28);
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.mLevel = 80;
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + 4, releaseAddSynth, &addSynthCampanas, midinote);
-};
+    switch (event.command) {
+    case SequenceEvent::ON:
+        synth.mFundamental.set(AudioApp::midi2cps(event.value));
+        synth.trigger(event.value);
+        break;
+    case SequenceEvent::OFF:
+        synth.release(event.value);
+        break;
+    case SequenceEvent::PROGRAM:
+        synth.recallPreset(int(event.value));
+        break;
+    }
+}
 
-void AudioApp::trigger22()
+// Renders synth up to each of the sequencer's events in the block, then applies it
+void AudioApp::renderSequence(AudioIOData &io, SequencePlayer &sequencer, AddSynth &synth)
 {
-    std::cout << "CAMPANITAS 22 Trigger" << std::endl;
-    addSynthCampanas.mPresetHandler.recallPresetSynchronous(22);
-
-    int midinote = 36;
-    addSynthCampanas.mFundamental = midi2cps(midinote);
-    addSynthCampanas.mLevel = 300;
-    addSynthCampanas.trigger(midinote);
-    msgQueue.send(msgQueue.now() + 25, releaseAddSynth, &addSynthCampanas, midinote);
-};
+    int frame = 0;
+    sequencer.process(io.framesPerSecond(), io.framesPerBuffer(), [&](const SequenceEvent &event, int offset) {
+        synth.generateAudio(io, frame, offset);
+        frame = offset;
+        sequenceEvent(event, synth);
+    });
+    synth.generateAudio(io, frame, io.framesPerBuffer());
+}
 
-static void turnoffSeq(al_sec timestamp, AddSynth * addSynth)
+static void turnoffSeq(void *synths, int)
 {
+    AddSynth *addSynth = static_cast<AddSynth *>(synths);
     addSynth[0].allNotesOff();
     addSynth[1].allNotesOff();
     addSynth[2].allNotesOff();
@@ -446,18 +297,19 @@ static void turnoffSeq(al_sec timestamp, AddSynth * addSynth)
 
 void AudioApp::onAudioCB(AudioIOData &io)
 {
+    mProfiler.beginBlock(io.framesPerBuffer(), io.framesPerSecond());
+    mChaos.beginBlock(io.framesPerBuffer(), io.framesPerSecond());
     int bufferSize = io.framesPerBuffer();
     float *swBuffer = io.outBuffer(47);
-    bool consumeChaos = false;
 
     // Campanitas
 
     float max = 0.3;
-    if (mChaos < max) {
-        float probCampanitas = 0.0005 + (mChaos/max) * 0.002;
+    if (mChaos.value() < max) {
+        float probCampanitas = 0.0005 + (mChaos.value()/max) * 0.002;
         if (rnd::prob(probCampanitas)) {
-            std::cout << "trigger" << std::endl;
-            addSynthCampanas.mPresetHandler.recallPresetSynchronous("34");
+            mStarted[CAMPANITAS].fetch_add(1, std::memory_order_relaxed);
+            addSynthCampanas.recallPreset("34");
             addSynthCampanas.mLayer = rnd::uniform(3);
             addSynthCampanas.mLevel = 0.09;
             addSynthCampanas.mArcSpan = rnd::uniform(0.5, 2.0);
@@ -465,494 +317,40 @@ void AudioApp::onAudioCB(AudioIOData &io)
             addSynthCampanas.mCumulativeDelayRandomness = addSynthCampanas.mCumulativeDelayRandomness +rnd::uniform(0.2, -0.2);
             addSynthCampanas.mFundamental = addSynthCampanas.mFundamental + rnd::uniform(40, -40);
             addSynthCampanas.trigger(0);
-            msgQueue.send(msgQueue.now() + 2.5, releaseAddSynth, &addSynthCampanas, 0);
-        }
-    }
-
-    float TimeDelta;
-    float ifNotTime;
-    int stateCamp;
-    if (!mSequencer1a.running() && !mSequencer2.running() && !mSequencer3a.running() && !mSequencer4a.running()) {
-        // 1 --------------------
-        TimeDelta = 8;
-        ifNotTime = 2;
-        stateCamp = 1;
-        if (mPrevChaos < 0.15 && mChaos >= 0.15) {
-            mCampanitasStates.push_back(stateCamp);
-            std::cout << "ENTER campanitas stateCamp" << std::endl;
-            if (rnd::prob(0.1)) {
-                trigger1();
-                mCampanitasCounter[stateCamp] = 0;
-                std::cout << "CAMPANITAS 1 Launch" << std::endl;
-            } else {
-                mCampanitasCounter[stateCamp] =  (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-            }
-            consumeChaos = true;
-        } else if (mPrevChaos < 0.3 && mChaos >= 0.3) {
-
-            std::cout << "EXIT campanitas stateCamp" << std::endl;
-            mCampanitasStates.remove(stateCamp);
-            consumeChaos = true;
-        }  else if (mPrevChaos > 0.15 && mChaos <= 0.15) {
-            std::cout << "EXIT campanitas stateCamp" << std::endl;
-            mCampanitasStates.remove(stateCamp);
-            consumeChaos = true;
-        }
-
-        if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-            mCampanitasCounter[stateCamp]++;
-            if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-                if (rnd::prob(0.7)) {
-                    std::cout << "CAMPANITAS 1 Launch" << std::endl;
-                    trigger1();
-                    mCampanitasCounter[stateCamp] = 0;
-                    std::cout << "campanitas 1" << std::endl;
-                } else {
-                    mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-                }
-            }
-        }
-        // 2 --------------------
-        TimeDelta = 6;
-        ifNotTime = 2;
-        stateCamp = 2;
-        if (mPrevChaos > 0.2 && mChaos <= 0.2) {
-            mCampanitasStates.push_back(stateCamp);
-            std::cout << "ENTER campanitas stateCamp 2" << std::endl;
-            if (rnd::prob(0.5)) {
-                trigger2();
-                mCampanitasCounter[stateCamp] = 0;
-            } else {
-                mCampanitasCounter[stateCamp] =  (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-            }
-            consumeChaos = true;
-        } else if (mPrevChaos > 0.1 && mChaos <= 0.1) {
-            std::cout << "EXIT campanitas stateCamp " << std::endl;
-            mCampanitasStates.remove(stateCamp);
-            consumeChaos = true;
-        }  else if (mPrevChaos > 0.22 && mChaos <= 0.22) {
-            std::cout << "EXIT campanitas state " << std::endl;
-            mCampanitasStates.remove(stateCamp);
-            consumeChaos = true;
-        }
-
-        if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-            mCampanitasCounter[stateCamp]++;
-            if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-                if (rnd::prob(0.7)) {
-                    trigger2();
-                    mCampanitasCounter[stateCamp] = 0;
-                    std::cout << "campanitas 1" << std::endl;
-                } else {
-                    mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-                }
-            }
-        }
-		// 9 Oh Boy Bottom row AM --------------------
-		TimeDelta = 30; // separacion entre notas
-		ifNotTime = 2; //
-		stateCamp = 9; //numero de preset
-		if (mPrevChaos > 0.4 && mChaos <= 0.4) { //umbral de entrada
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 9 Oh Boy Bottom row AM" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.4 && mChaos >= 0.4) { //umbral de salida subiendo
-			std::cout << "EXIT 9 Oh boy bottom row AM" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}  else if (mPrevChaos > 0.2 && mChaos <= 0.2) { //umbral de salida bajando
-			std::cout << "EXIT 9 Oh boy bottom row AM" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.5)) { // prob
-					std::cout << "9 Oh boy bottom row AM Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(9); // preset
-					int midinote = rnd::uniform(40,30); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 1;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + 15, releaseAddSynth, &addSynthCampanas, midinote); // duracion
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "9 Oh boy bottom row AM" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-		// 10 Oh Boy Bottom its FM 2 --------------------
-		TimeDelta = 12; // separacion entre notas
-		ifNotTime = 4; //
-		stateCamp = 10; //numero de preset
-		if (mPrevChaos < 0.55 && mChaos >= 0.55) { //umbral de entrada subiendo
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 10 Oh Boy Its FM2" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.75 && mChaos >= 0.75) { //umbral de salida subiendo
-			std::cout << "EXIT 10 Oh Boy Its FM2" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		} else if (mPrevChaos > 0.55 && mChaos <= 0.55) { //umbral de entrada bajando
-			if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) == mCampanitasStates.end() ) {
-				mCampanitasStates.push_back(stateCamp);
-				std::cout << "ENTER 10 Oh Boy Its FM2" << std::endl;//print esto
-				mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-				consumeChaos = true;
-			}
-		}  else if (mPrevChaos > 0.47 && mChaos <= 0.47) { //umbral de salida bajando
-			std::cout << "EXIT 10 Oh Boy Its FM2" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.2)) { // probabilidad
-					std::cout << "10 Oh Boy Its FM2 Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(10); // preset
-					int midinote = rnd::uniform(76,24); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 0.6;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + rnd::uniform(12,9), releaseAddSynth, &addSynthCampanas, midinote); // duracion
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "10 Oh Boy Its FM2" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-		// 12 Bells 1 --------------------
-		TimeDelta = 0.05; // separacion entre notas
-		ifNotTime = 4; //
-		stateCamp = 12; //numero de preset
-		if (mPrevChaos < 0.55 && mChaos >= 0.55) { //umbral de entrada subiendo
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 12 Bells 1" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.75 && mChaos >= 0.75) { //umbral de salida subiendo
-			std::cout << "EXIT 10 12 Bells 1" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		} else if (mPrevChaos > 0.55 && mChaos <= 0.55) { //umbral de entrada bajando
-			if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) == mCampanitasStates.end() ) {
-				mCampanitasStates.push_back(stateCamp);
-				std::cout << "ENTER 12 Bells 1" << std::endl;//print esto
-				mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-				consumeChaos = true;
-			}
-		}  else if (mPrevChaos > 0.3 && mChaos <= 0.3) { //umbral de salida bajando
-			std::cout << "EXIT 12 Bells 1" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.4)) { // probabilidad
-					std::cout << "12 Bells 1 Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(12); // preset
-					int midinote = rnd::uniform(110,63); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 0.6;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + rnd::uniform(12,9), releaseAddSynth, &addSynthCampanas, midinote); // duracion
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "12 Bells 1" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-		// 37 Is It a drop --------------------
-		TimeDelta = 10; // separacion entre notas
-		ifNotTime = 1; //
-		stateCamp = 37; //numero de preset
-		if (mPrevChaos < 0.65 && mChaos >= 0.65) { //umbral de entrada subiendo
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 37 Is It  a   D R O P   ?" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.75 && mChaos >= 0.75) { //umbral de salida subiendo
-			std::cout << "EXIT 37 Is It  a   D R O P   ?" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		} else if (mPrevChaos > 0.75 && mChaos <= 0.75) { //umbral de entrada bajando
-			if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) == mCampanitasStates.end() ) {
-				mCampanitasStates.push_back(stateCamp);
-				std::cout << "ENTER 37 Is It  a   D R O P   ?" << std::endl;//print esto
-				mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-				consumeChaos = true;
-			}
-		}  else if (mPrevChaos > 0.65 && mChaos <= 0.65) { //umbral de salida bajando
-			std::cout << "EXIT 37 Is It  a   D R O P   ?" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.4)) { // probabilidad
-					std::cout << "37 Is It  a   D R O P   ? Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(37); // preset
-					int midinote = rnd::uniform(88,40); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 0.9;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + 15, releaseAddSynth, &addSynthCampanas, midinote); // duracion. En este caso quiero que la duración se mayor que 15, no solo 15
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "37 Is It  a   D R O P   ?" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-		// 38 Slow FM Bells --------------------
-		TimeDelta = 2; // separacion entre notas
-		ifNotTime = 2; //
-		stateCamp = 38; //numero de preset
-		if (mPrevChaos < 0.25 && mChaos >= 0.25) { //umbral de entrada subiendo
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 38 Slow   F M   B  e l l s" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.50 && mChaos >= 0.50) { //umbral de salida subiendo
-			std::cout << "EXIT 38 Slow   F M   B  e l l s" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		} else if (mPrevChaos > 0.5 && mChaos <= 0.5) { //umbral de entrada bajando
-			if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) == mCampanitasStates.end() ) {
-				mCampanitasStates.push_back(stateCamp);
-				std::cout << "ENTER 38 Slow   F M   B  e l l s" << std::endl;//print esto
-				mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-				consumeChaos = true;
-			}
-		}  else if (mPrevChaos > 0.35 && mChaos <= 0.35) { //umbral de salida bajando
-			std::cout << "EXIT 38 Slow   F M   B  e l l s" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}  else if (mPrevChaos > 0.24 && mChaos <= 0.24) { //umbral de salida bajando
-            std::cout << "EXIT 38 Slow   F M   B  e l l s" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.3)) { // probabilidad Quiero que sea diferente subiendo que bajando. Subiendo 30 bajando 10
-					std::cout << "38 Slow   F M   B  e l l s Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(38); // preset
-					int midinote = rnd::uniform(70,28); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 0.9;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + 2.5, releaseAddSynth, &addSynthCampanas, midinote); // duracion.
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "38 Slow   F M   B  e l l s" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-		// 41 Slow FMs --------------------
-		TimeDelta = 12; // separacion entre notas
-		ifNotTime = 4; //
-		stateCamp = 41; //numero de preset
-		if (mPrevChaos < 0.55 && mChaos >= 0.55) { //umbral de entrada subiendo
-			mCampanitasStates.push_back(stateCamp);
-			std::cout << "ENTER 41 Slow   F M s" << std::endl;//print esto
-			mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-			consumeChaos = true;
-		} else if (mPrevChaos < 0.75 && mChaos >= 0.75) { //umbral de salida subiendo
-			std::cout << "EXIT 41 Slow   F M s" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-        if (mPrevChaos > 0.75 && mChaos <= 0.75) { //umbral de entrada bajando
-			if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) == mCampanitasStates.end() ) {
-				mCampanitasStates.push_back(stateCamp);
-				std::cout << "ENTER 41 Slow   F M s" << std::endl;//print esto
-				mCampanitasCounter[stateCamp] = TimeDelta * io.framesPerSecond()/ io.framesPerBuffer();
-				consumeChaos = true;
-			}
-		} else if (mPrevChaos > 0.54 && mChaos <= 0.54) { //umbral de salida bajando
-			std::cout << "EXIT 41 Slow   F M s" << std::endl;
-			mCampanitasStates.remove(stateCamp);
-			consumeChaos = true;
-		}
-		
-		if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-			mCampanitasCounter[stateCamp]++;
-			if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-				if (rnd::prob(0.15)) { // probabilidad
-					std::cout << "41 Slow   F M s Trigger" << std::endl;
-					addSynthCampanas.mPresetHandler.recallPresetSynchronous(41); // preset
-					int midinote = rnd::uniform(63,24); //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-					addSynthCampanas.mFundamental = midi2cps(midinote);
-					addSynthCampanas.mLevel = 0.9;// nivel
-					addSynthCampanas.trigger(midinote);
-					msgQueue.send(msgQueue.now() + 20, releaseAddSynth, &addSynthCampanas, midinote); // duracion.
-					
-					mCampanitasCounter[stateCamp] = 0;
-					std::cout << "41 Slow   F M s" << std::endl;
-				} else {
-					mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-				}
-			}
-		}
-
-
-    }
-    // 22 simple bass --------------------
-    TimeDelta = 40;
-    ifNotTime = 2;
-    stateCamp = 22;
-    if (mPrevChaos < 0.5 && mChaos >= 0.5) {
-        mCampanitasStates.push_back(stateCamp);
-        std::cout << "ENTER campanitas stateCamp 22" << std::endl;
-        if (rnd::prob(0.5)) {
-            trigger22();
-            mCampanitasCounter[stateCamp] = 0;
-        } else {
-            mCampanitasCounter[stateCamp] =  (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-        }
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.49 && mChaos <= 0.49) {
-        std::cout << "EXIT campanitas stateCamp 22" << std::endl;
-        mCampanitasStates.remove(stateCamp);
-        consumeChaos = true;
-    }/*  else if (mPrevChaos < 0.49 && mChaos >= 0.49) {
-        std::cout << "EXIT campanitas state " << std::endl;
-        mCampanitasStates.remove(stateCamp);
-consumeChaos = true;
-    }*/
-
-    if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-        mCampanitasCounter[stateCamp]++;
-        if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-            if (rnd::prob(0.5)) {
-                trigger22();
-                mCampanitasCounter[stateCamp] = 0;
-                std::cout << "campanitas" << stateCamp << std::endl;
-            } else {
-                mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-            }
+            mScheduler.schedule(2.5, releaseAddSynth, &addSynthCampanas, 0);
         }
     }
 
+    bool idle = !mSequencer1a.running() && !mSequencer2.running() && !mSequencer3a.running() && !mSequencer4a.running();
+    mScenes.process(mChaos, idle, io.framesPerSecond() / io.framesPerBuffer(),
+                    [this](const ChaosScene &scene) { playScene(scene); });
 
-    // 3,4,5 Beating --------------------
-    TimeDelta = 20;
-    ifNotTime = 2;
-    stateCamp = 3;
-    if (mPrevChaos < 0.8 && mChaos >= 0.8) {
-        mCampanitasStates.push_back(stateCamp);
-        std::cout << "ENTER beating" << std::endl;
-        mCampanitasCounter[stateCamp] =  io.framesPerSecond()/ io.framesPerBuffer();
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.7 && mChaos <= 0.7) {
-        std::cout << "EXIT campanitas stateCamp 22" << std::endl;
-        mCampanitasStates.remove(stateCamp);
-        consumeChaos = true;
-    }
-
-    if (std::find(mCampanitasStates.begin(), mCampanitasStates.end(), stateCamp) != mCampanitasStates.end()) {
-        mCampanitasCounter[stateCamp]++;
-        if (mCampanitasCounter[stateCamp] > TimeDelta * io.framesPerSecond()/ io.framesPerBuffer()) {
-            if (rnd::prob(0.7)) {
-                float dur = rnd::uniform(20.0, 8.0);
-                std::cout << "41 Slow   F M s Trigger" << std::endl;
-
-                addSynthCampanas.mPresetHandler.recallPresetSynchronous(3); // preset
-                int midinote = 36; //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote); // duracion.
-
-                midinote = 43;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote); // duracion.
-
-                midinote = 50;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote); // duracion.
-
-                addSynthCampanas.mPresetHandler.recallPresetSynchronous(4); // preset
-
-                midinote = 36; //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -12);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote-12); // duracion.
-
-                midinote = 43;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -12);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote -12); // duracion.
-
-                midinote = 50;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -12);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote -12); // duracion.
-
-                addSynthCampanas.mPresetHandler.recallPresetSynchronous(5); // preset
-
-                midinote = 36; //rango de notas entre MIDI 36 y 20. Si es solo una es el numero despues del =
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -24);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote-24); // duracion.
-
-                midinote = 43;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -24);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote -24); // duracion.
-
-                midinote = 50;
-                addSynthCampanas.mFundamental = midi2cps(midinote);
-                addSynthCampanas.mLevel = 0.9;// nivel
-                addSynthCampanas.trigger(midinote -24);
-                msgQueue.send(msgQueue.now() + dur, releaseAddSynth, &addSynthCampanas, midinote -24); // duracion.
-
-                mCampanitasCounter[stateCamp] = 0;
-                std::cout << "campanitas" << stateCamp << std::endl;
-            } else {
-                mCampanitasCounter[stateCamp] = (TimeDelta - ifNotTime) * io.framesPerSecond()/ io.framesPerBuffer();
-            }
-        }
+    {
+        DspProfiler::Scope scope(mProfiler, mAddSynthStage);
+        renderSequence(io, mSequencer1a, addSynth[0]);
+        renderSequence(io, mSequencer1b, addSynth[1]);
+        renderSequence(io, mSequencer1c, addSynth[2]);
+        renderSequence(io, mSequencer3a, addSynth3[0]);
+        renderSequence(io, mSequencer3b, addSynth3[1]);
+        renderSequence(io, mSequencer3c, addSynth3[2]);
+        renderSequence(io, mSequencer4a, addSynth4[0]);
+        renderSequence(io, mSequencer4b, addSynth4[1]);
+        renderSequence(io, mSequencer4c, addSynth4[2]);
+        mSequencer2.process(io.framesPerSecond(), io.framesPerBuffer(), [this](const SequenceEvent &event, int offset) {
+            sequenceEvent(event, addSynth2);
+        });
+//        addSynth2.generateAudio(io);
     }
-
-    for (int i = 0; i < 3; i++) {
-        addSynth[i].generateAudio(io);
-        addSynth3[i].generateAudio(io);
-        addSynth4[i].generateAudio(io);
+    {
+        DspProfiler::Scope scope(mProfiler, mCampanasStage);
+        // Releases land on their frame in the campanitas, other events apply from the next block
+        int frame = 0;
+        mScheduler.process(io.framesPerSecond(), io.framesPerBuffer(), [&](int offset) {
+            addSynthCampanas.generateAudio(io, frame, offset);
+            frame = offset;
+        });
+        addSynthCampanas.generateAudio(io, frame, io.framesPerBuffer());
     }
-//    addSynth2.generateAudio(io);
-    addSynthCampanas.generateAudio(io);
 
     /// Sequences
     ///
@@ -963,8 +361,8 @@ consumeChaos = true;
 
     rangeStart = 0.1;
     rangeEnd = 0.2;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
         if (!mSequencer4a.running()) {
             mSequencer3a.stopSequence();
@@ -983,18 +381,17 @@ consumeChaos = true;
             addSynth[0].allNotesOff();
             addSynth[1].allNotesOff();
             addSynth[2].allNotesOff();
-            mSequencer4a.playSequence("Seq 4a-0");
-            mSequencer4b.playSequence("Seq 4b-0");
-            mSequencer4c.playSequence("Seq 4c-0");
-            std::cout << "Seq 4" << std::endl;
-            consumeChaos = true;
+            mSequencer4a.playSequence(mSequences.sequence("Seq 4a-0"));
+            mSequencer4b.playSequence(mSequences.sequence("Seq 4b-0"));
+            mSequencer4c.playSequence(mSequences.sequence("Seq 4c-0"));
+            mStarted[SEQ_4].fetch_add(1, std::memory_order_relaxed);
         }
     }
 
 //    rangeStart = 0.25;
 ////    rangeEnd = 0.5;
-//    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-//            || (mPrevChaos > rangeStart &&  mChaos <= rangeStart)
+//    if (mChaos.crossedUp(rangeStart)
+//            || mChaos.crossedDown(rangeStart)
 //            ) {
 //        if (!mSequencer2.running()) {
 //            mSequencer1a.stopSequence();
@@ -1009,15 +406,15 @@ consumeChaos = true;
 //            addSynth3[0].allNotesOff();
 //            addSynth3[1].allNotesOff();
 //            addSynth3[2].allNotesOff();
-//            mSequencer2.playSequence("Seq 2-1");
+//            mSequencer2.playSequence(mSequences.sequence("Seq 2-1"));
 //            std::cout << "Seq 2" << std::endl;
 //        }
 //    }
 
     rangeStart = 0.3;
     rangeEnd = 0.4;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
         if (!mSequencer3a.running()) {
             mSequencer1a.stopSequence();
@@ -1036,20 +433,19 @@ consumeChaos = true;
             addSynth[1].allNotesOff();
             addSynth[2].allNotesOff();
 
-            msgQueue.send(msgQueue.now() + 3.5, turnoffSeq, addSynth4); // duracion.
-            mSequencer3a.playSequence("Seq 3-1");
-            mSequencer3b.playSequence("Seq 3-2");
-            mSequencer3c.playSequence("Seq 3-3");
-            std::cout << "Seq 3" << std::endl;
-            consumeChaos = true;
+            mScheduler.schedule(3.5, turnoffSeq, addSynth4); // duracion.
+            mSequencer3a.playSequence(mSequences.sequence("Seq 3-1"));
+            mSequencer3b.playSequence(mSequences.sequence("Seq 3-2"));
+            mSequencer3c.playSequence(mSequences.sequence("Seq 3-3"));
+            mStarted[SEQ_3].fetch_add(1, std::memory_order_relaxed);
         }
     }
 
     ///
     rangeStart = 0.5;
     rangeEnd = 0.6;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
         if (!mSequencer1a.running()) {
 //            mSequencer2.stopSequence();
@@ -1057,12 +453,11 @@ consumeChaos = true;
             mSequencer3a.stopSequence();
             mSequencer3b.stopSequence();
             mSequencer3c.stopSequence();
-            msgQueue.send(msgQueue.now() + 2.0, turnoffSeq, addSynth3); // duracion.
-            mSequencer1a.playSequence("Seq 1-1");
-            mSequencer1b.playSequence("Seq 1-2");
-            mSequencer1c.playSequence("Seq 1-3");
-            std::cout << "Seq 1" << std::endl;
-            consumeChaos = true;
+            mScheduler.schedule(2.0, turnoffSeq, addSynth3); // duracion.
+            mSequencer1a.playSequence(mSequences.sequence("Seq 1-1"));
+            mSequencer1b.playSequence(mSequences.sequence("Seq 1-2"));
+            mSequencer1c.playSequence(mSequences.sequence("Seq 1-3"));
+            mStarted[SEQ_1].fetch_add(1, std::memory_order_relaxed);
         }
     }
 
@@ -1070,14 +465,8 @@ consumeChaos = true;
         *swBuffer++ *= 0.07;
     }
 
-    msgQueue.advance(io.framesPerBuffer()/io.framesPerSecond());
-
-    if (mChaos == 0 && mPrevChaos > 0.0) {
-        mCampanitasStates.clear();
-    }
-
-    if (consumeChaos) {
-        mPrevChaos = mChaos;
+    if (mChaos.crossedDown(0)) {
+        mScenes.clear();
     }
 //    std::cout << "-------------" << std::endl;
 //    for (int i= 0; i < 60; i++) {
@@ -1086,12 +475,20 @@ consumeChaos = true;
 //    std::cout << std::endl;
 
 #ifndef BUILDING_FOR_ALLOSPHERE
-    mDownMixer.process(io);
+    {
+        DspProfiler::Scope scope(mProfiler, mDownMixStage);
+        mDownMixer.process(io);
+    }
 #endif
+    mProfiler.endBlock();
 }
 
 int main(int argc, char *argv[] )
 {
+    if (argc > 3 && std::string(argv[1]) == "-render") {
+        // Same random choices in every render of a timeline
+        rnd::global().seed(1);
+    }
     AudioApp app;
 
     int outChans = 60;
@@ -1103,6 +500,21 @@ int main(int argc, char *argv[] )
 
 //    AudioDevice::printAll();
     app.audioIO().print();
+    // -render <seconds> <output.wav|.raw> [timeline]: offline render, no device or OSC
+    // -record <timeline>: records the messages received, e.g. for -render
+    if (argc > 3 && std::string(argv[1]) == "-render") {
+        ControlTimeline timeline;
+        if (argc > 4 && !timeline.read(argv[4], app.audioIO().fps())) {
+            return 1;
+        }
+        app.startProfiler();
+        bool rendered = app.renderOffline(atof(argv[2]), timeline, argv[3]);
+        app.printStatus(); // DSP load of the last second
+        return rendered ? 0 : 1;
+    }
+    if (argc > 2 && std::string(argv[1]) == "-record") {
+        app.recordControls(argv[2]);
+    }
     app.init();
     app.start();
     return 0;
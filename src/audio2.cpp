@@ -1,4 +1,5 @@
 
+#include <atomic>
 #include <vector>
 
 #include "allocore/al_Allocore.hpp"
@@ -15,6 +16,9 @@
 #include "add_synth.hpp"
 #include "granulator.hpp"
 #include "downmixer.hpp"
+#include "control_input.hpp"
+#include "offline_render.hpp"
+#include "dsp_profiler.hpp"
 
 #define CHAOS_SYNTH_POLYPHONY 3
 
@@ -38,6 +42,7 @@ public:
 		mAudioIO.framesPerBuffer(framesPerBuffer);
 		mAudioIO.channelsOut(outChans);
 		mAudioIO.channelsIn(inChans);
+		mChannelsOut = outChans;
 		gam::sampleRate(framesPerSec);
 	}
 
@@ -50,8 +55,8 @@ public:
             do {
                 c=getchar();
                 putchar (c);
-                if (c == 'q') {
-                    std::cout << "ip" << std::endl;
+                if (c == 's') {
+                   printStatus();
                 }
                 if (c == 'w') {
                     std::cout << "ip" << std::endl;
@@ -60,8 +65,27 @@ public:
 		}
 	}
 
+	// Runs the callback seconds without the device, as fast as possible,
+	// applying the timeline's messages with control(), and writes all the
+	// channels asked of initAudio() to path (see OfflineRender)
+	bool renderOffline(double seconds, const ControlTimeline &timeline, std::string path) {
+		mOffline = true;
+		return OfflineRender::render(*this, mChannelsOut, mAudioIO.framesPerBuffer(), mAudioIO.framesPerSecond(),
+		                             seconds, timeline, path, [this](const ControlEvent &event) {
+			control(event.address, event.value, event.frame);
+		});
+	}
+
+	bool offline() const { return mOffline; }
+
+    virtual void printStatus() = 0;
+    // Applies a control message at a frame of the audio clock
+    virtual void control(const std::string &address, float value, uint64_t frame) = 0;
+
 private:
 	AudioIO mAudioIO;
+	unsigned mChannelsOut {2}; // Requested, mAudioIO has at most the device's
+	bool mOffline {false};
 };
 
 class AudioApp: public BaseAudioApp, public osc::PacketHandler
@@ -95,6 +119,10 @@ public:
                 exit(-1);
             }
         }
+        mVocesEnv.sustainPoint(1);
+//        mVocesEnv.lengths()[1] = 1.2;
+//        mVocesEnv.lengths()[2] = 1.2;
+        mVocesEnv.release();
     }
 
     static inline float midi2cps(int midiNote) {
@@ -105,36 +133,59 @@ public:
         mFromSimulator.handler(*this);
         mFromSimulator.timeout(0.005);
         mFromSimulator.start();
-        mVocesEnv.sustainPoint(1);
-//        mVocesEnv.lengths()[1] = 1.2;
-//        mVocesEnv.lengths()[2] = 1.2;
-        mVocesEnv.release();
+        startProfiler();
+    }
+
+    // Reports the DSP load every second to the control app, see DspProfiler
+    void startProfiler() {
+        mProfiler.startCollector([this]() { mProfiler.send(mProfileSender); });
     }
 
+    // Offline, file reads wait for the reader thread, out of the DSP load
+    DspProfiler *fileWait() { return offline() ? &mProfiler : nullptr; }
+
     void basesAudio(AudioIOData &io);
     void vocesCura(AudioIOData &io);
     void chaosSynthAudio(AudioIOData &io);
 
     virtual void onAudioCB(AudioIOData &io) override;
+    // Writes the messages received from the simulator to path, as a ControlTimeline
+    bool recordControls(std::string path) {
+        return mRecording.record(path, audioIO().framesPerSecond());
+    }
+
     virtual void onMessage(osc::Message &m) override {
-        if (m.addressPattern() == "/chaos" && m.typeTags() == "f") {
-            mPrevChaos = mChaos;
-            m >> mChaos;
-        } else if (m.addressPattern() == "/mouseDown" && m.typeTags() == "f") {
-            float val;
-            m >> val;
-            if (val == 0) {
-                mVocesEnv.release();
-            } else {
-                mVocesEnv.resetSoft();
+        if (m.typeTags() == "f") {
+            float value;
+            m >> value;
+            uint64_t frame = mChaos.nextFrame();
+            mRecording.write(frame, m.addressPattern(), value);
+            control(m.addressPattern(), value, frame);
+            if (m.addressPattern() == "/mouseDown") {
+                m.print();
             }
-            m.print();
+        }
+    }
+
+    virtual void control(const std::string &address, float value, uint64_t frame) override {
+        if (address == "/chaos") {
+            mChaos.pushAt(frame, value);
+        } else if (address == "/mouseDown") {
+            mMouseDown.pushAt(frame, value);
+        }
+    }
+
+    virtual void printStatus() override {
+        std::cout << "Chaos 1 triggers: " << mChaosTriggers.load(std::memory_order_relaxed) << std::endl;
+        for (const std::string &line: mProfiler.lines()) {
+            std::cout << line << std::endl;
         }
     }
 
 private:
     // Synthesis
     ChaosSynth chaosSynth[CHAOS_SYNTH_POLYPHONY];
+    std::atomic<unsigned int> mChaosTriggers {0}; // Counted by the audio callback instead of printed there
     int chaosCounter {0};
     int chaosState {0};
 
@@ -180,15 +231,20 @@ private:
     std::vector<std::shared_ptr<SoundFileBuffered>> mVoices;
     gam::ADSR<> mVocesEnv {0.3, 0.3, 1.0, 4.0};
 
-    // Schedule Messages
-    MsgQueue msgQueue;
-
     DownMixer mDownMixer;
 
     osc::Recv mFromSimulator {AUDIO2_IN_PORT, AUDIO2_IP_ADDRESS};
 
-    float mChaos {0};
-    float mPrevChaos {0};
+    ControlInput mChaos; // Written by the OSC thread, read by the audio thread
+    ControlInput mMouseDown {0, 0};
+    ControlTimeline mRecording;
+
+    osc::Send mProfileSender {CONTROL_IN_PORT, CONTROL_IP_ADDRESS}; // Used by mProfiler's collector until it stops
+    DspProfiler mProfiler {"audio2"};
+    int mBasesStage = mProfiler.stage("bases");
+    int mVocesStage = mProfiler.stage("voces");
+    int mChaosSynthStage = mProfiler.stage("chaosSynth");
+    int mDownMixStage = mProfiler.stage("downmix");
 };
 
 
@@ -198,18 +254,39 @@ static void releaseChaosSynth(al_sec timestamp, ChaosSynth *chaosSynth, int id)
     std::cout << "release chaos" << std::endl;
 }
 
+// Reads frames from a buffered file. Live (wait is null), a block the reader
+// thread hasn't buffered yet is skipped; offline the render is faster than the
+// reader, so wait for it (up to a second) to get the same output as a live
+// run, leaving the waiting out of the DSP load in the wait profiler.
+static bool readFrames(SoundFileBuffered &file, float *buffer, int frames, DspProfiler *wait)
+{
+    if (!wait) {
+        return file.read(buffer, frames) == frames;
+    }
+    int done = 0;
+    for (int tries = 0; done < frames && tries < 1000; tries++) {
+        done += file.read(buffer + done, frames - done);
+        if (done < frames) {
+            DspProfiler::Exclude waiting(*wait);
+            al_sleep(0.001);
+        }
+    }
+    return done == frames;
+}
+
 void readFile(std::vector<std::shared_ptr<SoundFileBuffered>> files,
               float *readBuffer,
               AudioIOData &io,
               std::vector<int> routing,
-              float gain = 1.0) {
+              float gain = 1.0,
+              DspProfiler *wait = nullptr) {
     int bufferSize = io.framesPerBuffer();
     float *swBuffer = io.outBuffer(47);
 
     int counter = 0;
     for (auto f : files) {
         assert(bufferSize < 8192);
-        if (f->read(readBuffer, bufferSize) == bufferSize) {
+        if (readFrames(*f, readBuffer, bufferSize, wait)) {
             float *buf = readBuffer;
             float *bufsw = swBuffer;
             float *outbuf = io.outBuffer(routing[counter]);
@@ -234,65 +311,65 @@ void AudioApp::basesAudio(AudioIOData &io)
     std::vector<float> mCamasGains = {0.03, 0.05, 0.07, 0.1, 0.2};
 
     int fileIndex = 0;
-    if (mChaos < 0.2) {
+    if (mChaos.value() < 0.2) {
         fileIndex = 0;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex]);
-    } else if (mChaos < 0.3) {
-        float gainIndex = (mChaos - 0.2) * 10;
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex], fileWait());
+    } else if (mChaos.value() < 0.3) {
+        float gainIndex = (mChaos.value() - 0.2) * 10;
 
         fileIndex = 0;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex));
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex), fileWait());
 
         fileIndex = 1;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex, fileWait());
 
-    }  else if (mChaos < 0.4) {
+    }  else if (mChaos.value() < 0.4) {
         fileIndex = 1;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex]);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex], fileWait());
 
-    } else if (mChaos < 0.5) {
-        float gainIndex = (mChaos - 0.4) * 10;
+    } else if (mChaos.value() < 0.5) {
+        float gainIndex = (mChaos.value() - 0.4) * 10;
 
         fileIndex = 1;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex));
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex), fileWait());
 
         fileIndex = 2;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex, fileWait());
 
-    } else if (mChaos < 0.6) {
+    } else if (mChaos.value() < 0.6) {
 
         fileIndex = 2;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex]);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex], fileWait());
 
-    } else if (mChaos < 0.7) {
+    } else if (mChaos.value() < 0.7) {
 
-        float gainIndex = (mChaos - 0.6) * 10;
+        float gainIndex = (mChaos.value() - 0.6) * 10;
 
         fileIndex = 2;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex));
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex), fileWait());
 
         fileIndex = 3;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex, fileWait());
 
-    } else if (mChaos < 0.8) {
+    } else if (mChaos.value() < 0.8) {
 
         fileIndex = 3;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex]);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex], fileWait());
 
 
-    }  else if (mChaos < 0.9) {
+    }  else if (mChaos.value() < 0.9) {
 
-        float gainIndex = (mChaos - 0.8) * 10;
+        float gainIndex = (mChaos.value() - 0.8) * 10;
 
         fileIndex = 3;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex));
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] * (1.0 - gainIndex), fileWait());
 
         fileIndex = 4;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex] *gainIndex, fileWait());
 
     } else {
         fileIndex = 4;
-        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex]);
+        readFile(mCamaFiles[fileIndex], readBuffer, io, mCamasRouting, mCamasGains[fileIndex], fileWait());
     }
 }
 
@@ -304,14 +381,14 @@ void AudioApp::vocesCura(AudioIOData &io)
     float vocesGain = 0.0;
     const float vocesGainTarget = 0.8;
 
-    if (mChaos > 0.45) {
-        vocesGain = vocesGainTarget * ((mChaos - 0.45)/ 0.25);
-    } else if (mChaos > 0.7) {
+    if (mChaos.value() > 0.45) {
+        vocesGain = vocesGainTarget * ((mChaos.value() - 0.45)/ 0.25);
+    } else if (mChaos.value() > 0.7) {
         vocesGain = vocesGainTarget;
     }
     for (int i = 0; i < mVoices.size(); i++) {
         assert(bufferSize < 8192);
-        if (mVoices[i]->read(readBuffer, bufferSize) == bufferSize) {
+        if (readFrames(*mVoices[i], readBuffer, bufferSize, fileWait())) {
             float *buf = readBuffer;
             float *bufsw = swBuffer;
             float *outbuf = io.outBuffer(mVoicesRouting[i]);
@@ -329,10 +406,8 @@ void AudioApp::vocesCura(AudioIOData &io)
 
 void AudioApp::chaosSynthAudio(AudioIOData &io)
 {
-    bool consumeChaos = false;
-
-    if (mChaos > 0.6) {
-        chaosSynth[0].mTrim = 0.2 + 2. * ((mChaos - 0.6)/ 0.4);
+    if (mChaos.value() > 0.6) {
+        chaosSynth[0].mTrim = 0.2 + 2. * ((mChaos.value() - 0.6)/ 0.4);
     } else {
         chaosSynth[0].mTrim = 0.2;
     }
@@ -340,63 +415,56 @@ void AudioApp::chaosSynthAudio(AudioIOData &io)
     float rangeStart, rangeEnd;
     rangeStart = 0.4;
     rangeEnd = 0.5;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
-        std::cout << "trigger CHAOS 1" << std::endl;
-        chaosSynth[0].mPresetHandler.recallPreset("12");
+        mChaosTriggers.fetch_add(1, std::memory_order_relaxed);
+        chaosSynth[0].recallPreset("12");
         chaosSynth[0].mTrim = 0.4;
         chaosSynth[0].setOutputIndeces(rnd::uniform(47, 16),rnd::uniform(47, 16));
         chaosSynth[0].trigger(0);
-        consumeChaos = true;
-    } else if (mPrevChaos > rangeStart &&  mChaos <= rangeStart) {
-        chaosSynth[0].mPresetHandler.recallPreset("12");
+    } else if (mChaos.crossedDown(rangeStart)) {
+        chaosSynth[0].recallPreset("12");
         chaosSynth[0].mTrim = 0.4;
         chaosSynth[0].release(0);
-        consumeChaos = true;
     }
-    if (mPrevChaos > 0.65 &&  mChaos <= 0.65) { // Apagarlo cuando baja
-        chaosSynth[0].mPresetHandler.recallPreset("12");
+    if (mChaos.crossedDown(0.65)) { // Apagarlo cuando baja
+        chaosSynth[0].recallPreset("12");
         chaosSynth[0].release(0);
-        consumeChaos = true;
     }
  ///////////////////////////
     rangeStart = 0.5;
     rangeEnd = 0.7;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
-        chaosSynth[0].mPresetHandler.recallPreset(0);
+        chaosSynth[0].recallPreset(0);
         chaosSynth[0].setOutputIndeces(rnd::uniform(47, 16),rnd::uniform(47, 16));
         chaosSynth[0].trigger(0);
-        consumeChaos = true;
-    } else if (mPrevChaos > rangeStart &&  mChaos <= rangeStart) {
+    } else if (mChaos.crossedDown(rangeStart)) {
 //        chaosSynth[0].release(0);
-        consumeChaos = true;
     }
     ////////
     rangeStart = 0.6;
     rangeEnd = 0.75;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
         chaosCounter = 0;
         chaosState = 0;
-        chaosSynth[0].mPresetHandler.recallPreset(0);
+        chaosSynth[0].recallPreset(0);
         chaosSynth[0].setOutputIndeces(rnd::uniform(47, 16),rnd::uniform(47, 16));
         chaosSynth[0].trigger(0);
-        consumeChaos = true;
-    } else if (mPrevChaos > rangeStart &&  mChaos <= rangeStart) {
+    } else if (mChaos.crossedDown(rangeStart)) {
 //        chaosSynth[0].release(0);
-        consumeChaos = true;
     }
-    if (mChaos > rangeStart && mChaos < rangeEnd) {
+    if (mChaos.value() > rangeStart && mChaos.value() < rangeEnd) {
         chaosCounter++;
         if (chaosCounter > 6.0 * io.framesPerSecond()/ io.framesPerBuffer()) {
             if (chaosState == 0) {
                 if (rnd::prob(0.5)) {
-                    chaosSynth[0].mPresetHandler.setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
-                    chaosSynth[0].mPresetHandler.recallPreset(1);
+                    chaosSynth[0].setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
+                    chaosSynth[0].recallPreset(1);
                     chaosState = 1;
                     chaosCounter = 0;
                 } else {
@@ -404,8 +472,8 @@ void AudioApp::chaosSynthAudio(AudioIOData &io)
                 }
             } else if (chaosState == 1) {
                 if (rnd::prob(0.5)) {
-                    chaosSynth[0].mPresetHandler.setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
-                    chaosSynth[0].mPresetHandler.recallPreset(0);
+                    chaosSynth[0].setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
+                    chaosSynth[0].recallPreset(0);
                     chaosState = 0;
                     chaosCounter = 0;
                 } else {
@@ -419,26 +487,24 @@ void AudioApp::chaosSynthAudio(AudioIOData &io)
     /////////////////////////
     rangeStart = 0.75;
     rangeEnd = 0.99;
-    if ((mPrevChaos < rangeStart &&  mChaos >= rangeStart)
-            || (mPrevChaos > rangeEnd &&  mChaos <= rangeEnd)
+    if (mChaos.crossedUp(rangeStart)
+            || mChaos.crossedDown(rangeEnd)
             ) {
         chaosCounter = 0;
         chaosState = 0;
-        chaosSynth[0].mPresetHandler.recallPreset(0);
+        chaosSynth[0].recallPreset(0);
         chaosSynth[0].setOutputIndeces(rnd::uniform(47, 16),rnd::uniform(47, 16));
         chaosSynth[0].trigger(0);
-        consumeChaos = true;
-	} else if (mPrevChaos > rangeStart &&  mChaos <= rangeStart) {
+	} else if (mChaos.crossedDown(rangeStart)) {
 //		chaosSynth[0].release(0);
-        consumeChaos = true;
 	}
-    if (mChaos > rangeStart && mChaos < rangeEnd) {
+    if (mChaos.value() > rangeStart && mChaos.value() < rangeEnd) {
         chaosCounter++;
         if (chaosCounter > 6.0 * io.framesPerSecond()/ io.framesPerBuffer()) {
             if (chaosState == 0) {
                 if (rnd::prob(0.5)) {
-                    chaosSynth[0].mPresetHandler.setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
-                    chaosSynth[0].mPresetHandler.recallPreset(1);
+                    chaosSynth[0].setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
+                    chaosSynth[0].recallPreset(1);
                     chaosState = 1;
                     chaosCounter = 0;
                 } else {
@@ -446,8 +512,8 @@ void AudioApp::chaosSynthAudio(AudioIOData &io)
                 }
             } else if (chaosState == 1) {
                 if (rnd::prob(0.5)) {
-                    chaosSynth[0].mPresetHandler.setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
-                    chaosSynth[0].mPresetHandler.recallPreset(0);
+                    chaosSynth[0].setMorphTime(3 /*+ rnd::uniform(1.0, -1.0)*/);
+                    chaosSynth[0].recallPreset(0);
                     chaosState = 0;
                     chaosCounter = 0;
                 } else {
@@ -461,105 +527,100 @@ void AudioApp::chaosSynthAudio(AudioIOData &io)
 
     // Segundo synth caos
 
-    if (mPrevChaos < 0.8 && mChaos >= 0.8) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(63);
-        chaosSynth[1].mPresetHandler.setMorphTime(3 + rnd::uniform(1.0, -1.0));
+    if (mChaos.crossedUp(0.8)) {
+        chaosSynth[1].recallPresetSynchronous(63);
+        chaosSynth[1].setMorphTime(3 + rnd::uniform(1.0, -1.0));
         chaosSynth[1].trigger(0);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.86 && mChaos >= 0.86) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(24);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.88 && mChaos >= 0.88) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(25);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.9 && mChaos >= 0.9) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(26);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.94 && mChaos >= 0.94) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(27);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.96 && mChaos >= 0.96) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(28);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.98 && mChaos >= 0.98) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(36);
-        consumeChaos = true;
-    } else if (mPrevChaos < 0.99 && mChaos >= 0.99) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(37);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.88 && mChaos <= 0.88) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(24);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.9 && mChaos <= 0.9) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(25);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.94 && mChaos <= 0.94) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(26);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.96 && mChaos <= 0.96) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(27);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.98 && mChaos <= 0.98) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(28);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.99 && mChaos <= 0.99) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(36);
-        consumeChaos = true;
-    }
-
-    if (mPrevChaos > 0.86 && mChaos <= 0.86) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(63);
-        chaosSynth[1].mPresetHandler.setMorphTime(3 + rnd::uniform(1.0, -1.0));
+    } else if (mChaos.crossedUp(0.86)) {
+        chaosSynth[1].recallPresetSynchronous(24);
+    } else if (mChaos.crossedUp(0.88)) {
+        chaosSynth[1].recallPresetSynchronous(25);
+    } else if (mChaos.crossedUp(0.9)) {
+        chaosSynth[1].recallPresetSynchronous(26);
+    } else if (mChaos.crossedUp(0.94)) {
+        chaosSynth[1].recallPresetSynchronous(27);
+    } else if (mChaos.crossedUp(0.96)) {
+        chaosSynth[1].recallPresetSynchronous(28);
+    } else if (mChaos.crossedUp(0.98)) {
+        chaosSynth[1].recallPresetSynchronous(36);
+    } else if (mChaos.crossedUp(0.99)) {
+        chaosSynth[1].recallPresetSynchronous(37);
+    } else if (mChaos.crossedDown(0.88)) {
+        chaosSynth[1].recallPresetSynchronous(24);
+    } else if (mChaos.crossedDown(0.9)) {
+        chaosSynth[1].recallPresetSynchronous(25);
+    } else if (mChaos.crossedDown(0.94)) {
+        chaosSynth[1].recallPresetSynchronous(26);
+    } else if (mChaos.crossedDown(0.96)) {
+        chaosSynth[1].recallPresetSynchronous(27);
+    } else if (mChaos.crossedDown(0.98)) {
+        chaosSynth[1].recallPresetSynchronous(28);
+    } else if (mChaos.crossedDown(0.99)) {
+        chaosSynth[1].recallPresetSynchronous(36);
+    }
+
+    if (mChaos.crossedDown(0.86)) {
+        chaosSynth[1].recallPresetSynchronous(63);
+        chaosSynth[1].setMorphTime(3 + rnd::uniform(1.0, -1.0));
         chaosSynth[1].release(0);
-        consumeChaos = true;
     }
-    if (mPrevChaos > 0.79 && mChaos <= 0.79) {
-        chaosSynth[1].mPresetHandler.recallPresetSynchronous(63);
+    if (mChaos.crossedDown(0.79)) {
+        chaosSynth[1].recallPresetSynchronous(63);
         chaosSynth[1].release(0);
-        consumeChaos = true;
     }
     // Tercer synth caos
 
-    if (mPrevChaos < 0.9 && mChaos >= 0.9) {
-        chaosSynth[2].mPresetHandler.recallPresetSynchronous(39);
-//        chaosSynth[2].mPresetHandler.setMorphTime(3 + rnd::uniform(1.0, -1.0));
+    if (mChaos.crossedUp(0.9)) {
+        chaosSynth[2].recallPresetSynchronous(39);
+//        chaosSynth[2].setMorphTime(3 + rnd::uniform(1.0, -1.0));
         chaosSynth[2].trigger(0);
-        consumeChaos = true;
-    } else if (mPrevChaos > 0.9 && mChaos <= 0.9) {
+    } else if (mChaos.crossedDown(0.9)) {
         chaosSynth[2].release(0);
-        consumeChaos = true;
     }
 
     for (int i = 0; i < CHAOS_SYNTH_POLYPHONY; i++) {
         if (!chaosSynth[i].done()) {
             chaosSynth[i].generateAudio(io);
             io.frame(0);
+        } else {
+            chaosSynth[i].skipAudio(io);
         }
     }
-
-    if (consumeChaos) {
-        mPrevChaos = mChaos;
-    }
 }
 
 void AudioApp::onAudioCB(AudioIOData &io)
 {
+    mProfiler.beginBlock(io.framesPerBuffer(), io.framesPerSecond());
+    mChaos.beginBlock(io.framesPerBuffer(), io.framesPerSecond());
+    mMouseDown.beginBlock(io.framesPerBuffer(), io.framesPerSecond());
+    if (mMouseDown.moved()) {
+        if (mMouseDown.raw() == 0) {
+            mVocesEnv.release();
+        } else {
+            mVocesEnv.resetSoft();
+        }
+    }
     int bufferSize = io.framesPerBuffer();
     float *swBuffer = io.outBuffer(47);
 
-    basesAudio(io);
-
-    vocesCura(io);
-
-    chaosSynthAudio(io);
+    {
+        DspProfiler::Scope scope(mProfiler, mBasesStage);
+        basesAudio(io);
+    }
+    {
+        DspProfiler::Scope scope(mProfiler, mVocesStage);
+        vocesCura(io);
+    }
+    {
+        DspProfiler::Scope scope(mProfiler, mChaosSynthStage);
+        chaosSynthAudio(io);
+    }
 
 
     for (int i = 0; i < bufferSize; i++) {
         *swBuffer++ *= 0.07;
     }
 
-    msgQueue.advance(io.framesPerBuffer()/io.framesPerSecond());
-
 //    std::cout << "-------------" << std::endl;
 //    for (int i= 0; i < 60; i++) {
 //        std::cout << io.out(i, 0) << " ";
@@ -567,12 +628,20 @@ void AudioApp::onAudioCB(AudioIOData &io)
 //    std::cout << std::endl;
 
 #ifndef BUILDING_FOR_ALLOSPHERE
-    mDownMixer.process(io);
+    {
+        DspProfiler::Scope scope(mProfiler, mDownMixStage);
+        mDownMixer.process(io);
+    }
 #endif
+    mProfiler.endBlock();
 }
 
 int main(int argc, char *argv[] )
 {
+    if (argc > 3 && std::string(argv[1]) == "-render") {
+        // Same random choices in every render, also for the noise the synths seed when made
+        rnd::global().seed(1);
+    }
     AudioApp app;
 
     int outChans = 60;
@@ -584,6 +653,21 @@ int main(int argc, char *argv[] )
 
 //    AudioDevice::printAll();
     app.audioIO().print();
+    // -render <seconds> <output.wav|.raw> [timeline]: offline render, no device or OSC
+    // -record <timeline>: records the messages received, e.g. for -render
+    if (argc > 3 && std::string(argv[1]) == "-render") {
+        ControlTimeline timeline;
+        if (argc > 4 && !timeline.read(argv[4], app.audioIO().fps())) {
+            return 1;
+        }
+        app.startProfiler();
+        bool rendered = app.renderOffline(atof(argv[2]), timeline, argv[3]);
+        app.printStatus(); // DSP load of the last second
+        return rendered ? 0 : 1;
+    }
+    if (argc > 2 && std::string(argv[1]) == "-record") {
+        app.recordControls(argv[2]);
+    }
     app.init();
     app.start();
     return 0;
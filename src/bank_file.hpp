@@ -0,0 +1,132 @@
+#ifndef BANK_FILE_HPP
+#define BANK_FILE_HPP
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace al {
+
+/**
+ * @brief The compiled bank of a directory of text files, mapped in place
+ *
+ * What PresetBank and SequenceBank share: deciding whether the compiled
+ * bank is stale, and mapping it with the checks every bank header allows
+ * (magic, version, size, NUL terminated strings). The header types need
+ * magic, version and stringBytes fields, expectedMagic(), currentVersion and
+ * fileSize(). The mapping lasts as long as the BankFile.
+ */
+class BankFile {
+public:
+    // owner names the bank in messages, e.g. "PresetBank"
+    BankFile(const char *owner) : mOwner(owner) {}
+
+    ~BankFile() {
+        unmap();
+    }
+
+    BankFile(const BankFile &) = delete;
+
+    static bool hasExtension(const std::string &file, const std::string &extension) {
+        return file.size() > extension.size()
+                && file.compare(file.size() - extension.size(), extension.size(), extension) == 0;
+    }
+
+    /**
+     * @brief True if the bank is missing, or a text file was saved, renamed or removed after it
+     *
+     * isText(name) selects the text files of the directory. Renames and
+     * removals leave no newer file behind, but change the mtime of the
+     * directory.
+     */
+    template<class IsText>
+    bool textIsNewer(std::string directory, std::string bankPath, IsText isText) const {
+        struct stat bankInfo, info;
+        if (stat(bankPath.c_str(), &bankInfo) != 0) {
+            return true;
+        }
+        if (stat(directory.c_str(), &info) == 0 && info.st_mtime > bankInfo.st_mtime) {
+            std::cout << mOwner << ": " << directory << " changed after " << bankPath << ", reading text files" << std::endl;
+            return true;
+        }
+        DIR *dir = opendir(directory.c_str());
+        if (!dir) {
+            return false;
+        }
+        bool newer = false;
+        while (struct dirent *entry = readdir(dir)) {
+            std::string file = entry->d_name;
+            if (isText(file) && stat((directory + "/" + file).c_str(), &info) == 0
+                    && info.st_mtime > bankInfo.st_mtime) {
+                std::cout << mOwner << ": " << file << " is newer than " << bankPath << ", reading text files" << std::endl;
+                newer = true;
+                break;
+            }
+        }
+        closedir(dir);
+        return newer;
+    }
+
+    // Maps path if its header is valid, nullptr otherwise. The sections are the caller's to check.
+    template<class Header>
+    const Header *map(std::string path) {
+        unmap();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat info;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header)) {
+            data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        mData = data;
+        mSize = info.st_size;
+
+        const Header *header = (const Header *) data;
+        const char *bytes = (const char *) data;
+        if (std::strncmp(header->magic, Header::expectedMagic(), 8) != 0
+                || header->version != Header::currentVersion
+                || header->fileSize() != mSize
+                || header->stringBytes == 0 || bytes[mSize - 1] != '\0') {
+            reject(path);
+            return nullptr;
+        }
+        return header;
+    }
+
+    // Unmaps a bank whose sections failed the caller's checks
+    void reject(std::string path) {
+        std::cout << mOwner << ": " << path << " is not a valid compiled bank" << std::endl;
+        unmap();
+    }
+
+    bool mapped() const { return mData != nullptr; }
+
+private:
+    void unmap() {
+        if (mData) {
+            munmap(mData, mSize);
+            mData = nullptr;
+            mSize = 0;
+        }
+    }
+
+    const char *mOwner;
+    void *mData = nullptr;
+    size_t mSize = 0;
+};
+
+} // namespace al
+
+#endif // BANK_FILE_HPP
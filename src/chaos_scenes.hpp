@@ -0,0 +1,269 @@
+#ifndef CHAOS_SCENES_HPP
+#define CHAOS_SCENES_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "allocore/math/al_Random.hpp"
+
+#include "control_input.hpp"
+
+namespace al {
+
+// Notes a scene plays when it triggers, with one preset and level
+struct ScenePlay {
+    int preset = 0;
+    float level = 1;
+    std::vector<int> notes; // Played in order, or empty for random notes
+    int lowNote = 0, highNote = 0; // Random notes from low, below high
+    int count = 1;
+    int idOffset = 0; // Added to the note for the trigger and release ids
+    float minDuration = 1, maxDuration = 1;
+    bool sharedDuration = false; // Same duration for all shared notes of a trigger
+
+    int note(int i) const {
+        return notes.empty() ? int(rnd::uniform(highNote, lowNote)) : notes[i];
+    }
+    int size() const { return notes.empty() ? count : int(notes.size()); }
+};
+
+/**
+ * @brief A campanitas scene: when it is active and what it plays
+ *
+ * Scenes become active and inactive when the chaos crosses their levels.
+ * While active, every interval they play with a probability, and try again
+ * after retry seconds when they don't.
+ */
+struct ChaosScene {
+    enum Action { ENTER, JOIN, EXIT }; // JOIN enters only if not active
+
+    struct Transition {
+        bool up;
+        float level;
+        Action action;
+    };
+
+    int id = 0;
+    std::string name;
+    bool idle = false; // Only while no sequence plays
+    std::vector<Transition> transitions; // The first one crossed applies
+    float interval = 1, retry = 0, probability = 1;
+    float enterProbability = 0; // Plays when entering, else starts at enterElapsed
+    float enterElapsed = 0;
+    std::vector<ScenePlay> plays;
+};
+
+/**
+ * @brief Runs the chaos scenes of a .scenes file, once per audio block
+ *
+ * Times are converted to blocks once per block rate, the transitions of all
+ * scenes are a flat table only checked when new chaos values arrived, and
+ * only active scenes, kept as bits, count their intervals. The format is
+ * described in scenes/campanitas.scenes.
+ */
+class ChaosScenes {
+public:
+    bool load(std::string path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cout << "ChaosScenes: can't read " << path << std::endl;
+            return false;
+        }
+        std::vector<ChaosScene> scenes;
+        std::string line;
+        int lineNumber = 0;
+        bool inScene = false;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string word;
+            if (!(words >> word)) {
+                continue;
+            }
+            bool valid = true;
+            if (word == "scene" && !inScene) {
+                scenes.push_back(ChaosScene());
+                valid = bool(words >> scenes.back().id);
+                std::getline(words >> std::ws, scenes.back().name);
+                inScene = true;
+            } else if (!inScene) {
+                valid = false;
+            } else if (word == "end") {
+                inScene = false;
+            } else if (word == "idle") {
+                scenes.back().idle = true;
+            } else if (word == "up" || word == "down") {
+                ChaosScene::Transition transition {word == "up", 0, ChaosScene::ENTER};
+                std::string action;
+                valid = bool(words >> transition.level >> action);
+                if (action == "join") {
+                    transition.action = ChaosScene::JOIN;
+                } else if (action == "exit") {
+                    transition.action = ChaosScene::EXIT;
+                } else if (action != "enter") {
+                    valid = false;
+                }
+                scenes.back().transitions.push_back(transition);
+            } else if (word == "every") {
+                valid = bool(words >> scenes.back().interval >> scenes.back().retry >> scenes.back().probability);
+            } else if (word == "on_enter") {
+                valid = bool(words >> scenes.back().enterProbability >> scenes.back().enterElapsed);
+            } else if (word == "play") {
+                scenes.back().plays.push_back(ScenePlay());
+                valid = readPlay(words, scenes.back().plays.back());
+            } else {
+                valid = false;
+            }
+            if (!valid) {
+                std::cout << "ChaosScenes: " << path << ":" << lineNumber << ": can't read \"" << line << "\"" << std::endl;
+                return false;
+            }
+        }
+        if (scenes.size() > 64) {
+            std::cout << "ChaosScenes: more than 64 scenes in " << path << std::endl;
+            return false;
+        }
+        mScenes = scenes;
+        mTransitions.clear();
+        for (size_t s = 0; s < mScenes.size(); s++) {
+            for (const ChaosScene::Transition &transition: mScenes[s].transitions) {
+                mTransitions.push_back({int(s), transition});
+            }
+        }
+        mCounters.assign(mScenes.size(), 0);
+        mBlocks.assign(mScenes.size(), Blocks());
+        mBlocksPerSecond = 0;
+        mActive = 0;
+        return true;
+    }
+
+    const std::vector<ChaosScene> &scenes() const { return mScenes; }
+    bool active(size_t scene) const { return (mActive >> scene) & 1; }
+
+    void clear() { mActive = 0; }
+
+    /**
+     * @brief Applies the chaos crossings and plays the scenes due, for one block
+     *
+     * play(const ChaosScene &) is called for each scene that triggers.
+     */
+    template<class Callback>
+    void process(const ControlInput &chaos, bool idle, double blocksPerSecond, Callback play) {
+        if (blocksPerSecond != mBlocksPerSecond) {
+            compile(blocksPerSecond);
+        }
+        if (chaos.moved()) {
+            uint64_t applied = 0;
+            for (const FlatTransition &flat: mTransitions) {
+                const ChaosScene &scene = mScenes[flat.scene];
+                uint64_t bit = uint64_t(1) << flat.scene;
+                const ChaosScene::Transition &t = flat.transition;
+                bool crossed = t.up ? chaos.crossedUp(t.level) : chaos.crossedDown(t.level);
+                if ((applied & bit) || (scene.idle && !idle) || !crossed) {
+                    continue;
+                }
+                applied |= bit;
+                if (t.action == ChaosScene::EXIT) {
+                    mActive &= ~bit;
+                } else if (t.action == ChaosScene::ENTER || !(mActive & bit)) {
+                    mActive |= bit;
+                    if (rnd::prob(scene.enterProbability)) {
+                        play(scene);
+                        mCounters[flat.scene] = 0;
+                    } else {
+                        mCounters[flat.scene] = mBlocks[flat.scene].enter;
+                    }
+                }
+            }
+        }
+        for (uint64_t active = mActive; active; active &= active - 1) {
+            int s = __builtin_ctzll(active);
+            const ChaosScene &scene = mScenes[s];
+            if (scene.idle && !idle) {
+                continue;
+            }
+            if (++mCounters[s] > mBlocks[s].interval) {
+                if (rnd::prob(scene.probability)) {
+                    play(scene);
+                    mCounters[s] = 0;
+                } else {
+                    mCounters[s] = mBlocks[s].retry;
+                }
+            }
+        }
+    }
+
+private:
+    struct FlatTransition {
+        int scene;
+        ChaosScene::Transition transition;
+    };
+
+    struct Blocks {
+        double interval = 0;
+        int retry = 0, enter = 0; // Counter after a missed try and when entering
+    };
+
+    // preset=1 level=0.2 notes=50-80|36,43,50 count=5 id=-12 duration=0.3-1 shared
+    static bool readPlay(std::istream &words, ScenePlay &play) {
+        std::string word;
+        while (words >> word) {
+            size_t equals = word.find('=');
+            std::string key = word.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+            if (key == "preset") {
+                play.preset = atoi(value.c_str());
+            } else if (key == "level") {
+                play.level = atof(value.c_str());
+            } else if (key == "count") {
+                play.count = atoi(value.c_str());
+            } else if (key == "id") {
+                play.idOffset = atoi(value.c_str());
+            } else if (key == "shared") {
+                play.sharedDuration = true;
+            } else if (key == "notes" && sscanf(value.c_str(), "%d-%d", &play.lowNote, &play.highNote) == 2) {
+                play.notes.clear();
+            } else if (key == "notes") {
+                std::istringstream notes(value);
+                std::string note;
+                while (std::getline(notes, note, ',')) {
+                    play.notes.push_back(atoi(note.c_str()));
+                }
+            } else if (key == "duration") {
+                if (sscanf(value.c_str(), "%f-%f", &play.minDuration, &play.maxDuration) != 2) {
+                    play.minDuration = play.maxDuration = atof(value.c_str());
+                }
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void compile(double blocksPerSecond) {
+        for (size_t s = 0; s < mScenes.size(); s++) {
+            const ChaosScene &scene = mScenes[s];
+            mBlocks[s].interval = scene.interval * blocksPerSecond;
+            mBlocks[s].retry = int((scene.interval - scene.retry) * blocksPerSecond);
+            mBlocks[s].enter = int(scene.enterElapsed * blocksPerSecond);
+        }
+        mBlocksPerSecond = blocksPerSecond;
+    }
+
+    std::vector<ChaosScene> mScenes;
+    std::vector<FlatTransition> mTransitions; // In scene order
+    std::vector<int> mCounters; // Blocks since the last try
+    std::vector<Blocks> mBlocks;
+    double mBlocksPerSecond = 0;
+    uint64_t mActive = 0; // Bit per scene
+};
+
+} // namespace al
+
+#endif // CHAOS_SCENES_HPP
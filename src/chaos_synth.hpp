@@ -16,6 +16,9 @@
 #include "allocore/math/al_Random.hpp"
 #include "allocore/io/al_AudioIOData.hpp"
 
+#include "preset_bank.hpp"
+#include "preset_morph.hpp"
+
 using namespace al;
 using namespace std;
 
@@ -35,7 +38,19 @@ public:
         mPresetHandler << noiseRnd;
         mPresetHandler << changeProb << changeDev;
 
+        // Same order as the preset handler, see the Morph enum
+        mMorph.add(mLevel);
+        mMorph.add(envFreq1);
+        mMorph.add(envFreq2);
+        mMorph.add(phsrFreq1, PresetMorph::EXPONENTIAL);
+        mMorph.add(phsrFreq2, PresetMorph::EXPONENTIAL);
+        mMorph.add(noiseRnd, PresetMorph::EXPONENTIAL);
+        mMorph.add(changeProb);
+        mMorph.add(changeDev);
+        mPresetBank = PresetBank::get("chaosPresets", mMorph.parameters());
+
         connectCallbacks();
+        mNoise.seed(rnd::uniform(0x7fffffff, 1)); // Not from the clock, so renders repeat
 
 //        mEnv.sustainPoint(1);
 
@@ -66,9 +81,9 @@ public:
 		if (bassChannel < 0) {
 			bassChannel += 60;
 		}
-		while (mNoiseChannel == 47
-		       || mNoiseChannel == 12 || mNoiseChannel == 13 || mNoiseChannel == 14 || mNoiseChannel == 15
-		       || mNoiseChannel == 46
+		while (bassChannel == 47
+		       || bassChannel == 12 || bassChannel == 13 || bassChannel == 14 || bassChannel == 15
+		       || bassChannel == 46
 		       ) {
 			bassChannel += rnd::uniform(-10, 10);
 			bassChannel %= 60;
@@ -83,9 +98,9 @@ public:
 		if (noiseChannel < 0) {
 			noiseChannel += 60;
 		}
-		while (mNoiseChannel == 47
-		       || mNoiseChannel == 12 || mNoiseChannel == 13 || mNoiseChannel == 14 || mNoiseChannel == 15
-		       || mNoiseChannel == 46
+		while (noiseChannel == 47
+		       || noiseChannel == 12 || noiseChannel == 13 || noiseChannel == 14 || noiseChannel == 15
+		       || noiseChannel == 46
 		       ) {
 			noiseChannel += rnd::uniform(-8, 8);
 			noiseChannel %= 60;
@@ -100,6 +115,26 @@ public:
         mEnv.release();
     }
 
+    // Preset recall on the audio thread, from the bank in chaosPresets. Like
+    // PresetHandler's, recallPreset() morphs over the morph time, but the
+    // morph is stepped per sample in generateAudio() instead of on a thread.
+    void setMorphTime(float seconds) {
+        mMorphTime = seconds;
+    }
+
+    const std::string &recallPreset(int index) {
+        return recall(mPresetBank->preset(index), mMorphTime);
+    }
+
+    const std::string &recallPreset(const std::string &name) {
+        return recall(mPresetBank->preset(name), mMorphTime);
+    }
+
+    // Jumps to the preset, smoothed over a few milliseconds
+    const std::string &recallPresetSynchronous(int index) {
+        return recall(mPresetBank->preset(index), 0);
+    }
+
 	float mTrim = 1.0;
 
     // Presets
@@ -147,18 +182,25 @@ public:
     void generateAudio(AudioIOData &io) {
         float noise;
         float max = 0.0;
+        mMorph.beginBlock(io.framesPerSecond());
         while (io()) {
+            if (mMorph.step()) {
+                applyMorph();
+            }
             float outL, outR;
             float env = al::clip((mEnvOsc1() + mEnvOsc2()), 0.0, 1.0);
             // basstone |
 			float outerenv = mEnv();
             float basstone = (env * 0.5) * (mOsc1() + mOsc2()) * outerenv;
 
-			if (rnd::prob(changeProb.get()/1000.0)) {
-	            freqDev1 = phsrFreq1 * changeDev.get() * 0.01 * rnd::uniform(1.0, -1.0);
-	            freqDev2 = phsrFreq2 * changeDev.get() * 0.01 * rnd::uniform(1.0, -1.0);
-	            mOsc1.freq(phsrFreq1 + freqDev1);
-	            mOsc2.freq(phsrFreq2 + freqDev2);
+			if (rnd::prob(mMorph.value(MORPH_CHANGE_PROB)/1000.0)) {
+	            float freq1 = mMorph.value(MORPH_PHSR_FREQ1);
+	            float freq2 = mMorph.value(MORPH_PHSR_FREQ2);
+	            float dev = mMorph.value(MORPH_CHANGE_DEV);
+	            freqDev1 = freq1 * dev * 0.01 * rnd::uniform(1.0, -1.0);
+	            freqDev2 = freq2 * dev * 0.01 * rnd::uniform(1.0, -1.0);
+	            mOsc1.freq(freq1 + freqDev1);
+	            mOsc2.freq(freq2 + freqDev2);
 	        }
 			float revOutL, revOutR;
 			if(mSilenceDetect(basstone)) {
@@ -181,8 +223,9 @@ public:
 //            mReverb(basstone, revOutL, revOutR);
 //			outL = mDCBlockL(revOutL);
 //            outR = mDCBlockR(revOutR);
-			outL = outL * mLevel * 0.05;
-			outR = outR * mLevel * 0.05;
+			float level = mMorph.value(MORPH_LEVEL); // Per sample, mLevel only moves at endBlock()
+			outL = outL * level * 0.05;
+			outR = outR * level * 0.05;
 			if (mOsc1.freq() > 0.001 && mOsc2.freq() > 0.001) {
 //				io.out(mOutputChannels[0]) = outL * 0.8;
 //				io.out(mOutputChannels[1]) = outR * 0.8;
@@ -228,7 +271,17 @@ public:
 			io.out(47) += (/*revOutR + revOutL +*/ noiseOut) * 0.07 * mTrim;
 
         }
+        mMorph.endBlock();
+    }
 
+    // Keeps morphs going for a block while the synth is silent
+    void skipAudio(AudioIOData &io) {
+        mMorph.beginBlock(io.framesPerSecond());
+        if (mMorph.active()) {
+            mMorph.skip(io.framesPerBuffer());
+            applyMorph();
+            mMorph.endBlock();
+        }
     }
 
     void resetNoisy()  {
@@ -273,6 +326,37 @@ public:
     }
 
 private:
+    enum Morph {
+        MORPH_LEVEL,
+        MORPH_ENV_FREQ1,
+        MORPH_ENV_FREQ2,
+        MORPH_PHSR_FREQ1,
+        MORPH_PHSR_FREQ2,
+        MORPH_NOISE_RND,
+        MORPH_CHANGE_PROB,
+        MORPH_CHANGE_DEV
+    };
+
+    const std::string &recall(const PresetBank::Preset *preset, float seconds) {
+        static const std::string none;
+        return mMorph.morph(*mPresetBank, preset, seconds) ? preset->name : none;
+    }
+
+    // What the change callbacks do, for the morphing values
+    void applyMorph() {
+        float freq1 = mMorph.value(MORPH_PHSR_FREQ1);
+        float freq2 = mMorph.value(MORPH_PHSR_FREQ2);
+        if (freq1 != 0) {
+            mOsc1.freq(freq1 + freqDev1);
+        }
+        if (freq2 != 0) {
+            mOsc2.freq(freq2 + freqDev2);
+        }
+        mEnvOsc1.freq(mMorph.value(MORPH_ENV_FREQ1));
+        mEnvOsc2.freq(mMorph.value(MORPH_ENV_FREQ2));
+        mTrigger.freq(mMorph.value(MORPH_NOISE_RND));
+    }
+
     void connectCallbacks() {
         phsrFreq1.registerChangeCallback([] (float value, void *sender,
                                          void *userData, void * blockSender){
@@ -307,6 +391,10 @@ private:
     vector<int> mOutputChannels {18, 28, 21, 26};
 
     int mId = 0;
+
+    PresetMorph mMorph;
+    std::shared_ptr<const PresetBank> mPresetBank;
+    float mMorphTime = 0;
 };
 
 
@@ -174,33 +174,20 @@ typedef struct {
 
 // -------------- Painter
 #include "render_tree.hpp"
+#include "grid_renderer.hpp"
+#include "asset_loader.hpp"
+#include "quad_batch.hpp"
+#include "visibility_culler.hpp"
+#include "water_surface.hpp"
+#include "streaming_buffer.hpp"
 
 class Sink2 : public Behavior {
-    friend class RenderModule;
 public:
-	Sink2(unsigned long numTicks, float zDelta) : Behavior() {
-        mNumTicks = numTicks;
-        mDelta = zDelta/numTicks;
-    }
-
-    virtual void init() override {
-        mTargetTicks = mModule->getTicks() + mNumTicks;
-    }
-
-    virtual void tick() override {
-        if (mModule->getTicks() < mTargetTicks) {
-            Vec3f pos = mModule->getPosition();
-            pos.y -= mDelta;
-            mModule->setPosition(pos);
-		} else {
-			mDone = true;
-		}
-    }
-
-private:
-    unsigned long mTargetTicks;
-    unsigned long mNumTicks;
-    float mDelta;
+	Sink2(unsigned long numTicks, float zDelta) {
+		type = POSITION_RAMP;
+		this->numTicks = numTicks;
+		delta = Vec3f(0, -zDelta, 0);
+	}
 };
 
 class SharedPainter : osc::PacketHandler {
@@ -210,21 +197,22 @@ public:
 	Material mGoldMaterial;		// Necessary for specular highlights
     Material mOfrendaMaterial;
 
-    Mesh waterMesh;
+    WaterSurface mWater {Nx, Ny};
+    StreamingHeightField mWaterStream;
+    int mWaterHeightAttribute = -2; // Looked up on the first frame, -1 if the shader has none
 
-    vector<Mesh> mGrid;
-	vector<Mesh> mGridVertical;
-	vector<Mesh> mGridHorizontal;
+    GridRenderer mGrid;
 
     Mesh mInteractionLine;
-    Mesh mQuad;
-
-    Image imagesOfrendas[NUM_OFRENDAS];
-    Texture textureOfrendas[NUM_OFRENDAS];
-	std::vector<float> ofrendaAspects;
+    // Ofrendas and casas are each packed into one atlas and drawn as one batch
+    TextureAssets mImages {"Fotos/textures.cache"};
+    int mOfrendaImages[NUM_OFRENDAS];
+	int mCasasImages[NUM_CASAS];
+    QuadBatch mOfrendaQuads;
+    QuadBatch mCasasQuads;
 
-	Image imagesCasas[NUM_CASAS];
-    Texture textureCasas[NUM_CASAS];
+    // Leaves out grid nodes and images outside this node's projections
+    VisibilityCuller mCuller;
 
 	RenderTree mRenderTree;
 	RenderTreeHandler mRenderTreeHandler {mRenderTree};
@@ -251,17 +239,6 @@ public:
         mState = state;
         mShader = shader;
 
-        mGrid.resize(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ);
-		mGridVertical.resize(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ);
-		mGridHorizontal.resize(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ);
-
-        // Add a tessellated plane
-        addSurface(waterMesh, Nx,Ny);
-        // fill color array
-        for (int i = 0; i < waterMesh.vertices().size(); i += 1) {
-            waterMesh.color(1, 1, 1, 1);
-        }
-
         // required: (a > b) && (a != b)
         auto smoothstep = [] (float a, float b, float x) -> float {
             if (x < a) x = a;
@@ -278,36 +255,51 @@ public:
                 float x = (i - waterMeshHalfWidth) / waterMeshHalfWidth; // [0:1]
                 float r = sqrt(x * x + y * y); // [0:sqrt(2)]
                 r = smoothstep(0.4, 0.8, r);
-                waterMesh.colors()[j*Nx + i] = Color(1-r, 1-r, 1-r, 1-r);
+                mWater.colors()[j*Nx + i] = Color(1-r, 1-r, 1-r, 1-r);
             }
         }
 
 
-		for (Mesh &m: mGrid) {
-//			addCylinder(m, 0.01, 1);
-			addSphere(m, 0.09);
-			m.generateNormals();
-			int cylinderVertices = m.vertices().size();
-			for(int i = 0; i < cylinderVertices; i++) {
-				m.color(HSV(0.16, 0.5, al::fold(0.5/(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ), 0.5)+0.5));
-			}
-		}
-		for (Mesh &m: mGridVertical) {
-			addCylinder(m, 0.02, 1, 24);
-			m.generateNormals();
-			int cylinderVertices = m.vertices().size();
-			for(int i = 0; i < cylinderVertices; i++) {
-				m.color(HSV(0.13, 0.5, al::fold(0.5/(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ), 0.5)+0.5));
-			}
+		// Start decoding images now, so they are ready by the first frames
+        vector<string> ofrendaImageFiles =
+        {"Fotos/MO_01alpha.png",
+		 "Fotos/MO_02alpha.png",
+		 "Fotos/MO_03alpha.png",
+		 "Fotos/MO_04alpha.png",
+          "Fotos/MO_05alpha.png",
+//         "Fotos/MO_06.png "
+		 "Fotos/MO_07alpha.png",
+		 "Fotos/MO_08alpha.png",
+		 "Fotos/MO_09alpha.png",
+		 "Fotos/MO_10alpha.png",
+		 "Fotos/MO_11alpha.png",
+		 "Fotos/MO_12_poporo_alpha.png",
+		 "Fotos/MO_13alpha.png",
+		 "Fotos/MO_14alpha.png",
+		 "Fotos/MO_15alpha.png",
+		 "Fotos/MO_16alpha.png",
+		 "Fotos/MO_17alpha.png"
+ };
+		std::vector<std::string> mFotos = {
+		    "Fotos/5623_155776159.jpg",
+		    "Fotos/casas1.jpg",
+		    "Fotos/casas5.jpg",
+		    "Fotos/destruction-of-the-indies.jpg",
+		    "Fotos/dsc01195.jpg",
+		    "Fotos/Narratio_Regionum_indicarum_per_Hispanos_Quosdam_devastatarum_verissima_Theodore_de_Bry.jpg"
+		};
+		int ofrendaAtlas = mImages.atlas("ofrendas");
+		for (int i = 0; i < NUM_OFRENDAS; i++) {
+			mOfrendaImages[i] = mImages.add(ofrendaImageFiles[i], ofrendaAtlas);
 		}
-		for (Mesh &m: mGridHorizontal) {
-			addCylinder(m, 0.01, 1, 24);
-			m.generateNormals();
-			int cylinderVertices = m.vertices().size();
-			for(int i = 0; i < cylinderVertices; i++) {
-				m.color(HSV(0.14, 0.5, al::fold(0.5/(GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ), 0.5)+0.5));
-			}
+		int casasAtlas = mImages.atlas("casas");
+		for (int i = 0; i < NUM_CASAS; i++) {
+			mCasasImages[i] = mImages.add(mFotos[i], casasAtlas);
 		}
+		mImages.start();
+
+		mOfrendaQuads.culler(&mCuller);
+		mCasasQuads.culler(&mCuller);
 
 		// Initialize OSC server
 		mRecvFromSimulator.handler(*this);
@@ -332,99 +324,133 @@ public:
 	}
 
     void onInit() {
+		// Sizes used by showBitcoinReport() and addBitcoinMarker()
+		FontCache::get().preload(TextRenderModule::defaultFontPath(), 18);
+		FontCache::get().preload(TextRenderModule::defaultFontPath(), 24);
 
-		ofrendaAspects = {
-		    741.0	/683.0,
-		    921.0	/716.0,
-		    654.0	/598.0,
-		    556.0	/596.0,
-		    557.0	/608.0,
-//			473.0	/512.0,
-		    559.0	/661.0,
-		    454.0	/496.0,
-		    1050.0/395.0,
-		    386	/673,
-		    530	/481,
-		    330.0/571.0,
-		    454.0	/689.0,
-		    299.0	/510.0,
-		    625.0	/659.0,
-		    736.0	/454.0,
-		    945.0	/485.0
-		};
+        for (int i = 0; i < NUM_OFRENDAS; i++) {
+            SharedPainter::state().ofrendas[i] = false;
+        }
+    }
 
-        vector<string> ofrendaImageFiles =
-        {"Fotos/MO_01alpha.png",
-		 "Fotos/MO_02alpha.png",
-		 "Fotos/MO_03alpha.png",
-		 "Fotos/MO_04alpha.png",
-          "Fotos/MO_05alpha.png",
-//         "Fotos/MO_06.png "
-		 "Fotos/MO_07alpha.png",
-		 "Fotos/MO_08alpha.png",
-		 "Fotos/MO_09alpha.png",
-		 "Fotos/MO_10alpha.png",
-		 "Fotos/MO_11alpha.png",
-		 "Fotos/MO_12_poporo_alpha.png",
-		 "Fotos/MO_13alpha.png",
-		 "Fotos/MO_14alpha.png",
-		 "Fotos/MO_15alpha.png",
-		 "Fotos/MO_16alpha.png",
-		 "Fotos/MO_17alpha.png"
- };
+	// Per frame CPU work, once per frame rather than once per eye and projection
+	void onAnimate(const Pose &viewer = Pose()) {
+		mCuller.viewer(viewer);
+		float waterTransform[16];
+		waterMatrix(waterTransform);
+		mWater.update(waterTransform, Vec3f(viewer.pos()));
+		if (mWaterHeightAttribute == -2) {
+			mWaterHeightAttribute = shader().id() ? glGetAttribLocation(shader().id(), "waterHeight") : -1;
+		}
+		if (mWaterHeightAttribute >= 0) {
+			mWaterStream.update(mWater.mesh(), mWater.revision());
+		}
+		mGrid.update(state().dev, state().chaos, &mCuller, gridOffset(), 2.0f);
+		// Images not uploaded yet are skipped when drawing
+		mImages.upload();
+		mRenderTree.tick();
+		updateImageQuads();
+	}
 
+	float waterScale() {
+		float scale = 4.5;
+		if (state().chaos > 0.6) {
+			scale += 3.0 * (state().chaos - 0.6) * 0.4;
+		}
+		return scale;
+	}
 
-        int counter = 0;
-        for (string filename: ofrendaImageFiles) {
-            if (imagesOfrendas[counter].load(filename)) {
-                cout << "Read image from " << filename << "  " << imagesOfrendas[counter].format() << endl;
-//                printf("Read image from %s\n", filename);
-                textureOfrendas[counter].allocate(imagesOfrendas[counter].array());
-                textureOfrendas[counter].submit();
-                SharedPainter::state().ofrendas[counter] = false;
-            } else {
-//                printf("Failed to read image from %s!  Quitting.\n", filename);
-                exit(-1);
-            }
-            counter++;
-        }
+	// The transform the water is drawn with in onDraw(), column major
+	void waterMatrix(float *m) {
+		float scale = waterScale();
+		float transform[16] = {1.4f * scale, 0, 0, 0,
+		                       0, 0, 1.4f * scale, 0,      // rotate(90, 1, 0, 0)
+		                       0, -0.4f * scale, 0, 0,
+		                       0, float(LAGOON_Y - state().chaos * 2.0), -3.0f, 1};
+		std::copy(transform, transform + 16, m);
+	}
 
-        mQuad.reset();
-        mQuad.primitive(Graphics::TRIANGLE_STRIP);
-        mQuad.vertex(-1, -1, 0);
-        mQuad.texCoord(0, 0);
-        mQuad.vertex( 1, -1,0);
-        mQuad.texCoord(1, 0);
-        mQuad.vertex(-1,  1, 0);
-        mQuad.texCoord(0, 1);
-        mQuad.vertex( 1,  1, 0);
-        mQuad.texCoord(1, 1);
+	// Translation of the grid before its scale of 2 in onDraw()
+	Vec3f gridOffset() {
+		float wobble = 0.1 + sin(state().casasPhase*0.015);
+		float wobble2 = 0.1 + sin(state().casasPhase*0.012);
+		return Vec3f(wobble2 - GRID_SIZEX/2,- GRID_SIZEY/1.6, -4.0 + wobble);
+	}
 
+	// Width over height of the ofrenda image
+	float ofrendaAspect(int i) {
+		int height = mImages.height(mOfrendaImages[i]);
+		return height > 0 ? mImages.width(mOfrendaImages[i]) / (float) height : 1.0f;
+	}
 
-		std::vector<std::string> mFotos = {
-		    "Fotos/5623_155776159.jpg",
-		    "Fotos/casas1.jpg",
-		    "Fotos/casas5.jpg",
-		    "Fotos/destruction-of-the-indies.jpg",
-		    "Fotos/dsc01195.jpg",
-		    "Fotos/Narratio_Regionum_indicarum_per_Hispanos_Quosdam_devastatarum_verissima_Theodore_de_Bry.jpg"
-		};
+	// Builds the ofrenda and casas quads drawn by onDraw()
+	void updateImageQuads() {
+		float chaos = state().chaos;
+		float uv[4];
+
+		mOfrendaQuads.clear();
+		for (unsigned int i = 0; i < NUM_OFRENDAS; i++) {
+			if (state().ofrendas[i] && mImages.ready(mOfrendaImages[i])) {
+				mOfrendaQuads.pushMatrix();
+
+				Vec4f posOfrenda = state().posOfrendas[i];
+				mOfrendaQuads.translate(posOfrenda[0], posOfrenda[1], posOfrenda[2] );
+				mOfrendaQuads.rotate(posOfrenda[3], 0, 0, 1);
+
+				mOfrendaQuads.scale(ofrendaAspect(i), 1.0, 1.0);
+				mOfrendaQuads.scale(0.3);
+				mImages.uvs(mOfrendaImages[i], uv);
+				mOfrendaQuads.quad(uv);
 
-		counter = 0;
-		for (string filename: mFotos) {
-			if (imagesCasas[counter].load(filename)) {
-				cout << "Read image from " << filename << "  " << imagesOfrendas[counter].format() << endl;
-				//                printf("Read image from %s\n", filename);
-				textureCasas[counter].allocate(imagesCasas[counter].array());
-				textureCasas[counter].submit();
-			} else {
-				//                printf("Failed to read image from %s!  Quitting.\n", filename);
-				exit(-1);
+				mOfrendaQuads.popMatrix();
 			}
-			counter++;
 		}
 
-    }
+		float casasIndex = chaos;
+		float *dev = state().dev;
+		mCasasQuads.clear();
+		mCasasQuads.rotate(180, 0, 1, 0);
+
+		/// Casas Atras
+		for (unsigned int i = 0; i < NUM_CASAS; i++) {
+			bool ready = mImages.ready(mCasasImages[i]);
+			mImages.uvs(mCasasImages[i], uv);
+			for (int j = 0; j < 2; j++) {
+				mCasasQuads.pushMatrix();
+				mCasasQuads.rotate(i*30 + j *180, 0, 0.1, 1);
+
+				mCasasQuads.translate(0.35 + chaos * 2, 0, -2 - 0.01 * i);
+				float dev1 = *dev++;
+				float dev2 = *dev++;
+				mCasasQuads.translate(dev1* 0.04, 0, dev2* 0.1);
+
+				mCasasQuads.rotate(state().casasPhase, 0.64, 0.12, 0.1);
+				mCasasQuads.scale(0.2 + casasIndex* 0.6);
+				if (ready) {
+					mCasasQuads.quad(uv);
+				}
+				mCasasQuads.popMatrix();
+			}
+
+			for (int j = 0; j < 3; j++) {
+				mCasasQuads.pushMatrix();
+				float dev1 = *dev++;
+				float dev2 = *dev++;
+				mCasasQuads.translate(dev1* 0.1, dev2* 0.2, 0);
+				mCasasQuads.rotate(i*20 + j *140, 0.05, 0.1, 1);
+				mCasasQuads.translate(-0.1 + chaos* 1.2, 0, -2 + 0.01 * i);
+
+				mCasasQuads.rotate(i*20 + j *140,-1);
+
+				mCasasQuads.rotate(state().casasPhase* 1.2124, 0.1, 0.22, 0.2);
+				mCasasQuads.scale(casasIndex* 0.7  + 0.05);
+				if (ready) {
+					mCasasQuads.quad(uv);
+				}
+				mCasasQuads.popMatrix();
+			}
+		}
+	}
 
 	void setTreeMaster() {
 		int port = GRAPHICS_SLAVE_PORT;
@@ -536,47 +562,13 @@ public:
 			fogEnd = 30;
 		}
 
-		float wobble = 0.1 + sin(state().casasPhase*0.015);
-		float wobble2 = 0.1 + sin(state().casasPhase*0.012);
-
         g.fog(fogEnd, fogStart, Color(0,0,0, 0.2));
         shader().uniform("tint", Color{1, 1- chaos, 0}); // put in color here
 
 		g.pushMatrix();
 		g.scale(2);
-		g.translate(wobble2 - GRID_SIZEX/2,- GRID_SIZEY/1.6, -4.0 + wobble);
-		unsigned int count = 0;
-		float *dev = state().dev;
-		float prevdev = 0;
-		for (int x = 0; x < GRID_SIZEX; x++) {
-			g.pushMatrix();
-			g.translate(x, 0, -*dev/2);
-			for (int y = 0; y < GRID_SIZEY; y++) {
-				g.pushMatrix();
-				g.translate(0, y-*dev/2, 0);
-				for (int z = 0; z < GRID_SIZEZ; z++) {
-					g.pushMatrix();
-					g.translate(*dev/-2.0f, 0.0f + prevdev * 2.0, -z + *dev);
-					g.draw(mGrid[count]);
-					g.pushMatrix();
-					g.rotate(90, 0, 1, *dev* chaos );
-					g.translate(0, *dev, 0);
-					g.draw(mGridVertical[count]);
-					g.popMatrix();
-					g.pushMatrix();
-					g.rotate(90,1, 0, 0);
-					g.translate(*dev, *dev - chaos, 0);
-					g.draw(mGridHorizontal[count]);
-					g.popMatrix();
-					g.popMatrix();
-					prevdev = *dev;
-                    dev++;
-					count++;
-				}
-				g.popMatrix();
-			}
-			g.popMatrix();
-		}
+		g.translate(gridOffset());
+		g.draw(mGrid.mesh());
 		g.popMatrix();
 
 //        // Interaction line
@@ -593,13 +585,14 @@ public:
         g.pushMatrix();
         g.translate(0, LAGOON_Y - chaos * 2.0, -3.0);
         g.rotate(90, 1, 0, 0);
-        float waterScale = 4.5;
-        if (chaos > 0.6) {
-			waterScale += 3.0 * (chaos - 0.6) * 0.4;
-        }
+        float waterScale = this->waterScale();
         g.scale(1.4 * waterScale, 1.4 * waterScale, 0.4 * waterScale);
         shader().uniform("tint", Color{1, 1- chaos, 0}); // put in color here
-        g.draw(waterMesh);
+        if (mWaterHeightAttribute >= 0) {
+            mWaterStream.draw(mWaterHeightAttribute);
+        } else {
+            g.draw(mWater.mesh());
+        }
         g.popMatrix();
         shader().uniform("tint", Color{1, 1, 1});
 
@@ -608,22 +601,11 @@ public:
         shader().uniform("lighting", 0.0);
         shader().uniform("texture", 1.0);
         shader().uniform("enableFog", 0);
-        for (unsigned int i = 0; i < NUM_OFRENDAS; i++) {
-            if (state().ofrendas[i]) {
-                g.pushMatrix();
-
-                Vec4f posOfrenda = state().posOfrendas[i];
-                g.translate(posOfrenda[0], posOfrenda[1], posOfrenda[2] );
-                g.rotate(posOfrenda[3], 0, 0, 1);
-
-				g.scale(ofrendaAspects[i], 1.0, 1.0);
-                g.scale(0.3);
-                textureOfrendas[i].bind(0);
-                g.draw(mQuad);
-                textureOfrendas[i].unbind();
-
-                g.popMatrix();
-            }
+        if (!mOfrendaQuads.empty()) {
+            Texture &texture = mImages.texture(mOfrendaImages[0]);
+            texture.bind(0);
+            g.draw(mOfrendaQuads.mesh());
+            texture.unbind();
         }
 
 //		g.lighting(true);
@@ -637,66 +619,12 @@ public:
 			g.color(casasIndex* 0.2, 0.0, 0.0, 0.3);
 			shader().uniform("texture", casasIndex/3);
 		}
-		dev = state().dev;
-
-		g.pushMatrix();
-		g.rotate(180, 0, 1, 0);
-
-		/// Casas Atras
-		for (unsigned int i = 0; i < NUM_CASAS; i++) {
-			if (true) {
-				textureCasas[i].bind(0);
-				for (int j = 0; j < 2; j++) {
-					g.pushMatrix();
-					g.rotate(i*30 + j *180, 0, 0.1, 1);
-
-					g.translate(0.35 + chaos * 2, 0, -2 - 0.01 * i);
-					float dev1 = *dev++;
-					float dev2 = *dev++;
-					g.translate(dev1* 0.04, 0, dev2* 0.1);
-
-//					g.rotate(10, 0.3, 0.12, 0.0);
-
-//					g.translate(0, *dev* 0.15, 0);
-					g.rotate(state().casasPhase, 0.64, 0.12, 0.1);
-					//                Vec4f posOfrenda = state().posOfrendas[i];
-					//				Vec4f posOfrenda = state().posOfrendas[i];
-					//                g.rotate(posOfrenda[3], 0, 0, 1);
-
-					//				g.rotate(i*20, 0, 0, 1);
-					g.scale(0.2 + casasIndex* 0.6);
-					g.draw(mQuad);
-					g.popMatrix();
-				}
-
-				for (int j = 0; j < 3; j++) {
-					g.pushMatrix();
-					float dev1 = *dev++;
-					float dev2 = *dev++;
-					g.translate(dev1* 0.1, dev2* 0.2, 0);
-					g.rotate(i*20 + j *140, 0.05, 0.1, 1);
-					g.translate(-0.1 + chaos* 1.2, 0, -2 + 0.01 * i);
-
-					g.rotate(i*20 + j *140,-1);
-
-//					g.rotate((1-casasIndex)*2, 0.1, 0.6, 0.0);
-
-//					g.translate(*dev* 0.05, *dev* 0.15, 0);
-					g.rotate(state().casasPhase* 1.2124, 0.1, 0.22, 0.2);
-					//                Vec4f posOfrenda = state().posOfrendas[i];
-					//				Vec4f posOfrenda = state().posOfrendas[i];
-					//                g.rotate(posOfrenda[3], 0, 0, 1);
-
-					//				g.rotate(i*20, 0, 0, 1);
-					g.scale(casasIndex* 0.7  + 0.05);
-					g.draw(mQuad);
-					g.popMatrix();
-				}
-				textureCasas[i].unbind();
-//				dev++;
-            }
-        }
-		g.popMatrix();
+		if (!mCasasQuads.empty()) {
+			Texture &texture = mImages.texture(mCasasImages[0]);
+			texture.bind(0);
+			g.draw(mCasasQuads.mesh());
+			texture.unbind();
+		}
 
 		if (mPreviousChaos > 0.3 && chaos <= 0.3) {
             mRenderTree.clear();
@@ -739,8 +667,8 @@ public:
 		float randPosX = rnd::gaussian() * 1.2;
         module->setPosition(Vec3d(randPosX, -0.4, -1));
 
-        module->addBehavior(std::make_shared<Sink2>(5* fps, -0.08));
-        module->addBehavior(std::make_shared<FadeOut>(6* fps,3* fps));
+        module->addBehavior(Sink2(5* fps, -0.08));
+        module->addBehavior(FadeOut(6* fps,3* fps));
 
         auto module2 = mRenderTree.createModule<TextRenderModule>();
         module2->setFontSize(18);
@@ -751,15 +679,15 @@ public:
             module2->setText("Not a Bitcoin");
         }
         module2->setPosition(Vec3d(randPosX, -0.41, -1));
-//                    module2->addBehavior(std::make_shared<FadeIn>(2* fps));
-        module2->addBehavior(std::make_shared<Sink2>(4* fps, 0.08));
-        module2->addBehavior(std::make_shared<FadeOut>(4* fps,5* fps));
+//                    module2->addBehavior(FadeIn(2* fps));
+        module2->addBehavior(Sink2(4* fps, 0.08));
+        module2->addBehavior(FadeOut(4* fps,5* fps));
 
 //        auto lineStrip = mRenderTree.createModule<LineStripModule>();
 //        for (int i = 0; i < 32; i++) {
 //            lineStrip->addVertex(mPairHash.mHashX[i] * window(0).width()/2, mPairHash.mHashY[i] * window(0).height()/2, 0.1);
 //        }
-//        lineStrip->addBehavior(std::make_shared<FadeOut>(7* fps,3* fps));
+//        lineStrip->addBehavior(FadeOut(7* fps,3* fps));
 
 		std::shared_ptr<LineStripModule> lineStrip = mRenderTree.createModule<LineStripModule>();
 		lineStrip->setColor(Color(0.2, 0.6, 0.6, 0.5));
@@ -770,14 +698,14 @@ public:
 			Vec3f pos = bcHex->getPosition();
 			if (pos.z < 0 ) {
 				lineStrip->addVertex(pos.x, pos.y, pos.z-0.3);
-				//			bcHex->addBehavior(std::make_shared<Timeout>(10 * fps));
+				//			bcHex->addBehavior(Timeout(10 * fps));
 				//			std::cout << pos.x << " _ " << pos.z << std::endl;
 				bcHex->clearBehaviors();
-				bcHex->addBehavior(std::make_shared<FadeOut>(4* fps,6* fps));
+				bcHex->addBehavior(FadeOut(4* fps,6* fps));
 			}
 		}
-//		lineStrip->addBehavior(std::make_shared<Timeout>(10 * fps));
-		lineStrip->addBehavior(std::make_shared<FadeOut>(4* fps,6* fps));
+//		lineStrip->addBehavior(Timeout(10 * fps));
+		lineStrip->addBehavior(FadeOut(4* fps,6* fps));
 		mBitcoinHexes.clear();
     }
 
@@ -788,8 +716,8 @@ public:
         module->setScale(1.0);
         module->setText(text);
 		module->setPosition(Vec3d(2 * (x - 0.5), LAGOON_Y - 1, (y * -3.5) - 1.5));
-        module->addBehavior(std::make_shared<Sink2>(10* fps, 3.0 + rnd::gaussian()*0.5));
-        module->addBehavior(std::make_shared<FadeOut>(6* fps,15* fps));
+        module->addBehavior(Sink2(10* fps, 3.0 + rnd::gaussian()*0.5));
+        module->addBehavior(FadeOut(6* fps,15* fps));
 		mBitcoinHexes.push_back(module);
     }
 };
@@ -798,6 +726,9 @@ static const char* vertexShader = R"(
 uniform float fogCurve;
 uniform int enableFog;
 
+/* Height of streamed height fields, 0 for everything else */
+attribute float waterHeight;
+
 /* The fog amount in [0,1] passed to the fragment shader. */
 varying float fogFactor;
 varying vec4 color;
@@ -805,7 +736,7 @@ varying vec3 normal, lightDir, eyeVec;
 
 void main() {
     color = gl_Color;
-    vec4 vertex = gl_ModelViewMatrix * gl_Vertex;
+    vec4 vertex = gl_ModelViewMatrix * (gl_Vertex + vec4(0.0, 0.0, waterHeight, 0.0));
     normal = gl_NormalMatrix * gl_Normal;
     vec3 V = vertex.xyz;
     eyeVec = normalize(-V);
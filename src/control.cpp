@@ -28,6 +28,10 @@ Lance Putnam, Oct. 2014
 
 #include "common.hpp"
 #include "render_tree.hpp"
+#include "frame_profiler.hpp"
+
+#include <map>
+#include <mutex>
 using namespace al;
 
 
@@ -53,6 +57,7 @@ public:
         mOSCReceiver.handler(*this);
         mOSCReceiver.timeout(0.005);
         mOSCReceiver.start();
+        mProfiler.startCollector(nullptr);
 	}
 
     void reset() {
@@ -93,8 +98,8 @@ public:
         module->setText(hash);
         module->setPosition(Vec3d(-0.48, 0.45, 0.079990));
 
-        module->addBehavior(std::make_shared<Sink>(5* window().fps(), -0.08));
-        module->addBehavior(std::make_shared<FadeOut>(6* window().fps(),3* window().fps()));
+        module->addBehavior(Sink(5* window().fps(), -0.08));
+        module->addBehavior(FadeOut(6* window().fps(),3* window().fps()));
 
         auto module2 = mRenderTree.createModule<TextRenderModule>();
         module2->setFontSize(18);
@@ -105,15 +110,15 @@ public:
             module2->setText("Not a Bitcoin");
         }
         module2->setPosition(Vec3d(-0.4, 0.4, 0.079990));
-//                    module2->addBehavior(std::make_shared<FadeIn>(2* window().fps()));
-        module2->addBehavior(std::make_shared<Sink>(4* window().fps(), -0.08));
-        module2->addBehavior(std::make_shared<FadeOut>(4* window().fps(),5* window().fps()));
+//                    module2->addBehavior(FadeIn(2* window().fps()));
+        module2->addBehavior(Sink(4* window().fps(), -0.08));
+        module2->addBehavior(FadeOut(4* window().fps(),5* window().fps()));
 
 //        auto lineStrip = mRenderTree.createModule<LineStripModule>();
 //        for (int i = 0; i < 32; i++) {
 //            lineStrip->addVertex(mPairHash.mHashX[i] * window(0).width()/2, mPairHash.mHashY[i] * window(0).height()/2, 0.1);
 //        }
-//        lineStrip->addBehavior(std::make_shared<FadeOut>(7* window().fps(),3* window().fps()));
+//        lineStrip->addBehavior(FadeOut(7* window().fps(),3* window().fps()));
     }
 
     void addBitcoinMarker(std::string text, float x, float y) {
@@ -122,12 +127,18 @@ public:
         module->setScale(0.3);
         module->setText(text);
         module->setPosition(Vec3d(x- 0.5, y- 0.5, 0.3999));
-        module->addBehavior(std::make_shared<Timeout>(10 * window().fps()));
-        module->addBehavior(std::make_shared<Sink>(3* window().fps(), -0.3));
-        module->addBehavior(std::make_shared<FadeOut>(7* window().fps(),3* window().fps()));
+        module->addBehavior(Timeout(10 * window().fps()));
+        module->addBehavior(Sink(3* window().fps(), -0.3));
+        module->addBehavior(FadeOut(7* window().fps(),3* window().fps()));
     }
 
     void onAnimate(double dt){
+        mProfiler.beginFrame();
+        if (mProfiler.newReport() && mProfileOverlay) {
+            updateProfileOverlay();
+        }
+        FrameProfiler::Scope animate(mProfiler, mAnimateStage);
+        mRenderTree.tick();
 
         int zprev = 1-zcurr;
         if (mDown) {
@@ -211,6 +222,7 @@ public:
     }
 
     void onDraw(Graphics& g){
+        FrameProfiler::Scope draw(mProfiler, mDrawStage);
         g.pushMatrix();
         mtrl.specular(RGB(0));
         mtrl.shininess(shininess.get());
@@ -222,8 +234,21 @@ public:
         g.draw(mesh);
         g.popMatrix();
         mRenderTree.render(g);
+        if (mProfileOverlay) {
+            mProfileOverlay->draw(g, window(0).width(), window(0).height());
+        }
 	}
 
+    // This app's timings, then the last report of every render node
+    void updateProfileOverlay() {
+        std::vector<std::string> lines = mProfiler.lines();
+        std::lock_guard<std::mutex> locker(mNodeProfilesLock);
+        for (auto &nodeProfile: mNodeProfiles) {
+            lines.push_back(nodeProfile.second);
+        }
+        mProfileOverlay->lines(lines);
+    }
+
     virtual void onMouseDown(const Mouse &m) override {
         mDown = m.down(0);
         mOSCSender.send("/mouseDown", 1.0f);
@@ -251,12 +276,12 @@ public:
             if (mIntroTextModule->done()) {
                 mIntroTextModule = nullptr;
             } else if (!mIntroTextFading) {
-                mIntroTextModule->addBehavior(std::make_shared<FadeOut>(15* window().fps()));
-                mIntroTextModule->addBehavior(std::make_shared<Sink>(15* window().fps(), -0.05));
-                mIntroTextModule2->addBehavior(std::make_shared<FadeOut>(20* window().fps()));
-                mIntroTextModule2->addBehavior(std::make_shared<Sink>(20* window().fps(), -0.05));
-				mIntroTextModule3->addBehavior(std::make_shared<FadeOut>(25* window().fps()));
-                mIntroTextModule3->addBehavior(std::make_shared<Sink>(25* window().fps(), -0.05));
+                mIntroTextModule->addBehavior(FadeOut(15* window().fps()));
+                mIntroTextModule->addBehavior(Sink(15* window().fps(), -0.05));
+                mIntroTextModule2->addBehavior(FadeOut(20* window().fps()));
+                mIntroTextModule2->addBehavior(Sink(20* window().fps(), -0.05));
+				mIntroTextModule3->addBehavior(FadeOut(25* window().fps()));
+                mIntroTextModule3->addBehavior(Sink(25* window().fps(), -0.05));
                 mIntroTextFading = true;
             }
         }
@@ -275,6 +300,13 @@ public:
     virtual void onKeyDown(const Keyboard &k) override {
         if (k.key() == 'r') {
             reset();
+        } else if (k.key() == 'f') {
+            if (mProfileOverlay) {
+                mProfileOverlay.reset();
+            } else {
+                mProfileOverlay.reset(new TextOverlay(TextRenderModule::defaultFontPath()));
+                updateProfileOverlay();
+            }
         }
     }
 
@@ -289,6 +321,26 @@ public:
             int isBitcoin;
             m >> chars >> isBitcoin;
             showBitcoinReport(chars, isBitcoin != 0);
+        } else if (m.addressPattern() == "/profile" && m.typeTags() == "ssfffii") {
+            std::string node, stage;
+            float mean, p95, max;
+            int frames, late;
+            m >> node >> stage >> mean >> p95 >> max >> frames >> late;
+            char line[128];
+            snprintf(line, sizeof(line), "%-8s %-12s %6.2f ms  p95 %6.2f  max %6.2f  late %d/%d",
+                     node.c_str(), stage.c_str(), mean, p95, max, late, frames);
+            std::lock_guard<std::mutex> locker(mNodeProfilesLock);
+            mNodeProfiles[node + " " + stage] = line;
+        } else if (m.addressPattern() == "/dspProfile" && m.typeTags() == "ssffffiii") {
+            std::string node, stage;
+            float min, mean, p99, load;
+            int blocks, xruns, dropped;
+            m >> node >> stage >> min >> mean >> p99 >> load >> blocks >> xruns >> dropped;
+            char line[128];
+            snprintf(line, sizeof(line), "%-8s %-12s %5.1f%%  %6.3f ms  p99 %6.3f  xruns %d/%d  dropped %d",
+                     node.c_str(), stage.c_str(), load * 100, mean, p99, xruns, blocks, dropped);
+            std::lock_guard<std::mutex> locker(mNodeProfilesLock);
+            mNodeProfiles[node + " " + stage] = line;
         } else if (m.addressPattern() == "/reset") {
             reset();
         } else if (m.addressPattern() == "/chaos" && m.typeTags() == "f") {
@@ -326,6 +378,14 @@ public:
 	std::shared_ptr<TextRenderModule> mChaosDisplay;
     bool mIntroTextFading {false};
 
+    // Frame timings of this app and, from /profile messages, of the render nodes
+    FrameProfiler mProfiler {"control"};
+    int mAnimateStage = mProfiler.stage("animate");
+    int mDrawStage = mProfiler.stage("draw");
+    std::map<std::string, std::string> mNodeProfiles; // By node and stage
+    std::mutex mNodeProfilesLock;
+    std::unique_ptr<TextOverlay> mProfileOverlay; // Toggled with 'f'
+
     // Remote parameters
     float mChaos;
 	float mPreviousChaos;
@@ -0,0 +1,238 @@
+#ifndef CONTROL_INPUT_HPP
+#define CONTROL_INPUT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace al {
+
+/**
+ * @brief Fixed size queue for one producer thread and one consumer thread
+ *
+ * Neither side locks or allocates. push() fails when full.
+ */
+template<class T, size_t Size>
+class SpscQueue {
+public:
+    bool push(const T &value) {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        mItems[head % Size] = value;
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Oldest value, or nullptr if empty. Consumer only.
+    const T *front() const {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        return tail == mHead.load(std::memory_order_acquire) ? nullptr : &mItems[tail % Size];
+    }
+
+    void pop() {
+        mTail.store(mTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    T mItems[Size];
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+};
+
+/**
+ * @brief A control value sent to the audio thread, e.g. the chaos over OSC
+ *
+ * The receiving thread push()es values, stamped one block ahead of the audio
+ * clock so they apply at a known block whatever the thread timing. At the
+ * start of each block the audio thread drains the values due and gets:
+ *   - value(): the input smoothed per block, for gains and probabilities
+ *   - crossedUp()/crossedDown(): whether one of the block's steps between
+ *     received values crossed a level, each step seen in exactly one block
+ *
+ * A ControlTimeline records the stamped values, and pushAt() plays them back
+ * to the same blocks, e.g. in an offline render.
+ */
+class ControlInput {
+public:
+    struct Event {
+        uint64_t frame;
+        float value;
+    };
+
+    ControlInput(float initial = 0, float smoothingSeconds = 0.05) :
+        mSmoothingSeconds(smoothingSeconds), mRaw(initial), mValue(initial)
+    {
+    }
+
+    // Receiving thread
+
+    // Frame a value pushed now applies at
+    uint64_t nextFrame() const {
+        return mNextBlock.load(std::memory_order_acquire) + mBlockFrames.load(std::memory_order_relaxed);
+    }
+
+    bool push(float value) {
+        return pushAt(nextFrame(), value);
+    }
+
+    bool pushAt(uint64_t frame, float value) {
+        return mQueue.push({frame, value});
+    }
+
+    // Audio thread
+
+    void beginBlock(int frames, double sampleRate) {
+        mMoveCount = 0;
+        uint64_t end = mFrame + frames;
+        while (const Event *event = mQueue.front()) {
+            if (event->frame >= end) {
+                break;
+            }
+            if (event->frame < mFrame) {
+                mLate++;
+            }
+            addMove(event->value);
+            mQueue.pop();
+        }
+        double blockSeconds = frames / sampleRate;
+        float coefficient = mSmoothingSeconds > 0 ? 1 - std::exp(-blockSeconds / mSmoothingSeconds) : 1;
+        mValue += (mRaw - mValue) * coefficient;
+        mFrame = end;
+        mBlockFrames.store(frames, std::memory_order_relaxed);
+        mNextBlock.store(end, std::memory_order_release);
+    }
+
+    float value() const { return mValue; }
+    float raw() const { return mRaw; }
+    bool moved() const { return mMoveCount > 0; }
+    unsigned int late() const { return mLate; } // Values that arrived after their block
+
+    bool crossedUp(float level) const {
+        for (int i = 0; i < mMoveCount; i++) {
+            if (mMoves[i].from < level && mMoves[i].to >= level) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool crossedDown(float level) const {
+        for (int i = 0; i < mMoveCount; i++) {
+            if (mMoves[i].from > level && mMoves[i].to <= level) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    enum { maxMoves = 32 };
+
+    struct Move {
+        float from, to;
+    };
+
+    void addMove(float value) {
+        if (mMoveCount == maxMoves) {
+            mMoves[maxMoves - 1].to = value; // Very busy input: the last steps are merged
+        } else {
+            mMoves[mMoveCount++] = {mRaw, value};
+        }
+        mRaw = value;
+    }
+
+    SpscQueue<Event, 256> mQueue;
+    std::atomic<uint64_t> mNextBlock {0};
+    std::atomic<int> mBlockFrames {0};
+
+    float mSmoothingSeconds;
+    float mRaw;
+    float mValue;
+    uint64_t mFrame = 0;
+    Move mMoves[maxMoves];
+    int mMoveCount = 0;
+    unsigned int mLate = 0;
+};
+
+// A control message at a frame of the audio clock
+struct ControlEvent {
+    uint64_t frame;
+    std::string address;
+    float value;
+};
+
+/**
+ * @brief Control messages over time, scripted or recorded from the OSC input
+ *
+ * Files have one "seconds /address value" line per message, in time order,
+ * and # comments:
+ *
+ *     0    /chaos 0.1
+ *     12.5 /chaos 0.45
+ *     20   /mouseDown 1
+ */
+class ControlTimeline {
+public:
+    bool read(std::string path, double sampleRate) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cout << "ControlTimeline: can't read " << path << std::endl;
+            return false;
+        }
+        mEvents.clear();
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            std::istringstream words(line.substr(0, line.find('#')));
+            double seconds;
+            ControlEvent event;
+            if (!(words >> seconds)) {
+                continue;
+            }
+            if (!(words >> event.address >> event.value) || seconds < 0) {
+                std::cout << "ControlTimeline: " << path << ":" << lineNumber << ": can't read \"" << line << "\"" << std::endl;
+                return false;
+            }
+            event.frame = uint64_t(std::llround(seconds * sampleRate));
+            mEvents.push_back(event);
+        }
+        std::stable_sort(mEvents.begin(), mEvents.end(),
+                         [](const ControlEvent &a, const ControlEvent &b) { return a.frame < b.frame; });
+        return true;
+    }
+
+    const std::vector<ControlEvent> &events() const { return mEvents; }
+
+    // Writes the messages passed to write() from now on to path
+    bool record(std::string path, double sampleRate) {
+        mRecording.open(path);
+        mRecording << std::setprecision(12);
+        mSampleRate = sampleRate;
+        return mRecording.is_open();
+    }
+
+    void write(uint64_t frame, const std::string &address, float value) {
+        if (mRecording.is_open()) {
+            mRecording << frame / mSampleRate << " " << address << " " << value << std::endl;
+        }
+    }
+
+private:
+    std::vector<ControlEvent> mEvents;
+    std::ofstream mRecording;
+    double mSampleRate = 44100;
+};
+
+} // namespace al
+
+#endif // CONTROL_INPUT_HPP
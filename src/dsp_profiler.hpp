@@ -0,0 +1,352 @@
+#ifndef DSP_PROFILER_HPP
+#define DSP_PROFILER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "allocore/protocol/al_OSC.hpp"
+
+namespace al {
+
+/**
+ * @brief Histogram of block loads, in 0.1% of the block duration up to 200%
+ */
+class LoadHistogram {
+public:
+    enum { numBuckets = 2000 };
+
+    LoadHistogram() { clear(); }
+
+    void clear() {
+        std::fill(mBuckets, mBuckets + numBuckets + 1, 0);
+        mCount = 0;
+        mSum = 0;
+        mMin = 0;
+        mMax = 0;
+    }
+
+    void add(double load) {
+        int bucket = std::min(int(load * 1000), (int) numBuckets); // Last one is overflow
+        mBuckets[std::max(bucket, 0)]++;
+        mMin = mCount == 0 ? load : std::min(mMin, load);
+        mMax = std::max(mMax, load);
+        mCount++;
+        mSum += load;
+    }
+
+    unsigned int count() const { return mCount; }
+    double mean() const { return mCount > 0 ? mSum / mCount : 0; }
+    double min() const { return mMin; }
+    double max() const { return mMax; }
+
+    // Upper edge of the bucket holding the p quantile
+    double percentile(double p) const {
+        unsigned int target = (unsigned int) (p * mCount), seen = 0;
+        for (int i = 0; i < numBuckets; i++) {
+            seen += mBuckets[i];
+            if (seen > target) {
+                return std::min((i + 1) / 1000.0, mMax);
+            }
+        }
+        return mMax;
+    }
+
+private:
+    unsigned int mBuckets[numBuckets + 1];
+    unsigned int mCount;
+    double mSum, mMin, mMax;
+};
+
+/**
+ * @brief Per stage DSP load of the audio callback, e.g. synths, file players, downmix
+ *
+ * FrameProfiler for the audio thread: scope timers read the CPU cycle
+ * counter around the stages of the callback, and endBlock() pushes the
+ * block's cycles to a lock-free ring, so the audio thread never locks or
+ * allocates. A non-audio thread collect()s them into histograms of the
+ * share of the block duration each stage used and, once per window of
+ * audio time, makes the report printed by lines() and exported by send().
+ *
+ * Xruns are blocks whose callback took longer than the block lasts, and
+ * blocks that started more than a block later than the previous block's
+ * start says they should have (the device ran out of samples). Blocks lost
+ * to a full ring, when the collector falls behind (e.g. in a fast offline
+ * render), are reported apart as dropped: they say nothing about xruns.
+ */
+class DspProfiler {
+public:
+    enum { maxStages = 8, ringSize = 1024 };
+
+    struct StageReport {
+        std::string name;
+        double min, mean, p99; // ms
+        double load; // Mean share of the block duration
+    };
+
+    DspProfiler(std::string node) : mNode(node) {
+        mCalibrationTicks = ticks();
+        mCalibrationTime = std::chrono::steady_clock::now();
+    }
+
+    ~DspProfiler() {
+        stopCollector();
+    }
+
+    // Adds a stage, before the first block
+    int stage(std::string name) {
+        if (mStageNames.size() >= maxStages) {
+            return maxStages - 1;
+        }
+        mStageNames.push_back(name);
+        return mStageNames.size() - 1;
+    }
+
+    // Cycle counter, or nanoseconds where there is none
+    static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    class Scope {
+    public:
+        Scope(DspProfiler &profiler, int stage) :
+            mProfiler(profiler), mStage(stage), mStart(ticks()), mExcluded(profiler.mExcluded) {}
+        ~Scope() { mProfiler.add(mStage, ticks() - mStart - (mProfiler.mExcluded - mExcluded)); }
+    private:
+        DspProfiler &mProfiler;
+        int mStage;
+        uint64_t mStart;
+        uint64_t mExcluded;
+    };
+
+    // Leaves its time out of the block, the stages around it and the block
+    // starts, e.g. waiting for a file in an offline render, which isn't DSP load
+    class Exclude {
+    public:
+        Exclude(DspProfiler &profiler) : mProfiler(profiler), mStart(ticks()) {}
+        ~Exclude() { mProfiler.mExcluded += ticks() - mStart; }
+    private:
+        DspProfiler &mProfiler;
+        uint64_t mStart;
+    };
+
+    // Stages timed several times a block add up
+    void add(int stage, uint64_t ticks) { mCurrent.stages[stage] += ticks; }
+
+    // Call at the start and end of each callback, on the audio thread
+    void beginBlock(int frames, double sampleRate) {
+        mCurrent = Sample();
+        mCurrent.block = mBlocks++;
+        mCurrent.seconds = frames / sampleRate;
+        mCurrent.start = ticks() - mExcluded;
+    }
+
+    void endBlock() {
+        mCurrent.total = ticks() - mExcluded - mCurrent.start;
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) < ringSize) {
+            mRing[head % ringSize] = mCurrent;
+            mHead.store(head + 1, std::memory_order_release);
+        } else {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns true when a new report is ready, every windowSeconds of audio. One thread only.
+    bool collect(double windowSeconds = 1.0) {
+        double ticksPerSecond = calibrate();
+        size_t head = mHead.load(std::memory_order_acquire);
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        bool ready = false;
+        for (; tail != head; tail++) {
+            const Sample &sample = mRing[tail % ringSize];
+            double blockTicks = sample.seconds * ticksPerSecond;
+            double load = sample.total / blockTicks;
+            mTotal.add(load);
+            if (load > 1) {
+                mXruns++;
+            }
+            // Against the previous block only, so that the drift between the
+            // device and CPU clocks doesn't add up to false or hidden xruns
+            if (mLastStart > 0) {
+                double expected = mLastStart + (sample.block - mLastBlock) * blockTicks;
+                if (sample.start > expected + blockTicks) {
+                    mXruns++;
+                }
+            }
+            mLastStart = sample.start;
+            mLastBlock = sample.block;
+            for (size_t i = 0; i < mStageNames.size(); i++) {
+                mStages[i].add(sample.stages[i] / blockTicks);
+            }
+            mWindowSeconds += sample.seconds;
+            mBlockMs = sample.seconds * 1000.0;
+            if (mWindowSeconds >= windowSeconds) {
+                makeReport();
+                ready = true;
+            }
+        }
+        mTail.store(tail, std::memory_order_release);
+        return ready;
+    }
+
+    // Calls collect() every 0.1 s on a thread, and onReport() after each report
+    void startCollector(std::function<void()> onReport, double windowSeconds = 1.0) {
+        stopCollector();
+        mCollecting = true;
+        mCollector = std::thread([this, onReport, windowSeconds]() {
+            while (mCollecting) {
+                if (collect(windowSeconds) && onReport) {
+                    onReport();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+
+    void stopCollector() {
+        mCollecting = false;
+        if (mCollector.joinable()) {
+            mCollector.join();
+        }
+    }
+
+    const std::string &node() { return mNode; }
+
+    // Text of the last report, one line per stage
+    std::vector<std::string> lines() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        std::vector<std::string> text;
+        char line[128];
+        snprintf(line, sizeof(line), "%s  DSP load %5.1f%%  p99 %5.1f%%  max %5.1f%%  %u blocks  %u xruns  %u dropped",
+                 mNode.c_str(), mReportLoad.mean * 100, mReportLoad.p99 * 100, mReportLoad.max * 100,
+                 mReportBlocks, mReportXruns, mReportDropped);
+        text.push_back(line);
+        for (const StageReport &stage: mReport) {
+            snprintf(line, sizeof(line), "  %-12s %5.1f%%  min %6.3f  mean %6.3f  p99 %6.3f ms",
+                     stage.name.c_str(), stage.load * 100, stage.min, stage.mean, stage.p99);
+            text.push_back(line);
+        }
+        return text;
+    }
+
+    // One /dspProfile message per stage, the first one "callback" for the
+    // whole callback: node, stage, min, mean, p99 (ms), load (0-1), blocks,
+    // xruns, dropped
+    void send(osc::Send &sender) {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        std::vector<StageReport> stages(1, mReportTotal);
+        stages.insert(stages.end(), mReport.begin(), mReport.end());
+        for (const StageReport &stage: stages) {
+            sender.beginMessage("/dspProfile");
+            sender << mNode << stage.name << (float) stage.min << (float) stage.mean << (float) stage.p99;
+            sender << (float) stage.load << (int) mReportBlocks << (int) mReportXruns << (int) mReportDropped;
+            sender.endMessage();
+            sender.send();
+        }
+    }
+
+private:
+    struct Load {
+        double mean, p99, max;
+    };
+
+    struct Sample {
+        uint64_t block = 0;
+        double seconds = 0; // Block duration
+        uint64_t start = 0;
+        uint64_t total = 0;
+        uint64_t stages[maxStages] = {0};
+    };
+
+    // Ticks per second, measured against the steady clock since construction
+    double calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mCalibrationTime).count();
+        if (seconds > 0.01) {
+            mTicksPerSecond = (ticks() - mCalibrationTicks) / seconds;
+        }
+        return mTicksPerSecond;
+#else
+        return 1e9;
+#endif
+    }
+
+    StageReport stageReport(std::string name, const LoadHistogram &histogram) {
+        return {name, histogram.min() * mBlockMs, histogram.mean() * mBlockMs,
+                histogram.percentile(0.99) * mBlockMs, histogram.mean()};
+    }
+
+    void makeReport() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        mReport.clear();
+        mReportTotal = stageReport("callback", mTotal);
+        mReportLoad = {mTotal.mean(), mTotal.percentile(0.99), mTotal.max()};
+        for (size_t i = 0; i < mStageNames.size(); i++) {
+            mReport.push_back(stageReport(mStageNames[i], mStages[i]));
+            mStages[i].clear();
+        }
+        mReportBlocks = mTotal.count();
+        mReportXruns = mXruns;
+        mReportDropped = mDropped.exchange(0, std::memory_order_relaxed);
+        mTotal.clear();
+        mXruns = 0;
+        mWindowSeconds = 0;
+    }
+
+    std::string mNode;
+    std::vector<std::string> mStageNames;
+
+    // Audio thread
+    Sample mCurrent;
+    uint64_t mBlocks = 0;
+    uint64_t mExcluded = 0; // Ticks left out since the start, block starts included
+
+    Sample mRing[ringSize];
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+    std::atomic<unsigned int> mDropped {0}; // Samples lost to a full ring, not xruns
+
+    // Collecting thread
+    uint64_t mCalibrationTicks;
+    std::chrono::steady_clock::time_point mCalibrationTime;
+    double mTicksPerSecond = 1e9;
+    LoadHistogram mTotal;
+    LoadHistogram mStages[maxStages];
+    unsigned int mXruns = 0;
+    uint64_t mLastStart = 0;
+    uint64_t mLastBlock = 0;
+    double mWindowSeconds = 0;
+    double mBlockMs = 0;
+    std::thread mCollector;
+    std::atomic<bool> mCollecting {false};
+
+    // Last report, read from other threads
+    std::mutex mReportLock;
+    std::vector<StageReport> mReport;
+    StageReport mReportTotal {"callback", 0, 0, 0, 0};
+    Load mReportLoad {0, 0, 0}; // Of the whole callback
+    unsigned int mReportBlocks = 0;
+    unsigned int mReportXruns = 0;
+    unsigned int mReportDropped = 0;
+};
+
+} // namespace al
+
+#endif // DSP_PROFILER_HPP
@@ -0,0 +1,96 @@
+#ifndef EVENT_SCHEDULER_HPP
+#define EVENT_SCHEDULER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace al {
+
+/**
+ * @brief Timed events for the audio callback, on the sample clock
+ *
+ * Replaces MsgQueue there: events are a function pointer, a target and an
+ * int, kept in a fixed binary heap ordered by frame, so scheduling and
+ * dispatching don't allocate or lock. process() dispatches the events due
+ * in the block at their frame offsets, so synths can render up to an event
+ * before it runs. Everything happens on the audio thread.
+ */
+template<int Capacity = 1024>
+class EventScheduler {
+public:
+    typedef void (*Function)(void *target, int value);
+
+    // Frame of the start of the block being or about to be processed
+    uint64_t now() const { return mNow; }
+    int size() const { return mSize; }
+    int dropped() const { return mDropped; }
+
+    // Schedules function(target, value) seconds from the start of the block. False if full.
+    bool schedule(double seconds, Function function, void *target, int value = 0) {
+        return scheduleFrame(mNow + uint64_t(std::max(std::llround(seconds * mSampleRate), 0LL)),
+                             function, target, value);
+    }
+
+    bool scheduleFrame(uint64_t frame, Function function, void *target, int value = 0) {
+        if (mSize == Capacity) {
+            mDropped++;
+            return false;
+        }
+        mHeap[mSize++] = {frame, mCount++, function, target, value};
+        std::push_heap(mHeap, mHeap + mSize, later);
+        return true;
+    }
+
+    /**
+     * @brief Runs the events of the next frames, in time order
+     *
+     * beforeEvent(int offset) is called before each event, with its frame in
+     * the block. Offsets never go back, also for events scheduled while
+     * processing.
+     */
+    template<class Callback>
+    void process(double sampleRate, int frames, Callback beforeEvent) {
+        mSampleRate = sampleRate;
+        uint64_t end = mNow + frames;
+        int last = 0;
+        while (mSize > 0 && mHeap[0].frame < end) {
+            Event event = mHeap[0];
+            std::pop_heap(mHeap, mHeap + mSize, later);
+            mSize--;
+            int offset = event.frame > mNow ? int(event.frame - mNow) : 0;
+            last = std::max(offset, last);
+            beforeEvent(last);
+            event.function(event.target, event.value);
+        }
+        mNow = end;
+    }
+
+    void clear() {
+        mSize = 0;
+    }
+
+private:
+    struct Event {
+        uint64_t frame;
+        uint64_t order; // Keeps events of the same frame in scheduling order
+        Function function;
+        void *target;
+        int value;
+    };
+
+    static bool later(const Event &a, const Event &b) {
+        return a.frame != b.frame ? a.frame > b.frame : a.order > b.order;
+    }
+
+    Event mHeap[Capacity];
+    int mSize = 0;
+    int mDropped = 0;
+    uint64_t mCount = 0;
+    uint64_t mNow = 0;
+    double mSampleRate = 44100;
+};
+
+} // namespace al
+
+#endif // EVENT_SCHEDULER_HPP
@@ -11,3 +11,7 @@
 #if(${CMAKE_SYSTEM_NAME} STREQUAL "Darwin")
 #  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -stdlib=libc++")
 #endif()
+
+# painter_bench renders through OSMesa instead of the null GL backend with:
+#set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -DPAINTER_BENCH_OSMESA")
+#target_link_libraries("${APP_NAME}" OSMesa)
@@ -0,0 +1,92 @@
+#ifndef FONT_CACHE_HPP
+#define FONT_CACHE_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "allocore/graphics/al_Font.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+
+namespace al {
+
+/**
+ * @brief Process wide cache of loaded fonts and the meshes written with them
+ *
+ * Loading a Font rasterizes all its glyphs, so modules showing text share one
+ * Font (and its glyph texture) per path, size and antialias setting. Each
+ * cached font also keeps the meshes for the strings written with it, since
+ * markers repeat a small set of strings (e.g. hex pairs).
+ */
+class FontCache {
+public:
+    class CachedFont {
+    public:
+        CachedFont(const std::string &path, int size, bool antialias) :
+            mFont(path, size, antialias) {}
+
+        Font &font() { return mFont; }
+
+        std::shared_ptr<const Mesh> mesh(const std::string &text) {
+            std::lock_guard<std::mutex> locker(mMeshLock);
+            auto it = mMeshes.find(text);
+            if (it != mMeshes.end()) {
+                return it->second;
+            }
+            if (mMeshes.size() >= maxMeshes) {
+                mMeshes.clear(); // Modules still using meshes hold their own reference
+            }
+            std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+            mFont.write(*mesh, text);
+            mMeshes[text] = mesh;
+            return mesh;
+        }
+
+    private:
+        static const size_t maxMeshes = 512;
+        Font mFont;
+        std::mutex mMeshLock;
+        std::map<std::string, std::shared_ptr<const Mesh>> mMeshes;
+    };
+
+    static FontCache &get() {
+        static FontCache cache;
+        return cache;
+    }
+
+    std::shared_ptr<CachedFont> font(const std::string &path, int size, bool antialias = true) {
+        std::lock_guard<std::mutex> locker(mLock);
+        Key key(path, size, antialias);
+        auto it = mFonts.find(key);
+        if (it != mFonts.end()) {
+            return it->second;
+        }
+        std::shared_ptr<CachedFont> font = std::make_shared<CachedFont>(path, size, antialias);
+        mFonts[key] = font;
+        return font;
+    }
+
+    // Load ahead of time so the first module using the font doesn't have to
+    void preload(const std::string &path, int size, bool antialias = true) {
+        font(path, size, antialias);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> locker(mLock);
+        mFonts.clear();
+    }
+
+private:
+    typedef std::tuple<std::string, int, bool> Key;
+
+    FontCache() {}
+
+    std::mutex mLock;
+    std::map<Key, std::shared_ptr<CachedFont>> mFonts;
+};
+
+}
+
+#endif // FONT_CACHE_HPP
@@ -0,0 +1,333 @@
+#ifndef FRAME_PROFILER_HPP
+#define FRAME_PROFILER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocore/graphics/al_Font.hpp"
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/protocol/al_OSC.hpp"
+
+#include "font_cache.hpp"
+
+namespace al {
+
+/**
+ * @brief Histogram of durations in milliseconds, 0.25 ms buckets up to 100 ms
+ */
+class TimeHistogram {
+public:
+    enum { numBuckets = 400 };
+    static constexpr double bucketMs() { return 0.25; }
+
+    TimeHistogram() { clear(); }
+
+    void clear() {
+        std::fill(mBuckets, mBuckets + numBuckets + 1, 0);
+        mCount = 0;
+        mSum = 0;
+        mMax = 0;
+    }
+
+    void add(double ms) {
+        int bucket = std::min(int(ms / bucketMs()), (int) numBuckets); // Last one is overflow
+        mBuckets[std::max(bucket, 0)]++;
+        mCount++;
+        mSum += ms;
+        mMax = std::max(mMax, ms);
+    }
+
+    unsigned int count() const { return mCount; }
+    double mean() const { return mCount > 0 ? mSum / mCount : 0; }
+    double max() const { return mMax; }
+
+    // Upper edge of the bucket holding the p quantile
+    double percentile(double p) const {
+        unsigned int target = (unsigned int) (p * mCount), seen = 0;
+        for (int i = 0; i < numBuckets; i++) {
+            seen += mBuckets[i];
+            if (seen > target) {
+                return (i + 1) * bucketMs();
+            }
+        }
+        return mMax;
+    }
+
+private:
+    unsigned int mBuckets[numBuckets + 1];
+    unsigned int mCount;
+    double mSum;
+    double mMax;
+};
+
+/**
+ * @brief Per stage frame timings of an app, e.g. onAnimate, onDraw, afterEffect
+ *
+ * Scope timers add to the stages of the current frame on the render thread.
+ * beginFrame() closes the previous frame and pushes its totals, with the
+ * frame period, to a lock-free single producer, single consumer ring, so the
+ * render thread never blocks. collect() (on any one thread, normally the
+ * one startCollector() runs) moves samples from the ring into histograms
+ * and, once per window, makes them the report shown by lines() and
+ * exported by send(). The render thread only checks newReport() to know
+ * when to fetch the new lines.
+ */
+class FrameProfiler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum { maxStages = 8, ringSize = 256 };
+
+    struct StageReport {
+        std::string name;
+        double mean, p95, max;
+    };
+
+    FrameProfiler(std::string node, double fps = 60) :
+        mNode(node), mLateMs(1500.0 / fps) {}
+
+    ~FrameProfiler() {
+        stopCollector();
+    }
+
+    // Adds a stage, before the first frame
+    int stage(std::string name) {
+        if (mStageNames.size() >= maxStages) {
+            return maxStages - 1;
+        }
+        mStageNames.push_back(name);
+        return mStageNames.size() - 1;
+    }
+
+    class Scope {
+    public:
+        Scope(FrameProfiler &profiler, int stage) :
+            mProfiler(profiler), mStage(stage), mStart(Clock::now()) {}
+        ~Scope() {
+            mProfiler.add(mStage, std::chrono::duration<double, std::milli>(Clock::now() - mStart).count());
+        }
+    private:
+        FrameProfiler &mProfiler;
+        int mStage;
+        Clock::time_point mStart;
+    };
+
+    // Stages called several times a frame (e.g. onDraw per projection) add up
+    void add(int stage, double ms) { mCurrent.stages[stage] += ms; }
+
+    // Call at the start of each frame, on the render thread
+    void beginFrame() {
+        Clock::time_point now = Clock::now();
+        if (mFrameStarted) {
+            mCurrent.frame = std::chrono::duration<double, std::milli>(now - mFrameStart).count();
+            size_t head = mHead.load(std::memory_order_relaxed);
+            if (head - mTail.load(std::memory_order_acquire) < ringSize) {
+                mRing[head % ringSize] = mCurrent;
+                mHead.store(head + 1, std::memory_order_release);
+            } else {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        mCurrent = Sample();
+        mFrameStart = now;
+        mFrameStarted = true;
+    }
+
+    // Returns true when a new report is ready, every windowSeconds of frames. One thread only.
+    bool collect(double windowSeconds = 1.0) {
+        size_t head = mHead.load(std::memory_order_acquire);
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        bool ready = false;
+        for (; tail != head; tail++) {
+            const Sample &sample = mRing[tail % ringSize];
+            mFrames.add(sample.frame);
+            if (sample.frame > mLateMs) {
+                mLate++;
+            }
+            for (size_t i = 0; i < mStageNames.size(); i++) {
+                mStages[i].add(sample.stages[i]);
+            }
+            mWindowMs += sample.frame;
+            if (mWindowMs >= windowSeconds * 1000.0) {
+                makeReport();
+                ready = true;
+            }
+        }
+        mTail.store(tail, std::memory_order_release);
+        return ready;
+    }
+
+    // Calls collect() every 0.1 s on a thread, and onReport() after each report
+    void startCollector(std::function<void()> onReport, double windowSeconds = 1.0) {
+        stopCollector();
+        mCollecting = true;
+        mCollector = std::thread([this, onReport, windowSeconds]() {
+            while (mCollecting) {
+                if (collect(windowSeconds) && onReport) {
+                    onReport();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+
+    void stopCollector() {
+        mCollecting = false;
+        if (mCollector.joinable()) {
+            mCollector.join();
+        }
+    }
+
+    // True once after each report, for the render thread to update what it shows
+    bool newReport() { return mNewReport.exchange(false, std::memory_order_acquire); }
+
+    std::vector<StageReport> report() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        return mReport;
+    }
+    unsigned int reportFrames() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        return mReportFrames;
+    }
+    unsigned int reportLate() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        return mReportLate;
+    }
+    const std::string &node() { return mNode; }
+
+    // Text of the last report, one line per stage
+    std::vector<std::string> lines() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        std::vector<std::string> text;
+        char line[128];
+        snprintf(line, sizeof(line), "%s  %u frames  %u late", mNode.c_str(), mReportFrames, mReportLate);
+        text.push_back(line);
+        for (const StageReport &stage: mReport) {
+            snprintf(line, sizeof(line), "%-12s %6.2f ms  p95 %6.2f  max %6.2f",
+                     stage.name.c_str(), stage.mean, stage.p95, stage.max);
+            text.push_back(line);
+        }
+        return text;
+    }
+
+    // One /profile message per stage: node, stage, mean, p95, max (ms), frames, late frames
+    void send(osc::Send &sender) {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        for (const StageReport &stage: mReport) {
+            sender.beginMessage("/profile");
+            sender << mNode << stage.name << (float) stage.mean << (float) stage.p95 << (float) stage.max;
+            sender << (int) mReportFrames << (int) mReportLate;
+            sender.endMessage();
+            sender.send();
+        }
+    }
+
+private:
+    struct Sample {
+        double frame = 0;
+        double stages[maxStages] = {0};
+    };
+
+    void makeReport() {
+        std::lock_guard<std::mutex> locker(mReportLock);
+        mReport.clear();
+        mReport.push_back({"frame", mFrames.mean(), mFrames.percentile(0.95), mFrames.max()});
+        for (size_t i = 0; i < mStageNames.size(); i++) {
+            mReport.push_back({mStageNames[i], mStages[i].mean(), mStages[i].percentile(0.95), mStages[i].max()});
+            mStages[i].clear();
+        }
+        mReportFrames = mFrames.count();
+        mReportLate = mLate + mDropped.exchange(0, std::memory_order_relaxed);
+        mFrames.clear();
+        mLate = 0;
+        mWindowMs = 0;
+        mNewReport.store(true, std::memory_order_release);
+    }
+
+    std::string mNode;
+    double mLateMs;
+    std::vector<std::string> mStageNames;
+
+    // Render thread
+    Sample mCurrent;
+    Clock::time_point mFrameStart;
+    bool mFrameStarted = false;
+
+    Sample mRing[ringSize];
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+    std::atomic<unsigned int> mDropped {0}; // Samples lost to a full ring, counted as late
+
+    // Collecting thread
+    TimeHistogram mFrames;
+    TimeHistogram mStages[maxStages];
+    unsigned int mLate = 0;
+    double mWindowMs = 0;
+    std::thread mCollector;
+    std::atomic<bool> mCollecting {false};
+
+    // Last report, read from other threads
+    std::mutex mReportLock;
+    std::vector<StageReport> mReport;
+    unsigned int mReportFrames = 0;
+    unsigned int mReportLate = 0;
+    std::atomic<bool> mNewReport {false};
+};
+
+/**
+ * @brief Lines of text drawn over the window in pixel coordinates
+ *
+ * Meshes are only rebuilt when the lines change, e.g. once per profiler report.
+ */
+class TextOverlay {
+public:
+    TextOverlay(std::string fontPath, int size = 14) :
+        mFont(FontCache::get().font(fontPath, size)), mLineHeight(size * 1.3f) {}
+
+    void lines(const std::vector<std::string> &lines) {
+        mMeshes.resize(lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            mMeshes[i].reset();
+            mFont->font().write(mMeshes[i], lines[i]);
+        }
+    }
+
+    void draw(Graphics &g, int width, int height) {
+        g.pushMatrix(Graphics::PROJECTION);
+        g.loadMatrix(Matrix4d::ortho(0, width, 0, height, -1, 1));
+        g.pushMatrix(Graphics::MODELVIEW);
+        g.loadIdentity();
+        g.depthTesting(false);
+        g.blending(true);
+        g.blendModeTrans();
+        g.color(1, 1, 0.6, 1);
+        mFont->font().texture().bind();
+        for (size_t i = 0; i < mMeshes.size(); i++) {
+            g.pushMatrix();
+            g.translate(8, height - (i + 1) * mLineHeight, 0);
+            g.draw(mMeshes[i]);
+            g.popMatrix();
+        }
+        mFont->font().texture().unbind();
+        g.blending(false);
+        g.popMatrix(Graphics::MODELVIEW);
+        g.popMatrix(Graphics::PROJECTION);
+    }
+
+private:
+    std::shared_ptr<FontCache::CachedFont> mFont;
+    float mLineHeight;
+    std::vector<Mesh> mMeshes;
+};
+
+} // namespace al
+
+#endif // FRAME_PROFILER_HPP
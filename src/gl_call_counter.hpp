@@ -0,0 +1,472 @@
+#ifndef GL_CALL_COUNTER_HPP
+#define GL_CALL_COUNTER_HPP
+
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+#include "allocore/graphics/al_OpenGL.hpp"
+
+namespace al {
+
+struct GLFrameStats {
+    unsigned long calls = 0;
+    unsigned long drawCalls = 0;
+    unsigned long vertices = 0;     // Vertices or indices submitted by draw calls
+    unsigned long stateChanges = 0; // Enables, binds, uniforms, pointers, lights...
+    unsigned long uploads = 0;      // Buffer and texture data calls
+};
+
+/**
+ * @brief Counts the GL calls made by the rendering code of an app
+ *
+ * Including this header defines the GL 1.1 entry points themselves, which
+ * take precedence over the ones in the GL library, so it must be included by
+ * a single source file: a headless app. install() also replaces the GLEW
+ * function pointers. Every call is counted, then either dropped (the null
+ * backend: no context, ids and status queries return plausible values) or
+ * forwarded to the functions a resolver returns, e.g. OSMesaGetProcAddress.
+ */
+class GLCallCounter {
+public:
+    enum Kind { CALL, STATE, UPLOAD };
+    typedef void *(*Resolver)(const char *name);
+
+    // Must be called before any GL call. With no resolver, nothing is drawn
+    static void install(Resolver resolver = nullptr) {
+        resolverRef() = resolver;
+        installPointers();
+    }
+
+    static bool forwarding() { return resolverRef() != nullptr; }
+
+    static void *next(const char *name) {
+        return resolverRef() ? resolverRef()(name) : nullptr;
+    }
+
+    static void count(Kind kind) {
+        GLFrameStats &s = stats();
+        s.calls++;
+        if (kind == STATE) {
+            s.stateChanges++;
+        } else if (kind == UPLOAD) {
+            s.uploads++;
+        }
+    }
+
+    static void draw(GLsizei vertices) {
+        GLFrameStats &s = stats();
+        s.calls++;
+        s.drawCalls++;
+        s.vertices += vertices;
+    }
+
+    static GLFrameStats &stats() {
+        static GLFrameStats s;
+        return s;
+    }
+
+    // Returns the counts since the previous call and starts over
+    static GLFrameStats frame() {
+        GLFrameStats s = stats();
+        stats() = GLFrameStats();
+        return s;
+    }
+
+    // Ids for glGen*(), never reused
+    static GLuint newId() {
+        static GLuint id = 0;
+        return ++id;
+    }
+
+private:
+    static Resolver &resolverRef() {
+        static Resolver resolver = nullptr;
+        return resolver;
+    }
+
+    template <int Id, class F>
+    static void installPointer(F &pointer, const char *name, Kind kind,
+                               typename std::common_type<F>::type nullFunction = nullptr);
+
+    static void installPointers();
+};
+
+// Replacement for a GLEW function pointer. Id keeps functions of the same type apart
+template <int Id, class F> struct GLPointerStub;
+
+template <int Id, class R, class... A>
+struct GLPointerStub<Id, R (GLAPIENTRY *)(A...)> {
+    typedef R (GLAPIENTRY *F)(A...);
+
+    static F &next() { static F f = nullptr; return f; }
+    static F &null() { static F f = nullptr; return f; }
+    static GLCallCounter::Kind &kind() { static GLCallCounter::Kind k = GLCallCounter::CALL; return k; }
+
+    static R GLAPIENTRY call(A... args) {
+        GLCallCounter::count(kind());
+        if (next()) {
+            return next()(args...);
+        }
+        if (null()) {
+            return null()(args...);
+        }
+        return R();
+    }
+};
+
+template <int Id, class F>
+void GLCallCounter::installPointer(F &pointer, const char *name, Kind kind,
+                                   typename std::common_type<F>::type nullFunction) {
+    typedef GLPointerStub<Id, F> Stub;
+    Stub::next() = (F) next(name);
+    Stub::null() = nullFunction;
+    Stub::kind() = kind;
+    pointer = &Stub::call;
+}
+
+// What the null backend answers for calls whose results are used
+struct NullGL {
+    static void GLAPIENTRY genIds(GLsizei n, GLuint *ids) {
+        for (GLsizei i = 0; i < n; i++) {
+            ids[i] = GLCallCounter::newId();
+        }
+    }
+    static GLuint GLAPIENTRY createShader(GLenum) { return GLCallCounter::newId(); }
+    static GLuint GLAPIENTRY createProgram() { return GLCallCounter::newId(); }
+    static void GLAPIENTRY getObjectiv(GLuint, GLenum pname, GLint *params) {
+        *params = pname == GL_INFO_LOG_LENGTH ? 0 : GL_TRUE; // Compiled, linked and valid
+    }
+    static void GLAPIENTRY getInfoLog(GLuint, GLsizei size, GLsizei *length, GLchar *log) {
+        if (length) *length = 0;
+        if (size > 0) log[0] = '\0';
+    }
+    static GLint GLAPIENTRY location(GLuint, const GLchar *) { return 0; }
+    static void GLAPIENTRY getUniformfv(GLuint, GLint, GLfloat *params) { *params = 0; }
+    static void GLAPIENTRY getUniformiv(GLuint, GLint, GLint *params) { *params = 0; }
+    static void GLAPIENTRY getActive(GLuint, GLuint, GLsizei size, GLsizei *length, GLint *count,
+                                     GLenum *type, GLchar *name) {
+        getInfoLog(0, size, length, name);
+        *count = 0;
+        *type = GL_FLOAT;
+    }
+    static GLenum GLAPIENTRY framebufferStatus(GLenum) { return GL_FRAMEBUFFER_COMPLETE; }
+    static GLboolean GLAPIENTRY unmap(GLenum) { return GL_TRUE; }
+};
+
+// glDrawRangeElements() is loaded by GLEW, but counts as a draw like glDrawElements()
+struct GLRangeDraw {
+    static PFNGLDRAWRANGEELEMENTSPROC &next() {
+        static PFNGLDRAWRANGEELEMENTSPROC f = nullptr;
+        return f;
+    }
+    static void GLAPIENTRY call(GLenum mode, GLuint start, GLuint end, GLsizei count,
+                                GLenum type, const GLvoid *indices) {
+        GLCallCounter::draw(count);
+        if (next()) {
+            next()(mode, start, end, count, type, indices);
+        }
+    }
+};
+
+#define GL_CALL_COUNTER_POINTER(name, kind, ...) \
+    installPointer<__LINE__>(name, #name, kind, ##__VA_ARGS__)
+
+inline void GLCallCounter::installPointers() {
+    GLRangeDraw::next() = (PFNGLDRAWRANGEELEMENTSPROC) next("glDrawRangeElements");
+    glDrawRangeElements = &GLRangeDraw::call;
+
+    GL_CALL_COUNTER_POINTER(glActiveTexture, STATE);
+    GL_CALL_COUNTER_POINTER(glClientActiveTexture, STATE);
+    GL_CALL_COUNTER_POINTER(glBlendEquation, STATE);
+    GL_CALL_COUNTER_POINTER(glBlendEquationSeparate, STATE);
+    GL_CALL_COUNTER_POINTER(glBlendFuncSeparate, STATE);
+    GL_CALL_COUNTER_POINTER(glBlendColor, STATE);
+    GL_CALL_COUNTER_POINTER(glTexImage3D, UPLOAD);
+    GL_CALL_COUNTER_POINTER(glTexSubImage3D, UPLOAD);
+    GL_CALL_COUNTER_POINTER(glGenerateMipmap, CALL);
+    GL_CALL_COUNTER_POINTER(glGenerateMipmapEXT, CALL);
+
+    GL_CALL_COUNTER_POINTER(glGenBuffers, CALL, &NullGL::genIds);
+    GL_CALL_COUNTER_POINTER(glDeleteBuffers, CALL);
+    GL_CALL_COUNTER_POINTER(glBindBuffer, STATE);
+    GL_CALL_COUNTER_POINTER(glBufferData, UPLOAD);
+    GL_CALL_COUNTER_POINTER(glBufferSubData, UPLOAD);
+    GL_CALL_COUNTER_POINTER(glMapBuffer, CALL);
+    GL_CALL_COUNTER_POINTER(glUnmapBuffer, CALL, &NullGL::unmap);
+
+    GL_CALL_COUNTER_POINTER(glCreateShader, CALL, &NullGL::createShader);
+    GL_CALL_COUNTER_POINTER(glShaderSource, CALL);
+    GL_CALL_COUNTER_POINTER(glCompileShader, CALL);
+    GL_CALL_COUNTER_POINTER(glGetShaderiv, CALL, &NullGL::getObjectiv);
+    GL_CALL_COUNTER_POINTER(glGetShaderInfoLog, CALL, &NullGL::getInfoLog);
+    GL_CALL_COUNTER_POINTER(glDeleteShader, CALL);
+    GL_CALL_COUNTER_POINTER(glCreateProgram, CALL, &NullGL::createProgram);
+    GL_CALL_COUNTER_POINTER(glAttachShader, CALL);
+    GL_CALL_COUNTER_POINTER(glDetachShader, CALL);
+    GL_CALL_COUNTER_POINTER(glLinkProgram, CALL);
+    GL_CALL_COUNTER_POINTER(glValidateProgram, CALL);
+    GL_CALL_COUNTER_POINTER(glGetProgramiv, CALL, &NullGL::getObjectiv);
+    GL_CALL_COUNTER_POINTER(glGetProgramInfoLog, CALL, &NullGL::getInfoLog);
+    GL_CALL_COUNTER_POINTER(glDeleteProgram, CALL);
+    GL_CALL_COUNTER_POINTER(glUseProgram, STATE);
+    GL_CALL_COUNTER_POINTER(glGetUniformLocation, CALL, &NullGL::location);
+    GL_CALL_COUNTER_POINTER(glGetAttribLocation, CALL, &NullGL::location);
+    GL_CALL_COUNTER_POINTER(glBindAttribLocation, CALL);
+    GL_CALL_COUNTER_POINTER(glGetUniformfv, CALL, &NullGL::getUniformfv);
+    GL_CALL_COUNTER_POINTER(glGetUniformiv, CALL, &NullGL::getUniformiv);
+    GL_CALL_COUNTER_POINTER(glGetActiveUniform, CALL, &NullGL::getActive);
+    GL_CALL_COUNTER_POINTER(glGetActiveAttrib, CALL, &NullGL::getActive);
+
+    GL_CALL_COUNTER_POINTER(glUniform1i, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform2i, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform3i, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform4i, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform1f, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform2f, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform3f, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform4f, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform1iv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform2iv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform3iv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform4iv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform1fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform2fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform3fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniform4fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniformMatrix2fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniformMatrix3fv, STATE);
+    GL_CALL_COUNTER_POINTER(glUniformMatrix4fv, STATE);
+
+    GL_CALL_COUNTER_POINTER(glVertexAttribPointer, STATE);
+    GL_CALL_COUNTER_POINTER(glEnableVertexAttribArray, STATE);
+    GL_CALL_COUNTER_POINTER(glDisableVertexAttribArray, STATE);
+    GL_CALL_COUNTER_POINTER(glVertexAttrib1f, STATE);
+    GL_CALL_COUNTER_POINTER(glVertexAttrib2f, STATE);
+    GL_CALL_COUNTER_POINTER(glVertexAttrib3f, STATE);
+    GL_CALL_COUNTER_POINTER(glVertexAttrib4f, STATE);
+
+    GL_CALL_COUNTER_POINTER(glGenFramebuffers, CALL, &NullGL::genIds);
+    GL_CALL_COUNTER_POINTER(glDeleteFramebuffers, CALL);
+    GL_CALL_COUNTER_POINTER(glBindFramebuffer, STATE);
+    GL_CALL_COUNTER_POINTER(glFramebufferTexture2D, STATE);
+    GL_CALL_COUNTER_POINTER(glFramebufferRenderbuffer, STATE);
+    GL_CALL_COUNTER_POINTER(glCheckFramebufferStatus, CALL, &NullGL::framebufferStatus);
+    GL_CALL_COUNTER_POINTER(glGenRenderbuffers, CALL, &NullGL::genIds);
+    GL_CALL_COUNTER_POINTER(glDeleteRenderbuffers, CALL);
+    GL_CALL_COUNTER_POINTER(glBindRenderbuffer, STATE);
+    GL_CALL_COUNTER_POINTER(glRenderbufferStorage, CALL);
+    GL_CALL_COUNTER_POINTER(glGenFramebuffersEXT, CALL, &NullGL::genIds);
+    GL_CALL_COUNTER_POINTER(glDeleteFramebuffersEXT, CALL);
+    GL_CALL_COUNTER_POINTER(glBindFramebufferEXT, STATE);
+    GL_CALL_COUNTER_POINTER(glFramebufferTexture2DEXT, STATE);
+    GL_CALL_COUNTER_POINTER(glFramebufferRenderbufferEXT, STATE);
+    GL_CALL_COUNTER_POINTER(glCheckFramebufferStatusEXT, CALL, &NullGL::framebufferStatus);
+    GL_CALL_COUNTER_POINTER(glGenRenderbuffersEXT, CALL, &NullGL::genIds);
+    GL_CALL_COUNTER_POINTER(glDeleteRenderbuffersEXT, CALL);
+    GL_CALL_COUNTER_POINTER(glBindRenderbufferEXT, STATE);
+    GL_CALL_COUNTER_POINTER(glRenderbufferStorageEXT, CALL);
+
+#if defined(GLEW_ARB_buffer_storage) && defined(GLEW_ARB_sync)
+    // Only called when GLEW reports the extensions, which it doesn't headless
+    GL_CALL_COUNTER_POINTER(glBufferStorage, UPLOAD);
+    GL_CALL_COUNTER_POINTER(glMapBufferRange, CALL);
+    GL_CALL_COUNTER_POINTER(glFenceSync, CALL);
+    GL_CALL_COUNTER_POINTER(glClientWaitSync, CALL);
+    GL_CALL_COUNTER_POINTER(glDeleteSync, CALL);
+#endif
+
+    // Without glewInit() any of these left out is a null pointer, called by
+    // the painter and the render tree every frame
+    const void *used[] = {
+        (const void *) glGetUniformfv, (const void *) glGetUniformLocation, (const void *) glUseProgram,
+        (const void *) glUniform1f, (const void *) glUniform1i, (const void *) glUniform4f,
+        (const void *) glUniformMatrix4fv, (const void *) glGetAttribLocation,
+        (const void *) glVertexAttribPointer, (const void *) glVertexAttrib1f,
+        (const void *) glEnableVertexAttribArray, (const void *) glDisableVertexAttribArray,
+        (const void *) glActiveTexture, (const void *) glGenerateMipmap,
+        (const void *) glGenBuffers, (const void *) glDeleteBuffers, (const void *) glBindBuffer,
+        (const void *) glBufferData, (const void *) glBufferSubData, (const void *) glMapBuffer,
+        (const void *) glUnmapBuffer, (const void *) glDrawRangeElements,
+        (const void *) glGenFramebuffers, (const void *) glBindFramebuffer,
+        (const void *) glFramebufferTexture2D, (const void *) glCheckFramebufferStatus,
+    };
+    for (const void *pointer: used) {
+        assert(pointer != nullptr);
+        (void) pointer;
+    }
+}
+
+#undef GL_CALL_COUNTER_POINTER
+
+} // namespace al
+
+// ---- GL 1.1 entry points, which GLEW does not load through pointers
+
+#define GL_CALL_COUNTER_CORE(name, kind, params, args) \
+    extern "C" void GLAPIENTRY name params { \
+        al::GLCallCounter::count(al::GLCallCounter::kind); \
+        typedef void (GLAPIENTRY *Next) params; \
+        static Next next = (Next) al::GLCallCounter::next(#name); \
+        if (next) next args; \
+    }
+
+GL_CALL_COUNTER_CORE(glEnable, STATE, (GLenum cap), (cap))
+GL_CALL_COUNTER_CORE(glDisable, STATE, (GLenum cap), (cap))
+GL_CALL_COUNTER_CORE(glBlendFunc, STATE, (GLenum s, GLenum d), (s, d))
+GL_CALL_COUNTER_CORE(glDepthFunc, STATE, (GLenum f), (f))
+GL_CALL_COUNTER_CORE(glDepthMask, STATE, (GLboolean m), (m))
+GL_CALL_COUNTER_CORE(glColorMask, STATE, (GLboolean r, GLboolean g, GLboolean b, GLboolean a), (r, g, b, a))
+GL_CALL_COUNTER_CORE(glCullFace, STATE, (GLenum m), (m))
+GL_CALL_COUNTER_CORE(glFrontFace, STATE, (GLenum m), (m))
+GL_CALL_COUNTER_CORE(glPolygonMode, STATE, (GLenum f, GLenum m), (f, m))
+GL_CALL_COUNTER_CORE(glPolygonOffset, STATE, (GLfloat f, GLfloat u), (f, u))
+GL_CALL_COUNTER_CORE(glShadeModel, STATE, (GLenum m), (m))
+GL_CALL_COUNTER_CORE(glAlphaFunc, STATE, (GLenum f, GLclampf r), (f, r))
+GL_CALL_COUNTER_CORE(glHint, STATE, (GLenum t, GLenum m), (t, m))
+GL_CALL_COUNTER_CORE(glLineWidth, STATE, (GLfloat w), (w))
+GL_CALL_COUNTER_CORE(glPointSize, STATE, (GLfloat s), (s))
+GL_CALL_COUNTER_CORE(glViewport, STATE, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h))
+GL_CALL_COUNTER_CORE(glScissor, STATE, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h))
+GL_CALL_COUNTER_CORE(glClearColor, STATE, (GLclampf r, GLclampf g, GLclampf b, GLclampf a), (r, g, b, a))
+GL_CALL_COUNTER_CORE(glClearDepth, STATE, (GLclampd d), (d))
+GL_CALL_COUNTER_CORE(glPushAttrib, STATE, (GLbitfield m), (m))
+GL_CALL_COUNTER_CORE(glPopAttrib, STATE, (), ())
+GL_CALL_COUNTER_CORE(glPixelStorei, STATE, (GLenum p, GLint v), (p, v))
+GL_CALL_COUNTER_CORE(glBindTexture, STATE, (GLenum t, GLuint id), (t, id))
+GL_CALL_COUNTER_CORE(glTexParameteri, STATE, (GLenum t, GLenum p, GLint v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexParameterf, STATE, (GLenum t, GLenum p, GLfloat v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexParameteriv, STATE, (GLenum t, GLenum p, const GLint *v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexParameterfv, STATE, (GLenum t, GLenum p, const GLfloat *v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexEnvi, STATE, (GLenum t, GLenum p, GLint v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexEnvf, STATE, (GLenum t, GLenum p, GLfloat v), (t, p, v))
+GL_CALL_COUNTER_CORE(glTexEnvfv, STATE, (GLenum t, GLenum p, const GLfloat *v), (t, p, v))
+GL_CALL_COUNTER_CORE(glFogf, STATE, (GLenum p, GLfloat v), (p, v))
+GL_CALL_COUNTER_CORE(glFogi, STATE, (GLenum p, GLint v), (p, v))
+GL_CALL_COUNTER_CORE(glFogfv, STATE, (GLenum p, const GLfloat *v), (p, v))
+GL_CALL_COUNTER_CORE(glLightf, STATE, (GLenum l, GLenum p, GLfloat v), (l, p, v))
+GL_CALL_COUNTER_CORE(glLighti, STATE, (GLenum l, GLenum p, GLint v), (l, p, v))
+GL_CALL_COUNTER_CORE(glLightfv, STATE, (GLenum l, GLenum p, const GLfloat *v), (l, p, v))
+GL_CALL_COUNTER_CORE(glLightModelf, STATE, (GLenum p, GLfloat v), (p, v))
+GL_CALL_COUNTER_CORE(glLightModeli, STATE, (GLenum p, GLint v), (p, v))
+GL_CALL_COUNTER_CORE(glLightModelfv, STATE, (GLenum p, const GLfloat *v), (p, v))
+GL_CALL_COUNTER_CORE(glMaterialf, STATE, (GLenum f, GLenum p, GLfloat v), (f, p, v))
+GL_CALL_COUNTER_CORE(glMateriali, STATE, (GLenum f, GLenum p, GLint v), (f, p, v))
+GL_CALL_COUNTER_CORE(glMaterialfv, STATE, (GLenum f, GLenum p, const GLfloat *v), (f, p, v))
+GL_CALL_COUNTER_CORE(glColorMaterial, STATE, (GLenum f, GLenum m), (f, m))
+GL_CALL_COUNTER_CORE(glEnableClientState, STATE, (GLenum a), (a))
+GL_CALL_COUNTER_CORE(glDisableClientState, STATE, (GLenum a), (a))
+GL_CALL_COUNTER_CORE(glVertexPointer, STATE, (GLint n, GLenum t, GLsizei s, const GLvoid *p), (n, t, s, p))
+GL_CALL_COUNTER_CORE(glNormalPointer, STATE, (GLenum t, GLsizei s, const GLvoid *p), (t, s, p))
+GL_CALL_COUNTER_CORE(glColorPointer, STATE, (GLint n, GLenum t, GLsizei s, const GLvoid *p), (n, t, s, p))
+GL_CALL_COUNTER_CORE(glTexCoordPointer, STATE, (GLint n, GLenum t, GLsizei s, const GLvoid *p), (n, t, s, p))
+
+GL_CALL_COUNTER_CORE(glClear, CALL, (GLbitfield m), (m))
+GL_CALL_COUNTER_CORE(glFlush, CALL, (), ())
+GL_CALL_COUNTER_CORE(glFinish, CALL, (), ())
+GL_CALL_COUNTER_CORE(glMatrixMode, CALL, (GLenum m), (m))
+GL_CALL_COUNTER_CORE(glLoadIdentity, CALL, (), ())
+GL_CALL_COUNTER_CORE(glLoadMatrixf, CALL, (const GLfloat *m), (m))
+GL_CALL_COUNTER_CORE(glLoadMatrixd, CALL, (const GLdouble *m), (m))
+GL_CALL_COUNTER_CORE(glMultMatrixf, CALL, (const GLfloat *m), (m))
+GL_CALL_COUNTER_CORE(glMultMatrixd, CALL, (const GLdouble *m), (m))
+GL_CALL_COUNTER_CORE(glPushMatrix, CALL, (), ())
+GL_CALL_COUNTER_CORE(glPopMatrix, CALL, (), ())
+GL_CALL_COUNTER_CORE(glTranslatef, CALL, (GLfloat x, GLfloat y, GLfloat z), (x, y, z))
+GL_CALL_COUNTER_CORE(glTranslated, CALL, (GLdouble x, GLdouble y, GLdouble z), (x, y, z))
+GL_CALL_COUNTER_CORE(glRotatef, CALL, (GLfloat a, GLfloat x, GLfloat y, GLfloat z), (a, x, y, z))
+GL_CALL_COUNTER_CORE(glRotated, CALL, (GLdouble a, GLdouble x, GLdouble y, GLdouble z), (a, x, y, z))
+GL_CALL_COUNTER_CORE(glScalef, CALL, (GLfloat x, GLfloat y, GLfloat z), (x, y, z))
+GL_CALL_COUNTER_CORE(glScaled, CALL, (GLdouble x, GLdouble y, GLdouble z), (x, y, z))
+GL_CALL_COUNTER_CORE(glColor3f, CALL, (GLfloat r, GLfloat g, GLfloat b), (r, g, b))
+GL_CALL_COUNTER_CORE(glColor4f, CALL, (GLfloat r, GLfloat g, GLfloat b, GLfloat a), (r, g, b, a))
+GL_CALL_COUNTER_CORE(glColor4fv, CALL, (const GLfloat *c), (c))
+GL_CALL_COUNTER_CORE(glNormal3f, CALL, (GLfloat x, GLfloat y, GLfloat z), (x, y, z))
+GL_CALL_COUNTER_CORE(glTexCoord2f, CALL, (GLfloat s, GLfloat t), (s, t))
+GL_CALL_COUNTER_CORE(glVertex3f, CALL, (GLfloat x, GLfloat y, GLfloat z), (x, y, z))
+GL_CALL_COUNTER_CORE(glBegin, CALL, (GLenum m), (m))
+GL_CALL_COUNTER_CORE(glEnd, CALL, (), ())
+GL_CALL_COUNTER_CORE(glDeleteTextures, CALL, (GLsizei n, const GLuint *ids), (n, ids))
+GL_CALL_COUNTER_CORE(glReadPixels, CALL, (GLint x, GLint y, GLsizei w, GLsizei h, GLenum f, GLenum t, GLvoid *p), (x, y, w, h, f, t, p))
+GL_CALL_COUNTER_CORE(glCopyTexSubImage2D, CALL, (GLenum t, GLint l, GLint xo, GLint yo, GLint x, GLint y, GLsizei w, GLsizei h), (t, l, xo, yo, x, y, w, h))
+
+GL_CALL_COUNTER_CORE(glTexImage1D, UPLOAD, (GLenum t, GLint l, GLint i, GLsizei w, GLint b, GLenum f, GLenum ty, const GLvoid *p), (t, l, i, w, b, f, ty, p))
+GL_CALL_COUNTER_CORE(glTexImage2D, UPLOAD, (GLenum t, GLint l, GLint i, GLsizei w, GLsizei h, GLint b, GLenum f, GLenum ty, const GLvoid *p), (t, l, i, w, h, b, f, ty, p))
+GL_CALL_COUNTER_CORE(glTexSubImage2D, UPLOAD, (GLenum t, GLint l, GLint x, GLint y, GLsizei w, GLsizei h, GLenum f, GLenum ty, const GLvoid *p), (t, l, x, y, w, h, f, ty, p))
+
+#undef GL_CALL_COUNTER_CORE
+
+// Entry points that draw, or whose results are used
+
+#define GL_CALL_COUNTER_NEXT(name, result, params) \
+    typedef result (GLAPIENTRY *Next) params; \
+    static Next next = (Next) al::GLCallCounter::next(#name)
+
+extern "C" void GLAPIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    al::GLCallCounter::draw(count);
+    GL_CALL_COUNTER_NEXT(glDrawArrays, void, (GLenum, GLint, GLsizei));
+    if (next) next(mode, first, count);
+}
+
+extern "C" void GLAPIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {
+    al::GLCallCounter::draw(count);
+    GL_CALL_COUNTER_NEXT(glDrawElements, void, (GLenum, GLsizei, GLenum, const GLvoid *));
+    if (next) next(mode, count, type, indices);
+}
+
+extern "C" void GLAPIENTRY glGenTextures(GLsizei n, GLuint *ids) {
+    al::GLCallCounter::count(al::GLCallCounter::CALL);
+    GL_CALL_COUNTER_NEXT(glGenTextures, void, (GLsizei, GLuint *));
+    if (next) next(n, ids);
+    else al::NullGL::genIds(n, ids);
+}
+
+extern "C" GLenum GLAPIENTRY glGetError() {
+    GL_CALL_COUNTER_NEXT(glGetError, GLenum, ());
+    return next ? next() : GL_NO_ERROR;
+}
+
+extern "C" GLboolean GLAPIENTRY glIsEnabled(GLenum cap) {
+    GL_CALL_COUNTER_NEXT(glIsEnabled, GLboolean, (GLenum));
+    return next ? next(cap) : GL_FALSE;
+}
+
+extern "C" const GLubyte * GLAPIENTRY glGetString(GLenum name) {
+    GL_CALL_COUNTER_NEXT(glGetString, const GLubyte *, (GLenum));
+    return next ? next(name) : (const GLubyte *) (name == GL_VERSION ? "2.1 null" : "null");
+}
+
+namespace al {
+// Number of values a glGet*v() query writes, for the ones that matter to allocore
+inline int glGetCount(GLenum pname) {
+    switch (pname) {
+    case GL_VIEWPORT: case GL_SCISSOR_BOX: case GL_COLOR_CLEAR_VALUE: return 4;
+    case GL_MODELVIEW_MATRIX: case GL_PROJECTION_MATRIX: case GL_TEXTURE_MATRIX: return 16;
+    default: return 1;
+    }
+}
+}
+
+#define GL_CALL_COUNTER_GET(name, type) \
+    extern "C" void GLAPIENTRY name(GLenum pname, type *params) { \
+        GL_CALL_COUNTER_NEXT(name, void, (GLenum, type *)); \
+        if (next) next(pname, params); \
+        else std::memset(params, 0, al::glGetCount(pname) * sizeof(type)); \
+    }
+
+GL_CALL_COUNTER_GET(glGetBooleanv, GLboolean)
+GL_CALL_COUNTER_GET(glGetIntegerv, GLint)
+GL_CALL_COUNTER_GET(glGetFloatv, GLfloat)
+GL_CALL_COUNTER_GET(glGetDoublev, GLdouble)
+
+#undef GL_CALL_COUNTER_GET
+
+extern "C" void GLAPIENTRY glGetTexLevelParameteriv(GLenum target, GLint level, GLenum pname, GLint *params) {
+    GL_CALL_COUNTER_NEXT(glGetTexLevelParameteriv, void, (GLenum, GLint, GLenum, GLint *));
+    if (next) next(target, level, pname, params);
+    else *params = 0;
+}
+
+#undef GL_CALL_COUNTER_NEXT
+
+#endif // GL_CALL_COUNTER_HPP
@@ -53,7 +53,9 @@ Lance Putnam, 6/2011, putnam.lance@gmail.com
 */
 
 #include <iostream>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "Cuttlebone/Cuttlebone.hpp"
 
@@ -71,6 +73,8 @@ Lance Putnam, 6/2011, putnam.lance@gmail.com
 #include "Gamma/Oscillator.h"
 
 #include "common.hpp"
+#include "frame_profiler.hpp"
+#include "noise_field.hpp"
 
 //#define SURROUND
 using namespace al;
@@ -117,157 +121,19 @@ std::string effectFragmentCode() {
   return R"(
 #version 120
 
-//
-// Description : Array and textureless GLSL 2D/3D/4D simplex
-//               noise functions.
-//      Author : Ian McEwan, Ashima Arts.
-//  Maintainer : ijm
-//     Lastmod : 20110822 (ijm)
-//     License : Copyright (C) 2011 Ashima Arts. All rights reserved.
-//               Distributed under the MIT License. See LICENSE file.
-//               https://github.com/ashima/webgl-noise
-//
-
-vec4 mod289(vec4 x) {
-  return x - floor(x * (1.0 / 289.0)) * 289.0; }
-
-float mod289(float x) {
-  return x - floor(x * (1.0 / 289.0)) * 289.0; }
-
-vec4 permute(vec4 x) {
-     return mod289(((x*34.0)+1.0)*x);
-}
-
-float permute(float x) {
-     return mod289(((x*34.0)+1.0)*x);
-}
-
-vec4 taylorInvSqrt(vec4 r)
-{
-  return 1.79284291400159 - 0.85373472095314 * r;
-}
-
-float taylorInvSqrt(float r)
-{
-  return 1.79284291400159 - 0.85373472095314 * r;
-}
-
-vec4 grad4(float j, vec4 ip)
-{
-    const vec4 ones = vec4(1.0, 1.0, 1.0, -1.0);
-    vec4 p,s;
-
-    p.xyz = floor( fract (vec3(j) * ip.xyz) * 7.0) * ip.z - 1.0;
-    p.w = 1.5 - dot(abs(p.xyz), ones.xyz);
-    s = vec4(lessThan(p, vec4(0.0)));
-    p.xyz = p.xyz + (s.xyz*2.0 - 1.0) * s.www;
-
-    return p;
-}
-
-// (sqrt(5) - 1)/4 = F4, used once below
-#define F4 0.309016994374947451
-
-float snoise(vec4 v)
-{
-  const vec4  C = vec4( 0.138196601125011,  // (5 - sqrt(5))/20  G4
-                        0.276393202250021,  // 2 * G4
-                        0.414589803375032,  // 3 * G4
-                       -0.447213595499958); // -1 + 4 * G4
-
-  // First corner
-  vec4 i  = floor(v + dot(v, vec4(F4)) );
-  vec4 x0 = v -   i + dot(i, C.xxxx);
-
-  // Other corners
-
-  // Rank sorting originally contributed by Bill Licea-Kane, AMD (formerly ATI)
-  vec4 i0;
-  vec3 isX = step( x0.yzw, x0.xxx );
-  vec3 isYZ = step( x0.zww, x0.yyz );
-  //  i0.x = dot( isX, vec3( 1.0 ) );
-  i0.x = isX.x + isX.y + isX.z;
-  i0.yzw = 1.0 - isX;
-  //  i0.y += dot( isYZ.xy, vec2( 1.0 ) );
-  i0.y += isYZ.x + isYZ.y;
-  i0.zw += 1.0 - isYZ.xy;
-  i0.z += isYZ.z;
-  i0.w += 1.0 - isYZ.z;
-
-  // i0 now contains the unique values 0,1,2,3 in each channel
-  vec4 i3 = clamp( i0, 0.0, 1.0 );
-  vec4 i2 = clamp( i0-1.0, 0.0, 1.0 );
-  vec4 i1 = clamp( i0-2.0, 0.0, 1.0 );
-
-  //  x0 = x0 - 0.0 + 0.0 * C.xxxx
-  //  x1 = x0 - i1  + 1.0 * C.xxxx
-  //  x2 = x0 - i2  + 2.0 * C.xxxx
-  //  x3 = x0 - i3  + 3.0 * C.xxxx
-  //  x4 = x0 - 1.0 + 4.0 * C.xxxx
-  vec4 x1 = x0 - i1 + C.xxxx;
-  vec4 x2 = x0 - i2 + C.yyyy;
-  vec4 x3 = x0 - i3 + C.zzzz;
-  vec4 x4 = x0 + C.wwww;
-
-  // Permutations
-  i = mod289(i);
-  float j0 = permute( permute( permute( permute(i.w) + i.z) + i.y) + i.x);
-  vec4 j1 = permute( permute( permute( permute (
-             i.w + vec4(i1.w, i2.w, i3.w, 1.0 ))
-           + i.z + vec4(i1.z, i2.z, i3.z, 1.0 ))
-           + i.y + vec4(i1.y, i2.y, i3.y, 1.0 ))
-           + i.x + vec4(i1.x, i2.x, i3.x, 1.0 ));
-
-  // Gradients: 7x7x6 points over a cube, mapped onto a 4-cross polytope
-  // 7*7*6 = 294, which is close to the ring size 17*17 = 289.
-  vec4 ip = vec4(1.0/294.0, 1.0/49.0, 1.0/7.0, 0.0) ;
-
-  vec4 p0 = grad4(j0,   ip);
-  vec4 p1 = grad4(j1.x, ip);
-  vec4 p2 = grad4(j1.y, ip);
-  vec4 p3 = grad4(j1.z, ip);
-  vec4 p4 = grad4(j1.w, ip);
-
-  // Normalise gradients
-  vec4 norm = taylorInvSqrt(vec4(dot(p0,p0), dot(p1,p1), dot(p2, p2), dot(p3,p3)));
-  p0 *= norm.x;
-  p1 *= norm.y;
-  p2 *= norm.z;
-  p3 *= norm.w;
-  p4 *= taylorInvSqrt(dot(p4,p4));
-
-  // Mix contributions from the five corners
-  vec3 m0 = max(0.6 - vec3(dot(x0,x0), dot(x1,x1), dot(x2,x2)), 0.0);
-  vec2 m1 = max(0.6 - vec2(dot(x3,x3), dot(x4,x4)            ), 0.0);
-  m0 = m0 * m0;
-  m1 = m1 * m1;
-  return 49.0 * ( dot(m0*m0, vec3( dot( p0, x0 ), dot( p1, x1 ), dot( p2, x2 )))
-               + dot(m1*m1, vec2( dot( p3, x3 ), dot( p4, x4 ) ) ) ) ;
-
-}
-
 uniform sampler2D texture0;
 uniform sampler2D wb_tex;
-uniform float time;
-uniform float radius;
+// 3 octaves of 4D simplex noise over (radius * dir, time), computed on the
+// CPU (see noise_field.hpp), with one time slice in each channel
+uniform samplerCube noise_tex;
+uniform vec3 slice_weights;
 
 void main() {
   vec3 dir = texture2D(wb_tex, gl_TexCoord[0].st).rgb;
   dir *= 2.0;
   dir -= 1.0; // [0:1] to [-1:+1]
 
-  vec4 st1 = vec4(radius * dir, time); // dir in space + time
-  float n1 = snoise(st1);
-
-  vec4 st2 = 2 * vec4(radius * dir, time);
-  float n2 = snoise(st2);
-
-  vec4 st3 = 4 * vec4(radius * dir, time);
-  float n3 = snoise(st3);
-
-  float n = (n1 + 0.5 * n2 + 0.25 * n3) / (1.0 + 0.5 + 0.25);
-  n += 1.0;
-  n *= 0.5; // [-1:+1] to [0:1]
+  float n = dot(textureCube(noise_tex, dir).rgb, slice_weights); // [0:1]
 
   vec4 textureColor = texture2D(texture0, gl_TexCoord[0].st);
   float multiplier = 0.75 + 0.5 * n; // 0.25 + 0.75 * n;
@@ -280,6 +146,27 @@ struct Renderer : public OmniStereoGraphicsRenderer2 {
 public:
 
   bool do_aftereffect = false;
+  bool show_profile = false; // Frame timings over the window, toggled with 'f' as in control
+
+    struct ProfileKey : InputEventHandler {
+        bool *show;
+        ProfileKey(bool *show) : show(show) {}
+        bool onKeyDown(const Keyboard &k) override {
+            if (k.key() == 'f') {
+                *show = !*show;
+            }
+            return true;
+        }
+    } mProfileKey {&show_profile};
+
+    // Timings of each stage of the frame, sent to control once a second
+    osc::Send mProfileSender {CONTROL_IN_PORT, CONTROL_IP_ADDRESS}; // Used by mProfiler's collector until it stops
+    FrameProfiler mProfiler {hostName()};
+    int mTakeStage = mProfiler.stage("take");
+    int mAnimateStage = mProfiler.stage("animate");
+    int mDrawStage = mProfiler.stage("draw");
+    int mAfterEffectStage = mProfiler.stage("afterEffect");
+    std::unique_ptr<TextOverlay> mProfileOverlay; // Created with the first report shown
 
     SharedState mState;
     SharedPainter mPainter;
@@ -288,14 +175,18 @@ public:
     Texture temp_capture_tex;
     int capture_idx = 0;
     RBO rbo;
-    FBO fbo;
+    FBO capture_fbo[2]; // Each with its capture_tex attached
     ShaderProgram effectShader;
+    int mTargetWidth = 0, mTargetHeight = 0; // Size the targets are allocated for
 
     // for recording warp and blend
     RBO wb_rbo;
     FBO wb_fbo;
     Texture wb_tex;
     ShaderProgram wb_shader;
+    Mesh mDirectionQuad {Graphics::TRIANGLE_STRIP};
+    std::vector<double> mWarpKey; // Warp maps wb_tex was drawn for, see currentWarpKey()
+    NoiseCubeMap mNoise; // Modulation of the after-effect, by direction and time
 
     SharedState& state() {return mState;}
 
@@ -342,6 +233,8 @@ public:
 //        displayMode(Window::STEREO_BUF);
         omni().mode(OmniStereo::ACTIVE);
         omni().stereo(true);
+        Window::append(mProfileKey);
+        mProfiler.startCollector([this]() { mProfiler.send(mProfileSender); });
 	}
 
 	virtual bool onCreate() override {
@@ -364,6 +257,17 @@ public:
 
         mPainter.onInit();
 
+        // Cull the scene to the directions this node's projectors show
+        for (int i = 0; i < omni().numProjections(); i++) {
+            Array &warp = omni().projection(i).warp().array();
+            if (warp.data.ptr && warp.header.type == AlloFloat32Ty && warp.header.components >= 3) {
+                size_t step = 3; // Every third texel is enough for the bounds
+                size_t count = warp.header.dim[0] * warp.header.dim[1] / step;
+                mPainter.mCuller.addView((float *) warp.data.ptr, count, warp.header.components * step);
+            }
+        }
+        mPainter.mCuller.margin(lens().eyeSep() + 0.1);
+
         auto& s = shader();
         s.begin();
         // the shader will look for texture0 uniform's data
@@ -384,6 +288,7 @@ public:
         effectShader.begin();
         effectShader.uniform("texture0", 0);
         effectShader.uniform("wb_tex", 1);
+        effectShader.uniform("noise_tex", 2);
         effectShader.end();
 
         Shader wb_vert, wb_frag;
@@ -397,6 +302,15 @@ public:
         wb_shader.uniform("texture_warp", 0);
         // wb_shader.uniform("texture_blend", 1);
         wb_shader.end();
+
+        mDirectionQuad.vertex(-1, -1, 0);
+        mDirectionQuad.vertex( 1, -1, 0);
+        mDirectionQuad.vertex(-1,  1, 0);
+        mDirectionQuad.vertex( 1,  1, 0);
+        mDirectionQuad.texCoord(0, 0);
+        mDirectionQuad.texCoord(1, 0);
+        mDirectionQuad.texCoord(0, 1);
+        mDirectionQuad.texCoord(1, 1);
     }
 
     virtual void start() {
@@ -405,7 +319,19 @@ public:
     }
 
     virtual void onAnimate(double dt) override {
-        int got = mTaker.get(state());
+        mProfiler.beginFrame();
+        if (mProfiler.newReport() && show_profile) {
+            if (!mProfileOverlay) {
+                mProfileOverlay.reset(new TextOverlay(TextRenderModule::defaultFontPath()));
+            }
+            mProfileOverlay->lines(mProfiler.lines());
+        }
+        int got;
+        {
+            FrameProfiler::Scope take(mProfiler, mTakeStage);
+            got = mTaker.get(state());
+        }
+        FrameProfiler::Scope animate(mProfiler, mAnimateStage);
 //        if (got > 0) {
 //            std::cout << "got " << got << std::endl;
 //        }
@@ -416,94 +342,64 @@ public:
           first_frame = false;
         }
         // Update wave equation
+        float *heights = mPainter.mWater.heights();
         for(int j=0; j<Ny; ++j){
             for(int i=0; i<Nx; ++i){
                 int idx = j*Nx + i;
-                mPainter.waterMesh.vertices()[idx].z = state().wave[indexAt(i,j, state().zcurr)] / state().decay;
+                heights[idx] = state().wave[indexAt(i,j, state().zcurr)] / state().decay;
             }
         }
 
-        mPainter.waterMesh.generateNormals();
+        mPainter.mCuller.enable(omniEnable());
+        mPainter.onAnimate(pose);
     }
 
     virtual void onDraw(Graphics& g) override {
+        FrameProfiler::Scope draw(mProfiler, mDrawStage);
         mPainter.onDraw(g);
     }
 
     void afterEffect(Graphics& g) override {
+        {
+            FrameProfiler::Scope afterEffect(mProfiler, mAfterEffectStage);
+            if (do_aftereffect) {
+                rippleEffect(g);
+            }
+        }
+        if (show_profile && mProfileOverlay) {
+            g.viewport(0, 0, width(), height());
+            mProfileOverlay->draw(g, width(), height());
+        }
+    }
 
-        if (!do_aftereffect) return;
-
-        // resize if needed
-        capture_tex[0].resize(width(), height());
-        capture_tex[1].resize(width(), height());
-        temp_capture_tex.resize(width(), height());
-        rbo.resize(width(), height());
-
-        wb_tex.resize(width(), height());
-        wb_rbo.resize(width(), height());
-        wb_fbo.attachRBO(rbo, FBO::DEPTH_ATTACHMENT);
-        wb_fbo.attachTexture2D(wb_tex.id(), FBO::COLOR_ATTACHMENT0);
-
-        // prepare wb texture
-        wb_fbo.begin();
-        g.clearColor(1, 0, 0, 1);
-        g.clear(Graphics::COLOR_BUFFER_BIT | Graphics::DEPTH_BUFFER_BIT);
-        g.blending(false);
-        wb_shader.begin();
-        auto& o = omni();
-        for (int i = 0; i < o.numProjections(); i += 1) {
-            OmniStereo::Projection& p = o.projection(i);
-            Viewport& v = p.viewport();
-            Viewport viewport(v.l * width(), v.b * height(), v.w * width(), v.h * height());
-            g.viewport(viewport); // also scissors
-
-            g.clearColor(1, 1, 1, 1);
-            g.clear(Graphics::COLOR_BUFFER_BIT | Graphics::DEPTH_BUFFER_BIT);
-
-            g.projection(Matrix4d::identity());
-            g.modelView(Matrix4d::identity());
-
-            p.warp().bind(0);
-            // p.blend().bind(1);
-
-            Mesh m {Graphics::TRIANGLE_STRIP};
-            m.vertex(-1, -1, 0);
-            m.vertex( 1, -1, 0);
-            m.vertex(-1,  1, 0);
-            m.vertex( 1,  1, 0);
-
-            m.texCoord(0, 0);
-            m.texCoord(1, 0);
-            m.texCoord(0, 1);
-            m.texCoord(1, 1);
-
-            g.draw(m);
+    void rippleEffect(Graphics& g) {
+        resizeTargets();
 
-            p.warp().unbind(0);
-            // p.blend().unbind(1);
+        // The direction of each pixel only changes with the warp maps
+        std::vector<double> warpKey = currentWarpKey();
+        if (warpKey != mWarpKey) {
+            renderDirections(g);
+            mWarpKey = warpKey;
         }
-        wb_shader.end();
-        wb_fbo.end();
-        g.viewport(0, 0, width(), height()); // put back viewport
 
         // copy the result from omni rendering
         temp_capture_tex.copyFrameBuffer();
 
         // add ripple to capture
         // use warp and blend texture made above
-        fbo.attachRBO(rbo, FBO::DEPTH_ATTACHMENT);
-        fbo.attachTexture2D(capture_tex[capture_idx].id(), FBO::COLOR_ATTACHMENT0);
-        fbo.begin();
+        capture_fbo[capture_idx].begin();
         g.blending(false);
+        mNoise.update(state().casasPhase * 0.1f);
+        const float *weights = mNoise.weights();
         effectShader.begin();
-        effectShader.uniform("radius", 2.5);
-        effectShader.uniform("time", state().casasPhase * 0.1f);
+        effectShader.uniform("slice_weights", weights[0], weights[1], weights[2]);
         wb_tex.bind(1);
+        mNoise.bind(2);
         temp_capture_tex.quadViewport(g);
+        mNoise.unbind(2);
         wb_tex.unbind(1);
         effectShader.end();
-        fbo.end();
+        capture_fbo[capture_idx].end();
 
         // clear all        
         g.clearColor(0, 0, 0, 1);
@@ -532,6 +428,84 @@ public:
         capture_idx = 1- capture_idx;
     }
 
+    // Resizes the render targets and attaches them only when the window size changes
+    void resizeTargets() {
+        if (width() == mTargetWidth && height() == mTargetHeight) {
+            return;
+        }
+        mTargetWidth = width();
+        mTargetHeight = height();
+
+        Texture *textures[] = {&capture_tex[0], &capture_tex[1], &temp_capture_tex, &wb_tex};
+        for (Texture *texture: textures) {
+            texture->resize(width(), height());
+            // Binding creates the texture and its storage, so it can be attached now
+            texture->bind();
+            texture->unbind();
+        }
+        rbo.resize(width(), height());
+        wb_rbo.resize(width(), height());
+
+        wb_fbo.attachRBO(wb_rbo, FBO::DEPTH_ATTACHMENT);
+        wb_fbo.attachTexture2D(wb_tex.id(), FBO::COLOR_ATTACHMENT0);
+        for (int i = 0; i < 2; i++) {
+            capture_fbo[i].attachRBO(rbo, FBO::DEPTH_ATTACHMENT);
+            capture_fbo[i].attachTexture2D(capture_tex[i].id(), FBO::COLOR_ATTACHMENT0);
+        }
+        mWarpKey.clear(); // Directions must be drawn again at the new size
+    }
+
+    // Changes when a warp map or projection viewport changes
+    std::vector<double> currentWarpKey() {
+        std::vector<double> key;
+        auto& o = omni();
+        key.push_back(o.numProjections());
+        for (int i = 0; i < o.numProjections(); i++) {
+            OmniStereo::Projection& p = o.projection(i);
+            Array &warp = p.warp().array();
+            key.push_back((double) (uintptr_t) warp.data.ptr);
+            key.push_back(warp.header.dim[0]);
+            key.push_back(warp.header.dim[1]);
+            Viewport& v = p.viewport();
+            key.push_back(v.l);
+            key.push_back(v.b);
+            key.push_back(v.w);
+            key.push_back(v.h);
+        }
+        return key;
+    }
+
+    // Renders each projection's warp map as directions into wb_tex
+    void renderDirections(Graphics& g) {
+        wb_fbo.begin();
+        g.clearColor(1, 0, 0, 1);
+        g.clear(Graphics::COLOR_BUFFER_BIT | Graphics::DEPTH_BUFFER_BIT);
+        g.blending(false);
+        wb_shader.begin();
+        auto& o = omni();
+        for (int i = 0; i < o.numProjections(); i += 1) {
+            OmniStereo::Projection& p = o.projection(i);
+            Viewport& v = p.viewport();
+            Viewport viewport(v.l * width(), v.b * height(), v.w * width(), v.h * height());
+            g.viewport(viewport); // also scissors
+
+            g.clearColor(1, 1, 1, 1);
+            g.clear(Graphics::COLOR_BUFFER_BIT | Graphics::DEPTH_BUFFER_BIT);
+
+            g.projection(Matrix4d::identity());
+            g.modelView(Matrix4d::identity());
+
+            p.warp().bind(0);
+            // p.blend().bind(1);
+            g.draw(mDirectionQuad);
+            p.warp().unbind(0);
+            // p.blend().unbind(1);
+        }
+        wb_shader.end();
+        wb_fbo.end();
+        g.viewport(0, 0, width(), height()); // put back viewport
+    }
+
 //    virtual void onDrawOmni(OmniStereo &om) override {
 //        mPainter.onDraw(om.graphics() );
 //	}
@@ -0,0 +1,233 @@
+/*
+Check and benchmark of the merged grid mesh
+
+Builds the sphere and cylinder grid the way SharedPainter used to draw it,
+one mesh per node drawn through nested translate()/rotate() calls, and
+checks that GridRenderer::update() writes the same vertices into its single
+merged mesh. Also checks that with a VisibilityCuller the index list only
+draws the visible instances, complete. Then times update() per frame.
+
+No GL context is needed.
+
+Usage:
+    grid_bench [frames=200]
+*/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+
+#include "common.hpp"
+
+using namespace al;
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// Column major 4x4 matrix stack with the semantics of glTranslate and glRotate
+struct MatrixStack {
+    vector<array<float, 16>> stack {{{1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1}}};
+
+    void push() { stack.push_back(stack.back()); }
+    void pop() { stack.pop_back(); }
+
+    void multiply(const float *b) {
+        array<float, 16> &a = stack.back();
+        array<float, 16> r;
+        for (int c = 0; c < 4; c++) {
+            for (int row = 0; row < 4; row++) {
+                r[c * 4 + row] = a[row] * b[c * 4] + a[4 + row] * b[c * 4 + 1]
+                        + a[8 + row] * b[c * 4 + 2] + a[12 + row] * b[c * 4 + 3];
+            }
+        }
+        a = r;
+    }
+
+    void translate(float x, float y, float z) {
+        const float t[16] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  x, y, z, 1};
+        multiply(t);
+    }
+
+    void rotate(float degrees, float x, float y, float z) {
+        float length = std::sqrt(x * x + y * y + z * z);
+        x /= length; y /= length; z /= length;
+        float c = std::cos(degrees * M_PI / 180.0), s = std::sin(degrees * M_PI / 180.0), k = 1 - c;
+        const float r[16] = {x * x * k + c,     y * x * k + z * s, x * z * k - y * s, 0,
+                             x * y * k - z * s, y * y * k + c,     y * z * k + x * s, 0,
+                             x * z * k + y * s, y * z * k - x * s, z * z * k + c,     0,
+                             0, 0, 0, 1};
+        multiply(r);
+    }
+
+    Vec3f apply(const Vec3f &v) {
+        const array<float, 16> &m = stack.back();
+        return Vec3f(m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12],
+                     m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13],
+                     m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14]);
+    }
+};
+
+// Vertices of the grid as the nested draws placed them: spheres, then vertical and horizontal cylinders
+static vector<Vec3f> referenceGrid(const float *dev, float chaos) {
+    const int nodes = GridRenderer::NUM_NODES;
+    Mesh sphere, vertical, horizontal;
+    addSphere(sphere, 0.09);
+    addCylinder(vertical, 0.02, 1, 24);
+    addCylinder(horizontal, 0.01, 1, 24);
+    vector<Vec3f> spheres, verticals, horizontals;
+
+    MatrixStack g;
+    float prevdev = 0;
+    int count = 0;
+    for (int x = 0; x < GRID_SIZEX; x++) {
+        g.push();
+        g.translate(x, 0, -dev[count]/2);
+        for (int y = 0; y < GRID_SIZEY; y++) {
+            g.push();
+            g.translate(0, y - dev[count]/2, 0);
+            for (int z = 0; z < GRID_SIZEZ; z++) {
+                float d = dev[count];
+                g.push();
+                g.translate(d/-2.0f, 0.0f + prevdev * 2.0, -z + d);
+                for (auto &v: sphere.vertices()) spheres.push_back(g.apply(v));
+                g.push();
+                g.rotate(90, 0, 1, d * chaos);
+                g.translate(0, d, 0);
+                for (auto &v: vertical.vertices()) verticals.push_back(g.apply(v));
+                g.pop();
+                g.push();
+                g.rotate(90, 1, 0, 0);
+                g.translate(d, d - chaos, 0);
+                for (auto &v: horizontal.vertices()) horizontals.push_back(g.apply(v));
+                g.pop();
+                g.pop();
+                prevdev = d;
+                count++;
+            }
+            g.pop();
+        }
+        g.pop();
+    }
+    check(count == nodes, "reference covers every node");
+    spheres.insert(spheres.end(), verticals.begin(), verticals.end());
+    spheres.insert(spheres.end(), horizontals.begin(), horizontals.end());
+    return spheres;
+}
+
+static void checkVertices(GridRenderer &grid, const float *dev, float chaos) {
+    grid.update(dev, chaos);
+    vector<Vec3f> reference = referenceGrid(dev, chaos);
+    Mesh &mesh = grid.mesh();
+    check(mesh.vertices().size() == reference.size(), "one merged vertex per reference vertex");
+    float maxError = 0, maxNormalError = 0;
+    size_t count = std::min<size_t>(mesh.vertices().size(), reference.size());
+    for (size_t i = 0; i < count; i++) {
+        const Vec3f &v = mesh.vertices()[i];
+        maxError = std::max(maxError, (v - reference[i]).mag());
+        maxNormalError = std::max(maxNormalError, std::fabs(mesh.normals()[i].mag() - 1.0f));
+    }
+    cout << "chaos " << chaos << ": max_vertex_error " << maxError
+         << " max_normal_length_error " << maxNormalError << endl;
+    check(maxError < 1e-4f, "merged vertices match the nested draws");
+    check(maxNormalError < 1e-4f, "normals are unit length");
+    check(mesh.indices().size() > 0 && grid.numVisible() == GridRenderer::NUM_INSTANCES,
+          "all instances drawn without a culler");
+}
+
+// Instance of each vertex in the merged mesh, which holds the instances back to back
+static int vertexInstance(unsigned int index) {
+    static size_t sphereVertices = 0, cylinderVertices = 0;
+    if (sphereVertices == 0) {
+        Mesh sphere, cylinder;
+        addSphere(sphere, 0.09);
+        addCylinder(cylinder, 1, 1, 24);
+        sphereVertices = sphere.vertices().size();
+        cylinderVertices = cylinder.vertices().size();
+    }
+    const size_t spheres = GridRenderer::NUM_NODES * sphereVertices;
+    if (index < spheres) {
+        return index / sphereVertices;
+    }
+    return GridRenderer::NUM_NODES + (index - spheres) / cylinderVertices;
+}
+
+static vector<size_t> indicesPerInstance(Mesh &mesh) {
+    vector<size_t> count(GridRenderer::NUM_INSTANCES, 0);
+    for (size_t i = 0; i < mesh.indices().size(); i++) {
+        int instance = vertexInstance(mesh.indices()[i]);
+        if (instance < GridRenderer::NUM_INSTANCES) {
+            count[instance]++;
+        }
+    }
+    return count;
+}
+
+static void checkCulling(GridRenderer &grid, const float *dev, float chaos) {
+    grid.update(dev, chaos);
+    vector<size_t> all = indicesPerInstance(grid.mesh());
+    check(std::count(all.begin(), all.end(), 0) == 0, "every instance indexed");
+
+    // A 20 degree cone straight ahead, as one projector of a node might cover
+    VisibilityCuller culler;
+    const float directions[] = {0.35f, 0, -1,  -0.35f, 0, -1,  0, 0.35f, -1,  0, -0.35f, -1};
+    culler.addView(directions, 4);
+    Vec3f offset(-3, -GRID_SIZEY/1.6, -4);
+    grid.update(dev, chaos, &culler, offset, 2.0f);
+    int visible = grid.numVisible();
+    cout << "culled: " << visible << " of " << GridRenderer::NUM_INSTANCES << " instances visible" << endl;
+    check(visible > 0 && visible < GridRenderer::NUM_INSTANCES, "some instances culled");
+
+    vector<size_t> drawn = indicesPerInstance(grid.mesh());
+    int complete = 0, partial = 0;
+    for (int instance = 0; instance < GridRenderer::NUM_INSTANCES; instance++) {
+        if (drawn[instance] == all[instance]) {
+            complete++;
+        } else if (drawn[instance] > 0) {
+            partial++;
+        }
+    }
+    check(partial == 0, "instances are drawn whole or not at all");
+    check(complete == visible, "every visible instance drawn");
+
+    culler.enable(false);
+    grid.update(dev, chaos, &culler, offset, 2.0f);
+    check(grid.numVisible() == GridRenderer::NUM_INSTANCES, "disabled culler draws everything");
+}
+
+int main(int argc, char *argv[]) {
+    int frames = argc > 1 ? atoi(argv[1]) : 200;
+
+    // Deviations as the simulator's, fixed so runs compare
+    vector<float> dev(GridRenderer::NUM_NODES);
+    for (size_t i = 0; i < dev.size(); i++) {
+        dev[i] = 0.25f + 0.25f * std::sin(i * 1.7f);
+    }
+
+    GridRenderer grid;
+    checkVertices(grid, dev.data(), 0.0f);
+    checkVertices(grid, dev.data(), 0.7f);
+    checkCulling(grid, dev.data(), 0.7f);
+
+    al_sec start = al_steady_time();
+    for (int frame = 0; frame < frames; frame++) {
+        grid.update(dev.data(), frame / (float) frames);
+    }
+    double updateMs = (al_steady_time() - start) * 1000.0 / frames;
+
+    cout << GridRenderer::NUM_INSTANCES << " instances, " << grid.mesh().vertices().size() << " vertices, "
+         << grid.mesh().indices().size() << " indices" << endl;
+    cout << "update_ms " << updateMs << endl;
+    cout << (failures == 0 ? "checks passed" : "checks FAILED") << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,338 @@
+#ifndef GRID_RENDERER_HPP
+#define GRID_RENDERER_HPP
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/graphics/al_Shapes.hpp"
+#include "allocore/types/al_Color.hpp"
+
+#include "visibility_culler.hpp"
+
+/**
+ * @brief Sphere and cylinder grid drawn as one merged mesh
+ *
+ * Every node of the grid uses the same sphere and cylinder meshes. Once per
+ * frame, update() computes one 3x4 transform per instance into a flat array
+ * from the grid deviations and then writes all instances, transformed on the
+ * CPU, into a single indexed mesh. Drawing the grid is then a single draw
+ * instead of three draws and several matrix stack operations per node.
+ * This is not GPU instancing, which GL 2.1 lacks: the mesh holds a
+ * transformed copy of every instance, rewritten each frame.
+ *
+ * When given a VisibilityCuller, instances outside the node's views are
+ * neither transformed nor drawn: the index list only holds the visible
+ * instances and is rebuilt when visibility changes.
+ *
+ * Nothing here touches GL, so update() can run headless.
+ */
+class GridRenderer {
+public:
+    enum {
+        NUM_NODES = GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ,
+        NUM_INSTANCES = NUM_NODES * 3,
+        FLOATS_PER_TRANSFORM = 16 // Four columns of four floats
+    };
+
+    GridRenderer() {
+        Mesh sphere, cylinder;
+        addSphere(sphere, sphereRadius());
+        addCylinder(cylinder, 1, 1, 24); // Radius set per instance
+        appendTriangles(sphere, mSphere);
+        appendTriangles(cylinder, mCylinder);
+
+        float brightness = al::fold(0.5/NUM_NODES, 0.5) + 0.5;
+        Color sphereColor = HSV(0.16, 0.5, brightness);
+        Color verticalColor = HSV(0.13, 0.5, brightness);
+        Color horizontalColor = HSV(0.14, 0.5, brightness);
+
+        // Topology and colors never change, only positions and normals
+        mMesh.primitive(Graphics::TRIANGLES);
+        size_t numVertices = NUM_NODES * (mSphere.vertices.size()/3 + 2 * mCylinder.vertices.size()/3);
+        mMesh.vertices().resize(numVertices);
+        mMesh.normals().resize(numVertices);
+        mMesh.colors().resize(numVertices);
+        unsigned int offset = 0;
+        mIndexStart.resize(NUM_INSTANCES + 1);
+        for (int instance = 0; instance < NUM_INSTANCES; instance++) {
+            const Shape &shape = instanceShape(instance);
+            Color color = instance < NUM_NODES ? sphereColor :
+                                                 (instance < 2 * NUM_NODES ? verticalColor : horizontalColor);
+            mIndexStart[instance] = mIndices.size();
+            for (unsigned int index: shape.indices) {
+                mIndices.push_back(offset + index);
+                mMesh.index(offset + index);
+            }
+            size_t count = shape.vertices.size()/3;
+            for (size_t i = 0; i < count; i++) {
+                mMesh.colors()[offset + i] = color;
+            }
+            offset += count;
+        }
+        mIndexStart[NUM_INSTANCES] = mIndices.size();
+        mTransforms.resize(NUM_INSTANCES * FLOATS_PER_TRANSFORM);
+        mVisible.assign(NUM_INSTANCES, 1);
+    }
+
+    /**
+     * Computes instance transforms from deviations and rebuilds the mesh.
+     * With a culler, the grid is drawn scaled by scale after translating by
+     * offset, which is needed to place instances in world coordinates.
+     */
+    void update(const float *dev, float chaos, const VisibilityCuller *culler = nullptr,
+                const Vec3f &offset = Vec3f(0, 0, 0), float scale = 1.0f) {
+        buildTransforms(dev, chaos, mTransforms.data());
+        bool changed = false;
+        for (int instance = 0; instance < NUM_INSTANCES; instance++) {
+            char visible = 1;
+            if (culler && culler->active()) {
+                const float *m = &mTransforms[instance * FLOATS_PER_TRANSFORM];
+                Vec3f center = (Vec3f(m[12], m[13], m[14]) + offset) * scale;
+                // Cylinders are one unit long from their origin
+                float radius = (instance < NUM_NODES ? sphereRadius() : 1.0f) * scale;
+                visible = culler->visible(center, radius) ? 1 : 0;
+            }
+            changed = changed || visible != mVisible[instance];
+            mVisible[instance] = visible;
+        }
+        if (changed) {
+            buildIndices();
+        }
+
+        float *vertices = mMesh.vertices()[0].elems();
+        float *normals = mMesh.normals()[0].elems();
+        for (int instance = 0; instance < NUM_INSTANCES; instance++) {
+            const Shape &shape = instanceShape(instance);
+            size_t count = shape.vertices.size()/3;
+            if (mVisible[instance]) {
+                transformVertices(&mTransforms[instance * FLOATS_PER_TRANSFORM],
+                                  shape.vertices.data(), shape.normals.data(), count,
+                                  vertices, normals);
+            }
+            vertices += count * 3;
+            normals += count * 3;
+        }
+    }
+
+    Mesh &mesh() { return mMesh; }
+
+    int numVisible() {
+        int count = 0;
+        for (char visible: mVisible) {
+            count += visible;
+        }
+        return count;
+    }
+
+    const float *transforms() { return mTransforms.data(); }
+
+    /**
+     * Writes the transform for every instance: spheres first, then vertical
+     * and horizontal cylinders, each in x, y, z grid order. This reproduces
+     * the nested translate()/rotate() calls the grid used to be drawn with,
+     * relative to the grid's global scale and offset.
+     */
+    static void buildTransforms(const float *dev, float chaos, float *out) {
+        float *spheres = out;
+        float *verticals = out + NUM_NODES * FLOATS_PER_TRANSFORM;
+        float *horizontals = out + 2 * NUM_NODES * FLOATS_PER_TRANSFORM;
+        float prevdev = 0;
+        for (int x = 0; x < GRID_SIZEX; x++) {
+            float devX = *dev;
+            for (int y = 0; y < GRID_SIZEY; y++) {
+                float devY = *dev;
+                for (int z = 0; z < GRID_SIZEZ; z++) {
+                    float d = *dev;
+                    float tx = x - d / 2.0f;
+                    float ty = y - devY / 2.0f + prevdev * 2.0f;
+                    float tz = -devX / 2.0f - z + d;
+
+                    identity(spheres, tx, ty, tz);
+
+                    // rotate(90, 0, 1, d * chaos), translate(0, d, 0)
+                    float ax = 0, ay = 1, az = d * chaos;
+                    float norm = std::sqrt(ay * ay + az * az);
+                    ay /= norm; az /= norm;
+                    rotation90(verticals, ax, ay, az);
+                    translateLocal(verticals, tx, ty, tz, 0, d, 0);
+                    scaleRadius(verticals, 0.02f);
+
+                    // rotate(90, 1, 0, 0), translate(d, d - chaos, 0)
+                    rotation90(horizontals, 1, 0, 0);
+                    translateLocal(horizontals, tx, ty, tz, d, d - chaos, 0);
+                    scaleRadius(horizontals, 0.01f);
+
+                    spheres += FLOATS_PER_TRANSFORM;
+                    verticals += FLOATS_PER_TRANSFORM;
+                    horizontals += FLOATS_PER_TRANSFORM;
+                    prevdev = d;
+                    dev++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Transforms count positions and normals (packed xyz) by a column major
+     * transform of four columns. Normals use the inverse transpose of the
+     * upper 3x3, which for a rotation followed by a scale of the local x and
+     * y axes is the same rotation with reciprocal scales, renormalized.
+     */
+    static void transformVertices(const float *m, const float *positions, const float *normals,
+                                  size_t count, float *outPositions, float *outNormals) {
+        // Inverse transpose for normals: columns divided by their squared length
+        float n[12];
+        for (int c = 0; c < 3; c++) {
+            float len2 = m[c*4] * m[c*4] + m[c*4 + 1] * m[c*4 + 1] + m[c*4 + 2] * m[c*4 + 2];
+            float inv = len2 > 0.0f ? 1.0f/len2 : 0.0f;
+            n[c*4] = m[c*4] * inv; n[c*4 + 1] = m[c*4 + 1] * inv; n[c*4 + 2] = m[c*4 + 2] * inv; n[c*4 + 3] = 0;
+        }
+#ifdef __SSE__
+        __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4);
+        __m128 c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+        __m128 n0 = _mm_loadu_ps(n), n1 = _mm_loadu_ps(n + 4), n2 = _mm_loadu_ps(n + 8);
+        float tmp[4];
+        for (size_t i = 0; i < count; i++) {
+            const float *p = positions + i * 3;
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])),
+                                             _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                                  _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+            _mm_storeu_ps(tmp, r);
+            std::memcpy(outPositions + i * 3, tmp, 3 * sizeof(float));
+
+            const float *q = normals + i * 3;
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, _mm_set1_ps(q[0])),
+                                             _mm_mul_ps(n1, _mm_set1_ps(q[1]))),
+                                  _mm_mul_ps(n2, _mm_set1_ps(q[2])));
+            __m128 len2 = _mm_mul_ps(v, v);
+            _mm_storeu_ps(tmp, len2);
+            float len = std::sqrt(tmp[0] + tmp[1] + tmp[2]);
+            v = _mm_mul_ps(v, _mm_set1_ps(len > 0.0f ? 1.0f/len : 0.0f));
+            _mm_storeu_ps(tmp, v);
+            std::memcpy(outNormals + i * 3, tmp, 3 * sizeof(float));
+        }
+#else
+        for (size_t i = 0; i < count; i++) {
+            const float *p = positions + i * 3;
+            const float *q = normals + i * 3;
+            float *o = outPositions + i * 3;
+            float *on = outNormals + i * 3;
+            for (int k = 0; k < 3; k++) {
+                o[k] = m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k];
+                on[k] = n[k] * q[0] + n[4 + k] * q[1] + n[8 + k] * q[2];
+            }
+            float len = std::sqrt(on[0] * on[0] + on[1] * on[1] + on[2] * on[2]);
+            float inv = len > 0.0f ? 1.0f/len : 0.0f;
+            on[0] *= inv; on[1] *= inv; on[2] *= inv;
+        }
+#endif
+    }
+
+private:
+    static float sphereRadius() { return 0.09f; }
+
+    // Draw list: indices of the visible instances only
+    void buildIndices() {
+        mMesh.indices().reset();
+        for (int instance = 0; instance < NUM_INSTANCES; instance++) {
+            if (mVisible[instance]) {
+                for (unsigned int i = mIndexStart[instance]; i < mIndexStart[instance + 1]; i++) {
+                    mMesh.index(mIndices[i]);
+                }
+            }
+        }
+    }
+
+    struct Shape {
+        std::vector<float> vertices;
+        std::vector<float> normals;
+        std::vector<unsigned int> indices;
+    };
+
+    const Shape &instanceShape(int instance) {
+        return instance < NUM_NODES ? mSphere : mCylinder;
+    }
+
+    // Converts a shape to an indexed triangle list with smooth normals
+    static void appendTriangles(Mesh &source, Shape &shape) {
+        Mesh triangles;
+        triangles.primitive(Graphics::TRIANGLES);
+        for (auto &v: source.vertices()) {
+            triangles.vertex(v);
+        }
+        std::vector<unsigned int> order;
+        if (source.indices().size() > 0) {
+            for (auto i: source.indices()) order.push_back(i);
+        } else {
+            for (unsigned int i = 0; i < source.vertices().size(); i++) order.push_back(i);
+        }
+        if (source.primitive() == Graphics::TRIANGLE_STRIP) {
+            for (size_t i = 2; i < order.size(); i++) {
+                if (i % 2 == 0) {
+                    triangles.index(order[i - 2], order[i - 1], order[i]);
+                } else {
+                    triangles.index(order[i - 1], order[i - 2], order[i]);
+                }
+            }
+        } else {
+            for (auto i: order) triangles.index(i);
+        }
+        triangles.generateNormals();
+        for (auto &v: triangles.vertices()) {
+            shape.vertices.push_back(v.x); shape.vertices.push_back(v.y); shape.vertices.push_back(v.z);
+        }
+        for (auto &n: triangles.normals()) {
+            shape.normals.push_back(n.x); shape.normals.push_back(n.y); shape.normals.push_back(n.z);
+        }
+        for (auto i: triangles.indices()) {
+            shape.indices.push_back(i);
+        }
+    }
+
+    static void identity(float *m, float tx, float ty, float tz) {
+        static const float id[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+        std::memcpy(m, id, sizeof(id));
+        m[12] = tx; m[13] = ty; m[14] = tz; m[15] = 1;
+    }
+
+    // Rotation of 90 degrees around the unit axis (x, y, z):
+    // R = [u]x + u u^T since cos = 0 and sin = 1
+    static void rotation90(float *m, float x, float y, float z) {
+        m[0] = x * x;      m[1] = x * y + z;  m[2] = x * z - y;  m[3] = 0;
+        m[4] = x * y - z;  m[5] = y * y;      m[6] = y * z + x;  m[7] = 0;
+        m[8] = x * z + y;  m[9] = y * z - x;  m[10] = z * z;     m[11] = 0;
+    }
+
+    // Translation t followed by the rotation in m and a local offset o
+    static void translateLocal(float *m, float tx, float ty, float tz, float ox, float oy, float oz) {
+        m[12] = tx + m[0] * ox + m[4] * oy + m[8] * oz;
+        m[13] = ty + m[1] * ox + m[5] * oy + m[9] * oz;
+        m[14] = tz + m[2] * ox + m[6] * oy + m[10] * oz;
+        m[15] = 1;
+    }
+
+    // The shared cylinder has unit radius
+    static void scaleRadius(float *m, float radius) {
+        for (int i = 0; i < 3; i++) {
+            m[i] *= radius;
+            m[4 + i] *= radius;
+        }
+    }
+
+    Shape mSphere;
+    Shape mCylinder;
+    std::vector<float> mTransforms;
+    std::vector<unsigned int> mIndices; // Of all instances
+    std::vector<unsigned int> mIndexStart; // Per instance, into mIndices
+    std::vector<char> mVisible;
+    Mesh mMesh;
+};
+
+#endif // GRID_RENDERER_HPP
@@ -21,149 +21,16 @@
 #include "Gamma/Oscillator.h"
 #include "Gamma/Envelope.h"
 
+#include "modal_synth.hpp"
+
 using namespace std;
 using namespace al;
 
 #define SURROUND
 
-#define NUM_VOICES 8
+#define NUM_VOICES MODAL_VOICES
 #define SYNTH_POLYPHONY 16
-#define WIDTHFACTOR 100
-
-//namespace gam{
-//template <class Tv=gam::real, class Tp=gam::real, class Td=DomainObserver>
-//class Mode : public Filter2<Tv,Tp,Td>{
-//public:
-
-//    /// \param[in] frq	Center frequency
-//    /// \param[in] wid	Bandwidth
-//    Mode(Tp frq = Tp(1000), Tp wid = Tp(100))
-//        :	Base(frq, wid)
-//    {
-//        b0 =   alpha
-//                b1 =   0
-//                b2 =  -alpha
-//                a0 =   1 + alpha
-//                a1 =  -2*cos(w0)
-//                a2 =   1 - alpha
-//        onDomainChange(1);
-//    }
-
-//    /// Set center frequency
-//    void freq(Tp v){
-//        Base::freqRef(v);
-//        mSin = scl::cosP3<Tp>(scl::foldOnce<Tp>(v - Tp(0.25), Tp(0.5)));
-//        computeGain();
-//    }
-
-//    /// Set bandwidth
-//    void width(Tp v){ Base::width(v); computeGain(); }
-
-//    void set(Tp frq, Tp wid){ Base::width(wid); freq(frq); }
-
-//    /// Filter sample
-//    Tv operator()(Tv in){
-//        Tv t = in * gain() + d1*mC[1] + d2*mC[2];
-//        this->delay(t);
-//        return t;
-//    }
-
-//    void onDomainChange(double r){ freq(mFreq); width(mWidth); }
-
-//protected:
-//    INHERIT_FILTER2;
-//    Tp mSin;
-
-//    // compute constant gain factor
-//    void computeGain(){ gain() = 1.0; /*(Tp(1) - mRad*mRad) * mSin;*/ }
-//};
-//}
-
-class ModalSynthParameters {
-public:
-    int id; // Instance id (e.g. MIDI note)
-    float mLevel;
-    float mFundamental;
-    float mFrequencyFactors[NUM_VOICES];
-    float mWidths[NUM_VOICES];
-    float mAmplitudes[NUM_VOICES];
-
-    // Spatialization
-    float mArcStart;
-    float mArcSpan;
-    int mOutputChannel;
-    vector<int> mOutputRouting;
-};
-
-class ModalSynth {
-public:
-    ModalSynth(){
-        for (int i = 0; i < NUM_VOICES; i++) {
-            mResonators[i].type(gam::BAND_PASS_UNIT);
-        }
-    }
-
-    void trigger(ModalSynthParameters &params) {
-        mId = params.id;
-        mLevel = params.mLevel;
-        memcpy(mFrequencyFactors, params.mFrequencyFactors, sizeof(float) * NUM_VOICES); // Must be called before settinf oscillator fundamental
-        memcpy(mWidths, params.mWidths, sizeof(float) * NUM_VOICES); // Must be called before settinf oscillator fundamental
-        memcpy(mAmplitudes, params.mAmplitudes, sizeof(float) * NUM_VOICES);
-//        setFilterFreq(params.mFundamental);
-        mNoiseEnv.reset();
-
-        for (int i = 0; i < NUM_VOICES; i++) {
-            mResonators[i].freq(params.mFundamental * mFrequencyFactors[i]);
-            mResonators[i].res(params.mFundamental * mFrequencyFactors[i]/(mWidths[i] * params.mFundamental * mFrequencyFactors[i] / WIDTHFACTOR));
-//            mResonators[i].set(params.mFundamental * mFrequencyFactors[i], );
-        }
-        mDone = false;
-        mOutputChannel = params.mOutputChannel;
-    }
-
-    void generateAudio(AudioIOData &io) {
-        float noise;
-        float max = 0.0;
-        while (io()) {
-            noise = mNoise() * mNoiseEnv();
-            for (int i = 0; i < NUM_VOICES; i++) {
-                float value = 100000 * mResonators[i](noise) * mAmplitudes[i] *  std::pow(10, (mLevel-100)/ 20.0);
-				io.out(mOutputChannel) +=  value;
-                if(value > max) {max = value;};
-			}
-        }
-        if(max < 0.000001) {mDone = true;}
-    }
-
-//    void setFilterFreq(float frequency)
-//    {
-//        for (int i = 0; i < NUM_VOICES; i++) {
-//            mResonators[i].freq(frequency * mFrequencyFactors[i]);
-//        }
-//    }
-
-    bool done() {
-        return mDone;
-    }
-
-private:
-
-    // Instance parameters
-
-    // Synthesis
-//    gam::Mode<> mResonators[NUM_VOICES];
-    gam::Biquad<> mResonators[NUM_VOICES];
-    float mWidths[NUM_VOICES];
-    float mAmplitudes[NUM_VOICES];
-    gam::AD<> mNoiseEnv {0.001f, 0.001f};
-    gam::NoiseBrown<> mNoise;
-    int mOutputChannel;
-
-    int mId = 0;
-    float mLevel = 0;
-    float mFrequencyFactors[NUM_VOICES];
-    bool mDone {true};
-};
+#define WIDTHFACTOR MODAL_WIDTH_FACTOR
 
 class ModalSynthApp: public App
 {
@@ -0,0 +1,60 @@
+/*
+Benchmark of the after-effect noise generator
+
+Times the computation of one time slice of NoiseCubeMap with the scalar
+lanes and with the SIMD lanes used by the graphics nodes, and checks that
+both give the same noise.
+
+Usage:
+    noise_bench [face size=64] [slices=50]
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+
+#include "noise_field.hpp"
+
+using namespace al;
+using namespace std;
+
+template <class Noise>
+static double timeSlices(const vector<float> &x, const vector<float> &y, const vector<float> &z,
+                         int slices, vector<float> &out) {
+    al_sec start = al_steady_time();
+    for (int slice = 0; slice < slices; slice++) {
+        Noise::octaves(x.data(), y.data(), z.data(), x.size(), 2.5f, slice * 0.05f, out.data());
+    }
+    return (al_steady_time() - start) * 1000.0 / slices;
+}
+
+int main(int argc, char *argv[]) {
+    int size = argc > 1 ? atoi(argv[1]) : 64;
+    int slices = argc > 2 ? atoi(argv[2]) : 50;
+
+    int count = 6 * size * size;
+    vector<float> x(count), y(count), z(count);
+    NoiseCubeMap::directions(size, x.data(), y.data(), z.data());
+
+    vector<float> scalar(count), fast(count);
+    double scalarMs = timeSlices<SimplexNoise4<ScalarLanes>>(x, y, z, slices, scalar);
+    double fastMs = timeSlices<FastSimplexNoise4>(x, y, z, slices, fast);
+
+    float maxError = 0, low = 1, high = 0;
+    for (int i = 0; i < count; i++) {
+        maxError = std::max(maxError, std::fabs(scalar[i] - fast[i]));
+        low = std::min(low, fast[i]);
+        high = std::max(high, fast[i]);
+    }
+
+    cout << "face " << size << " (" << count << " texels), " << slices << " slices" << endl;
+    cout << "scalar_ms " << scalarMs << endl;
+    cout << "simd_ms " << fastMs << " (" << FastSimplexNoise4::lanes() << " lanes, "
+         << scalarMs / fastMs << "x)" << endl;
+    cout << "range " << low << " " << high << endl;
+    cout << "max_difference " << maxError << endl;
+    return maxError < 1e-4f ? 0 : 1;
+}
@@ -0,0 +1,396 @@
+#ifndef NOISE_FIELD_HPP
+#define NOISE_FIELD_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "allocore/graphics/al_OpenGL.hpp"
+
+namespace al {
+
+// One float per lane: the reference, and the fallback without SSE2
+struct ScalarLanes {
+    typedef float V;
+    enum { width = 1 };
+    static V load(const float *p) { return *p; }
+    static void store(float *p, V v) { *p = v; }
+    static V set(float f) { return f; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V floor(V v) { return std::floor(v); }
+    static V max(V a, V b) { return std::max(a, b); }
+    static V min(V a, V b) { return std::min(a, b); }
+    static V abs(V v) { return std::fabs(v); }
+    static V step(V edge, V x) { return x < edge ? 0.0f : 1.0f; } // As GLSL step()
+};
+
+#ifdef __SSE2__
+struct SSELanes {
+    typedef __m128 V;
+    enum { width = 4 };
+    static V load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+    static V set(float f) { return _mm_set1_ps(f); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V floor(V v) { // SSE2 has no floor: truncate, then fix negative fractions
+        V t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+    }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V abs(V v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+    static V step(V edge, V x) { return _mm_and_ps(_mm_cmpge_ps(x, edge), _mm_set1_ps(1.0f)); }
+};
+#endif
+
+/**
+ * @brief 4D simplex noise, computed like the GLSL snoise() by Ashima Arts
+ *
+ * The permutations are polynomials mod 289 rather than table lookups, so
+ * every step is plain arithmetic and Lanes points are computed at once
+ * (4 with SSE2). The results match the shader version to float precision.
+ */
+template <class L>
+struct SimplexNoise4 {
+    typedef typename L::V V;
+
+    static int lanes() { return L::width; }
+
+    static V mod289(V x) {
+        return L::sub(x, L::mul(L::floor(L::mul(x, L::set(1.0f / 289.0f))), L::set(289.0f)));
+    }
+
+    static V permute(V x) {
+        return mod289(L::mul(L::add(L::mul(x, L::set(34.0f)), L::set(1.0f)), x));
+    }
+
+    static V taylorInvSqrt(V r) {
+        return L::sub(L::set(1.79284291400159f), L::mul(L::set(0.85373472095314f), r));
+    }
+
+    static V clamp01(V v) { return L::min(L::max(v, L::set(0.0f)), L::set(1.0f)); }
+
+    static V dot(const V *a, const V *b) {
+        return L::add(L::add(L::mul(a[0], b[0]), L::mul(a[1], b[1])),
+                      L::add(L::mul(a[2], b[2]), L::mul(a[3], b[3])));
+    }
+
+    // grad4(j, ip) with ip = (1/294, 1/49, 1/7), normalized
+    static void gradient(V j, V *p) {
+        const float ip[3] = {1.0f / 294.0f, 1.0f / 49.0f, 1.0f / 7.0f};
+        V sumAbs = L::set(0.0f);
+        for (int c = 0; c < 3; c++) {
+            V scaled = L::mul(j, L::set(ip[c]));
+            V fraction = L::sub(scaled, L::floor(scaled));
+            p[c] = L::sub(L::mul(L::floor(L::mul(fraction, L::set(7.0f))), L::set(ip[2])), L::set(1.0f));
+            sumAbs = L::add(sumAbs, L::abs(p[c]));
+        }
+        p[3] = L::sub(L::set(1.5f), sumAbs);
+        V sw = L::sub(L::set(1.0f), L::step(L::set(0.0f), p[3])); // p.w < 0
+        for (int c = 0; c < 3; c++) {
+            V s = L::sub(L::set(1.0f), L::step(L::set(0.0f), p[c]));
+            p[c] = L::add(p[c], L::mul(L::sub(L::mul(s, L::set(2.0f)), L::set(1.0f)), sw));
+        }
+        V norm = taylorInvSqrt(dot(p, p));
+        for (int c = 0; c < 4; c++) {
+            p[c] = L::mul(p[c], norm);
+        }
+    }
+
+    static V noise(const V *v) {
+        const float G4 = 0.138196601125011f, F4 = 0.309016994374947451f;
+        V skew = L::mul(L::add(L::add(v[0], v[1]), L::add(v[2], v[3])), L::set(F4));
+        V i[4], x0[4];
+        for (int c = 0; c < 4; c++) {
+            i[c] = L::floor(L::add(v[c], skew));
+        }
+        V unskew = L::mul(L::add(L::add(i[0], i[1]), L::add(i[2], i[3])), L::set(G4));
+        for (int c = 0; c < 4; c++) {
+            x0[c] = L::add(L::sub(v[c], i[c]), unskew);
+        }
+
+        // Rank sorting of the corners
+        V one = L::set(1.0f);
+        V isX[3] = {L::step(x0[1], x0[0]), L::step(x0[2], x0[0]), L::step(x0[3], x0[0])};
+        V isYZ[3] = {L::step(x0[2], x0[1]), L::step(x0[3], x0[1]), L::step(x0[3], x0[2])};
+        V i0[4];
+        i0[0] = L::add(L::add(isX[0], isX[1]), isX[2]);
+        i0[1] = L::add(L::sub(one, isX[0]), L::add(isYZ[0], isYZ[1]));
+        i0[2] = L::add(L::add(L::sub(one, isX[1]), L::sub(one, isYZ[0])), isYZ[2]);
+        i0[3] = L::add(L::add(L::sub(one, isX[2]), L::sub(one, isYZ[1])), L::sub(one, isYZ[2]));
+
+        V i1[4], i2[4], i3[4];
+        V x[5][4];
+        for (int c = 0; c < 4; c++) {
+            i3[c] = clamp01(i0[c]);
+            i2[c] = clamp01(L::sub(i0[c], one));
+            i1[c] = clamp01(L::sub(i0[c], L::set(2.0f)));
+            x[0][c] = x0[c];
+            x[1][c] = L::add(L::sub(x0[c], i1[c]), L::set(G4));
+            x[2][c] = L::add(L::sub(x0[c], i2[c]), L::set(2 * G4));
+            x[3][c] = L::add(L::sub(x0[c], i3[c]), L::set(3 * G4));
+            x[4][c] = L::add(x0[c], L::set(-1 + 4 * G4));
+        }
+
+        // Permutations of the five corners, w first as in the shader
+        V *offsets[4] = {nullptr, i1, i2, i3};
+        V result = L::set(0.0f);
+        for (int k = 0; k < 5; k++) {
+            V j = L::set(0.0f);
+            for (int c = 3; c >= 0; c--) {
+                V corner = mod289(i[c]);
+                if (k > 0) {
+                    corner = L::add(corner, k < 4 ? offsets[k][c] : one);
+                }
+                j = permute(c == 3 ? corner : L::add(j, corner));
+            }
+            V p[4];
+            gradient(j, p);
+            V m = L::max(L::sub(L::set(0.6f), dot(x[k], x[k])), L::set(0.0f));
+            m = L::mul(m, m);
+            result = L::add(result, L::mul(L::mul(m, m), dot(p, x[k])));
+        }
+        return L::mul(result, L::set(49.0f));
+    }
+
+    /**
+     * @brief The after-effect's three octaves for count directions, mapped to [0, 1]
+     *
+     * Octave k samples noise at 2^k * (radius * direction, time), as the
+     * effect shader of graphics.cpp did per pixel. Directions past the last
+     * full group of lanes are done one at a time, so loads never read past
+     * count.
+     */
+    static void octaves(const float *dx, const float *dy, const float *dz, size_t count,
+                        float radius, float time, float *out) {
+        size_t n = 0;
+        for (; n + L::width <= count; n += L::width) {
+            V sum = L::set(0.0f);
+            float scale = 1.0f, weight = 1.0f;
+            for (int octave = 0; octave < 3; octave++) {
+                V v[4] = {L::mul(L::load(dx + n), L::set(radius * scale)),
+                          L::mul(L::load(dy + n), L::set(radius * scale)),
+                          L::mul(L::load(dz + n), L::set(radius * scale)),
+                          L::set(time * scale)};
+                sum = L::add(sum, L::mul(noise(v), L::set(weight)));
+                scale *= 2.0f;
+                weight *= 0.5f;
+            }
+            // (n1 + 0.5 n2 + 0.25 n3) / 1.75, then [-1, 1] to [0, 1]
+            L::store(out + n, L::mul(L::add(L::mul(sum, L::set(1.0f / 1.75f)), L::set(1.0f)), L::set(0.5f)));
+        }
+        if (n < count) {
+            SimplexNoise4<ScalarLanes>::octaves(dx + n, dy + n, dz + n, count - n, radius, time, out + n);
+        }
+    }
+};
+
+#ifdef __SSE2__
+typedef SimplexNoise4<SSELanes> FastSimplexNoise4;
+#else
+typedef SimplexNoise4<ScalarLanes> FastSimplexNoise4;
+#endif
+
+/**
+ * @brief Time slices of the after-effect noise in the channels of a cube map
+ *
+ * The noise only depends on the direction of a pixel and on a slow time, so
+ * it is computed on the CPU at slices sliceTime apart, on a cube map with a
+ * face size far below the omni resolution. Channel k % 3 holds slice k: two
+ * channels are the slices around the current time, which the shader blends
+ * with weights(), while the next slice is computed on a worker thread and
+ * then uploaded a few rows per frame into the third.
+ */
+class NoiseCubeMap {
+public:
+    NoiseCubeMap(int faceSize = 64, float sliceTime = 0.05f, float radius = 2.5f,
+                 int rowsPerUpdate = 128) :
+        mSize(faceSize), mSliceTime(sliceTime), mRadius(radius), mRowsPerUpdate(rowsPerUpdate)
+    {
+        int count = 6 * mSize * mSize;
+        mDirX.resize(count);
+        mDirY.resize(count);
+        mDirZ.resize(count);
+        mSlice.resize(count);
+        mTexels.assign(count * 4, 255);
+        directions(mSize, mDirX.data(), mDirY.data(), mDirZ.data());
+    }
+
+    ~NoiseCubeMap() {
+        if (mWorker.joinable()) {
+            mWorker.join();
+        }
+    }
+
+    /**
+     * @brief Unit directions of the texel centers of the six faces
+     *
+     * Faces are in GL order (+x, -x, +y, -y, +z, -z), rows bottom up.
+     */
+    static void directions(int size, float *x, float *y, float *z) {
+        size_t n = 0;
+        for (int face = 0; face < 6; face++) {
+            for (int row = 0; row < size; row++) {
+                for (int col = 0; col < size; col++) {
+                    float sc = 2 * (col + 0.5f) / size - 1, tc = 2 * (row + 0.5f) / size - 1;
+                    float d[6][3] = {{1, -tc, -sc}, {-1, -tc, sc}, {sc, 1, tc},
+                                     {sc, -1, -tc}, {sc, -tc, 1}, {-sc, -tc, -1}};
+                    float length = std::sqrt(d[face][0] * d[face][0] + d[face][1] * d[face][1] + d[face][2] * d[face][2]);
+                    x[n] = d[face][0] / length;
+                    y[n] = d[face][1] / length;
+                    z[n] = d[face][2] / length;
+                    n++;
+                }
+            }
+        }
+    }
+
+    // Call once per frame with a current GL context, before weights() and bind()
+    void update(float time) {
+        long target = (long) std::floor(time / mSliceTime);
+        if (mTexture == 0) {
+            glGenTextures(1, &mTexture);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            for (int face = 0; face < 6; face++) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, mSize, mSize, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        }
+
+        if (mCount == 0 || target < mFirst || target >= mFirst + mCount) {
+            // Start, or a jump in time: compute the two slices needed now
+            if (mWorker.joinable()) {
+                mWorker.join();
+            }
+            mFirst = target;
+            for (int k = 0; k < 2; k++) {
+                computeSlice(target + k);
+                copySlice(target + k, 0, 6 * mSize);
+            }
+            uploadRows(0, 6 * mSize);
+            mCount = 2;
+            mPending = kNoSlice;
+        }
+        // Slices behind the current time free their channel for the next one
+        while (target > mFirst && mCount == 3) {
+            mFirst++;
+            mCount--;
+        }
+
+        if (mCount < 3) {
+            long next = mFirst + mCount;
+            if (mPending != next) {
+                if (mWorker.joinable()) {
+                    mWorker.join();
+                }
+                mPending = next;
+                mUploadedRows = 0;
+                mWorkerDone = false;
+                mWorker = std::thread([this, next]() {
+                    computeSlice(next);
+                    mWorkerDone = true;
+                });
+            } else if (mWorkerDone) {
+                int rows = std::min(mRowsPerUpdate, 6 * mSize - mUploadedRows);
+                copySlice(next, mUploadedRows, rows);
+                uploadRows(mUploadedRows, rows);
+                mUploadedRows += rows;
+                if (mUploadedRows == 6 * mSize) {
+                    mWorker.join();
+                    mCount++;
+                    mPending = kNoSlice;
+                }
+            }
+        }
+
+        // Blend the slices around time, or hold the latest if the next is late
+        std::fill(mWeights, mWeights + 3, 0.0f);
+        float fraction = std::min(std::max(time / mSliceTime - mFirst, 0.0f), 1.0f);
+        mWeights[channel(mFirst)] = 1.0f - fraction;
+        mWeights[channel(mFirst + 1)] += fraction;
+    }
+
+    // Weights of the r, g and b channels for the time given to update()
+    const float *weights() { return mWeights; }
+
+    void bind(int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void unbind(int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    // slice % 3 wrapped into [0, 3), slices are negative before time 0
+    static int channel(long slice) { return int((slice % 3 + 3) % 3); }
+
+    void computeSlice(long slice) {
+        FastSimplexNoise4::octaves(mDirX.data(), mDirY.data(), mDirZ.data(), mDirX.size(),
+                                   mRadius, slice * mSliceTime, mSlice.data());
+    }
+
+    // Moves rows of mSlice into the channel of slice, rows counted across all faces
+    void copySlice(long slice, int firstRow, int numRows) {
+        for (size_t i = firstRow * mSize; i < size_t(firstRow + numRows) * mSize; i++) {
+            float v = std::min(std::max(mSlice[i], 0.0f), 1.0f);
+            mTexels[i * 4 + channel(slice)] = (unsigned char) (v * 255.0f + 0.5f);
+        }
+    }
+
+    void uploadRows(int firstRow, int numRows) {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        while (numRows > 0) {
+            int face = firstRow / mSize, row = firstRow % mSize;
+            int rows = std::min(numRows, mSize - row);
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, row, mSize, rows,
+                            GL_RGBA, GL_UNSIGNED_BYTE, &mTexels[(firstRow * mSize) * 4]);
+            firstRow += rows;
+            numRows -= rows;
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    int mSize;
+    float mSliceTime;
+    float mRadius;
+    int mRowsPerUpdate;
+    std::vector<float> mDirX, mDirY, mDirZ;
+    std::vector<float> mSlice; // Written by the worker while a slice is pending
+    std::vector<unsigned char> mTexels; // RGBA copy of the cube map
+
+    GLuint mTexture = 0;
+    long mFirst = 0; // Oldest slice in the texture
+    int mCount = 0; // Consecutive slices in the texture from mFirst
+    static constexpr long kNoSlice = LONG_MIN; // -1 is a valid slice
+    long mPending = kNoSlice; // Slice being computed or uploaded
+    int mUploadedRows = 0;
+    std::thread mWorker;
+    std::atomic<bool> mWorkerDone {false};
+    float mWeights[3] = {1, 0, 0};
+};
+
+} // namespace al
+
+#endif // NOISE_FIELD_HPP
@@ -0,0 +1,199 @@
+#ifndef OFFLINE_RENDER_HPP
+#define OFFLINE_RENDER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "allocore/io/al_AudioIOData.hpp"
+
+#include "control_input.hpp"
+
+namespace al {
+
+/**
+ * @brief Writes interleaved 32 bit float frames to a WAV or raw file
+ *
+ * Files ending in .wav get a WAVE_FORMAT_EXTENSIBLE header, which becomes
+ * RF64 when the data passes 4 GB (about 6 minutes of 60 channels at 44.1
+ * kHz). Any other name is written as headerless interleaved floats.
+ */
+class MultichannelWriter {
+public:
+    ~MultichannelWriter() { close(); }
+
+    bool open(std::string path, int channels, double sampleRate) {
+        close();
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile) {
+            std::cout << "MultichannelWriter: can't write " << path << std::endl;
+            return false;
+        }
+        mChannels = channels;
+        mSampleRate = sampleRate;
+        mWav = path.size() > 4 && path.compare(path.size() - 4, 4, ".wav") == 0;
+        mDataBytes = 0;
+        if (mWav) {
+            writeHeader();
+        }
+        return true;
+    }
+
+    // frames of channels[c], one pointer per channel
+    void write(const float *const *channels, int frames) {
+        mInterleaved.resize(size_t(frames) * mChannels);
+        float *out = mInterleaved.data();
+        for (int i = 0; i < frames; i++) {
+            for (int c = 0; c < mChannels; c++) {
+                *out++ = channels[c][i];
+            }
+        }
+        mDataBytes += fwrite(mInterleaved.data(), sizeof(float), mInterleaved.size(), mFile) * sizeof(float);
+    }
+
+    bool close() {
+        if (!mFile) {
+            return true;
+        }
+        if (mWav) {
+            fseek(mFile, 0, SEEK_SET);
+            writeHeader();
+        }
+        bool ok = fclose(mFile) == 0;
+        mFile = nullptr;
+        return ok;
+    }
+
+private:
+    enum { headerBytes = 12 + 36 + 48 + 8 }; // RIFF, JUNK/ds64, fmt, data
+
+    void writeHeader() {
+        uint64_t riffBytes = headerBytes - 8 + mDataBytes;
+        bool rf64 = riffBytes > 0xFFFFFFFFu;
+        uint32_t blockAlign = mChannels * 4;
+        static const uint8_t floatFormat[16] = {3, 0, 0, 0, 0, 0, 0x10, 0, 0x80, 0, 0, 0xAA, 0, 0x38, 0x9B, 0x71};
+
+        fwrite(rf64 ? "RF64" : "RIFF", 1, 4, mFile);
+        put32(rf64 ? 0xFFFFFFFFu : uint32_t(riffBytes));
+        fwrite("WAVE", 1, 4, mFile);
+        // Space for the ds64 chunk, skipped as JUNK while the file is a RIFF
+        fwrite(rf64 ? "ds64" : "JUNK", 1, 4, mFile);
+        put32(28);
+        put64(rf64 ? riffBytes : 0);
+        put64(rf64 ? mDataBytes : 0);
+        put64(rf64 ? mDataBytes / blockAlign : 0);
+        put32(0);
+
+        fwrite("fmt ", 1, 4, mFile);
+        put32(40);
+        put16(0xFFFE); // WAVE_FORMAT_EXTENSIBLE
+        put16(mChannels);
+        put32(uint32_t(mSampleRate));
+        put32(uint32_t(mSampleRate) * blockAlign);
+        put16(blockAlign);
+        put16(32);
+        put16(22);
+        put16(32);
+        put32(0); // No speaker positions
+        fwrite(floatFormat, 1, 16, mFile);
+
+        fwrite("data", 1, 4, mFile);
+        put32(rf64 ? 0xFFFFFFFFu : uint32_t(mDataBytes));
+    }
+
+    void put16(uint32_t v) { uint8_t b[2] = {uint8_t(v), uint8_t(v >> 8)}; fwrite(b, 1, 2, mFile); }
+    void put32(uint32_t v) { put16(v & 0xFFFF); put16(v >> 16); }
+    void put64(uint64_t v) { put32(uint32_t(v)); put32(uint32_t(v >> 32)); }
+
+    FILE *mFile = nullptr;
+    int mChannels = 0;
+    double mSampleRate = 44100;
+    bool mWav = false;
+    uint64_t mDataBytes = 0;
+    std::vector<float> mInterleaved;
+};
+
+/**
+ * @brief Runs an audio callback in a loop, without opening the device
+ *
+ * The callback renders into its own AudioIOData of the given channels, not
+ * the app's AudioIO, whose channels are clamped to the selected device's (or
+ * left at the default without one). Each block the output buffers are
+ * cleared, the timeline messages due up to the end of the block are passed
+ * to control(const ControlEvent &) (so ControlInputs apply them at their
+ * frame, as if received live), the callback's onAudioCB() runs and the
+ * output channels are written to the file. Nothing waits for the clock, so
+ * it renders as fast as the callback allows, e.g. for regression renders
+ * and benchmarks on machines without the audio hardware.
+ */
+class OfflineRender {
+public:
+    struct Stats {
+        uint64_t frames = 0;
+        double sampleRate = 44100;
+        double seconds = 0; // Wall clock
+        double realtime() const { return seconds > 0 ? frames / sampleRate / seconds : 0; }
+    };
+
+    template<class Callback, class Control>
+    static bool render(Callback &callback, int channels, int frames, double sampleRate,
+                       double seconds, const ControlTimeline &timeline,
+                       std::string path, Control control, Stats *stats = nullptr) {
+        AudioIOData io(nullptr);
+        io.framesPerSecond(sampleRate);
+        io.framesPerBuffer(frames);
+        io.channelsIn(0);
+        io.channelsOut(channels);
+        if (frames <= 0 || io.channelsOut() != channels) {
+            std::cout << "OfflineRender: can't render " << channels << " channels of " << frames << " frames" << std::endl;
+            return false;
+        }
+        MultichannelWriter writer;
+        if (!writer.open(path, channels, sampleRate)) {
+            return false;
+        }
+        std::vector<const float *> buffers(channels);
+        uint64_t totalFrames = uint64_t(seconds * sampleRate);
+        const std::vector<ControlEvent> &events = timeline.events();
+        size_t next = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t frame = 0;
+        for (; frame < totalFrames; frame += frames) {
+            while (next < events.size() && events[next].frame < frame + frames) {
+                control(events[next++]);
+            }
+            io.zeroOut();
+            io.frame(0);
+            callback.onAudioCB(io);
+            for (int c = 0; c < channels; c++) {
+                buffers[c] = io.outBuffer(c);
+            }
+            writer.write(buffers.data(), int(std::min(uint64_t(frames), totalFrames - frame)));
+        }
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!writer.close()) {
+            std::cout << "OfflineRender: error writing " << path << std::endl;
+            return false;
+        }
+        Stats result;
+        result.frames = std::min(frame, totalFrames);
+        result.seconds = wallSeconds;
+        result.sampleRate = sampleRate;
+        printf("OfflineRender: %.1f s of %d channels in %.2f s (%.1fx real time) to %s\n",
+               result.frames / sampleRate, channels, wallSeconds, result.realtime(), path.c_str());
+        if (stats) {
+            *stats = result;
+        }
+        return true;
+    }
+};
+
+} // namespace al
+
+#endif // OFFLINE_RENDER_HPP
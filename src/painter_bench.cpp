@@ -0,0 +1,233 @@
+/*
+Headless SharedPainter benchmark
+
+Drives SharedPainter::onAnimate() and onDraw() (water, grid, images and the
+render tree) frame by frame without a window, and reports the CPU time and
+GL work of each frame.
+
+By default GL calls go to a null backend that only counts them, so it runs
+on machines with no GPU or display. Build with PAINTER_BENCH_OSMESA defined
+and linked to OSMesa (see flags.cmake) to render into an OSMesa/llvmpipe
+context instead, with the same counts.
+
+Usage:
+    painter_bench [recording|-] [frames] [frames.csv]
+
+The recording is a SharedState stream written by the simulator (press 'p'
+in the simulator to start and stop). '-' or no recording uses a generated
+stream that sweeps chaos from 0 to 1 and back. Text markers and reports are
+added at a fixed rate, as the simulator's OSC messages would.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+#include "allocore/system/al_Time.hpp"
+
+#include "common.hpp"
+#include "gl_call_counter.hpp"
+#include "state_recording.hpp"
+
+#ifdef PAINTER_BENCH_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+using namespace al;
+using namespace std;
+
+struct FrameResult {
+    double animateMs, drawMs;
+    GLFrameStats gl;
+};
+
+// A simple perspective in place of the omni projection
+static const char *benchOmniRender = R"(
+vec4 omni_render(in vec4 vertex) {
+    return gl_ProjectionMatrix * vertex;
+}
+)";
+
+// Fills state with one frame of a sweep of chaos from 0 to 1 and back
+static void generateFrame(SharedState &s, int frame, int frames) {
+    float t = frame / (float) std::max(frames, 1);
+    s.chaos = 0.5f - 0.5f * cos(2 * M_PI * t);
+    s.decay = 0.93 + s.chaos * 0.068;
+    s.velocity = 0.001 + s.chaos * s.chaos * 0.49;
+    s.lightPhase = 0.75 + frame * 0.001;
+    s.casasPhase += 0.005 + s.chaos * 0.06;
+    s.mouseDown = (frame / 60) % 2 == 1;
+    for (int i = 0; i < GRID_SIZEX * GRID_SIZEY * GRID_SIZEZ; i++) {
+        s.dev[i] = sin(frame * 0.05 + i) * s.chaos;
+    }
+    for (int i = 0; i < NUM_OFRENDAS; i++) {
+        s.ofrendas[i] = i < (frame / 20) % (NUM_OFRENDAS + 1);
+        s.posOfrendas[i] = Vec4f(-2 + 4 * i / (float) NUM_OFRENDAS, LAGOON_Y - 0.2, -3 + sin(i + frame * 0.01), i * 20);
+    }
+    // Two ripples, calm away from their centers, stronger with chaos
+    s.zcurr = 0;
+    float amplitude = 0.02 + 0.2 * s.chaos;
+    for (int j = 0; j < Ny; j++) {
+        for (int i = 0; i < Nx; i++) {
+            float x = i / (float) Nx, y = j / (float) Ny;
+            float d1 = hypot(x - 0.3, y - 0.4), d2 = hypot(x - 0.7, y - 0.6);
+            float h = exp(-8 * d1) * sin(60 * d1 - frame * 0.2) + exp(-8 * d2) * sin(45 * d2 - frame * 0.15);
+            s.wave[indexAt(i, j, 0)] = amplitude * s.decay * h;
+            s.wave[indexAt(i, j, 1)] = 0;
+        }
+    }
+}
+
+static double percentile(vector<double> values, double p) {
+    if (values.size() == 0) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, size_t(p * values.size()))];
+}
+
+static void printSummary(string name, const vector<double> &values) {
+    double sum = 0, maximum = 0;
+    for (double v: values) {
+        sum += v;
+        maximum = std::max(maximum, v);
+    }
+    cout << name << " mean " << sum / values.size()
+         << " p50 " << percentile(values, 0.5)
+         << " p95 " << percentile(values, 0.95)
+         << " max " << maximum << endl;
+}
+
+int main(int argc, char *argv[]) {
+    string recording = argc > 1 ? argv[1] : "-";
+    int frames = argc > 2 ? atoi(argv[2]) : 600;
+    string csvPath = argc > 3 ? argv[3] : "";
+    const int width = 640, height = 480;
+
+#ifdef PAINTER_BENCH_OSMESA
+    OSMesaContext context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, nullptr);
+    vector<unsigned char> buffer(width * height * 4);
+    if (!context || !OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, width, height)) {
+        cout << "painter_bench: can't create an OSMesa context" << endl;
+        return 1;
+    }
+    GLCallCounter::install([](const char *name) -> void * { return (void *) OSMesaGetProcAddress(name); });
+    cout << "OSMesa backend: " << glGetString(GL_RENDERER) << endl;
+#else
+    GLCallCounter::install();
+    cout << "Null GL backend" << endl;
+#endif
+
+    unique_ptr<SharedState> state(new SharedState());
+    StatePlayer<SharedState> player;
+    bool recorded = recording != "-" && player.open(recording);
+    if (recording != "-" && !recorded) {
+        return 1;
+    }
+
+    ShaderProgram shader;
+    Shader vert, frag;
+    vert.source(string(benchOmniRender) + vertexShader, Shader::VERTEX).compile();
+    frag.source(fragmentShader, Shader::FRAGMENT).compile();
+    shader.attach(vert).attach(frag).link();
+    shader.begin();
+    shader.uniform("texture0", 0);
+    shader.end();
+
+    // Ports away from the ones graphics and the simulator use
+    SharedPainter painter(state.get(), &shader, GRAPHICS_IN_PORT + 50, GRAPHICS_SLAVE_PORT + 50);
+    painter.onInit();
+
+    // Image decoding and upload is startup cost, not per frame work
+    al_sec waitStart = al_steady_time();
+    while (!painter.mImages.done() && al_steady_time() - waitStart < 30) {
+        painter.mImages.upload(0.1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    GLCallCounter::frame();
+
+    Graphics g;
+    Pose viewer(Vec3d(0, 3, 10));
+    vector<FrameResult> results;
+    results.reserve(frames);
+    const char *hex = "0123456789ABCDEF";
+    for (int frame = 0; frame < frames; frame++) {
+        if (recorded) {
+            player.next(*state);
+        } else {
+            generateFrame(*state, frame, frames);
+        }
+        if (frame % 30 == 0) {
+            string text;
+            for (int i = 0; i < 8; i++) {
+                text += hex[(frame * 7 + i * 3) % 16];
+            }
+            painter.addBitcoinMarker(text, (frame % 90) / 90.0f, 0.5f);
+        }
+        if (frame % 90 == 89) {
+            painter.showBitcoinReport(string(hex) + hex + hex + hex, frame % 180 == 179);
+        }
+
+        al_sec start = al_steady_time();
+        float *heights = painter.mWater.heights();
+        for (int j = 0; j < Ny; ++j) {
+            for (int i = 0; i < Nx; ++i) {
+                heights[j * Nx + i] = state->wave[indexAt(i, j, state->zcurr)] / state->decay;
+            }
+        }
+        painter.onAnimate(viewer);
+        al_sec animated = al_steady_time();
+
+        g.viewport(0, 0, width, height);
+        g.clearColor(0, 0, 0, 0);
+        g.clear(Graphics::COLOR_BUFFER_BIT | Graphics::DEPTH_BUFFER_BIT);
+        g.projection(Matrix4d::perspective(60, width / (double) height, 0.1, 100));
+        g.modelView(Matrix4d::lookAt(viewer.ur(), viewer.uu(), viewer.uf(), viewer.pos()));
+        shader.begin();
+        painter.onDraw(g);
+        shader.end();
+        if (GLCallCounter::forwarding()) {
+            glFinish();
+        }
+        al_sec drawn = al_steady_time();
+
+        results.push_back({(animated - start) * 1000.0, (drawn - animated) * 1000.0, GLCallCounter::frame()});
+    }
+
+    if (csvPath != "") {
+        ofstream csv(csvPath);
+        csv << "frame,animate_ms,draw_ms,calls,draw_calls,state_changes,vertices,uploads" << endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const FrameResult &r = results[i];
+            csv << i << "," << r.animateMs << "," << r.drawMs << "," << r.gl.calls << ","
+                << r.gl.drawCalls << "," << r.gl.stateChanges << "," << r.gl.vertices << ","
+                << r.gl.uploads << endl;
+        }
+    }
+
+    vector<double> animate, draw, total, calls, drawCalls, stateChanges, vertices;
+    for (const FrameResult &r: results) {
+        animate.push_back(r.animateMs);
+        draw.push_back(r.drawMs);
+        total.push_back(r.animateMs + r.drawMs);
+        calls.push_back(r.gl.calls);
+        drawCalls.push_back(r.gl.drawCalls);
+        stateChanges.push_back(r.gl.stateChanges);
+        vertices.push_back(r.gl.vertices);
+    }
+    cout << "frames " << results.size() << (recorded ? " recorded" : " generated") << endl;
+    printSummary("frame_ms", total);
+    printSummary("animate_ms", animate);
+    printSummary("draw_ms", draw);
+    printSummary("gl_calls", calls);
+    printSummary("draw_calls", drawCalls);
+    printSummary("state_changes", stateChanges);
+    printSummary("vertices", vertices);
+
+#ifdef PAINTER_BENCH_OSMESA
+    OSMesaDestroyContext(context);
+#endif
+    return 0;
+}
@@ -0,0 +1,366 @@
+#ifndef PRESET_BANK_HPP
+#define PRESET_BANK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include "allocore/ui/al_Parameter.hpp"
+
+#include "bank_file.hpp"
+
+namespace al {
+
+/**
+ * @brief Layout of a compiled preset bank (presets.bank in a preset directory)
+ *
+ * Sections follow the header in this order, in native byte order, all 4 byte
+ * aligned so the file can be used in place once mapped:
+ *   uint32 columnNames[columns]   offsets of the parameter addresses in strings
+ *   uint32 presetNames[presets]   offsets of the preset names in strings
+ *   int32 map[mapSize]            preset of each presetMap index, -1 if none
+ *   float values[presets][columns] NaN where a preset doesn't set a parameter
+ *   char strings[stringBytes]     NUL terminated names
+ */
+struct PresetBankHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columns;
+    uint32_t presets;
+    uint32_t mapSize;
+    uint32_t stringBytes;
+
+    static const char *expectedMagic() { return "ALPRBNK"; }
+    enum { currentVersion = 1 };
+
+    size_t fileSize() const {
+        return sizeof(PresetBankHeader) + (columns + presets + mapSize) * 4
+                + size_t(presets) * columns * sizeof(float) + stringBytes;
+    }
+};
+
+/**
+ * @brief All the presets of a PresetHandler directory, loaded into memory
+ *
+ * Parameter addresses are interned as columns and each preset is one float
+ * per column, NaN for parameters the preset doesn't set. default.presetMap
+ * becomes an index table. The bank is read from the compiled presets.bank
+ * of the directory, mapped in place, unless it is missing, invalid, or older
+ * than one of the text presets or than the directory, whose mtime changes
+ * when presets are renamed or removed; then the text presets are parsed
+ * instead.
+ *
+ * Recalling a preset is a lookup and a copy into the parameters, with no
+ * file reads, parsing, locks or allocation, so it can be done in the audio
+ * callback.
+ */
+class PresetBank {
+public:
+    enum Source { ANY, TEXT, COMPILED };
+
+    struct Preset {
+        std::string name;
+        const float *values; // One per column
+    };
+
+    static std::string bankPath(std::string directory) { return directory + "/presets.bank"; }
+
+    /**
+     * @brief Shared bank for a directory and parameter layout, loaded on first use
+     *
+     * Synth instances registering the same parameters share one bank, so each
+     * directory is only read once per process. Call at startup, not on the
+     * audio thread.
+     */
+    static std::shared_ptr<const PresetBank> get(std::string directory, const std::vector<Parameter *> &parameters) {
+        static std::mutex lock;
+        static std::map<std::string, std::shared_ptr<const PresetBank>> banks;
+        std::vector<std::string> addresses;
+        std::string key = directory;
+        for (Parameter *parameter: parameters) {
+            addresses.push_back(parameter->getFullAddress());
+            key += " " + addresses.back();
+        }
+        std::lock_guard<std::mutex> locker(lock);
+        std::shared_ptr<const PresetBank> &bank = banks[key];
+        if (!bank) {
+            bank = std::make_shared<PresetBank>(directory, addresses);
+        }
+        return bank;
+    }
+
+    /**
+     * @brief Loads the presets of directory for parameters with addresses
+     *
+     * The order of addresses is the order of the parameters given to apply().
+     * The source can be forced, e.g. to compile the text presets.
+     */
+    PresetBank(std::string directory, const std::vector<std::string> &addresses, Source source = ANY) :
+        mDirectory(directory)
+    {
+        std::string path = bankPath(directory);
+        bool compiled = false;
+        auto isText = [] (const std::string &file) { return isPresetFile(file) || file == "default.presetMap"; };
+        if (source == COMPILED || (source == ANY && !mFile.textIsNewer(directory, path, isText))) {
+            compiled = readCompiled(path);
+        }
+        if (!compiled && source != COMPILED) {
+            readText(directory);
+        }
+        for (const std::string &address: addresses) {
+            auto it = std::find(mColumnNames.begin(), mColumnNames.end(), address);
+            mColumns.push_back(it == mColumnNames.end() ? -1 : int(it - mColumnNames.begin()));
+        }
+    }
+
+    PresetBank(const PresetBank &) = delete; // mMap points into mPresets
+
+    const std::string &directory() const { return mDirectory; }
+    bool compiled() const { return mFile.mapped(); }
+    const std::vector<std::string> &columns() const { return mColumnNames; }
+    size_t size() const { return mPresets.size(); }
+    const Preset &at(size_t i) const { return mPresets[i]; }
+    size_t mapSize() const { return mMap.size(); }
+
+    // Preset at index of the preset map, or nullptr
+    const Preset *preset(int index) const {
+        return index >= 0 && index < (int) mMap.size() ? mMap[index] : nullptr;
+    }
+
+    // Preset by name (file name without .preset), or nullptr
+    const Preset *preset(const std::string &name) const {
+        for (const Preset &preset: mPresets) {
+            if (preset.name == name) {
+                return &preset;
+            }
+        }
+        return nullptr;
+    }
+
+    // Value of parameter i of the layout the bank was loaded for, NaN if the preset doesn't set it
+    float value(const Preset *preset, size_t i) const {
+        return mColumns[i] < 0 ? std::numeric_limits<float>::quiet_NaN() : preset->values[mColumns[i]];
+    }
+
+    /**
+     * @brief Sets the parameters a preset has values for, without change callbacks
+     *
+     * parameters must be in the order of the addresses the bank was loaded for.
+     */
+    bool apply(const Preset *preset, const std::vector<Parameter *> &parameters) const {
+        if (!preset) {
+            return false;
+        }
+        for (size_t i = 0; i < parameters.size() && i < mColumns.size(); i++) {
+            float v = value(preset, i);
+            if (!std::isnan(v)) {
+                parameters[i]->setNoCalls(v);
+            }
+        }
+        return true;
+    }
+
+    // Writes the compiled bank, e.g. to bankPath(directory())
+    bool write(std::string path) const {
+        PresetBankHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::strcpy(header.magic, PresetBankHeader::expectedMagic());
+        header.version = PresetBankHeader::currentVersion;
+        header.columns = mColumnNames.size();
+        header.presets = mPresets.size();
+        header.mapSize = mMap.size();
+
+        std::string strings;
+        std::vector<uint32_t> columnNames, presetNames;
+        for (const std::string &name: mColumnNames) {
+            columnNames.push_back(strings.size());
+            strings.append(name.c_str(), name.size() + 1);
+        }
+        for (const Preset &preset: mPresets) {
+            presetNames.push_back(strings.size());
+            strings.append(preset.name.c_str(), preset.name.size() + 1);
+        }
+        strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+        header.stringBytes = strings.size();
+        std::vector<int32_t> map;
+        for (const Preset *preset: mMap) {
+            map.push_back(preset ? int32_t(preset - mPresets.data()) : -1);
+        }
+
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cout << "PresetBank: can't write " << path << std::endl;
+            return false;
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(columnNames.data(), 4, columnNames.size(), file);
+        fwrite(presetNames.data(), 4, presetNames.size(), file);
+        fwrite(map.data(), 4, map.size(), file);
+        for (const Preset &preset: mPresets) {
+            fwrite(preset.values, sizeof(float), mColumnNames.size(), file);
+        }
+        fwrite(strings.data(), 1, strings.size(), file);
+        return fclose(file) == 0;
+    }
+
+    // Writes the presets as PresetHandler text files and presetMap into directory
+    bool writeText(std::string directory) const {
+        for (const Preset &preset: mPresets) {
+            std::ofstream file(directory + "/" + preset.name + ".preset");
+            if (!file.is_open()) {
+                std::cout << "PresetBank: can't write " << directory << std::endl;
+                return false;
+            }
+            std::vector<std::pair<std::string, float>> lines;
+            for (size_t c = 0; c < mColumnNames.size(); c++) {
+                if (!std::isnan(preset.values[c])) {
+                    lines.push_back({mColumnNames[c], preset.values[c]});
+                }
+            }
+            std::sort(lines.begin(), lines.end());
+            file << "::" << preset.name << std::endl;
+            char value[32];
+            for (auto &line: lines) {
+                snprintf(value, sizeof(value), "%f", line.second);
+                file << line.first << " f " << value << std::endl;
+            }
+            file << "::" << std::endl;
+        }
+        std::ofstream map(directory + "/default.presetMap");
+        for (size_t i = 0; i < mMap.size(); i++) {
+            if (mMap[i]) {
+                map << i << ":" << mMap[i]->name << std::endl;
+            }
+        }
+        map << "::" << std::endl;
+        return map.good();
+    }
+
+private:
+    static bool isPresetFile(const std::string &file) {
+        return BankFile::hasExtension(file, ".preset");
+    }
+
+    bool readCompiled(std::string path) {
+        const PresetBankHeader *header = mFile.map<PresetBankHeader>(path);
+        if (!header) {
+            return false;
+        }
+        const uint32_t *columnNames = (const uint32_t *) (header + 1);
+        const uint32_t *presetNames = columnNames + header->columns;
+        const int32_t *map = (const int32_t *) (presetNames + header->presets);
+        const float *values = (const float *) (map + header->mapSize);
+        const char *strings = (const char *) (values + size_t(header->presets) * header->columns);
+
+        for (uint32_t c = 0; c < header->columns; c++) {
+            mColumnNames.push_back(strings + std::min(columnNames[c], header->stringBytes - 1));
+        }
+        for (uint32_t p = 0; p < header->presets; p++) {
+            mPresets.push_back({strings + std::min(presetNames[p], header->stringBytes - 1),
+                                values + size_t(p) * header->columns});
+        }
+        for (uint32_t i = 0; i < header->mapSize; i++) {
+            mMap.push_back(map[i] >= 0 && map[i] < (int32_t) header->presets ? &mPresets[map[i]] : nullptr);
+        }
+        return true;
+    }
+
+    void readText(std::string directory) {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir) {
+            std::cout << "PresetBank: can't read " << directory << std::endl;
+            return;
+        }
+        std::vector<std::string> files;
+        while (struct dirent *entry = readdir(dir)) {
+            if (isPresetFile(entry->d_name)) {
+                files.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+
+        std::map<std::string, int> columnIds;
+        std::vector<std::vector<float>> presetValues;
+        for (const std::string &file: files) {
+            presetValues.push_back(readPreset(directory + "/" + file, columnIds));
+            mPresets.push_back({file.substr(0, file.size() - 7), nullptr});
+        }
+        mColumnNames.resize(columnIds.size());
+        for (auto &column: columnIds) {
+            mColumnNames[column.second] = column.first;
+        }
+        mValues.assign(mPresets.size() * mColumnNames.size(), std::numeric_limits<float>::quiet_NaN());
+        for (size_t p = 0; p < mPresets.size(); p++) {
+            std::copy(presetValues[p].begin(), presetValues[p].end(), mValues.begin() + p * mColumnNames.size());
+            mPresets[p].values = mValues.data() + p * mColumnNames.size();
+        }
+        readMap(directory + "/default.presetMap");
+    }
+
+    // Text preset: "::name", then one "/address f value" line per parameter, then "::"
+    static std::vector<float> readPreset(std::string path, std::map<std::string, int> &columnIds) {
+        std::vector<float> values;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            char address[256];
+            char type;
+            float value;
+            if (line.size() > 0 && line[0] == '/'
+                    && sscanf(line.c_str(), "%255s %c %f", address, &type, &value) == 3 && type == 'f') {
+                auto it = columnIds.insert({address, (int) columnIds.size()}).first;
+                if (it->second >= (int) values.size()) {
+                    values.resize(it->second + 1, std::numeric_limits<float>::quiet_NaN());
+                }
+                values[it->second] = value;
+            }
+        }
+        return values;
+    }
+
+    // "index:name" lines, up to "::"
+    void readMap(std::string path) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line) && line.substr(0, 2) != "::") {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            int index = atoi(line.substr(0, colon).c_str());
+            const Preset *preset = this->preset(line.substr(colon + 1));
+            if (index >= 0 && preset) {
+                if (index >= (int) mMap.size()) {
+                    mMap.resize(index + 1, nullptr);
+                }
+                mMap[index] = preset;
+            }
+        }
+    }
+
+    std::string mDirectory;
+    std::vector<std::string> mColumnNames; // Interned parameter addresses
+    std::vector<int> mColumns; // Column of each parameter of the layout, -1 if no preset sets it
+    std::vector<Preset> mPresets; // Not resized after loading, mMap points into it
+    std::vector<const Preset *> mMap;
+
+    std::vector<float> mValues; // Text presets
+    BankFile mFile {"PresetBank"}; // Compiled bank
+};
+
+} // namespace al
+
+#endif // PRESET_BANK_HPP
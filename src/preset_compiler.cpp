@@ -0,0 +1,94 @@
+/*
+Compiles the text presets of a preset directory into a presets.bank
+
+The synths load presets.bank (see preset_bank.hpp) with a single mapping
+instead of parsing every .preset file of the directory, and fall back to
+the text presets when there is no bank or a preset was saved after it.
+Run after changing the presets, e.g. for presets/ and chaosPresets/:
+
+    preset_compiler presets
+    preset_compiler chaosPresets
+
+Usage:
+    preset_compiler <directory> [bank]    text presets to bank (default <directory>/presets.bank)
+    preset_compiler -text <bank directory> <output directory>
+                                          compiled bank back to .preset files and default.presetMap
+    preset_compiler -check <directory>    compares the text presets with the compiled bank
+*/
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include "preset_bank.hpp"
+
+using namespace al;
+using namespace std;
+
+static bool samePresets(const PresetBank &a, const PresetBank &b) {
+    if (a.size() != b.size() || a.columns() != b.columns() || a.mapSize() != b.mapSize()) {
+        cout << "different number of presets, parameters or map entries" << endl;
+        return false;
+    }
+    for (size_t p = 0; p < a.size(); p++) {
+        if (a.at(p).name != b.at(p).name) {
+            cout << "preset " << p << ": " << a.at(p).name << " != " << b.at(p).name << endl;
+            return false;
+        }
+        for (size_t c = 0; c < a.columns().size(); c++) {
+            float x = a.at(p).values[c], y = b.at(p).values[c];
+            if (x != y && !(std::isnan(x) && std::isnan(y))) {
+                cout << a.at(p).name << " " << a.columns()[c] << ": " << x << " != " << y << endl;
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < a.mapSize(); i++) {
+        if ((a.preset(i) ? a.preset(i)->name : "") != (b.preset(i) ? b.preset(i)->name : "")) {
+            cout << "map entry " << i << " differs" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: preset_compiler <directory> [bank] | -text <bank directory> <output directory> | -check <directory>" << endl;
+        return 1;
+    }
+    string command = argv[1];
+
+    if (command == "-text" && argc > 3) {
+        PresetBank bank(argv[2], {}, PresetBank::COMPILED);
+        if (!bank.compiled()) {
+            cout << "No compiled bank in " << argv[2] << endl;
+            return 1;
+        }
+        bool written = bank.writeText(argv[3]);
+        cout << bank.size() << " presets written to " << argv[3] << endl;
+        return written ? 0 : 1;
+    }
+
+    if (command == "-check" && argc > 2) {
+        PresetBank text(argv[2], {}, PresetBank::TEXT);
+        PresetBank compiled(argv[2], {}, PresetBank::COMPILED);
+        bool same = compiled.compiled() && samePresets(text, compiled);
+        cout << PresetBank::bankPath(argv[2]) << (same ? " matches the text presets" : " is out of date") << endl;
+        return same ? 0 : 1;
+    }
+
+    string directory = command;
+    string path = argc > 2 ? argv[2] : PresetBank::bankPath(directory);
+    PresetBank bank(directory, {}, PresetBank::TEXT);
+    if (bank.size() == 0) {
+        cout << "No presets in " << directory << endl;
+        return 1;
+    }
+    if (!bank.write(path)) {
+        return 1;
+    }
+    cout << bank.size() << " presets, " << bank.columns().size() << " parameters, "
+         << bank.mapSize() << " map entries written to " << path << endl;
+    return 0;
+}
@@ -0,0 +1,157 @@
+#ifndef PRESET_MORPH_HPP
+#define PRESET_MORPH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "allocore/ui/al_Parameter.hpp"
+
+#include "preset_bank.hpp"
+
+namespace al {
+
+/**
+ * @brief Morphs between presets on the audio thread, one step per sample
+ *
+ * Replaces PresetHandler's morph thread, which set parameters every few
+ * milliseconds from another thread, so oscillators only saw the changes at
+ * the next block, as steps. Here each parameter glides from its current
+ * value to the preset value over the morph time, or at least over its own
+ * smoothing time so recalls without morph don't click either. The synth calls
+ * step() for each sample and reads value() into its oscillators.
+ *
+ * All calls but add() are for the audio thread. Parameters that are not
+ * moving are read back at each beginBlock(), so changes from GUIs or
+ * callbacks are kept; moving ones are written back at endBlock().
+ */
+class PresetMorph {
+public:
+    enum Curve {
+        LINEAR,
+        EXPONENTIAL // Equal ratios per step, for frequencies; linear if the sign changes
+    };
+
+    // Adds a parameter, before the first block. Returns its index.
+    size_t add(Parameter &parameter, Curve curve = LINEAR, float smoothingSeconds = 0.02f) {
+        mParameters.push_back(&parameter);
+        Slot slot;
+        slot.curve = curve;
+        slot.smoothing = smoothingSeconds;
+        slot.value = slot.target = parameter.get();
+        mSlots.push_back(slot);
+        return mSlots.size() - 1;
+    }
+
+    // In the order of add(), e.g. for PresetBank::get()
+    const std::vector<Parameter *> &parameters() const { return mParameters; }
+
+    float value(size_t i) const { return mSlots[i].value; }
+    bool active() const { return mActive > 0; }
+
+    // Glides every parameter the preset sets to its value, over seconds
+    bool morph(const PresetBank &bank, const PresetBank::Preset *preset, float seconds) {
+        if (!preset) {
+            return false;
+        }
+        for (size_t i = 0; i < mSlots.size(); i++) {
+            float target = bank.value(preset, i);
+            if (!std::isnan(target)) {
+                glide(i, target, seconds);
+            }
+        }
+        return true;
+    }
+
+    // Glides one parameter to target, over seconds or its smoothing time if longer
+    void glide(size_t i, float target, float seconds) {
+        Slot &slot = mSlots[i];
+        long samples = std::lround(std::max(seconds, slot.smoothing) * mSampleRate);
+        if (slot.remaining == 0) {
+            slot.value = mParameters[i]->get();
+            mActive++;
+        }
+        slot.target = target;
+        slot.remaining = std::max(samples, 1L);
+        if (slot.curve == EXPONENTIAL && slot.value * target > 0) {
+            slot.factor = std::pow(target / slot.value, 1.0 / slot.remaining);
+            slot.increment = 0;
+        } else {
+            slot.factor = 1;
+            slot.increment = (target - slot.value) / slot.remaining;
+        }
+    }
+
+    void beginBlock(double sampleRate) {
+        mSampleRate = sampleRate;
+        for (size_t i = 0; i < mSlots.size(); i++) {
+            if (mSlots[i].remaining == 0) {
+                mSlots[i].value = mSlots[i].target = mParameters[i]->get();
+            }
+        }
+    }
+
+    // Advances one sample. Returns true if any value changed.
+    bool step() {
+        if (mActive == 0) {
+            return false;
+        }
+        for (Slot &slot: mSlots) {
+            if (slot.remaining > 0) {
+                slot.value = slot.value * slot.factor + slot.increment;
+                slot.moved = true;
+                if (--slot.remaining == 0) {
+                    slot.value = slot.target;
+                    mActive--;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Advances a block without reading the values, e.g. while the synth is silent
+    void skip(int frames) {
+        for (Slot &slot: mSlots) {
+            if (slot.remaining > 0) {
+                long n = std::min(long(frames), slot.remaining);
+                slot.value = slot.value * std::pow(slot.factor, double(n)) + slot.increment * n;
+                slot.remaining -= n;
+                slot.moved = true;
+                if (slot.remaining == 0) {
+                    slot.value = slot.target;
+                    mActive--;
+                }
+            }
+        }
+    }
+
+    // Writes the values that moved in the block back to the parameters, without callbacks
+    void endBlock() {
+        for (size_t i = 0; i < mSlots.size(); i++) {
+            if (mSlots[i].moved) {
+                mParameters[i]->setNoCalls(mSlots[i].value);
+                mSlots[i].moved = false;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Curve curve;
+        float smoothing;
+        float value, target;
+        double factor = 1; // value = value * factor + increment per sample
+        float increment = 0;
+        long remaining = 0; // Samples to target
+        bool moved = false; // Since endBlock()
+    };
+
+    std::vector<Parameter *> mParameters;
+    std::vector<Slot> mSlots;
+    int mActive = 0;
+    double mSampleRate = 44100;
+};
+
+} // namespace al
+
+#endif // PRESET_MORPH_HPP
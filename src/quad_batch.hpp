@@ -0,0 +1,121 @@
+#ifndef QUAD_BATCH_HPP
+#define QUAD_BATCH_HPP
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+
+#include "visibility_culler.hpp"
+
+namespace al {
+
+/**
+ * @brief Textured quads transformed on the CPU into one mesh
+ *
+ * Keeps its own matrix stack with the same pushMatrix(), translate(),
+ * rotate() and scale() calls as Graphics, so drawing code can be moved here
+ * unchanged. quad() adds the unit quad mQuad used to be, transformed by the
+ * current matrix and with the texture coordinates of an atlas rect. All
+ * quads then draw with a single g.draw(mesh()) and one texture bind.
+ * Quads whose bounding sphere fails the culler are left out. Building a
+ * batch needs no GL context.
+ */
+class QuadBatch {
+public:
+    QuadBatch() { clear(); }
+
+    void clear() {
+        mMesh.reset();
+        mMesh.primitive(Graphics::TRIANGLES);
+        mStack.assign(1, Matrix());
+        static const float id[16] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1};
+        std::memcpy(mStack[0].m, id, sizeof(id));
+    }
+
+    // Quads are in world coordinates, the batch starts from the identity
+    void culler(const VisibilityCuller *culler) { mCuller = culler; }
+
+    void pushMatrix() { mStack.push_back(mStack.back()); }
+    void popMatrix() { if (mStack.size() > 1) mStack.pop_back(); }
+
+    void translate(float x, float y, float z) {
+        float *m = mStack.back().m;
+        for (int i = 0; i < 4; i++) {
+            m[12 + i] += m[i] * x + m[4 + i] * y + m[8 + i] * z;
+        }
+    }
+
+    // Angle in degrees around the axis (x, y, z), like Graphics::rotate()
+    void rotate(float angle, float x = 0, float y = 0, float z = 1) {
+        float norm = std::sqrt(x * x + y * y + z * z);
+        if (norm == 0) {
+            return;
+        }
+        x /= norm; y /= norm; z /= norm;
+        float radians = angle * float(M_PI / 180.0);
+        float c = std::cos(radians), s = std::sin(radians), t = 1 - c;
+        float r[9] = {x * x * t + c,     y * x * t + z * s, x * z * t - y * s,
+                      x * y * t - z * s, y * y * t + c,     y * z * t + x * s,
+                      x * z * t + y * s, y * z * t - x * s, z * z * t + c};
+        float *m = mStack.back().m;
+        float result[12];
+        for (int col = 0; col < 3; col++) {
+            for (int i = 0; i < 4; i++) {
+                result[col * 4 + i] = m[i] * r[col * 3] + m[4 + i] * r[col * 3 + 1] + m[8 + i] * r[col * 3 + 2];
+            }
+        }
+        std::memcpy(m, result, sizeof(result));
+    }
+
+    void scale(float x, float y, float z) {
+        float *m = mStack.back().m;
+        for (int i = 0; i < 4; i++) {
+            m[i] *= x; m[4 + i] *= y; m[8 + i] *= z;
+        }
+    }
+
+    void scale(float s) { scale(s, s, s); }
+
+    // Adds the quad from (-1, -1) to (1, 1) at z = 0, textured with uv = u0, v0, u1, v1
+    void quad(const float *uv) {
+        const float *m = mStack.back().m;
+        if (mCuller && mCuller->active()) {
+            float radius = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]
+                                     + m[4] * m[4] + m[5] * m[5] + m[6] * m[6]);
+            if (!mCuller->visible(Vec3f(m[12], m[13], m[14]), radius)) {
+                return;
+            }
+        }
+        unsigned int first = mMesh.vertices().size();
+        static const float corners[4][2] = {{-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+        for (int i = 0; i < 4; i++) {
+            float x = corners[i][0], y = corners[i][1];
+            mMesh.vertex(m[0] * x + m[4] * y + m[12],
+                         m[1] * x + m[5] * y + m[13],
+                         m[2] * x + m[6] * y + m[14]);
+            mMesh.texCoord(uv[i & 1 ? 2 : 0], uv[i & 2 ? 3 : 1]);
+        }
+        mMesh.index(first, first + 1, first + 2);
+        mMesh.index(first + 2, first + 1, first + 3);
+    }
+
+    bool empty() { return mMesh.vertices().size() == 0; }
+
+    Mesh &mesh() { return mMesh; }
+
+private:
+    struct Matrix {
+        float m[16]; // Column major
+    };
+
+    std::vector<Matrix> mStack;
+    Mesh mMesh;
+    const VisibilityCuller *mCuller = nullptr;
+};
+
+} // namespace al
+
+#endif // QUAD_BATCH_HPP
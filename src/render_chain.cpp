@@ -53,6 +53,7 @@ public:
         pos.z = -4;
         if (pos.x > 1.5) { pos.x = -1.5; }
         mModules[0]->setPosition(pos);
+        mRenderTree.tick();
     }
 
     virtual void onDraw(Graphics& g) override
@@ -7,6 +7,7 @@
 #include <memory>
 #include <mutex>
 #include <map>
+#include <algorithm>
 #include <inttypes.h>
 #include <cassert>
 
@@ -20,25 +21,151 @@
 #include "allocore/protocol/al_OSC.hpp"
 #include "allocore/ui/al_Parameter.hpp"
 
+#include "font_cache.hpp"
+#include "text_batch.hpp"
+
 namespace al {
 
 class RenderModule;
 
-class Behavior {
+/**
+ * @brief Description of an animation applied to a RenderModule
+ *
+ * Behaviors are plain values. Adding one to a module schedules it in the
+ * BehaviorSystem of the tree that owns the module, which advances all
+ * scheduled behaviors together once per frame. See FadeOut, FadeIn, Sink and
+ * Timeout below for the concrete types.
+ */
+struct Behavior {
+    typedef enum {
+        ALPHA_RAMP = 0,
+        POSITION_RAMP,
+        TIMEOUT
+    } Type;
+
+    Type type {TIMEOUT};
+    unsigned long numTicks {0};
+    unsigned long delayTicks {0};
+    float alpha {0.0f}; // ALPHA_RAMP: change as a multiple of the alpha when added
+    Vec3f delta {0, 0, 0}; // POSITION_RAMP: total displacement
+    bool finishModule {false}; // Mark module as done when behavior ends
+};
+
+typedef uint32_t BehaviorId;
+
+/**
+ * @brief A Behavior resolved against a module, as relayed to slave trees
+ *
+ * All values are absolute and the start is given in the ticks of the module
+ * so that every machine evaluates the same ramp in lockstep, even when the
+ * message arrives a few frames late.
+ */
+struct ScheduledBehavior {
+    BehaviorId id {0}; // 0 to have the system allocate an id
+    Behavior::Type type {Behavior::TIMEOUT};
+    unsigned long startTick {0}; // In module ticks
+    unsigned long numTicks {0};
+    float alphaDelta {0.0f};
+    Vec3f delta {0, 0, 0};
+    bool finishModule {false};
+};
+
+/**
+ * @brief Structure of arrays storage for the behaviors of a RenderTree
+ *
+ * Alpha ramps, position ramps and timers are stored in separate contiguous
+ * arrays. Ramps are evaluated in closed form from their start tick so that
+ * step() is a single branchless pass over each array followed by a scatter of
+ * the changes to the modules. Nothing is relayed per frame: slave trees run
+ * the same behaviors locally.
+ */
+class BehaviorSystem {
 public:
-    Behavior() {}
-    virtual ~Behavior() {}
-    virtual void init() = 0;
-    virtual void tick() = 0;
+    BehaviorId add(RenderModule *module, const ScheduledBehavior &behavior);
+    void remove(BehaviorId id); // Module keeps its current values
+    void detach(RenderModule *module); // Removes all behaviors for module
+    void clear();
 
-    void setModule(RenderModule *module) {
-        mModule = module;
-    }
-    bool done() {return mDone;}
+    void step(); // Advance one tick
 
-protected:
-    bool mDone = false;
-    RenderModule *mModule {nullptr};
+    unsigned long ticks() { return mTicks; }
+
+private:
+    struct Ramps {
+        std::vector<RenderModule *> module;
+        std::vector<BehaviorId> id;
+        std::vector<uint32_t> start;
+        std::vector<uint32_t> numTicks;
+        std::vector<float> invTicks;
+        std::vector<uint8_t> finishModule;
+        std::vector<float> progress;
+
+        size_t size() { return module.size(); }
+        void push(RenderModule *m, BehaviorId i, uint32_t s, uint32_t n, bool finish) {
+            module.push_back(m);
+            id.push_back(i);
+            start.push_back(s);
+            numTicks.push_back(n);
+            invTicks.push_back(n > 0 ? 1.0f/n : 1.0f);
+            finishModule.push_back(finish ? 1 : 0);
+            progress.push_back(0.0f);
+        }
+        void swapRemove(size_t i) {
+            size_t last = size() - 1;
+            module[i] = module[last]; module.pop_back();
+            id[i] = id[last]; id.pop_back();
+            start[i] = start[last]; start.pop_back();
+            numTicks[i] = numTicks[last]; numTicks.pop_back();
+            invTicks[i] = invTicks[last]; invTicks.pop_back();
+            finishModule[i] = finishModule[last]; finishModule.pop_back();
+            progress[i] = progress[last]; progress.pop_back();
+        }
+        void clear() {
+            module.clear(); id.clear(); start.clear(); numTicks.clear();
+            invTicks.clear(); finishModule.clear(); progress.clear();
+        }
+        // Computes progress in [0,1] for every ramp. Vectorizable.
+        void evaluate(uint32_t now) {
+            const size_t n = size();
+            for (size_t i = 0; i < n; i++) {
+                float elapsed = (float) (int32_t) (now - start[i]);
+                float p = elapsed * invTicks[i];
+                p = p < 0.0f ? 0.0f : p;
+                progress[i] = p > 1.0f ? 1.0f : p;
+            }
+        }
+        bool finished(size_t i, uint32_t now) {
+            return (int32_t) (now - start[i]) >= (int32_t) numTicks[i];
+        }
+    };
+
+    struct AlphaRamps : Ramps {
+        std::vector<float> delta;
+        std::vector<float> applied;
+    };
+
+    struct PositionRamps : Ramps {
+        std::vector<float> deltaX, deltaY, deltaZ;
+        std::vector<float> appliedX, appliedY, appliedZ;
+    };
+
+    struct Timers {
+        std::vector<RenderModule *> module;
+        std::vector<BehaviorId> id;
+        std::vector<uint32_t> end;
+    };
+
+    void removeAlphaRamp(size_t i);
+    void removePositionRamp(size_t i);
+    void removeTimer(size_t i);
+
+    std::mutex mLock;
+    uint32_t mTicks {0};
+    BehaviorId mNextId {0};
+
+    AlphaRamps mAlphaRamps;
+    PositionRamps mPositionRamps;
+    Timers mTimers;
 };
 
 class Relayer {
@@ -107,9 +234,15 @@ private:
 class RenderModule : public OSCNotifier {
     friend class RenderTree;
     friend class RenderTreeHandler;
+    friend class BehaviorSystem;
 public:
     RenderModule() {} // perhaps have non public constructor and factory function in chain?
-    virtual ~RenderModule() { relayDestruction();}
+    virtual ~RenderModule() {
+        if (mBehaviorSystem) {
+            mBehaviorSystem->detach(this);
+        }
+        relayDestruction();
+    }
 
     void setPosition(Vec3f pos) { mPosition = pos; relay(moduleAddress() + "/setPosition", pos);}
     void setRotation(Vec3f rot) { mRotation = rot; relay(moduleAddress() + "/setRotation", rot);}
@@ -137,24 +270,94 @@ public:
     void addChild(std::shared_ptr<RenderModule> child) {
         std::lock_guard<std::mutex> locker(mModuleLock);
 		child->setRelayer(mRelayer);
+		child->setBehaviorSystem(mBehaviorSystem);
         mChildren.push_back(child);
     }
 
-    void addBehavior(std::shared_ptr<Behavior> behavior) {
-        std::lock_guard<std::mutex> locker(mModuleLock);
-        behavior->setModule(this);
-        behavior->init();
-        mBehaviors.push_back(behavior);
+    // Behaviors added before the module is in a tree are scheduled when it
+    // is added. Returns 0 in that case, as the behavior can't be removed.
+    BehaviorId addBehavior(const Behavior &behavior) {
+        ScheduledBehavior scheduled;
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            if (!mBehaviorSystem) {
+                mPendingBehaviors.push_back(behavior);
+                return 0;
+            }
+            scheduled.startTick = mTicks + behavior.delayTicks;
+            scheduled.alphaDelta = behavior.alpha * mColor.a;
+        }
+        scheduled.type = behavior.type;
+        scheduled.numTicks = behavior.numTicks;
+        scheduled.delta = behavior.delta;
+        scheduled.finishModule = behavior.finishModule;
+        return addBehavior(scheduled);
     }
 
-	void removeBehavoir(std::shared_ptr<Behavior> behavior) {
-		std::lock_guard<std::mutex> locker(mModuleLock);
-		std::remove( mBehaviors.begin(), mBehaviors.end(), behavior );
+    BehaviorId addBehavior(ScheduledBehavior behavior) {
+        if (!mBehaviorSystem) {
+            return 0;
+        }
+        behavior.id = mBehaviorSystem->add(this, behavior);
+        if (mRelayer) {
+            osc::Packet p;
+            p.beginMessage(moduleAddress() + "/addBehavior");
+            p << (int) behavior.id << (int) behavior.type;
+            p << (int) behavior.startTick << (int) behavior.numTicks;
+            p << behavior.alphaDelta;
+            p << behavior.delta.x << behavior.delta.y << behavior.delta.z;
+            p << (behavior.finishModule ? 1 : 0);
+            p.endMessage();
+            mRelayer->relay(p);
+        }
+        return behavior.id;
+    }
+
+	void removeBehavior(BehaviorId id) {
+		if (mBehaviorSystem) {
+			mBehaviorSystem->remove(id);
+		}
+		relay(moduleAddress() + "/removeBehavior", (int) id);
 	}
 
+	// Stops all behaviors, leaving position and color where they are.
+	// Slaves snap to the values on this machine.
 	void clearBehaviors() {
-		std::lock_guard<std::mutex> locker(mModuleLock);
-		mBehaviors.clear();
+		{
+			std::lock_guard<std::mutex> locker(mModuleLock);
+			mPendingBehaviors.clear();
+		}
+		if (mBehaviorSystem) {
+			mBehaviorSystem->detach(this);
+		}
+		if (mRelayer) {
+			osc::Packet p;
+			p.beginMessage(moduleAddress() + "/clearBehaviors");
+			p << mPosition.x << mPosition.y << mPosition.z;
+			p << mColor.r << mColor.g << mColor.b << mColor.a;
+			p.endMessage();
+			mRelayer->relay(p);
+		}
+	}
+
+	void setBehaviorSystem(BehaviorSystem *system) {
+		std::vector<Behavior> pending;
+		{
+			std::lock_guard<std::mutex> locker(mModuleLock);
+			if (mBehaviorSystem && mBehaviorSystem != system) {
+				mBehaviorSystem->detach(this);
+			}
+			mBehaviorSystem = system;
+			if (system) {
+				pending.swap(mPendingBehaviors);
+			}
+			for (auto child : mChildren) {
+				child->setBehaviorSystem(system);
+			}
+		}
+		for (auto &behavior: pending) {
+			addBehavior(behavior);
+		}
 	}
 
 	void setRelayer(Relayer *relayer) {
@@ -201,6 +404,28 @@ public:
                 Vec3f newScale = Vec3f(std::stod(arguments[0]), std::stod(arguments[1]), std::stod(arguments[2]));
                 setScale(newScale);
             }
+        } else if (command == "addBehavior") {
+            if (arguments.size() == 9) {
+                ScheduledBehavior behavior;
+                behavior.id = std::stoul(arguments[0]);
+                behavior.type = (Behavior::Type) std::stoi(arguments[1]);
+                behavior.startTick = std::stoul(arguments[2]);
+                behavior.numTicks = std::stoul(arguments[3]);
+                behavior.alphaDelta = std::stod(arguments[4]);
+                behavior.delta = Vec3f(std::stod(arguments[5]), std::stod(arguments[6]), std::stod(arguments[7]));
+                behavior.finishModule = std::stoi(arguments[8]) != 0;
+                addBehavior(behavior);
+            }
+        } else if (command == "removeBehavior") {
+            if (arguments.size() == 1) {
+                removeBehavior(std::stoul(arguments[0]));
+            }
+        } else if (command == "clearBehaviors") {
+            clearBehaviors();
+            if (arguments.size() == 7) {
+                setPosition(Vec3f(std::stod(arguments[0]), std::stod(arguments[1]), std::stod(arguments[2])));
+                setColor(Color(std::stod(arguments[3]), std::stod(arguments[4]), std::stod(arguments[5]), std::stod(arguments[6])));
+            }
         } else if (command == "done") {
 			setDone(true);
         } else if (command == "destroy") {
@@ -225,6 +450,19 @@ protected:
     virtual void init(Graphics &g) = 0;
     virtual void render(Graphics &g, float dt = -1.0) = 0;
     virtual void cleanup() {}
+    // Override to append to the tree's text batch instead of rendering.
+    // Return false to be rendered through render()
+    virtual bool batch(TextBatch &batch) { return false; }
+    // Once per frame from RenderTree::tick(), with the module locked
+    virtual void onTick() {}
+
+	bool relaying() { return mRelayer != nullptr; }
+
+	void relay(osc::Packet &p) {
+		if (mRelayer) {
+			mRelayer->relay(p);
+		}
+	}
 
 	void relay(std::string addr) {
 		if (mRelayer) {
@@ -333,24 +571,32 @@ private:
             child->renderInternal(g, dt);
             g.popMatrix();
         }
-        std::vector<std::shared_ptr<Behavior>> behaviorsToRemove;
-        for (auto behavior: mBehaviors) {
-            if (behavior->done()) {
-                behaviorsToRemove.push_back(behavior);
-            } else {
-                behavior->tick();
-            }
-        }
-        for(auto behavior:behaviorsToRemove) {
-            mBehaviors.erase(std::find(mBehaviors.begin(),mBehaviors.end(), behavior));
-        }
-        mTicks++;
 		for (auto uniValues: uniformCache) {
 			glUniform1f(uniValues.first, uniValues.second);
 		}
     }
 
+    bool batchInternal(TextBatch &textBatch) {
+		std::lock_guard<std::mutex> locker(mModuleLock);
+		if (mChildren.size() > 0 || mUniformValues.size() > 0) {
+			return false;
+		}
+		return batch(textBatch);
+    }
+
+    // Once per frame, however many times the module is drawn
+    void tickInternal() {
+		std::lock_guard<std::mutex> locker(mModuleLock);
+        mTicks++;
+        onTick();
+        for(auto child : mChildren) {
+            child->tickInternal();
+        }
+    }
+
 	Relayer *mRelayer {nullptr};
+	BehaviorSystem *mBehaviorSystem {nullptr};
+	std::vector<Behavior> mPendingBehaviors;
 
     Vec3f mPosition {0, 0, 0};
     Vec3f mRotation {0, 0, 0};
@@ -358,117 +604,216 @@ private:
     Color mColor {1.0,1.0,1.0,1.0};
 //    u_int32_t mModuleType {0};
     std::vector<std::shared_ptr<RenderModule>> mChildren;
-    std::vector<std::shared_ptr<Behavior>> mBehaviors;
 	std::map<std::string, bool> mFlags;
 	std::map<int, float> mUniformValues;
 	int mProgram; // hack to store shader program index
 	u_int32_t mId {UINT32_MAX};
 };
 
+// Behaviors ------------------------
+
 class Timeout : public Behavior {
-    friend class RenderModule;
 public:
-    Timeout(unsigned long numTicks) : Behavior() {
-        mNumTicks = numTicks;
-    }
-
-    virtual void init() override {}
-
-    virtual void tick() override {
-        if (mNumTicks-- == 0) {
-            mModule->setDone(true);
-        }
+    Timeout(unsigned long numTicks) {
+        type = TIMEOUT;
+        this->numTicks = numTicks;
+        finishModule = true;
     }
-
-private:
-    unsigned long mNumTicks;
 };
 
-// Behaviors ------------------------
-
 class FadeOut : public Behavior {
-    friend class RenderModule;
 public:
-    FadeOut(unsigned long numTicks, unsigned long delayTicks = 0) : Behavior() {
-        mNumTicks = numTicks;
-        mDelayTicks = delayTicks;
+    FadeOut(unsigned long numTicks, unsigned long delayTicks = 0) {
+        type = ALPHA_RAMP;
+        this->numTicks = numTicks;
+        this->delayTicks = delayTicks;
+        alpha = -1.0f;
+        finishModule = true;
     }
+};
 
-    virtual void init() override {
-        mAlphaDec = mModule->getColor().a/(float)mNumTicks;
+class FadeIn : public Behavior {
+public:
+    FadeIn(unsigned long numTicks) {
+        type = ALPHA_RAMP;
+        this->numTicks = numTicks;
+        alpha = 1.0f;
     }
+};
 
-    virtual void tick() override {
-        if (mDelayTicks == 0) {
-			Color &c = mModule->getColor();
-            c.a -= mAlphaDec;
-			mModule->setColor(c);
-            if (mNumTicks-- == 0) {
-                mModule->setDone(true);
-            }
-        } else {
-            mDelayTicks--;
-        }
+class Sink : public Behavior {
+public:
+    Sink(unsigned long numTicks, float zDelta) {
+        type = POSITION_RAMP;
+        this->numTicks = numTicks;
+        delta = Vec3f(0, 0, zDelta);
     }
-
-private:
-    float mAlphaDec {0};
-    unsigned long mNumTicks;
-    unsigned long mDelayTicks;
 };
 
-class FadeIn : public Behavior {
-    friend class RenderModule;
-public:
-    FadeIn(unsigned long numTicks) : Behavior() {
-        mNumTicks = numTicks;
+// ------------------------------ Behavior System
+
+inline BehaviorId BehaviorSystem::add(RenderModule *module, const ScheduledBehavior &behavior)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    BehaviorId id = behavior.id;
+    if (id == 0) {
+        id = ++mNextId;
+    }
+    // Module ticks advance once per step, so the offset between them and
+    // the system ticks is fixed for the lifetime of the module
+    uint32_t start = mTicks + (uint32_t) behavior.startTick - (uint32_t) module->mTicks;
+    uint32_t numTicks = behavior.numTicks;
+    switch (behavior.type) {
+    case Behavior::ALPHA_RAMP:
+        mAlphaRamps.push(module, id, start, numTicks, behavior.finishModule);
+        mAlphaRamps.delta.push_back(behavior.alphaDelta);
+        mAlphaRamps.applied.push_back(0.0f);
+        break;
+    case Behavior::POSITION_RAMP:
+        mPositionRamps.push(module, id, start, numTicks, behavior.finishModule);
+        mPositionRamps.deltaX.push_back(behavior.delta.x);
+        mPositionRamps.deltaY.push_back(behavior.delta.y);
+        mPositionRamps.deltaZ.push_back(behavior.delta.z);
+        mPositionRamps.appliedX.push_back(0.0f);
+        mPositionRamps.appliedY.push_back(0.0f);
+        mPositionRamps.appliedZ.push_back(0.0f);
+        break;
+    case Behavior::TIMEOUT:
+        mTimers.module.push_back(module);
+        mTimers.id.push_back(id);
+        mTimers.end.push_back(start + numTicks);
+        break;
     }
+    return id;
+}
 
-    virtual void init() override {
-        mAlphaInc = mModule->getColor().a/(float)mNumTicks;
+inline void BehaviorSystem::remove(BehaviorId id)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    for (size_t i = 0; i < mAlphaRamps.size(); i++) {
+        if (mAlphaRamps.id[i] == id) { removeAlphaRamp(i); return; }
+    }
+    for (size_t i = 0; i < mPositionRamps.size(); i++) {
+        if (mPositionRamps.id[i] == id) { removePositionRamp(i); return; }
+    }
+    for (size_t i = 0; i < mTimers.id.size(); i++) {
+        if (mTimers.id[i] == id) { removeTimer(i); return; }
     }
+}
 
-    virtual void tick() override {
-        Color &c = mModule->getColor();
-		c.a += mAlphaInc;
-		mModule->setColor(c);
-        if (mNumTicks-- == 0) {
-            mDone = true;
-        }
+inline void BehaviorSystem::detach(RenderModule *module)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    for (size_t i = mAlphaRamps.size(); i-- > 0;) {
+        if (mAlphaRamps.module[i] == module) { removeAlphaRamp(i); }
     }
+    for (size_t i = mPositionRamps.size(); i-- > 0;) {
+        if (mPositionRamps.module[i] == module) { removePositionRamp(i); }
+    }
+    for (size_t i = mTimers.id.size(); i-- > 0;) {
+        if (mTimers.module[i] == module) { removeTimer(i); }
+    }
+}
 
-private:
-    float mAlphaInc {0};
-    unsigned long mNumTicks;
-};
+inline void BehaviorSystem::clear()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    mAlphaRamps.clear();
+    mAlphaRamps.delta.clear();
+    mAlphaRamps.applied.clear();
+    mPositionRamps.clear();
+    mPositionRamps.deltaX.clear(); mPositionRamps.deltaY.clear(); mPositionRamps.deltaZ.clear();
+    mPositionRamps.appliedX.clear(); mPositionRamps.appliedY.clear(); mPositionRamps.appliedZ.clear();
+    mTimers.module.clear();
+    mTimers.id.clear();
+    mTimers.end.clear();
+}
 
-class Sink : public Behavior {
-    friend class RenderModule;
-public:
-    Sink(unsigned long numTicks, float zDelta) : Behavior() {
-        mNumTicks = numTicks;
-        mDelta = zDelta/numTicks;
+inline void BehaviorSystem::step()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    const uint32_t now = ++mTicks;
+
+    // Evaluate all ramps
+    mAlphaRamps.evaluate(now);
+    mPositionRamps.evaluate(now);
+
+    // Scatter changes since last step to modules
+    AlphaRamps &a = mAlphaRamps;
+    for (size_t i = 0; i < a.size(); i++) {
+        float value = a.delta[i] * a.progress[i];
+        if (value != a.applied[i]) {
+            a.module[i]->mColor.a += value - a.applied[i];
+            a.applied[i] = value;
+        }
     }
-
-    virtual void init() override {
-        mTargetTicks = mModule->getTicks() + mNumTicks;
+    PositionRamps &p = mPositionRamps;
+    for (size_t i = 0; i < p.size(); i++) {
+        float x = p.deltaX[i] * p.progress[i];
+        float y = p.deltaY[i] * p.progress[i];
+        float z = p.deltaZ[i] * p.progress[i];
+        if (x != p.appliedX[i] || y != p.appliedY[i] || z != p.appliedZ[i]) {
+            Vec3f &pos = p.module[i]->mPosition;
+            pos.x += x - p.appliedX[i];
+            pos.y += y - p.appliedY[i];
+            pos.z += z - p.appliedZ[i];
+            p.appliedX[i] = x;
+            p.appliedY[i] = y;
+            p.appliedZ[i] = z;
+        }
     }
 
-    virtual void tick() override {
-        if (mModule->getTicks() < mTargetTicks) {
-            Vec3f pos = mModule->getPosition();
-            pos.z += mDelta;
-            mModule->setPosition(pos);
-		} else {
-			mDone = true;
-		}
+    // Retire finished behaviors
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a.finished(i, now)) {
+            if (a.finishModule[i]) { a.module[i]->setDone(true); }
+            removeAlphaRamp(i);
+        }
+    }
+    for (size_t i = p.size(); i-- > 0;) {
+        if (p.finished(i, now)) {
+            if (p.finishModule[i]) { p.module[i]->setDone(true); }
+            removePositionRamp(i);
+        }
     }
+    for (size_t i = mTimers.end.size(); i-- > 0;) {
+        if ((int32_t) (now - mTimers.end[i]) >= 0) {
+            mTimers.module[i]->setDone(true);
+            removeTimer(i);
+        }
+    }
+}
 
-private:
-    unsigned long mTargetTicks;
-    unsigned long mNumTicks;
-    float mDelta;
-};
+inline void BehaviorSystem::removeAlphaRamp(size_t i)
+{
+    mAlphaRamps.delta[i] = mAlphaRamps.delta.back();
+    mAlphaRamps.delta.pop_back();
+    mAlphaRamps.applied[i] = mAlphaRamps.applied.back();
+    mAlphaRamps.applied.pop_back();
+    mAlphaRamps.swapRemove(i);
+}
+
+inline void BehaviorSystem::removePositionRamp(size_t i)
+{
+    PositionRamps &p = mPositionRamps;
+    p.deltaX[i] = p.deltaX.back(); p.deltaX.pop_back();
+    p.deltaY[i] = p.deltaY.back(); p.deltaY.pop_back();
+    p.deltaZ[i] = p.deltaZ.back(); p.deltaZ.pop_back();
+    p.appliedX[i] = p.appliedX.back(); p.appliedX.pop_back();
+    p.appliedY[i] = p.appliedY.back(); p.appliedY.pop_back();
+    p.appliedZ[i] = p.appliedZ.back(); p.appliedZ.pop_back();
+    p.swapRemove(i);
+}
+
+inline void BehaviorSystem::removeTimer(size_t i)
+{
+    mTimers.module[i] = mTimers.module.back();
+    mTimers.module.pop_back();
+    mTimers.id[i] = mTimers.id.back();
+    mTimers.id.pop_back();
+    mTimers.end[i] = mTimers.end.back();
+    mTimers.end.pop_back();
+}
 
 // Yes this is absolutely gross. Please fix it if you can!
 
@@ -490,31 +835,45 @@ public:
     static std::shared_ptr<TextRenderModule> create() { return std::make_shared<TextRenderModule>();}
 	static std::shared_ptr<RenderModule> createBase() { return std::static_pointer_cast<RenderModule>(create());}
 
+    static std::string defaultFontPath() { return "AlloSystem/allocore/share/fonts/VeraMono.ttf"; }
+
     void loadFont(const std::string& filename, int fontSize=10, bool antialias=true)
     {
-        mFont.load(filename, fontSize, antialias);
+        // Fonts are shared through the cache, only the first request loads
+        std::shared_ptr<FontCache::CachedFont> font = FontCache::get().font(filename, fontSize, antialias);
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            mFontPath = filename;
+            mFontSize = fontSize;
+            mAntialias = antialias;
+            mFont = font;
+            if (initDone) {
+                mTextMesh = mFont->mesh(mText);
+            }
+        }
 		relay(moduleAddress() + "/loadFont", filename, fontSize, antialias ? 1: 0);
     }
 
     void setText(std::string text) {
-        mText = text;
-        if (initDone) {
-            mFont.write(mTextMesh, mText);
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            mText = text;
+            if (initDone) {
+                mTextMesh = mFont->mesh(mText);
+            }
         }
 		relay(moduleAddress() + "/setText", text);
     }
     void setFontSize(float size) {
-        mFontSize = size;
-//        mFont.size(size);
-        loadFont(mFontPath, mFontSize);
+        loadFont(mFontPath, size, mAntialias);
     }
 
     virtual void executeCommand(std::string command, std::vector<std::string> arguments) override
     {
         RenderModule::executeCommand(command, arguments);
 		if (command == "loadFont") {
-            if (arguments.size() > 0) {
-                loadFont(arguments.at(0), std::atoi(arguments.at(1).c_str()), arguments.at(1) == "1");
+            if (arguments.size() >= 3) {
+                loadFont(arguments.at(0), std::atoi(arguments.at(1).c_str()), arguments.at(2) == "1");
             }
         } else if (command == "setText") {
             if (arguments.size() > 0) {
@@ -530,29 +889,41 @@ public:
 protected:
     virtual void init(Graphics &g)
     {
-        mFont.write(mTextMesh, mText);
+        if (!mFont) {
+            mFont = FontCache::get().font(mFontPath, (int) mFontSize, mAntialias);
+        }
+        mTextMesh = mFont->mesh(mText);
         initDone = true;
     }
 
     virtual void render(Graphics &g, float dt = 1.0f)
     {
         g.pushMatrix();
-        mFont.texture().bind();
+        mFont->font().texture().bind();
         g.scale(0.005);
-        g.draw(mTextMesh);
-        mFont.texture().unbind();
+        g.draw(*mTextMesh);
+        mFont->font().texture().unbind();
         g.popMatrix();
     }
 
+    virtual bool batch(TextBatch &batch) override
+    {
+        if (!initDone) {
+            return false;
+        }
+        return batch.append(mFont.get(), *mTextMesh, getPosition(), getScale() * 0.005f, getColor());
+    }
+
 
 //    virtual void cleanup() {}
 
 private:
     std::string mText {"Test"};
-    std::string mFontPath {"AlloSystem/allocore/share/fonts/VeraMono.ttf"};
+    std::string mFontPath {defaultFontPath()};
     float mFontSize {18};
-    Font mFont{mFontPath, (int)mFontSize};
-    Mesh mTextMesh;
+    bool mAntialias {true};
+    std::shared_ptr<FontCache::CachedFont> mFont;
+    std::shared_ptr<const Mesh> mTextMesh;
 
     bool initDone {false};
 
@@ -560,50 +931,105 @@ private:
 
 REGISTER_MODULE(TextRenderModule);
 
+/**
+ * @brief Ribbon through a stream of points
+ *
+ * Points are kept in a ring buffer of setCapacity() points; when it is full
+ * the oldest points are dropped. On the GPU the ring is stored twice back to
+ * back so the visible points are always one contiguous range, and only the
+ * points added since the last frame are uploaded. Like the Mesh it replaces,
+ * each vertex has its own color, white, so strips don't take the module
+ * color. Vertices added one at a time are relayed to slaves together, once
+ * per frame or every 64 points.
+ */
 class LineStripModule : public RenderModule {
 public:
     LineStripModule() {
         mType = "LineStripModule";
-        mMesh.reset();
-        mMesh.primitive(Graphics::TRIANGLE_STRIP);
-        mMesh.vertices().resize(mMaxLen * 2);
-		mMesh.colors().resize(mMaxLen * 2);
-//		for (int i = 0; i < mMaxLen * 2; i++) {
-//			mMesh.colors()[i] = Color(1.0, 1.0, 1.0, 0.5);
-//		}
+        mPoints.resize(mCapacity * floatsPerPoint);
+    }
+
+    virtual ~LineStripModule() {
+        if (mBuffer) {
+            // GL objects can only be deleted on the render thread
+            std::lock_guard<std::mutex> locker(orphanLock());
+            orphanBuffers().push_back(mBuffer);
+        }
     }
 
     static std::shared_ptr<LineStripModule> create() { return std::make_shared<LineStripModule>();}
 	static std::shared_ptr<RenderModule> createBase() { return std::static_pointer_cast<RenderModule>(create());}
 
-    void setDelta(float delta) { mDelta = delta; relay(moduleAddress() + "/setDelta", delta);}
-    void setThickness(float thickness) { mThickness = thickness; relay(moduleAddress() + "/setThickness", thickness);}
+    void setDelta(float delta) { relayPendingVertices(); mDelta = delta; relay(moduleAddress() + "/setDelta", delta);}
+    void setThickness(float thickness) { relayPendingVertices(); mThickness = thickness; relay(moduleAddress() + "/setThickness", thickness);}
 
-    void addValue(float value)
+    // Number of points kept. Keeps the most recent points when shrinking.
+    void setCapacity(unsigned int numPoints)
     {
-        std::lock_guard<std::mutex> locker(mModuleLock);
-        if (mNumVertices >= mMaxLen* 2) {
-            std::cout << "Can't add more values to line strip. mMaxLen = " << mMaxLen << std::endl;
+        if (numPoints == 0) {
             return;
         }
-        mMesh.vertices()[mNumVertices++] =  {value, mNumVertices* mDelta, 0};
-        mMesh.vertices()[mNumVertices++] =  {value+ mThickness, mNumVertices* mDelta, mThickness};
+        relayPendingVertices();
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            std::vector<float> points(numPoints * floatsPerPoint);
+            size_t count = std::min<size_t>(mCount, numPoints);
+            for (size_t i = 0; i < count; i++) {
+                size_t slot = (mHead + mCapacity - count + i) % mCapacity;
+                std::copy(&mPoints[slot * floatsPerPoint], &mPoints[(slot + 1) * floatsPerPoint],
+                        &points[i * floatsPerPoint]);
+            }
+            mPoints.swap(points);
+            mCapacity = numPoints;
+            mCount = count;
+            mHead = count % mCapacity;
+            mDirtyBegin = 0;
+            mDirtyCount = count;
+            mBufferCapacity = 0; // Reallocate GPU buffer
+        }
+		relay(moduleAddress() + "/setCapacity", (int) numPoints);
+    }
+
+    void addValue(float value)
+    {
+        relayPendingVertices();
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            float y = mTotalPoints * mDelta;
+            pushPoint(value, y, 0);
+        }
 		relay(moduleAddress() + "/addValue", value);
     }
 
     void addVertex(float x, float y, float z)
     {
         std::lock_guard<std::mutex> locker(mModuleLock);
-        if (mNumVertices >= mMaxLen* 2) {
-            std::cout << "Can't add more values to line strip. mMaxLen = " << mMaxLen << std::endl;
-            return;
+        pushPoint(x, y, z);
+        if (relaying()) {
+            mPendingVertices.insert(mPendingVertices.end(), {x, y, z});
+            if (mPendingVertices.size() >= pointsPerMessage * 3) {
+                relayVertices(mPendingVertices.data(), mPendingVertices.size() / 3);
+                mPendingVertices.clear();
+            }
+        }
+    }
+
+    // Adds numPoints points from interleaved x, y, z values
+    void addVertices(const float *xyz, unsigned int numPoints)
+    {
+        relayPendingVertices();
+        {
+            std::lock_guard<std::mutex> locker(mModuleLock);
+            for (unsigned int i = 0; i < numPoints; i++) {
+                pushPoint(xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2]);
+            }
         }
-        mMesh.vertices()[mNumVertices++] =  {x, y, z};
-        mMesh.vertices()[mNumVertices++] =  {x+ mThickness, y, z + mThickness};
-//		mMesh.generateNormals();
-		relay(moduleAddress() + "/addVertex", x, y, z);
+        relayVertices(xyz, numPoints);
     }
 
+    unsigned int size() { return mCount; }
+    unsigned int capacity() { return mCapacity; }
+
 	virtual void executeCommand(std::string command, std::vector<std::string> arguments) override
     {
         RenderModule::executeCommand(command, arguments);
@@ -615,6 +1041,18 @@ public:
             if (arguments.size() == 3) {
                 addVertex(std::atof(arguments.at(0).c_str()), std::atof(arguments.at(1).c_str()), std::atof(arguments.at(2).c_str()));
             }
+        } else if (command == "addVertices") {
+            if (arguments.size() > 0 && arguments.size() % 3 == 0) {
+                std::vector<float> xyz(arguments.size());
+                for (size_t i = 0; i < arguments.size(); i++) {
+                    xyz[i] = std::atof(arguments[i].c_str());
+                }
+                addVertices(xyz.data(), xyz.size() / 3);
+            }
+        } else if (command == "setCapacity") {
+			if (arguments.size() == 1) {
+                setCapacity(std::atoi(arguments.at(0).c_str()));
+            }
         } else if (command == "setDelta") {
 			if (arguments.size() == 1) {
                 setDelta(std::atof(arguments.at(0).c_str()));
@@ -632,23 +1070,131 @@ protected:
     {
     }
 
+    virtual void onTick() override
+    {
+        if (mPendingVertices.size() > 0) {
+            relayVertices(mPendingVertices.data(), mPendingVertices.size() / 3);
+            mPendingVertices.clear();
+        }
+    }
+
     virtual void render(Graphics &g, float dt = 1.0f) override
     {
-//        mMesh.reset();
-//        addCube(mMesh);
+        deleteOrphanBuffers();
+        if (mCount < 2) {
+            return;
+        }
+        if (!mBuffer) {
+            glGenBuffers(1, &mBuffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+        if (mBufferCapacity != mCapacity) {
+            // Ring is mirrored so any window of mCount points is contiguous
+            glBufferData(GL_ARRAY_BUFFER, 2 * mCapacity * floatsPerPoint * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+            mBufferCapacity = mCapacity;
+            mDirtyBegin = (mHead + mCapacity - mCount) % mCapacity;
+            mDirtyCount = mCount;
+        }
+        if (mDirtyCount > 0) {
+            size_t first = std::min<size_t>(mDirtyCount, mCapacity - mDirtyBegin);
+            uploadPoints(mDirtyBegin, first);
+            uploadPoints(0, mDirtyCount - first);
+            mDirtyCount = 0;
+        }
         g.blendTrans();
-        mMesh.primitive(Graphics::TRIANGLE_STRIP);
-        g.draw(mMesh, mNumVertices);
+        size_t begin = (mHead + mCapacity - mCount) % mCapacity;
+        const char *first = (const char *) (begin * floatsPerPoint * sizeof(float));
+        const GLsizei stride = floatsPerVertex * sizeof(float);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride, first);
+        glColorPointer(4, GL_FLOAT, stride, first + 3 * sizeof(float));
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, mCount * 2);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
 private:
-    unsigned int mNumVertices {0};
-    size_t mMaxLen {128};
-    size_t mBegin {0}, mEnd{0};
+    static const size_t floatsPerVertex = 7; // x, y, z, r, g, b, a
+    static const size_t floatsPerPoint = 2 * floatsPerVertex; // Two strip vertices per point
+    static const unsigned int pointsPerMessage = 64; // Relayed messages stay well within a UDP datagram
+
+    void pushPoint(float x, float y, float z) {
+        float *point = &mPoints[mHead * floatsPerPoint];
+        const float vertices[floatsPerPoint] = {x, y, z, 1, 1, 1, 1,
+                                                x + mThickness, y, z + mThickness, 1, 1, 1, 1};
+        std::copy(vertices, vertices + floatsPerPoint, point);
+        if (mDirtyCount == 0) {
+            mDirtyBegin = mHead;
+        }
+        if (mDirtyCount < mCapacity) {
+            mDirtyCount++;
+        } else {
+            mDirtyBegin = (mDirtyBegin + 1) % mCapacity;
+        }
+        mHead = (mHead + 1) % mCapacity;
+        if (mCount < mCapacity) {
+            mCount++;
+        }
+        mTotalPoints++;
+    }
+
+    // As /addVertices messages of up to pointsPerMessage points
+    void relayVertices(const float *xyz, unsigned int numPoints) {
+        if (!relaying()) {
+            return;
+        }
+        for (unsigned int offset = 0; offset < numPoints; offset += pointsPerMessage) {
+            unsigned int count = std::min(numPoints - offset, (unsigned int) pointsPerMessage);
+            osc::Packet p;
+            p.beginMessage(moduleAddress() + "/addVertices");
+            for (unsigned int i = (offset * 3); i < (offset + count) * 3; i++) {
+                p << xyz[i];
+            }
+            p.endMessage();
+            relay(p);
+        }
+    }
+
+    // Sends what addVertex() has batched, before anything that must follow it
+    void relayPendingVertices() {
+        std::lock_guard<std::mutex> locker(mModuleLock);
+        onTick();
+    }
+
+    void uploadPoints(size_t slot, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        const size_t bytesPerPoint = floatsPerPoint * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, slot * bytesPerPoint, count * bytesPerPoint, &mPoints[slot * floatsPerPoint]);
+        glBufferSubData(GL_ARRAY_BUFFER, (slot + mCapacity) * bytesPerPoint, count * bytesPerPoint, &mPoints[slot * floatsPerPoint]);
+    }
+
+    static std::mutex &orphanLock() { static std::mutex lock; return lock; }
+    static std::vector<GLuint> &orphanBuffers() { static std::vector<GLuint> buffers; return buffers; }
+
+    static void deleteOrphanBuffers() {
+        std::lock_guard<std::mutex> locker(orphanLock());
+        if (orphanBuffers().size() > 0) {
+            glDeleteBuffers(orphanBuffers().size(), orphanBuffers().data());
+            orphanBuffers().clear();
+        }
+    }
+
+    std::vector<float> mPoints; // mCapacity points of two vertices each
+    std::vector<float> mPendingVertices; // x, y, z added by addVertex() but not relayed yet
+    unsigned int mCapacity {128};
+    unsigned int mCount {0};
+    unsigned int mHead {0}; // Next slot to write
+    unsigned long mTotalPoints {0};
+    unsigned int mDirtyBegin {0}, mDirtyCount {0}; // Points not yet uploaded
     float mDelta {0.1f};
     float mThickness {0.2f};
 
-    Mesh mMesh;
+    GLuint mBuffer {0};
+    unsigned int mBufferCapacity {0};
 };
 
 REGISTER_MODULE(LineStripModule);
@@ -745,15 +1291,22 @@ public:
         std::lock_guard<std::mutex> locker(mRenderChainLock);
         for(auto module: mModules) {
             module->cleanup();
+            module->setBehaviorSystem(nullptr);
         }
         mModules.clear();
+        mBehaviors.clear();
 		relay("/clear");
     }
 
     virtual bool addModule(std::shared_ptr<RenderModule> module);
 
+    // Draws the modules in the order they were added, text modules in runs
+    // batched by font. Can be called several times a frame, e.g. per eye
     void render(Graphics &g, float dt = 1.0f);
 
+    // Advances module ticks and behaviors, once per frame
+    void tick();
+
     template<class ModuleType>
     std::shared_ptr<ModuleType> createModule() {
         auto module = ModuleType::create();
@@ -763,9 +1316,14 @@ public:
 
     std::vector<std::shared_ptr<RenderModule>> modulesInTree() { return mModules; }
 
+    BehaviorSystem &behaviors() { return mBehaviors; }
+
 private:
+    void drawTextBatch(Graphics &g);
 
 	u_int32_t mCounter {0};
+    BehaviorSystem mBehaviors; // Must outlive modules
+    TextBatch mTextBatch;
     std::vector<std::shared_ptr<RenderModule>> mModules;
     std::mutex mRenderChainLock;
 
@@ -777,6 +1335,7 @@ bool RenderTree::addModule(std::shared_ptr<RenderModule> module)
     std::lock_guard<std::mutex> locker(mRenderChainLock);
 	module->setId(mCounter++);
 	module->setRelayer(this);
+	module->setBehaviorSystem(&mBehaviors);
     mModules.push_back(module);
     mModulesPendingInit.push_back(module);
 	return true;
@@ -790,18 +1349,42 @@ void RenderTree::render(Graphics &g, float dt)
     }
     mModulesPendingInit.clear();
 
-    std::vector<std::shared_ptr<RenderModule>> modulesToRemove;
+    mTextBatch.clear();
     for(auto module: mModules) {
         if (module->done()) {
             module->cleanup();
-            modulesToRemove.push_back(module);
-        } else {
+            module->setBehaviorSystem(nullptr);
+        } else if (!module->batchInternal(mTextBatch)) {
+            // Text batched so far was added before this module, draw it first
+            drawTextBatch(g);
             module->renderInternal(g);
         }
     }
-    for(auto module:modulesToRemove) {
-        mModules.erase(std::find(mModules.begin(),mModules.end(), module));
+    drawTextBatch(g);
+    mModules.erase(std::remove_if(mModules.begin(), mModules.end(),
+                                  [](const std::shared_ptr<RenderModule> &module) { return module->done(); }),
+                   mModules.end());
+}
+
+// Consecutive text modules sharing a font in a single draw
+void RenderTree::drawTextBatch(Graphics &g)
+{
+    if (mTextBatch.numVertices() == 0) {
+        return;
+    }
+    g.blending(true);
+    g.blendAdd();
+    mTextBatch.draw(g);
+    mTextBatch.clear();
+}
+
+void RenderTree::tick()
+{
+    std::lock_guard<std::mutex> locker(mRenderChainLock);
+    for(auto module: mModules) {
+        module->tickInternal();
     }
+    mBehaviors.step();
 }
 
 #include <functional>
@@ -0,0 +1,291 @@
+#ifndef SEQUENCE_BANK_HPP
+#define SEQUENCE_BANK_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include "bank_file.hpp"
+
+namespace al {
+
+// One event of a sequence, at an absolute time from the start of the sequence
+struct SequenceEvent {
+    enum Command : uint32_t { ON, OFF, PROGRAM };
+
+    double time; // Seconds
+    uint32_t command;
+    float value; // Note for ON and OFF, preset map index for PROGRAM
+
+    static const char *commandName(uint32_t command) {
+        static const char *names[] = {"ON", "OFF", "PROGRAM"};
+        return command <= PROGRAM ? names[command] : "";
+    }
+};
+
+/**
+ * @brief Layout of a compiled sequence bank (sequences.bank in a sequence directory)
+ *
+ * Sections follow the header in this order, in native byte order, 8 byte
+ * aligned so the file can be used in place once mapped:
+ *   SequenceEvent events[events]  all sequences, one after the other
+ *   uint32 sequences[sequences][3] name offset in strings, first event, event count
+ *   char strings[stringBytes]     NUL terminated names
+ */
+struct SequenceBankHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sequences;
+    uint32_t events;
+    uint32_t stringBytes;
+
+    static const char *expectedMagic() { return "ALSQBNK"; }
+    enum { currentVersion = 1 };
+
+    size_t fileSize() const {
+        return sizeof(SequenceBankHeader) + size_t(events) * sizeof(SequenceEvent)
+                + size_t(sequences) * 12 + stringBytes;
+    }
+};
+
+/**
+ * @brief All the PresetSequencer event sequences of a directory, as timelines
+ *
+ * Each "@COMMAND:delta:duration:value" line of a .sequence file becomes an
+ * event at the sum of the deltas and durations before it plus its own delta,
+ * which is when PresetSequencer would send it. Read from the compiled
+ * sequences.bank of the directory unless it is missing, invalid or older
+ * than one of the .sequence files or than the directory, like PresetBank.
+ */
+class SequenceBank {
+public:
+    enum Source { ANY, TEXT, COMPILED };
+
+    struct Sequence {
+        std::string name;
+        const SequenceEvent *events;
+        size_t size;
+    };
+
+    static std::string bankPath(std::string directory) { return directory + "/sequences.bank"; }
+
+    SequenceBank(std::string directory, Source source = ANY) {
+        std::string path = bankPath(directory);
+        bool compiled = false;
+        if (source == COMPILED || (source == ANY && !mFile.textIsNewer(directory, path, isSequenceFile))) {
+            compiled = readCompiled(path);
+        }
+        if (!compiled && source != COMPILED) {
+            readText(directory);
+        }
+    }
+
+    SequenceBank(const SequenceBank &) = delete;
+
+    bool compiled() const { return mFile.mapped(); }
+    size_t size() const { return mSequences.size(); }
+    const Sequence &at(size_t i) const { return mSequences[i]; }
+
+    // Sequence by name (file name without .sequence), or nullptr. Doesn't
+    // print, as it is called from the audio thread: see misses()
+    const Sequence *sequence(const std::string &name) const {
+        for (const Sequence &sequence: mSequences) {
+            if (sequence.name == name) {
+                return &sequence;
+            }
+        }
+        mMisses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // Times sequence() didn't find the name, for status reports
+    unsigned int misses() const { return mMisses.load(std::memory_order_relaxed); }
+
+    // Writes the compiled bank, e.g. to bankPath(directory)
+    bool write(std::string path) const {
+        SequenceBankHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::strcpy(header.magic, SequenceBankHeader::expectedMagic());
+        header.version = SequenceBankHeader::currentVersion;
+        header.sequences = mSequences.size();
+
+        std::string strings;
+        std::vector<uint32_t> table;
+        for (const Sequence &sequence: mSequences) {
+            table.push_back(strings.size());
+            table.push_back(header.events);
+            table.push_back(sequence.size);
+            header.events += sequence.size;
+            strings.append(sequence.name.c_str(), sequence.name.size() + 1);
+        }
+        size_t end = sizeof(header) + header.events * sizeof(SequenceEvent) + table.size() * 4 + strings.size();
+        strings.resize(strings.size() + ((8 - end % 8) % 8), '\0');
+        header.stringBytes = strings.size();
+
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cout << "SequenceBank: can't write " << path << std::endl;
+            return false;
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        for (const Sequence &sequence: mSequences) {
+            fwrite(sequence.events, sizeof(SequenceEvent), sequence.size, file);
+        }
+        fwrite(table.data(), 4, table.size(), file);
+        fwrite(strings.data(), 1, strings.size(), file);
+        return fclose(file) == 0;
+    }
+
+private:
+    static bool isSequenceFile(const std::string &file) {
+        return BankFile::hasExtension(file, ".sequence");
+    }
+
+    bool readCompiled(std::string path) {
+        const SequenceBankHeader *header = mFile.map<SequenceBankHeader>(path);
+        if (!header) {
+            return false;
+        }
+        bool valid = true;
+        const SequenceEvent *events = (const SequenceEvent *) (header + 1);
+        const uint32_t *table = (const uint32_t *) (events + header->events);
+        const char *strings = (const char *) (table + size_t(header->sequences) * 3);
+        for (uint32_t s = 0; valid && s < header->sequences; s++) {
+            valid = table[s * 3 + 1] <= header->events && table[s * 3 + 2] <= header->events - table[s * 3 + 1];
+        }
+        if (!valid) {
+            mFile.reject(path);
+            return false;
+        }
+        for (uint32_t s = 0; s < header->sequences; s++) {
+            mSequences.push_back({strings + std::min(table[s * 3], header->stringBytes - 1),
+                                  events + table[s * 3 + 1], table[s * 3 + 2]});
+        }
+        return true;
+    }
+
+    void readText(std::string directory) {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir) {
+            std::cout << "SequenceBank: can't read " << directory << std::endl;
+            return;
+        }
+        std::vector<std::string> files;
+        while (struct dirent *entry = readdir(dir)) {
+            if (isSequenceFile(entry->d_name)) {
+                files.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+
+        std::vector<size_t> starts;
+        for (const std::string &file: files) {
+            starts.push_back(mEvents.size());
+            readSequence(directory + "/" + file);
+            mSequences.push_back({file.substr(0, file.size() - 9), nullptr, mEvents.size() - starts.back()});
+        }
+        for (size_t s = 0; s < mSequences.size(); s++) {
+            mSequences[s].events = mEvents.data() + starts[s];
+        }
+    }
+
+    // "@COMMAND:delta:duration:value" lines, up to "::"
+    void readSequence(std::string path) {
+        std::ifstream file(path);
+        std::string line;
+        double time = 0;
+        while (std::getline(file, line) && line.substr(0, 2) != "::") {
+            char command[32];
+            double delta, duration;
+            float value;
+            if (line.size() > 0 && line[0] == '@'
+                    && sscanf(line.c_str(), "@%31[^:]:%lf:%lf:%f", command, &delta, &duration, &value) == 4) {
+                time += delta;
+                uint32_t id = SequenceEvent::ON;
+                while (id <= SequenceEvent::PROGRAM && std::strcmp(SequenceEvent::commandName(id), command) != 0) {
+                    id++;
+                }
+                if (id <= SequenceEvent::PROGRAM) {
+                    mEvents.push_back({time, id, value});
+                } else {
+                    std::cout << "SequenceBank: unknown command " << command << " in " << path << std::endl;
+                }
+                time += duration;
+            } else if (line.size() > 0) {
+                std::cout << "SequenceBank: ignoring \"" << line << "\" in " << path << std::endl;
+            }
+        }
+    }
+
+    std::vector<Sequence> mSequences; // Not resized after loading
+    mutable std::atomic<unsigned int> mMisses {0};
+
+    std::vector<SequenceEvent> mEvents; // Text sequences
+    BankFile mFile {"SequenceBank"}; // Compiled bank
+};
+
+/**
+ * @brief Plays a sequence from the audio callback, on the sample clock
+ *
+ * process() hands each event due in the block to a callback with its frame
+ * offset, so synths can render up to the offset before applying it. Players
+ * started in the same callback stay frame locked, unlike PresetSequencer
+ * threads, which drifted against each other and the audio blocks.
+ */
+class SequencePlayer {
+public:
+    // Starts the sequence at the next process(). nullptr stops.
+    void playSequence(const SequenceBank::Sequence *sequence) {
+        mSequence = sequence;
+        mNext = 0;
+        mFrame = 0;
+    }
+
+    void stopSequence() {
+        mSequence = nullptr;
+    }
+
+    bool running() const { return mSequence != nullptr; }
+
+    // Calls fire(const SequenceEvent &, int offset) for the events of the next frames
+    template<class Callback>
+    void process(double sampleRate, int frames, Callback fire) {
+        if (!mSequence) {
+            return;
+        }
+        uint64_t end = mFrame + frames;
+        while (mSequence && mNext < mSequence->size) {
+            const SequenceEvent &event = mSequence->events[mNext];
+            uint64_t frame = std::max(uint64_t(std::llround(event.time * sampleRate)), mFrame);
+            if (frame >= end) {
+                break;
+            }
+            mNext++;
+            fire(event, int(frame - mFrame));
+        }
+        mFrame = end;
+        if (mSequence && mNext == mSequence->size) {
+            mSequence = nullptr;
+        }
+    }
+
+private:
+    const SequenceBank::Sequence *mSequence = nullptr;
+    size_t mNext = 0;
+    uint64_t mFrame = 0; // Since the start of the sequence
+};
+
+} // namespace al
+
+#endif // SEQUENCE_BANK_HPP
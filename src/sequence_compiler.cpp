@@ -0,0 +1,90 @@
+/*
+Compiles the PresetSequencer .sequence files of a directory into a sequences.bank
+
+The audio app plays sequences from sequences.bank (see sequence_bank.hpp)
+and falls back to the .sequence files when there is no bank or a sequence
+was saved after it. Run after changing the sequences:
+
+    sequence_compiler sequences
+
+Usage:
+    sequence_compiler <directory> [bank]  text sequences to bank (default <directory>/sequences.bank)
+    sequence_compiler -print <directory>  prints the event times of each sequence
+    sequence_compiler -check <directory>  compares the text sequences with the compiled bank
+*/
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "sequence_bank.hpp"
+
+using namespace al;
+using namespace std;
+
+static bool sameSequences(const SequenceBank &a, const SequenceBank &b) {
+    if (a.size() != b.size()) {
+        cout << "different number of sequences" << endl;
+        return false;
+    }
+    for (size_t s = 0; s < a.size(); s++) {
+        const SequenceBank::Sequence &x = a.at(s), &y = b.at(s);
+        if (x.name != y.name || x.size != y.size) {
+            cout << "sequence " << s << ": " << x.name << " differs from " << y.name << endl;
+            return false;
+        }
+        for (size_t e = 0; e < x.size; e++) {
+            if (x.events[e].time != y.events[e].time || x.events[e].command != y.events[e].command
+                    || x.events[e].value != y.events[e].value) {
+                cout << x.name << " event " << e << " differs" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: sequence_compiler <directory> [bank] | -print <directory> | -check <directory>" << endl;
+        return 1;
+    }
+    string command = argv[1];
+
+    if (command == "-print" && argc > 2) {
+        SequenceBank bank(argv[2]);
+        for (size_t s = 0; s < bank.size(); s++) {
+            cout << bank.at(s).name << (bank.compiled() ? " (compiled)" : " (text)") << endl;
+            for (size_t e = 0; e < bank.at(s).size; e++) {
+                const SequenceEvent &event = bank.at(s).events[e];
+                printf("  %10.6f %-8s %g\n", event.time, SequenceEvent::commandName(event.command), event.value);
+            }
+        }
+        return 0;
+    }
+
+    if (command == "-check" && argc > 2) {
+        SequenceBank text(argv[2], SequenceBank::TEXT);
+        SequenceBank compiled(argv[2], SequenceBank::COMPILED);
+        bool same = compiled.compiled() && sameSequences(text, compiled);
+        cout << SequenceBank::bankPath(argv[2]) << (same ? " matches the text sequences" : " is out of date") << endl;
+        return same ? 0 : 1;
+    }
+
+    string directory = command;
+    string path = argc > 2 ? argv[2] : SequenceBank::bankPath(directory);
+    SequenceBank bank(directory, SequenceBank::TEXT);
+    if (bank.size() == 0) {
+        cout << "No sequences in " << directory << endl;
+        return 1;
+    }
+    if (!bank.write(path)) {
+        return 1;
+    }
+    size_t events = 0;
+    for (size_t s = 0; s < bank.size(); s++) {
+        events += bank.at(s).size;
+    }
+    cout << bank.size() << " sequences, " << events << " events written to " << path << endl;
+    return 0;
+}
@@ -61,6 +61,8 @@ Lance Putnam, 6/2011, putnam.lance@gmail.com
 #include "Gamma/Oscillator.h"
 
 #include "common.hpp"
+#include "state_recording.hpp"
+#include "frame_profiler.hpp"
 
 using namespace al;
 using namespace std;
@@ -468,6 +470,16 @@ public:
 
 	ShaderProgram mShader;
 
+    // State stream for painter_bench, toggled with 'p'
+    StateRecorder<SharedState> mRecorder;
+
+    // Frame timings, sent to control and shown with 'f'
+    osc::Send mProfileSender {CONTROL_IN_PORT, CONTROL_IP_ADDRESS}; // Used by mProfiler's collector until it stops
+    FrameProfiler mProfiler {"simulator", 20};
+    int mAnimateStage = mProfiler.stage("animate");
+    int mDrawStage = mProfiler.stage("draw");
+    std::unique_ptr<TextOverlay> mProfileOverlay;
+
 	// This constructor is where we initialize the application
 	MyApp(): mPainter(&mState, &mShader, GRAPHICS_IN_PORT, 12098),
         mSimulator(&mState)
@@ -482,6 +494,7 @@ public:
 		initWindow(Window::Dim(0,0, 600,400), "Simulator", 20);
 
         mPainter.setTreeMaster();
+        mProfiler.startCollector([this]() { mProfiler.send(mProfileSender); });
 		std::cout << "Constructor done" << std::endl;
 	}
 
@@ -490,6 +503,11 @@ public:
     }
 
 	virtual void onAnimate(double dt) override {
+        mProfiler.beginFrame();
+        if (mProfiler.newReport() && mProfileOverlay) {
+            mProfileOverlay->lines(mProfiler.lines());
+        }
+        FrameProfiler::Scope animate(mProfiler, mAnimateStage);
 //        mTaker.get(state());
 
         static bool first_frame {true};
@@ -498,21 +516,29 @@ public:
           first_frame = false;
         }
         mSimulator.onAnimate(dt); // State could be shared here when simulator is local
+        mRecorder.record(state());
 //        state().nav = nav();
 
         // Update wave equation
+        float *heights = mPainter.mWater.heights();
         for(int j=0; j<Ny; ++j){
             for(int i=0; i<Nx; ++i){
                 int idx = j*Nx + i;
-                mPainter.waterMesh.vertices()[idx].z = mSimulator.state().wave[indexAt(i,j, mSimulator.zcurr)] / mSimulator.decay.get();
+                heights[idx] = mSimulator.state().wave[indexAt(i,j, mSimulator.zcurr)] / mSimulator.decay.get();
             }
         }
 
-        mPainter.waterMesh.generateNormals();
+        mPainter.onAnimate(nav());
 	}
 
 	virtual void onDraw(Graphics& g) override {
-        mPainter.onDraw(g);
+        {
+            FrameProfiler::Scope draw(mProfiler, mDrawStage);
+            mPainter.onDraw(g);
+        }
+        if (mProfileOverlay) {
+            mProfileOverlay->draw(g, window(0).width(), window(0).height());
+        }
 	}
 
 
@@ -527,6 +553,22 @@ public:
 		case 'y': printf("Pressed y.\n"); mSimulator.adjustChaos(-0.03); break;
 		case 'n': printf("Pressed n.\n"); break;
 		case '.': printf("Pressed period.\n"); break;
+        case 'f':
+            if (mProfileOverlay) {
+                mProfileOverlay.reset();
+            } else {
+                mProfileOverlay.reset(new TextOverlay(TextRenderModule::defaultFontPath()));
+                mProfileOverlay->lines(mProfiler.lines());
+            }
+            break;
+        case 'p':
+            if (mRecorder.recording()) {
+                mRecorder.close();
+                printf("Recorded %lu frames to state.rec\n", mRecorder.frames());
+            } else {
+                mRecorder.open("state.rec");
+            }
+            break;
         case 'r': mSimulator.reset();
 
 		// For non-printable keys, we have to use the enums described in the
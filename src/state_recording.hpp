@@ -0,0 +1,125 @@
+#ifndef STATE_RECORDING_HPP
+#define STATE_RECORDING_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace al {
+
+/**
+ * @brief File of consecutive frames of a state struct
+ *
+ * The state is written as raw bytes, as cuttlebone sends it, so the State
+ * must be trivially copyable. The header holds the frame size, so a
+ * recording from a build with a different SharedState layout is rejected
+ * rather than misread.
+ */
+struct StateRecordingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t frameSize;
+
+    static const char *expectedMagic() { return "ALSTATE"; }
+    enum { currentVersion = 1 };
+};
+
+template <class State>
+class StateRecorder {
+public:
+    ~StateRecorder() { close(); }
+
+    bool open(std::string path) {
+        close();
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile) {
+            std::cout << "StateRecorder: can't write " << path << std::endl;
+            return false;
+        }
+        StateRecordingHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::strcpy(header.magic, StateRecordingHeader::expectedMagic());
+        header.version = StateRecordingHeader::currentVersion;
+        header.frameSize = sizeof(State);
+        fwrite(&header, sizeof(header), 1, mFile);
+        mFrames = 0;
+        return true;
+    }
+
+    void record(const State &state) {
+        if (mFile) {
+            fwrite(&state, sizeof(State), 1, mFile);
+            mFrames++;
+        }
+    }
+
+    void close() {
+        if (mFile) {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+    }
+
+    bool recording() { return mFile != nullptr; }
+    unsigned long frames() { return mFrames; }
+
+private:
+    FILE *mFile = nullptr;
+    unsigned long mFrames = 0;
+};
+
+// Reads the frames of a StateRecorder file in order, starting over at the end
+template <class State>
+class StatePlayer {
+public:
+    ~StatePlayer() {
+        if (mFile) {
+            fclose(mFile);
+        }
+    }
+
+    bool open(std::string path) {
+        mFile = fopen(path.c_str(), "rb");
+        if (!mFile) {
+            std::cout << "StatePlayer: can't read " << path << std::endl;
+            return false;
+        }
+        StateRecordingHeader header;
+        if (fread(&header, sizeof(header), 1, mFile) != 1
+                || std::strcmp(header.magic, StateRecordingHeader::expectedMagic()) != 0
+                || header.version != StateRecordingHeader::currentVersion
+                || header.frameSize != sizeof(State)) {
+            std::cout << "StatePlayer: " << path << " is not a recording of this state" << std::endl;
+            fclose(mFile);
+            mFile = nullptr;
+            return false;
+        }
+        fseek(mFile, 0, SEEK_END);
+        mFrames = (ftell(mFile) - sizeof(header)) / sizeof(State);
+        fseek(mFile, sizeof(header), SEEK_SET);
+        return mFrames > 0;
+    }
+
+    unsigned long frames() { return mFrames; }
+
+    bool next(State &state) {
+        if (!mFile || mFrames == 0) {
+            return false;
+        }
+        if (fread(&state, sizeof(State), 1, mFile) != 1) {
+            fseek(mFile, sizeof(StateRecordingHeader), SEEK_SET);
+            return fread(&state, sizeof(State), 1, mFile) == 1;
+        }
+        return true;
+    }
+
+private:
+    FILE *mFile = nullptr;
+    unsigned long mFrames = 0;
+};
+
+} // namespace al
+
+#endif // STATE_RECORDING_HPP
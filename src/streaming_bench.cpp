@@ -0,0 +1,198 @@
+/*
+Check and benchmark of the streamed water buffers
+
+Runs StreamRing against simulated fences, with a GPU that finishes each
+frame some frames after it was submitted, and checks that no slot is
+handed out for writing before the GPU is done with the frame that last
+used it, and how often the CPU has to wait. Checks that HeightFieldPacking
+splits the WaterSurface mesh into static and per-frame layouts that hold
+every vertex, color and normal. Then times the per-frame packing against
+packing the whole mesh.
+
+No GL context is needed.
+
+Usage:
+    streaming_bench [grid size=180] [frames=200]
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+
+#include "streaming_buffer.hpp"
+#include "water_surface.hpp"
+
+using namespace al;
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// Fences of a GPU that is latency frames behind the CPU
+struct SimulatedFences {
+    SimulatedFences(int numSlots, int latency) :
+        latency(latency), fenceFrame(numSlots, -1), writeFrame(numSlots, -1) {}
+
+    // A fence covers every frame submitted so far
+    void insert(int slot) {
+        fenceFrame[slot] = frame - 1;
+    }
+
+    void wait(int slot) {
+        if (fenceFrame[slot] > completed) {
+            stalls++;
+            completed = fenceFrame[slot]; // Blocks until the GPU gets there
+        }
+        fenceFrame[slot] = -1;
+    }
+
+    void reset(int slot) {
+        fenceFrame[slot] = -1;
+        resets++;
+    }
+
+    // Starts the next CPU frame, the GPU has finished up to latency frames before it
+    void advance() {
+        frame++;
+        completed = std::max(completed, frame - 1 - latency);
+    }
+
+    int latency;
+    int frame = -1;
+    int completed = -1;
+    int stalls = 0;
+    int resets = 0;
+    vector<int> fenceFrame;
+    vector<int> writeFrame; // Frame that last wrote each slot
+};
+
+// Returns the number of frames that had to wait for the GPU, not counting drain()
+static int checkRing(int numSlots, int latency, int frames) {
+    SimulatedFences fences(numSlots, latency);
+    StreamRing<SimulatedFences> ring(fences, numSlots);
+    bool safe = true, rotates = true, drained = true;
+    int used = 0, drainStalls = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        fences.advance();
+        if (frame == frames / 2) {
+            // As StreamingHeightField does before reallocating its buffers
+            int stalls = fences.stalls;
+            ring.drain();
+            drainStalls = fences.stalls - stalls;
+            drained = ring.current() == -1 && fences.resets == numSlots;
+            for (int s = 0; s < numSlots; s++) {
+                drained = drained && fences.writeFrame[s] <= fences.completed;
+            }
+            used = 0;
+        }
+        int slot = ring.beginFrame();
+        safe = safe && fences.writeFrame[slot] <= fences.completed;
+        rotates = rotates && slot == used % numSlots && ring.current() == slot;
+        fences.writeFrame[slot] = frame;
+        used++;
+    }
+    string name = to_string(numSlots) + " slots, latency " + to_string(latency);
+    check(safe, name + ": slots are only rewritten once the GPU is done with them");
+    check(rotates, name + ": slots are used in turn");
+    check(drained, name + ": drain() waits for every slot");
+    return fences.stalls - drainStalls;
+}
+
+static void fillWater(WaterSurface &water, float t) {
+    float *heights = water.heights();
+    for (int j = 0; j < water.ny(); j++) {
+        for (int i = 0; i < water.nx(); i++) {
+            heights[j * water.nx() + i] = 0.05f * std::sin(i * 0.3f + t) * std::cos(j * 0.2f - t);
+        }
+    }
+}
+
+static void checkPacking(Mesh &mesh) {
+    vector<float> staticData, dynamicData(mesh.vertices().size() * HeightFieldPacking::dynamicFloats);
+    HeightFieldPacking::packStatic(mesh, staticData);
+    HeightFieldPacking::packDynamic(mesh, dynamicData.data());
+    check(staticData.size() == mesh.vertices().size() * HeightFieldPacking::staticFloats, "static layout size");
+
+    bool same = true;
+    for (size_t i = 0; i < mesh.vertices().size(); i++) {
+        const float *s = &staticData[i * HeightFieldPacking::staticFloats];
+        const float *d = &dynamicData[i * HeightFieldPacking::dynamicFloats];
+        const Vec3f &v = mesh.vertices()[i];
+        const Vec3f &n = mesh.normals()[i];
+        const Color &c = mesh.colors()[i];
+        same = same && s[0] == v.x && s[1] == v.y && d[0] == v.z;
+        same = same && s[2] == c.r && s[3] == c.g && s[4] == c.b && s[5] == c.a;
+        same = same && d[1] == n.x && d[2] == n.y && d[3] == n.z;
+    }
+    check(same, "packed layouts hold every position, color and normal");
+}
+
+int main(int argc, char *argv[]) {
+    int size = argc > 1 ? atoi(argv[1]) : 180;
+    int frames = argc > 2 ? atoi(argv[2]) : 200;
+
+    for (int latency = 0; latency <= 4; latency++) {
+        int stalls = checkRing(3, latency, 100);
+        cout << "3 slots, latency " << latency << ": " << stalls << " stalls in 100 frames" << endl;
+        check(latency > 2 || stalls == 0, "no stalls while the GPU is up to two frames behind");
+    }
+    checkRing(1, 2, 20);
+
+    WaterSurface water(size, size);
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            float r = (i + j) / (2.0f * size);
+            water.colors()[j * size + i] = Color(1 - r, 1 - r, 1 - r, 1 - r);
+        }
+    }
+    const float identity[16] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1};
+    fillWater(water, 0);
+    water.update(identity, Vec3f(0, 0, 2));
+    checkPacking(water.mesh());
+    unsigned int revision = water.revision();
+
+    Mesh &mesh = water.mesh();
+    vector<float> staticData, dynamicData;
+    double dynamicMs = 0, fullMs = 0;
+    int revisions = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        fillWater(water, frame * 0.05f);
+        water.update(identity, Vec3f(0, 0, 2));
+        dynamicData.resize(mesh.vertices().size() * HeightFieldPacking::dynamicFloats);
+
+        al_sec start = al_steady_time();
+        if (water.revision() != revision) {
+            HeightFieldPacking::packStatic(mesh, staticData);
+            revision = water.revision();
+            revisions++;
+        }
+        HeightFieldPacking::packDynamic(mesh, dynamicData.data());
+        al_sec packed = al_steady_time();
+        HeightFieldPacking::packStatic(mesh, staticData);
+        HeightFieldPacking::packDynamic(mesh, dynamicData.data());
+        al_sec full = al_steady_time();
+
+        dynamicMs += (packed - start) * 1000.0;
+        fullMs += (full - packed) * 1000.0;
+    }
+    checkPacking(mesh);
+
+    size_t count = mesh.vertices().size();
+    cout << "grid " << size << "x" << size << ", " << count << " vertices, "
+         << revisions << " revisions in " << frames << " frames" << endl;
+    cout << "streamed_bytes " << count * HeightFieldPacking::dynamicFloats * sizeof(float)
+         << " of " << count * (HeightFieldPacking::staticFloats + HeightFieldPacking::dynamicFloats) * sizeof(float)
+         << " per frame" << endl;
+    cout << "pack_ms " << dynamicMs / frames << " (full mesh " << fullMs / frames << ")" << endl;
+    cout << (failures == 0 ? "checks passed" : "checks FAILED") << endl;
+    return failures == 0 ? 0 : 1;
+}
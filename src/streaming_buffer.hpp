@@ -0,0 +1,274 @@
+#ifndef STREAMING_BUFFER_HPP
+#define STREAMING_BUFFER_HPP
+
+#include <cstring>
+#include <vector>
+
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+
+#if defined(GLEW_ARB_buffer_storage) && defined(GLEW_ARB_sync)
+#define STREAMING_BUFFER_PERSISTENT
+#endif
+
+namespace al {
+
+/**
+ * @brief Ring of per-frame slots for streamed vertex data
+ *
+ * beginFrame() fences the slot written in the previous frame (its draws
+ * have all been issued by then) and waits until the GPU has finished with
+ * the slot it returns, written numSlots frames ago. Fences is any type with
+ * insert(int slot), wait(int slot) and reset(int slot), so the ring can be
+ * exercised without a GL context.
+ */
+template <class Fences>
+class StreamRing {
+public:
+    StreamRing(Fences &fences, int numSlots = 3) :
+        mFences(fences), mNumSlots(numSlots) {}
+
+    int beginFrame() {
+        if (mCurrent >= 0) {
+            mFences.insert(mCurrent);
+        }
+        mCurrent = (mCurrent + 1) % mNumSlots;
+        mFences.wait(mCurrent);
+        return mCurrent;
+    }
+
+    // Waits for every slot, e.g. before the slots are reallocated
+    void drain() {
+        if (mCurrent >= 0) {
+            mFences.insert(mCurrent);
+        }
+        for (int slot = 0; slot < mNumSlots; slot++) {
+            mFences.wait(slot);
+            mFences.reset(slot);
+        }
+        mCurrent = -1;
+    }
+
+    int current() const { return mCurrent; }
+    int numSlots() const { return mNumSlots; }
+
+private:
+    Fences &mFences;
+    int mNumSlots;
+    int mCurrent = -1;
+};
+
+/**
+ * @brief Vertex layouts of a height field mesh split by update rate
+ *
+ * Static data (x, y and color) changes only with the topology. Dynamic
+ * data (z and the normal) changes every frame and is all that is streamed.
+ */
+struct HeightFieldPacking {
+    enum {
+        staticFloats = 6,   // x, y, r, g, b, a
+        dynamicFloats = 4   // z, nx, ny, nz
+    };
+
+    static void packStatic(Mesh &mesh, std::vector<float> &out) {
+        size_t count = mesh.vertices().size();
+        out.resize(count * staticFloats);
+        float *o = out.data();
+        for (size_t i = 0; i < count; i++) {
+            const Vec3f &v = mesh.vertices()[i];
+            const Color &c = mesh.colors()[i];
+            o[0] = v.x; o[1] = v.y;
+            o[2] = c.r; o[3] = c.g; o[4] = c.b; o[5] = c.a;
+            o += staticFloats;
+        }
+    }
+
+    static void packDynamic(Mesh &mesh, float *out) {
+        size_t count = mesh.vertices().size();
+        for (size_t i = 0; i < count; i++) {
+            const Vec3f &n = mesh.normals()[i];
+            out[0] = mesh.vertices()[i].z;
+            out[1] = n.x; out[2] = n.y; out[3] = n.z;
+            out += dynamicFloats;
+        }
+    }
+};
+
+/**
+ * @brief Draws a height field mesh whose heights and normals change every frame
+ *
+ * x, y, colors and indices are uploaded when the mesh revision changes.
+ * Heights and normals are written each frame into one of a ring of
+ * buffers, so the driver never has to wait for a buffer still in use by
+ * the frames in flight. When ARB_buffer_storage and ARB_sync are available,
+ * the buffers are persistently mapped and written in place, guarded by
+ * fences. Otherwise they are written with glBufferSubData.
+ *
+ * Heights reach the shader through a float attribute added to gl_Vertex.z,
+ * since gl_Vertex comes from the static buffer.
+ */
+class StreamingHeightField {
+public:
+    StreamingHeightField(int numSlots = 3) :
+        mFences(numSlots), mRing(mFences, numSlots) {}
+
+    // Call once per frame with a current GL context, before draw()
+    void update(Mesh &mesh, unsigned int revision) {
+        size_t count = mesh.vertices().size();
+        if (revision != mRevision || mStaticBuffer == 0) {
+            HeightFieldPacking::packStatic(mesh, mStaging);
+            if (mStaticBuffer == 0) {
+                glGenBuffers(1, &mStaticBuffer);
+                glGenBuffers(1, &mIndexBuffer);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, mStaticBuffer);
+            glBufferData(GL_ARRAY_BUFFER, mStaging.size() * sizeof(float), mStaging.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            mNumIndices = mesh.indices().size();
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mNumIndices * sizeof(unsigned int),
+                         mNumIndices > 0 ? &mesh.indices()[0] : nullptr, GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            mRevision = revision;
+            reserve(count);
+        }
+
+        int slot = mRing.beginFrame();
+        size_t bytes = count * HeightFieldPacking::dynamicFloats * sizeof(float);
+        if (mMapped[slot]) {
+            HeightFieldPacking::packDynamic(mesh, mMapped[slot]);
+        } else {
+            mStaging.resize(count * HeightFieldPacking::dynamicFloats);
+            HeightFieldPacking::packDynamic(mesh, mStaging.data());
+            glBindBuffer(GL_ARRAY_BUFFER, mDynamicBuffers[slot]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, mStaging.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    // heightAttribute is the location of the float attribute added to z
+    void draw(int heightAttribute) {
+        int slot = mRing.current();
+        if (slot < 0 || mNumIndices == 0) {
+            return;
+        }
+        const GLsizei staticStride = HeightFieldPacking::staticFloats * sizeof(float);
+        const GLsizei dynamicStride = HeightFieldPacking::dynamicFloats * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, mStaticBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(2, GL_FLOAT, staticStride, (const GLvoid *) 0);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, staticStride, (const GLvoid *) (2 * sizeof(float)));
+
+        glBindBuffer(GL_ARRAY_BUFFER, mDynamicBuffers[slot]);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, dynamicStride, (const GLvoid *) sizeof(float));
+        glEnableVertexAttribArray(heightAttribute);
+        glVertexAttribPointer(heightAttribute, 1, GL_FLOAT, GL_FALSE, dynamicStride, (const GLvoid *) 0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+        glDrawElements(GL_TRIANGLES, mNumIndices, GL_UNSIGNED_INT, (const GLvoid *) 0);
+
+        glDisableVertexAttribArray(heightAttribute);
+        glVertexAttrib1f(heightAttribute, 0.0f); // Other meshes get no height offset
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    bool persistent() { return mMapped.size() > 0 && mMapped[0] != nullptr; }
+
+private:
+    // Fences for the ring. Without ARB_sync, separate buffers per slot are the only guard
+    class GLFences {
+    public:
+        GLFences(int numSlots) : mSync(numSlots, nullptr) {}
+
+        void insert(int slot) {
+#ifdef STREAMING_BUFFER_PERSISTENT
+            if (GLEW_ARB_sync) {
+                reset(slot);
+                mSync[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+#endif
+        }
+
+        void wait(int slot) {
+#ifdef STREAMING_BUFFER_PERSISTENT
+            if (mSync[slot]) {
+                GLenum result;
+                do {
+                    result = glClientWaitSync((GLsync) mSync[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                } while (result == GL_TIMEOUT_EXPIRED);
+                reset(slot);
+            }
+#endif
+        }
+
+        void reset(int slot) {
+#ifdef STREAMING_BUFFER_PERSISTENT
+            if (mSync[slot]) {
+                glDeleteSync((GLsync) mSync[slot]);
+            }
+#endif
+            mSync[slot] = nullptr;
+        }
+
+    private:
+        std::vector<void *> mSync;
+    };
+
+    // Makes every slot hold at least count vertices
+    void reserve(size_t count) {
+        if (count <= mSlotCapacity && mDynamicBuffers.size() > 0) {
+            return;
+        }
+        mRing.drain();
+        if (mDynamicBuffers.size() > 0) {
+            for (size_t slot = 0; slot < mDynamicBuffers.size(); slot++) {
+                if (mMapped[slot]) {
+                    glBindBuffer(GL_ARRAY_BUFFER, mDynamicBuffers[slot]);
+                    glUnmapBuffer(GL_ARRAY_BUFFER);
+                }
+            }
+            glDeleteBuffers(mDynamicBuffers.size(), mDynamicBuffers.data());
+        }
+        mSlotCapacity = count + count / 2; // Room for levels of detail to change
+        size_t bytes = mSlotCapacity * HeightFieldPacking::dynamicFloats * sizeof(float);
+        int numSlots = mRing.numSlots();
+        mDynamicBuffers.assign(numSlots, 0);
+        mMapped.assign(numSlots, nullptr);
+        glGenBuffers(numSlots, mDynamicBuffers.data());
+        for (int slot = 0; slot < numSlots; slot++) {
+            glBindBuffer(GL_ARRAY_BUFFER, mDynamicBuffers[slot]);
+#ifdef STREAMING_BUFFER_PERSISTENT
+            if (GLEW_ARB_buffer_storage && GLEW_ARB_sync) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                // Dynamic storage keeps glBufferSubData() possible if mapping fails
+                glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);
+                mMapped[slot] = (float *) glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+                continue;
+            }
+#endif
+            glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    GLFences mFences;
+    StreamRing<GLFences> mRing;
+    unsigned int mRevision = 0;
+    GLuint mStaticBuffer = 0;
+    GLuint mIndexBuffer = 0;
+    GLsizei mNumIndices = 0;
+    std::vector<GLuint> mDynamicBuffers;
+    std::vector<float *> mMapped;
+    size_t mSlotCapacity = 0;
+    std::vector<float> mStaging;
+};
+
+} // namespace al
+
+#endif // STREAMING_BUFFER_HPP
@@ -0,0 +1,269 @@
+/*
+Benchmark of the synthesis engines of the audio apps
+
+Renders fixed blocks into 60 output channels through AddSynthNote (with
+amplitude and with frequency modulation), ChaosSynth, ModalSynth, Granulator
+and DownMixer, for several buffer sizes and numbers of voices, without an
+audio device or GUI. Reports the time per sample per voice, the share of
+the block duration used (at 44.1 kHz) and the heap allocations per block,
+and writes the same as CSV lines for tracking regressions, e.g. before and
+after changing the inner loops of an engine.
+
+Partials are fixed at compile time (NUM_VOICES in add_synth.hpp, MODAL_VOICES
+in modal_synth.hpp), so they are reported rather than swept; ns_per_partial
+compares engines with different counts, and is per voice for the others.
+For DownMixer the voices are its 60 source channels. Run from the repository
+root, so that the synths find their preset directories.
+
+Usage:
+    synth_bench [results.csv=synth_bench.csv] [seconds=2] [granulator sound file]
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/system/al_Time.hpp"
+
+#include "add_synth.hpp"
+#include "chaos_synth.hpp"
+#include "modal_synth.hpp"
+#include "granulator.hpp"
+#include "downmixer.hpp"
+
+using namespace al;
+using namespace std;
+
+// Every heap allocation of the process, to check that rendering doesn't allocate
+static std::atomic<size_t> allocations {0};
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static const double sampleRate = 44100;
+static const int channels = 60;
+
+struct Result {
+    string engine;
+    int frames, voices, partials;
+    double nsPerSample; // Per voice
+    double load; // Share of the block duration
+    double allocationsPerBlock;
+};
+
+/**
+ * Renders seconds of blocks with render(AudioIO &) after warming up, and
+ * times them. trigger(int voices) (re)starts the voices before the blocks.
+ */
+template<class Trigger, class Render>
+static Result run(string engine, AudioIO &io, int voices, int partials, double seconds,
+                  Trigger trigger, Render render) {
+    int frames = io.framesPerBuffer();
+    int blocks = max(int(seconds * sampleRate / frames), 1);
+    trigger(voices);
+    for (int i = 0; i < max(blocks / 20, 1); i++) {
+        io.zeroOut();
+        render(io);
+    }
+    size_t startAllocations = allocations;
+    al_sec start = al_steady_time();
+    for (int i = 0; i < blocks; i++) {
+        io.zeroOut();
+        render(io);
+    }
+    double elapsed = al_steady_time() - start;
+    double blockSeconds = frames / sampleRate;
+    return {engine, frames, voices, partials,
+            elapsed * 1e9 / (double(blocks) * frames * voices),
+            elapsed / blocks / blockSeconds,
+            double(allocations - startAllocations) / blocks};
+}
+
+static vector<int> allChannels() {
+    vector<int> routing;
+    for (int i = 0; i < channels; i++) {
+        routing.push_back(i);
+    }
+    return routing;
+}
+
+static AddSynthNoteParameters addSynthParameters(int id, bool freqMod) {
+    AddSynthNoteParameters params;
+    params.id = id;
+    params.mLevel = 0.5;
+    params.mFundamental = 110 + id * 7;
+    params.mCumulativeDelay = 0;
+    params.mCumDelayRandomness = 0;
+    for (int i = 0; i < NUM_VOICES; i++) {
+        params.mAttackTimes[i] = 0.01;
+        params.mDecayTimes[i] = 0.1;
+        params.mSustainLevels[i] = 0.7;
+        params.mReleaseTimes[i] = 2.0;
+        params.mFrequencyFactors[i] = i + 1;
+        params.mAmplitudes[i] = 1.0 / (i + 1);
+        params.mAmpModFrequencies[i] = 1 + i * 0.1;
+        params.mAmpModDepth[i] = 0.1;
+    }
+    params.mAmpModAttack = 0.1;
+    params.mAmpModRelease = 0.1;
+    params.mAttackCurve = 4;
+    params.mReleaseCurve = -4;
+    params.mFreqMod = freqMod;
+    params.mArcStart = 0;
+    params.mArcSpan = 1;
+    params.mOutputRouting = allChannels();
+    return params;
+}
+
+static ModalSynthParameters modalParameters(int id) {
+    ModalSynthParameters params;
+    params.id = id;
+    params.mLevel = 80;
+    params.mFundamental = 220 + id * 11;
+    for (int i = 0; i < MODAL_VOICES; i++) {
+        params.mFrequencyFactors[i] = 1 + i * 1.7;
+        params.mWidths[i] = 1;
+        params.mAmplitudes[i] = 1.0 / (i + 1);
+    }
+    params.mArcStart = 0;
+    params.mArcSpan = 1;
+    params.mOutputChannel = id % channels;
+    params.mOutputRouting = allChannels();
+    return params;
+}
+
+int main(int argc, char *argv[]) {
+    string path = argc > 1 ? argv[1] : "synth_bench.csv";
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+    string granulatorFile = argc > 3 ? argv[3] : "";
+
+    const vector<int> bufferSizes = {64, 128, 256, 400, 512, 1024};
+    const vector<int> polyphonies = {1, 4, 11, 16};
+    int maxVoices = polyphonies.back();
+
+    gam::sampleRate(sampleRate);
+    // Engines are made once, outside the timed blocks
+    vector<AddSynthNote> addSynthNotes(maxVoices);
+    vector<unique_ptr<ChaosSynth>> chaosSynths;
+    for (int i = 0; i < maxVoices; i++) {
+        chaosSynths.emplace_back(new ChaosSynth);
+        chaosSynths.back()->setOutputIndeces(i % channels, (i + 30) % channels);
+    }
+    vector<ModalSynth> modalSynths(maxVoices);
+    vector<ModalSynthParameters> modalParams; // Made here, as retriggers are timed
+    for (int i = 0; i < maxVoices; i++) {
+        modalParams.push_back(modalParameters(i));
+    }
+    vector<unique_ptr<Granulator>> granulators;
+    if (!granulatorFile.empty()) {
+        for (int i = 0; i < maxVoices; i++) {
+            granulators.emplace_back(new Granulator(granulatorFile));
+        }
+    }
+    DownMixer downMixer;
+
+    vector<Result> results;
+    for (int frames: bufferSizes) {
+        AudioIO io;
+        io.framesPerSecond(sampleRate);
+        io.framesPerBuffer(frames);
+        io.channelsOut(channels);
+        io.channelsIn(0);
+        int modalRetrigger = max(int(0.25 * sampleRate / frames), 1); // Blocks between strikes
+        int block = 0;
+
+        for (int voices: polyphonies) {
+            for (bool freqMod: {false, true}) {
+                results.push_back(run(freqMod ? "AddSynthNoteFM" : "AddSynthNote", io, voices, NUM_VOICES, seconds,
+                                      [&](int count) {
+                    for (int i = 0; i < count; i++) {
+                        AddSynthNoteParameters params = addSynthParameters(i, freqMod);
+                        addSynthNotes[i].trigger(params);
+                    }
+                }, [&](AudioIO &io) {
+                    for (int i = 0; i < voices; i++) {
+                        addSynthNotes[i].generateAudio(io);
+                        io.frame(0);
+                    }
+                }));
+            }
+
+            results.push_back(run("ChaosSynth", io, voices, 1, seconds, [&](int count) {
+                for (int i = 0; i < count; i++) {
+                    chaosSynths[i]->recallPresetSynchronous(0);
+                    chaosSynths[i]->trigger(i);
+                }
+            }, [&](AudioIO &io) {
+                for (int i = 0; i < voices; i++) {
+                    io.frame(0);
+                    chaosSynths[i]->generateAudio(io);
+                }
+                io.frame(0);
+            }));
+
+            results.push_back(run("ModalSynth", io, voices, MODAL_VOICES, seconds, [&](int) {
+                block = 0;
+            }, [&](AudioIO &io) {
+                if (block++ % modalRetrigger == 0) {
+                    for (int i = 0; i < voices; i++) {
+                        modalSynths[i].trigger(modalParams[i]);
+                    }
+                }
+                for (int i = 0; i < voices; i++) {
+                    io.frame(0);
+                    modalSynths[i].generateAudio(io);
+                }
+                io.frame(0);
+            }));
+
+            if (!granulators.empty()) {
+                results.push_back(run("Granulator", io, voices, 1, seconds, [](int) {}, [&](AudioIO &io) {
+                    for (int i = 0; i < voices; i++) {
+                        Granulator &granulator = *granulators[i];
+                        float *out = io.outBuffer(i % channels);
+                        for (int frame = 0; frame < io.framesPerBuffer(); frame++) {
+                            out[frame] += granulator();
+                        }
+                    }
+                }));
+            }
+        }
+
+        results.push_back(run("DownMixer", io, channels, 1, seconds, [](int) {}, [&](AudioIO &io) {
+            downMixer.process(io);
+        }));
+    }
+
+    FILE *csv = fopen(path.c_str(), "w");
+    if (!csv) {
+        cout << "Can't write " << path << endl;
+        return 1;
+    }
+    fprintf(csv, "engine,frames,voices,partials,ns_per_sample_voice,ns_per_partial,load,allocations_per_block\n");
+    printf("%-16s %6s %6s %8s %14s %10s %8s %12s\n",
+           "engine", "frames", "voices", "partials", "ns/sample/voice", "ns/partial", "load", "allocs/block");
+    for (const Result &r: results) {
+        fprintf(csv, "%s,%d,%d,%d,%.3f,%.3f,%.5f,%.3f\n", r.engine.c_str(), r.frames, r.voices, r.partials,
+                r.nsPerSample, r.nsPerSample / r.partials, r.load, r.allocationsPerBlock);
+        printf("%-16s %6d %6d %8d %15.2f %10.3f %7.2f%% %12.2f\n", r.engine.c_str(), r.frames, r.voices, r.partials,
+               r.nsPerSample, r.nsPerSample / r.partials, r.load * 100, r.allocationsPerBlock);
+    }
+    fclose(csv);
+    cout << "Results written to " << path << endl;
+    return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef TEXT_BATCH_HPP
+#define TEXT_BATCH_HPP
+
+#include <vector>
+
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/types/al_Color.hpp"
+
+#include "font_cache.hpp"
+
+namespace al {
+
+/**
+ * @brief Collects the glyph quads of many text modules into one mesh per font
+ *
+ * append() only transforms vertices on the CPU into the batch for the font,
+ * so building a batch needs no GL context. draw() then binds each font's
+ * glyph texture once and issues a single draw per font.
+ */
+class TextBatch {
+public:
+
+    // Returns false if the glyph mesh can't be merged (e.g. a strip primitive)
+    bool append(FontCache::CachedFont *font, const Mesh &glyphs,
+                const Vec3f &translation, const Vec3f &scale, const Color &color) {
+        int primitive = glyphs.primitive();
+        if (primitive != Graphics::TRIANGLES && primitive != Graphics::QUADS) {
+            return false;
+        }
+        Batch &batch = batchFor(font, primitive);
+        if (!batch.used) {
+            batch.mesh.reset();
+            batch.mesh.primitive(primitive);
+            batch.used = true;
+        }
+        const Mesh::Vertices &vertices = glyphs.vertices();
+        const Mesh::TexCoords2 &texCoords = glyphs.texCoord2s();
+        const size_t count = vertices.size();
+        Mesh &mesh = batch.mesh;
+        for (size_t i = 0; i < count; i++) {
+            const Mesh::Vertex &v = vertices[i];
+            mesh.vertex(v.x * scale.x + translation.x,
+                        v.y * scale.y + translation.y,
+                        v.z * scale.z + translation.z);
+            mesh.texCoord(texCoords[i]);
+            mesh.color(color);
+        }
+        mGlyphVertices += count;
+        return true;
+    }
+
+    void draw(Graphics &g) {
+        for (Batch &batch: mBatches) {
+            if (batch.used && batch.mesh.vertices().size() > 0) {
+                batch.font->font().texture().bind();
+                g.draw(batch.mesh);
+                batch.font->font().texture().unbind();
+            }
+        }
+    }
+
+    // Start a new frame. Meshes keep their allocated storage.
+    void clear() {
+        for (Batch &batch: mBatches) {
+            batch.used = false;
+            batch.mesh.reset();
+        }
+        mGlyphVertices = 0;
+    }
+
+    size_t numBatches() {
+        size_t count = 0;
+        for (Batch &batch: mBatches) {
+            if (batch.used) count++;
+        }
+        return count;
+    }
+    size_t numVertices() { return mGlyphVertices; }
+    const Mesh *mesh(FontCache::CachedFont *font) {
+        for (Batch &batch: mBatches) {
+            if (batch.used && batch.font == font) return &batch.mesh;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Batch {
+        FontCache::CachedFont *font;
+        int primitive;
+        Mesh mesh;
+        bool used;
+    };
+
+    Batch &batchFor(FontCache::CachedFont *font, int primitive) {
+        for (Batch &batch: mBatches) {
+            if (batch.font == font && batch.primitive == primitive) {
+                return batch;
+            }
+        }
+        mBatches.push_back(Batch{font, primitive, Mesh(), false});
+        return mBatches.back();
+    }
+
+    std::vector<Batch> mBatches; // Few fonts, a linear search is enough
+    size_t mGlyphVertices {0};
+};
+
+}
+
+#endif // TEXT_BATCH_HPP
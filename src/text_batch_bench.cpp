@@ -0,0 +1,135 @@
+/*
+Check and benchmark of TextBatch
+
+Checks that TextBatch::append() places the glyph vertices of a module where
+the module would draw them, keeps one batch per font and primitive, and
+refuses meshes it can't merge. Then times batching a frame of text markers.
+No GL context is needed, append() only works on the CPU.
+
+Usage:
+    text_batch_bench [font=fonts/CaslonAntique.ttf] [modules=1000] [frames=100]
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+
+#include "text_batch.hpp"
+
+using namespace al;
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+static bool near(float a, float b) {
+    return std::fabs(a - b) < 1e-5f;
+}
+
+// Two triangles of a unit quad, as a glyph
+static void unitQuad(Mesh &m, int primitive) {
+    m.reset();
+    m.primitive(primitive);
+    const float corners[6][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+    for (auto &c: corners) {
+        m.vertex(c[0], c[1], 0);
+        m.texCoord(c[0] * 0.5f, c[1] * 0.25f);
+    }
+}
+
+static void checkAppend(FontCache::CachedFont *font, FontCache::CachedFont *otherFont) {
+    TextBatch batch;
+    Mesh quad;
+    unitQuad(quad, Graphics::TRIANGLES);
+
+    // Vertices are scaled, then translated, texture coordinates kept and colored per vertex
+    Vec3f translation(1, 2, 3), scale(2, 3, 4);
+    Color color(0.25f, 0.5f, 0.75f, 0.5f);
+    check(batch.append(font, quad, translation, scale, color), "triangles are accepted");
+    const Mesh *mesh = batch.mesh(font);
+    check(mesh != nullptr, "batch for the font");
+    if (mesh) {
+        check(mesh->vertices().size() == 6, "6 vertices");
+        check(mesh->texCoord2s().size() == 6, "6 texture coordinates");
+        check(mesh->colors().size() == 6, "6 colors");
+        bool placed = true, textured = true, colored = true;
+        for (size_t i = 0; i < 6 && i < mesh->vertices().size(); i++) {
+            const Mesh::Vertex &v = mesh->vertices()[i];
+            placed = placed && near(v.x, quad.vertices()[i].x * 2 + 1)
+                    && near(v.y, quad.vertices()[i].y * 3 + 2) && near(v.z, 3);
+            textured = textured && near(mesh->texCoord2s()[i][0], quad.texCoord2s()[i][0])
+                    && near(mesh->texCoord2s()[i][1], quad.texCoord2s()[i][1]);
+            const Color &c = mesh->colors()[i];
+            colored = colored && c.r == color.r && c.g == color.g && c.b == color.b && c.a == color.a;
+        }
+        check(placed, "vertices scaled then translated");
+        check(textured, "texture coordinates copied");
+        check(colored, "module color on every vertex");
+    }
+
+    // The same font shares the batch, another font or primitive gets its own
+    check(batch.append(font, quad, Vec3f(0, 0, 0), Vec3f(1, 1, 1), color), "second module, same font");
+    check(batch.numBatches() == 1 && batch.numVertices() == 12, "same font merged into one batch");
+    check(batch.append(otherFont, quad, Vec3f(0, 0, 0), Vec3f(1, 1, 1), color), "other font");
+    Mesh quads;
+    unitQuad(quads, Graphics::QUADS);
+    check(batch.append(font, quads, Vec3f(0, 0, 0), Vec3f(1, 1, 1), color), "quads are accepted");
+    check(batch.numBatches() == 3 && batch.numVertices() == 24, "one batch per font and primitive");
+
+    // Strips can't be concatenated
+    Mesh strip;
+    unitQuad(strip, Graphics::TRIANGLE_STRIP);
+    check(!batch.append(font, strip, Vec3f(0, 0, 0), Vec3f(1, 1, 1), color), "strips are refused");
+    check(batch.numBatches() == 3 && batch.numVertices() == 24, "refused mesh adds nothing");
+
+    batch.clear();
+    check(batch.numBatches() == 0 && batch.numVertices() == 0, "clear() empties the batches");
+    check(batch.mesh(font) == nullptr, "no batch after clear()");
+}
+
+int main(int argc, char *argv[]) {
+    string fontPath = argc > 1 ? argv[1] : "fonts/CaslonAntique.ttf";
+    int modules = argc > 2 ? atoi(argv[2]) : 1000;
+    int frames = argc > 3 ? atoi(argv[3]) : 100;
+
+    FontCache::CachedFont font(fontPath, 32, true);
+    FontCache::CachedFont smallFont(fontPath, 16, true);
+    checkAppend(&font, &smallFont);
+
+    // A frame of hex pair markers, as the graphics nodes show them
+    vector<shared_ptr<const Mesh>> meshes;
+    for (int i = 0; i < 256; i++) {
+        char text[3];
+        snprintf(text, sizeof(text), "%02X", i);
+        meshes.push_back(font.mesh(text));
+    }
+    TextBatch batch;
+    size_t vertices = 0;
+    al_sec start = al_steady_time();
+    for (int frame = 0; frame < frames; frame++) {
+        batch.clear();
+        for (int i = 0; i < modules; i++) {
+            batch.append(&font, *meshes[i % meshes.size()], Vec3f(i * 0.01f, frame * 0.01f, -4),
+                         Vec3f(0.005f, 0.005f, 0.005f), Color(1, 1, 1, 0.5f));
+        }
+        vertices = batch.numVertices();
+    }
+    double frameMs = (al_steady_time() - start) * 1000.0 / frames;
+
+    cout << modules << " modules, " << frames << " frames" << endl;
+    cout << "batches " << batch.numBatches() << ", vertices " << vertices << endl;
+    cout << "append_ms " << frameMs << endl;
+    cout << (failures == 0 ? "checks passed" : "checks FAILED") << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+#ifndef TEXTURE_ATLAS_HPP
+#define TEXTURE_ATLAS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace al {
+
+/**
+ * @brief Packs RGBA images into a single atlas image
+ *
+ * Images are placed on shelves, tallest first. Each image is surrounded by a
+ * border of repeated edge pixels so that filtering and mipmaps don't pick up
+ * texels from neighboring images. If the atlas would be larger than maxSize,
+ * every image is halved until it fits.
+ */
+class TextureAtlas {
+public:
+    struct Rect {
+        int x = 0, y = 0;   // In atlas pixels, excluding the border
+        int width = 0, height = 0;
+    };
+
+    TextureAtlas(int maxSize = 8192, int border = 2) :
+        mMaxSize(maxSize), mBorder(border) {}
+
+    /**
+     * Computes the atlas size and a rect for each size given. Empty sizes
+     * (images that failed to load) get an empty rect. Returns the number of
+     * times images have to be halved to fit.
+     */
+    int layout(const std::vector<int> &widths, const std::vector<int> &heights) {
+        int halvings = 0;
+        while (!tryLayout(widths, heights, halvings)) {
+            halvings++;
+        }
+        return halvings;
+    }
+
+    int width() { return mWidth; }
+    int height() { return mHeight; }
+    const Rect &rect(int index) { return mRects[index]; }
+
+    // Normalized texture coordinates of an image: u0, v0, u1, v1
+    void uvs(int index, float *uv) {
+        const Rect &r = mRects[index];
+        uv[0] = r.x / (float) mWidth;
+        uv[1] = r.y / (float) mHeight;
+        uv[2] = (r.x + r.width) / (float) mWidth;
+        uv[3] = (r.y + r.height) / (float) mHeight;
+    }
+
+    // Copies an image of the size given to layout() into the atlas pixels, halving it if needed
+    void blit(int index, const unsigned char *pixels, int width, int height, int halvings,
+              unsigned char *atlas) {
+        std::vector<unsigned char> scaled;
+        for (int i = 0; i < halvings; i++) {
+            halve(pixels, width, height, scaled);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            pixels = scaled.data();
+        }
+        const Rect &r = mRects[index];
+        for (int y = -mBorder; y < r.height + mBorder; y++) {
+            int sy = std::min(std::max(y, 0), height - 1);
+            unsigned char *dst = atlas + ((size_t) (r.y + y) * mWidth + r.x - mBorder) * 4;
+            for (int x = -mBorder; x < r.width + mBorder; x++) {
+                int sx = std::min(std::max(x, 0), width - 1);
+                std::memcpy(dst, pixels + ((size_t) sy * width + sx) * 4, 4);
+                dst += 4;
+            }
+        }
+    }
+
+    // Box filter to half size. out may not alias pixels
+    static void halve(const unsigned char *pixels, int width, int height,
+                      std::vector<unsigned char> &out) {
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        std::vector<unsigned char> result(w * h * 4);
+        for (int y = 0; y < h; y++) {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < w; x++) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < 4; c++) {
+                    int sum = pixels[((size_t) y0 * width + x0) * 4 + c] + pixels[((size_t) y0 * width + x1) * 4 + c]
+                            + pixels[((size_t) y1 * width + x0) * 4 + c] + pixels[((size_t) y1 * width + x1) * 4 + c];
+                    result[((size_t) y * w + x) * 4 + c] = (sum + 2) / 4;
+                }
+            }
+        }
+        out.swap(result);
+    }
+
+private:
+    static int halved(int size, int halvings) {
+        for (int i = 0; i < halvings; i++) {
+            size = std::max(1, size / 2);
+        }
+        return size;
+    }
+
+    bool tryLayout(const std::vector<int> &widths, const std::vector<int> &heights, int halvings) {
+        size_t count = widths.size();
+        mRects.assign(count, Rect());
+        std::vector<int> order;
+        long area = 0;
+        int widest = 1;
+        for (size_t i = 0; i < count; i++) {
+            if (widths[i] <= 0 || heights[i] <= 0) {
+                continue;
+            }
+            mRects[i].width = halved(widths[i], halvings);
+            mRects[i].height = halved(heights[i], halvings);
+            int w = mRects[i].width + 2 * mBorder, h = mRects[i].height + 2 * mBorder;
+            area += (long) w * h;
+            widest = std::max(widest, w);
+            order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            return mRects[a].height > mRects[b].height;
+        });
+
+        // Square-ish atlas: shelves as wide as the root of the total area
+        mWidth = std::max(widest, (int) std::ceil(std::sqrt((double) area) * 1.1));
+        if (mWidth > mMaxSize) {
+            return false;
+        }
+        int x = 0, y = 0, shelfHeight = 0;
+        for (int i: order) {
+            int w = mRects[i].width + 2 * mBorder, h = mRects[i].height + 2 * mBorder;
+            if (x + w > mWidth) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            mRects[i].x = x + mBorder;
+            mRects[i].y = y + mBorder;
+            x += w;
+            shelfHeight = std::max(shelfHeight, h);
+        }
+        mHeight = std::max(1, y + shelfHeight);
+        return mHeight <= mMaxSize;
+    }
+
+    int mMaxSize;
+    int mBorder;
+    int mWidth = 1;
+    int mHeight = 1;
+    std::vector<Rect> mRects;
+};
+
+} // namespace al
+
+#endif // TEXTURE_ATLAS_HPP
@@ -0,0 +1,123 @@
+#ifndef VISIBILITY_CULLER_HPP
+#define VISIBILITY_CULLER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "allocore/math/al_Vec.hpp"
+#include "allocore/spatial/al_Pose.hpp"
+
+namespace al {
+
+/**
+ * @brief Tests bounding spheres against the views a render node actually shows
+ *
+ * Each view is a cone of directions from the eye, computed from the
+ * directions its projector covers (e.g. the warp map of an omni projection).
+ * A sphere is visible if it intersects any of the cones. With no views, or
+ * when disabled, everything is visible, so apps without projections are not
+ * affected.
+ *
+ * Spheres are given in world coordinates and moved to eye space with the
+ * viewer pose set once per frame.
+ */
+class VisibilityCuller {
+public:
+
+    // Adds the cone around count unit or non unit directions, stride floats apart
+    void addView(const float *directions, size_t count, size_t stride = 3) {
+        Vec3f sum(0, 0, 0);
+        size_t used = 0;
+        for (size_t i = 0; i < count; i++) {
+            Vec3f dir(directions[i * stride], directions[i * stride + 1], directions[i * stride + 2]);
+            float length = dir.mag();
+            if (length > 0) {
+                sum += dir / length;
+                used++;
+            }
+        }
+        if (used == 0 || sum.mag() < 1e-3f * used) {
+            mCoversAll = true; // No data, or directions all around
+            return;
+        }
+        View view;
+        view.axis = sum.normalized();
+        float minCos = 1.0f;
+        for (size_t i = 0; i < count; i++) {
+            Vec3f dir(directions[i * stride], directions[i * stride + 1], directions[i * stride + 2]);
+            float length = dir.mag();
+            if (length > 0) {
+                minCos = std::min(minCos, view.axis.dot(dir) / length);
+            }
+        }
+        view.halfAngle = std::acos(std::max(-1.0f, std::min(1.0f, minCos)));
+        if (view.halfAngle > 2.0f) {
+            mCoversAll = true; // Little to gain, and the cone test gets loose
+            return;
+        }
+        mViews.push_back(view);
+    }
+
+    void clearViews() {
+        mViews.clear();
+        mCoversAll = false;
+    }
+
+    void enable(bool enabled) { mEnabled = enabled; }
+
+    // Whether spheres are actually tested
+    bool active() const { return mEnabled && !mCoversAll && mViews.size() > 0; }
+
+    // Extra radius for eye separation and omni parallax
+    void margin(float m) { mMargin = m; }
+
+    void viewer(const Pose &pose) {
+        mEye = Vec3f(pose.pos());
+        mRight = Vec3f(pose.ur());
+        mUp = Vec3f(pose.uu());
+        mForward = Vec3f(pose.uf());
+    }
+
+    bool visible(const Vec3f &center, float radius) const {
+        if (!active()) {
+            return true;
+        }
+        Vec3f d = center - mEye;
+        // Eye space: x right, y up, looking down -z
+        Vec3f eye(d.dot(mRight), d.dot(mUp), -d.dot(mForward));
+        float r = radius + mMargin;
+        float distance = eye.mag();
+        if (distance <= r) {
+            return true;
+        }
+        float angularRadius = std::asin(r / distance);
+        for (const View &view: mViews) {
+            float cosAngle = view.axis.dot(eye) / distance;
+            float angle = std::acos(std::max(-1.0f, std::min(1.0f, cosAngle)));
+            if (angle <= view.halfAngle + angularRadius) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct View {
+        Vec3f axis;
+        float halfAngle;
+    };
+
+    std::vector<View> mViews;
+    bool mCoversAll = false;
+    bool mEnabled = true;
+    float mMargin = 0.1f;
+    Vec3f mEye {0, 0, 0};
+    Vec3f mRight {1, 0, 0};
+    Vec3f mUp {0, 1, 0};
+    Vec3f mForward {0, 0, -1};
+};
+
+} // namespace al
+
+#endif // VISIBILITY_CULLER_HPP
@@ -0,0 +1,241 @@
+#ifndef WATER_SURFACE_HPP
+#define WATER_SURFACE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/math/al_Vec.hpp"
+#include "allocore/types/al_Color.hpp"
+
+namespace al {
+
+/**
+ * @brief Height field surface drawn with a level of detail per patch
+ *
+ * The Nx by Ny grid (spanning -1 to 1 in x and y, like addSurface()) is
+ * split into square patches: the leaves of a quadtree of patchCells cells.
+ * Every frame, each patch picks how many grid vertices to skip from its
+ * local wave energy (height range) and its distance to the viewer, so a
+ * flat lagoon far away is drawn with two triangles per patch.
+ *
+ * The mesh only holds the vertices used at the current levels. Its index
+ * list, positions and colors are rebuilt only when a patch level changes;
+ * otherwise update() rewrites z and normals of the used vertices only.
+ * Patch edges next to a coarser patch are snapped to the coarser vertices,
+ * so there are no cracks between levels.
+ */
+class WaterSurface {
+public:
+    enum {
+        patchCells = 16,
+        maxLevel = 4 // Step of 16 cells, a patch is two triangles
+    };
+
+    WaterSurface(int nx, int ny) :
+        mNx(nx), mNy(ny),
+        mHeights(nx * ny, 0.0f),
+        mColors(nx * ny, Color(1, 1, 1, 1)),
+        mCompact(nx * ny, -1)
+    {
+        mPatchesX = (mNx - 1 + patchCells - 1) / patchCells;
+        mPatchesY = (mNy - 1 + patchCells - 1) / patchCells;
+        mLevels.assign(mPatchesX * mPatchesY, -1);
+        mMesh.primitive(Graphics::TRIANGLES);
+    }
+
+    int nx() { return mNx; }
+    int ny() { return mNy; }
+
+    // Heights of the full resolution grid (index j * nx + i), written before update()
+    float *heights() { return mHeights.data(); }
+
+    // Colors of the full resolution grid, copied to the mesh when levels change
+    std::vector<Color> &colors() { return mColors; }
+
+    // Larger values lower the detail
+    void tolerance(float t) { mTolerance = t; }
+
+    // Forces all patches to full resolution, e.g. to compare with the old mesh
+    void fullDetail(bool full) { mFullDetail = full; }
+
+    /**
+     * @brief Picks patch levels and updates the mesh from heights()
+     *
+     * localToWorld is the column major transform the surface is drawn with,
+     * used to measure distances and heights in world units.
+     */
+    void update(const float *localToWorld, const Vec3f &viewer) {
+        bool changed = mMesh.vertices().size() == 0;
+        const float *m = localToWorld;
+        float zScale = std::sqrt(m[8] * m[8] + m[9] * m[9] + m[10] * m[10]);
+        for (int py = 0; py < mPatchesY; py++) {
+            for (int px = 0; px < mPatchesX; px++) {
+                int x0 = px * patchCells, y0 = py * patchCells;
+                int x1 = std::min(x0 + patchCells, mNx - 1), y1 = std::min(y0 + patchCells, mNy - 1);
+                float low = mHeights[y0 * mNx + x0], high = low;
+                for (int j = y0; j <= y1; j++) {
+                    const float *row = &mHeights[j * mNx];
+                    for (int i = x0; i <= x1; i++) {
+                        low = std::min(low, row[i]);
+                        high = std::max(high, row[i]);
+                    }
+                }
+                float cx = localX((x0 + x1) * 0.5f), cy = localY((y0 + y1) * 0.5f), cz = (low + high) * 0.5f;
+                Vec3f center(m[0] * cx + m[4] * cy + m[8] * cz + m[12],
+                             m[1] * cx + m[5] * cy + m[9] * cz + m[13],
+                             m[2] * cx + m[6] * cy + m[10] * cz + m[14]);
+                int level = mFullDetail ? 0 : chooseLevel((high - low) * zScale, (center - viewer).mag());
+                int &current = mLevels[py * mPatchesX + px];
+                if (level != current) {
+                    current = level;
+                    changed = true;
+                }
+            }
+        }
+        if (changed) {
+            rebuild();
+        }
+        updateVertices();
+    }
+
+    Mesh &mesh() { return mMesh; }
+
+    // Changes whenever the vertices used, indices or colors change
+    unsigned int revision() { return mRevision; }
+
+    int level(int px, int py) { return mLevels[py * mPatchesX + px]; }
+
+private:
+    float localX(float i) { return -1.0f + 2.0f * i / (mNx - 1); }
+    float localY(float j) { return -1.0f + 2.0f * j / (mNy - 1); }
+
+    /*
+     * Coarsest level whose step keeps the height change skipped over
+     * (roughly energy * step / patchCells) below tolerance * distance.
+     */
+    int chooseLevel(float energy, float distance) {
+        float allowed = mTolerance * std::max(distance, 1.0f) * patchCells / std::max(energy, 1e-6f);
+        int level = 0;
+        while (level < maxLevel && (2 << level) <= allowed) {
+            level++;
+        }
+        return level;
+    }
+
+    int step(int px, int py) {
+        if (px < 0 || py < 0 || px >= mPatchesX || py >= mPatchesY) {
+            return 0; // No neighbor
+        }
+        return 1 << mLevels[py * mPatchesX + px];
+    }
+
+    // Snaps an edge coordinate to the vertices of a coarser neighbor along the edge
+    static int snap(int v, int origin, int end, int coarseStep) {
+        if (v == end) {
+            return v;
+        }
+        return origin + ((v - origin) / coarseStep) * coarseStep;
+    }
+
+    void rebuild() {
+        mIndices.clear();
+        for (int py = 0; py < mPatchesY; py++) {
+            for (int px = 0; px < mPatchesX; px++) {
+                addPatch(px, py);
+            }
+        }
+        // Keep only the vertices the triangles use
+        std::fill(mCompact.begin(), mCompact.end(), -1);
+        mUsed.clear();
+        mMesh.reset();
+        mMesh.primitive(Graphics::TRIANGLES);
+        for (unsigned int &index: mIndices) {
+            int &compact = mCompact[index];
+            if (compact < 0) {
+                compact = mUsed.size();
+                mUsed.push_back(index);
+                mMesh.vertex(localX(index % mNx), localY(index / mNx), 0);
+                mMesh.color(mColors[index]);
+                mMesh.normal(0, 0, 1);
+            }
+            mMesh.index(compact);
+        }
+        mRevision++;
+    }
+
+    void addPatch(int px, int py) {
+        int s = 1 << mLevels[py * mPatchesX + px];
+        int x0 = px * patchCells, y0 = py * patchCells;
+        int x1 = std::min(x0 + patchCells, mNx - 1), y1 = std::min(y0 + patchCells, mNy - 1);
+        // Steps along each edge: the coarser of this patch and its neighbor
+        int left = std::max(s, step(px - 1, py)), right = std::max(s, step(px + 1, py));
+        int bottom = std::max(s, step(px, py - 1)), top = std::max(s, step(px, py + 1));
+
+        std::vector<int> xs, ys;
+        for (int x = x0; x < x1; x += s) xs.push_back(x);
+        xs.push_back(x1);
+        for (int y = y0; y < y1; y += s) ys.push_back(y);
+        ys.push_back(y1);
+
+        auto vertex = [&](int x, int y) -> unsigned int {
+            if (y == y0) x = snap(x, x0, x1, bottom);
+            else if (y == y1) x = snap(x, x0, x1, top);
+            if (x == x0) y = snap(y, y0, y1, left);
+            else if (x == x1) y = snap(y, y0, y1, right);
+            return y * mNx + x;
+        };
+        auto triangle = [&](unsigned int a, unsigned int b, unsigned int c) {
+            if (a != b && b != c && a != c) {
+                mIndices.push_back(a);
+                mIndices.push_back(b);
+                mIndices.push_back(c);
+            }
+        };
+        for (size_t b = 0; b + 1 < ys.size(); b++) {
+            for (size_t a = 0; a + 1 < xs.size(); a++) {
+                unsigned int v00 = vertex(xs[a], ys[b]), v10 = vertex(xs[a + 1], ys[b]);
+                unsigned int v01 = vertex(xs[a], ys[b + 1]), v11 = vertex(xs[a + 1], ys[b + 1]);
+                triangle(v00, v10, v11);
+                triangle(v00, v11, v01);
+            }
+        }
+    }
+
+    // Heights and normals (central differences of the full grid) of the used vertices
+    void updateVertices() {
+        Mesh::Vertices &vertices = mMesh.vertices();
+        Mesh::Normals &normals = mMesh.normals();
+        float dx = 2.0f / (mNx - 1), dy = 2.0f / (mNy - 1);
+        for (size_t k = 0; k < mUsed.size(); k++) {
+            int index = mUsed[k];
+            int i = index % mNx, j = index / mNx;
+            int il = std::max(i - 1, 0), ir = std::min(i + 1, mNx - 1);
+            int jb = std::max(j - 1, 0), jt = std::min(j + 1, mNy - 1);
+            float dzdx = (mHeights[j * mNx + ir] - mHeights[j * mNx + il]) / ((ir - il) * dx);
+            float dzdy = (mHeights[jt * mNx + i] - mHeights[jb * mNx + i]) / ((jt - jb) * dy);
+            vertices[k].z = mHeights[index];
+            Vec3f n(-dzdx, -dzdy, 1.0f);
+            normals[k] = n / n.mag();
+        }
+    }
+
+    int mNx, mNy;
+    int mPatchesX, mPatchesY;
+    float mTolerance = 0.01f;
+    bool mFullDetail = false;
+    unsigned int mRevision = 0;
+    std::vector<float> mHeights;
+    std::vector<Color> mColors;
+    std::vector<int> mLevels;
+    std::vector<unsigned int> mIndices; // Into the full grid
+    std::vector<int> mCompact; // Full grid index to mesh vertex, -1 if unused
+    std::vector<int> mUsed; // Mesh vertex to full grid index
+    Mesh mMesh;
+};
+
+} // namespace al
+
+#endif // WATER_SURFACE_HPP